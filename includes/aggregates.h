@@ -0,0 +1,50 @@
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include "utils.h"
+
+// Materialized enrollment aggregates. Each course, student and faculty
+// member with enrollment activity has one fixed-size record in
+// data/aggregates.dat, a table like the others, so the change log,
+// checkpoints and replicas carry it. An in-memory hash map locates each
+// record, so reading or updating an aggregate never scans another table.
+
+enum {
+    AGGREGATE_FREE,     // unused slot, reused by the next new record
+    AGGREGATE_COURSE,
+    AGGREGATE_STUDENT,
+    AGGREGATE_FACULTY
+};
+
+typedef struct {
+    int kind;
+    char key[MAX_ID_LEN];         // course code, student ID or faculty ID
+    int courses;                  // student: courses enrolled in; faculty: courses offered
+    int credits;                  // student: credits enrolled in; course: credits of the course
+    int enrolled;                 // course: students enrolled; faculty: enrollments in their courses
+    char faculty_id[MAX_ID_LEN];  // course: the faculty offering it
+} Aggregate;
+
+// Start-up: build the aggregate table from the other tables unless its
+// stamp shows that it and they are unchanged since it was last known to
+// agree with them (a missing table, a copy restored by hand or changes
+// after the last checkpoint all fail the check)
+int aggregates_init(void);
+
+// Record the sizes and mtimes of the aggregate table and the tables it is
+// computed from. Called at checkpoints, when every table mutex is held so
+// no change is half applied.
+void aggregates_stamp(void);
+
+// Fill *aggregate; a key without activity yields zero counts. Returns -1 on error.
+int aggregates_get(int kind, const char *key, Aggregate *aggregate);
+
+// Maintenance hooks, called by file_operations.c with the changed table's
+// mutex held; the aggregate table is always locked last
+void aggregates_course_added(const Course *course);
+void aggregates_course_removed(const char *course_code);
+void aggregates_enrollment_changed(const char *student_id, const char *course_code, int delta);
+void aggregates_enrollments_removed(const char *course_code, const char (*student_ids)[MAX_ID_LEN], int count);
+void aggregates_invalidate(void);
+
+#endif // AGGREGATES_H
@@ -0,0 +1,54 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include "utils.h"
+#include "arena.h"
+
+// Term analytics for admins. One snapshot of the tables is cut into
+// ANALYTICS_SLICE_SIZE slices: the enrollment partitions, for active and
+// dropped enrollments per course, and the aggregate table, for the credit
+// load of every student. Worker threads take slices from a shared counter
+// and count into partial results of their own, which are added up once
+// all workers are done. Reads go through the snapshot, so live enroll and
+// drop traffic never waits for an analytics run.
+#define ANALYTICS_SLICE_SIZE (256 * 1024)
+#define ANALYTICS_MAX_WORKERS 8
+
+// Courses listed per ranking in the admin report
+#define ANALYTICS_TOP_COURSES 10
+
+// Students by enrolled credits: 0, 1-4, 5-8, ... and the last bucket open
+#define CREDIT_BUCKET_WIDTH 4
+#define CREDIT_BUCKETS 8
+
+typedef struct {
+    char course_code[MAX_COURSE_CODE_LEN];
+    char name[MAX_NAME_LEN];
+    int credits;
+    int max_seats;
+    int available_seats;
+    int active;                 // active enrollments
+    int dropped;                // students who enrolled and dropped again
+} CourseStats;
+
+typedef struct {
+    CourseStats *courses;       // ordered by course code
+    int course_count;
+    long long students;
+    long long active;
+    long long dropped;
+    long long orphans;          // enrollments in courses not in the catalog
+    long long credit_load[CREDIT_BUCKETS];
+    int workers;
+    double elapsed_ms;
+} AnalyticsReport;
+
+// Worker threads per run; 0 (the default) uses one per online CPU, up to
+// ANALYTICS_MAX_WORKERS
+void analytics_configure(int workers);
+
+// Compute the report from a snapshot taken now. Everything it points to
+// comes from the arena. Returns 0, or -1 when the snapshot could not be read.
+int analytics_run(Arena *arena, AnalyticsReport *report);
+
+#endif // ANALYTICS_H
@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Per-session bump allocator. Objects that live only for one request
+// (listing pages, search results, reply scratch) are carved from the
+// session's arena and released together by arena_reset once the request
+// has been answered, so a session reaches a steady state where requests
+// allocate nothing from the heap and nothing can be leaked. An arena is
+// owned by one client thread and is not locked.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;   // block being filled; earlier blocks follow it
+    size_t used;        // bytes used in head
+} Arena;
+
+// Position to return to with arena_rewind
+typedef struct {
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+void arena_init(Arena *arena);
+
+// 16-byte aligned storage valid until the next reset; NULL when out of memory
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, const char *text);
+
+// Release everything allocated after the mark
+ArenaMark arena_mark(const Arena *arena);
+void arena_rewind(Arena *arena, ArenaMark mark);
+
+// Release every allocation, keeping one block for the next request
+void arena_reset(Arena *arena);
+void arena_destroy(Arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,32 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bloom filter over string keys. BLOOM_BITS_PER_KEY bits and BLOOM_HASHES
+// probes per key give about a 1% false positive rate while no more than
+// capacity keys have been added; past that the rate climbs, and the owner
+// should rebuild the filter larger. Keys cannot be removed, so a removed
+// key only costs a false positive. Not locked; the owner serializes access.
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 7
+
+typedef struct {
+    uint64_t *bits;
+    size_t bit_count;
+    size_t capacity;    // keys it was sized for
+    size_t count;       // keys added
+} BloomFilter;
+
+// Returns 0, or -1 when out of memory
+int bloom_init(BloomFilter *filter, size_t capacity);
+void bloom_free(BloomFilter *filter);
+
+// len bytes of key, which need not be terminated
+void bloom_add(BloomFilter *filter, const char *key, size_t len);
+
+// 0 when the key was certainly never added
+int bloom_may_contain(const BloomFilter *filter, const char *key, size_t len);
+
+#endif // BLOOM_H
@@ -0,0 +1,68 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Disk-resident B+tree mapping fixed-size keys to 64-bit values. Nodes are
+// BTREE_PAGE_SIZE pages of one file. A key is always key_size bytes and
+// compared bytewise, so callers pad shorter keys with zeros. Pages are read
+// through a pool of BTREE_POOL_PAGES frames with clock eviction, so a
+// lookup reads at most one page per level and memory use does not depend
+// on the key count.
+// Deleting only removes the entry from its leaf; pages are not merged.
+// Not locked; the owner serializes access.
+#define BTREE_PAGE_SIZE 4096
+#define BTREE_POOL_PAGES 64
+#define BTREE_MAX_KEY 32
+#define BTREE_MAX_DEPTH 16
+
+// What the owner indexed, e.g. the size and mtime of a table file; kept
+// in the header so that an index can be checked against its source
+typedef struct {
+    uint64_t size;
+    uint64_t mtime_ns;
+} BTreeStamp;
+
+typedef struct {
+    uint32_t page_no;       // 0 when the frame is free
+    int pins;
+    int referenced;         // clock bit
+    int dirty;
+    char *data;
+} BTreeFrame;
+
+typedef struct {
+    int fd;
+    size_t key_size;
+    uint32_t root;
+    uint32_t page_count;    // pages in the file, including the header page
+    uint64_t entries;
+    BTreeStamp stamp;
+    int stamp_valid;        // the header's stamp describes the current entries
+    BTreeFrame frames[BTREE_POOL_PAGES];
+    char *pool;
+    int hand;
+} BTree;
+
+// Open or create the index file. An existing index with another key size
+// or format is treated as empty with no stamp. Returns 0, or -1 on error.
+int btree_open(BTree *tree, const char *path, size_t key_size);
+void btree_close(BTree *tree);
+
+// 1 when the index was last synced with this stamp
+int btree_matches(const BTree *tree, const BTreeStamp *stamp);
+
+// Drop every entry and truncate the file
+int btree_reset(BTree *tree);
+
+// Each returns 1 on success, 0 when the key is absent (find, delete) or
+// already present (insert, which keeps the existing value), -1 on error
+int btree_find(BTree *tree, const char *key, uint64_t *value);
+int btree_insert(BTree *tree, const char *key, uint64_t value);
+int btree_delete(BTree *tree, const char *key);
+
+// Write the dirty pages and a header carrying stamp
+int btree_sync(BTree *tree, const BTreeStamp *stamp);
+
+#endif // BTREE_H
@@ -0,0 +1,48 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Traffic capture. With --capture FILE the server appends every session's
+// inbound bytes, exactly as each recv returned them, to FILE, together
+// with when the server finished replying to them. academia_replay re-drives
+// the captured sessions against another server and compares latencies.
+// The file holds passwords as typed, so it is created mode 0600.
+//
+// Layout: CAPTURE_MAGIC, then records in the order they were written. A
+// DATA record is followed by its payload. The REPLY record for a DATA
+// record comes before the session's next DATA record; its time is that of
+// the server's last send before it read again, and its length the bytes
+// sent in between. A message the server did not answer has no REPLY.
+#define CAPTURE_MAGIC "ACAPTUR1"
+#define CAPTURE_MAGIC_LEN 8
+
+enum {
+    CAPTURE_OPEN,       // connection accepted
+    CAPTURE_DATA,       // bytes received
+    CAPTURE_REPLY,      // reply to the previous DATA finished
+    CAPTURE_CLOSE       // connection closed
+};
+
+typedef struct {
+    uint64_t time_us;   // since the capture started
+    uint32_t session;
+    uint32_t type;
+    uint64_t length;
+} CaptureRecord;
+
+int capture_init(const char *path);
+int capture_enabled(void);
+
+// Microseconds on the capture clock
+uint64_t capture_now_us(void);
+
+// Returns the id of the new session
+uint32_t capture_open(void);
+void capture_data(uint32_t session, const void *data, size_t len);
+void capture_reply(uint32_t session, uint64_t time_us, uint64_t bytes);
+void capture_close(uint32_t session);
+
+#endif // CAPTURE_H
@@ -0,0 +1,49 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "utils.h"
+#include "arena.h"
+
+#include <stdint.h>
+
+// Versioned course catalog for client-side caches. Every change of the
+// course table (a course added or removed, or its seats changed) takes
+// the next catalog version and is kept in a ring of the last
+// CATALOG_LOG_SIZE changes. A client that holds version V is sent only the
+// courses changed after V, each once in its latest state; when V is older
+// than the ring, unknown or 0, it is sent the whole catalog instead.
+// Versions start at the server's start time in microseconds, so a version
+// from before a restart is always too old rather than mistaken for a new
+// one. The log is guarded by course_file_mutex, which every change holds.
+#define CATALOG_LOG_SIZE 4096
+
+// Replies are sent in chunks of this size
+#define CATALOG_CHUNK_SIZE (16 * 1024)
+
+// Rows of a sync reply, after the CATALOG_LABEL line:
+//   +  CODE NAME FACULTY CREDITS MAX_SEATS AVAILABLE_SEATS   added or replaced
+//   -  CODE                                                  removed
+//   =  CODE AVAILABLE_SEATS                                  seats changed
+// with the fields separated by tabs
+#define CATALOG_UPSERT '+'
+#define CATALOG_REMOVE '-'
+#define CATALOG_SEATS '='
+
+void catalog_init(void);
+
+// Change hooks, called by file_operations.c with course_file_mutex held
+// after the change is written, also for course records a replica applies
+void catalog_course_added(const Course *course);
+void catalog_course_removed(const char *course_code);
+void catalog_seats_changed(const Course *course);
+
+// A rewrite or replacement of the course table is not known course by
+// course; every client is sent the whole catalog on its next sync
+void catalog_invalidate(void);
+
+// Send the reply to a client holding version. Returns the number of rows
+// sent, or -1 when the course table could not be read (nothing was sent)
+// or the client went away.
+long long catalog_sync(int client_socket, Arena *arena, uint64_t version);
+
+#endif // CATALOG_H
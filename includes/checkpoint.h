@@ -0,0 +1,37 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+#define CHECKPOINT_DIR "data/checkpoint"
+#define CHANGELOG_DIR "data/wal"
+
+#define DEFAULT_CHECKPOINT_INTERVAL 60 // seconds, 0 disables checkpointing
+#define DEFAULT_CHECKPOINT_FULL_EVERY 8 // incremental checkpoints between full ones
+
+// Start-up: scan existing checkpoints and log segments, open a new segment
+int checkpoint_init(int interval_seconds, int full_every);
+
+// Start the background checkpoint thread (no-op when the interval is 0)
+int checkpoint_start(void);
+
+// Write a checkpoint now; full forces every page to be written
+int checkpoint_run(int full);
+
+// Rebuild the data files from the latest checkpoint chain plus the log tail
+int checkpoint_recover(void);
+
+// Change log hook, called by file_operations.c with the table mutex held
+// after the table file has been modified. new_size is the file size after
+// the change so that replay can also apply truncations. Returns the LSN
+// assigned to the change (assigned even when the log itself is disabled).
+// The record is on disk (fdatasync) before this returns, so a change that
+// was acknowledged survives a power loss; concurrent writers share one
+// sync. Returns 0 when the record could not be written or synced; the
+// caller then undoes the change and fails the request. After a failed
+// sync every later change is refused until restart.
+uint64_t changelog_record(int table, off_t offset, const void *data, size_t len, off_t new_size);
+
+#endif // CHECKPOINT_H
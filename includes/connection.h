@@ -0,0 +1,85 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "utils.h"
+#include "arena.h"
+#include "timer_wheel.h"
+
+#include <stdint.h>
+
+// Pooled connection contexts. All contexts are allocated in one slab at
+// startup; the accept loop takes a free context before accepting, and the
+// client thread returns it on disconnect. Accepting a connection therefore
+// allocates nothing, a session's buffers and arena are reused by the next
+// one, and memory use is bounded by the pool size. When every context is
+// in use, new connections wait in the listen backlog.
+#define DEFAULT_MAX_CONNECTIONS 64
+
+// Session deadlines, in seconds (0 disables). One wheel timer per context
+// always holds the deadline that applies now: the login deadline until the
+// user has logged in, the idle deadline while the server waits for the
+// next message, and the write deadline from the first send of a reply
+// until the server reads again. The write deadline only expires while a
+// single send has been blocked for the whole timeout, so a long reply that
+// keeps moving, such as an export, is not cut off. An expired session's
+// socket is shut down, which ends the blocked recv or send and with it
+// the session.
+#define DEFAULT_LOGIN_TIMEOUT 30
+#define DEFAULT_IDLE_TIMEOUT 600
+#define DEFAULT_WRITE_TIMEOUT 10
+
+enum {
+    DEADLINE_NONE,
+    DEADLINE_LOGIN,
+    DEADLINE_IDLE,
+    DEADLINE_WRITE
+};
+
+// How a client delimits its messages, decided by its first message. Raw
+// clients send one message per write and the server takes each recv as
+// one message. Line clients end every message with a newline, and a line
+// may carry a whole request as tab-separated fields (the menu choice
+// followed by the answers to its prompts), so requests can be pipelined.
+enum {
+    FRAMING_UNKNOWN,
+    FRAMING_RAW,
+    FRAMING_LINES
+};
+
+typedef struct ConnectionContext {
+    int socket;
+    char peer[INET_ADDRSTRLEN];         // client address, the rate limit key
+    int role;
+    char id[MAX_ID_LEN];                // authenticated user ID
+    Arena arena;                        // request-scoped storage, reset per request
+    char recv_buffer[BUFFER_SIZE];      // menu choices and login fields
+    char send_buffer[BUFFER_SIZE];      // formatted messages
+    int framing;
+    char frame[BUFFER_SIZE];            // received bytes not yet split into lines
+    int frame_len;
+    int skip_line;                      // dropping the tail of an over-long line
+    char line[BUFFER_SIZE];             // the current request line
+    int line_pos;                       // start of its next unread field
+    int line_open;                      // fields remain to be read
+    int request_open;                   // the current request's first message was read
+    uint32_t capture_session;           // with --capture
+    uint64_t reply_bytes;               // sent since the last capture DATA record
+    uint64_t reply_time_us;             // capture time of the last of those sends
+    TimerEntry timer;
+    _Atomic int deadline;               // which deadline the timer holds
+    _Atomic int timed_out;              // the deadline that expired, set by the wheel thread
+    uint64_t login_deadline_ms;         // on the wheel's clock
+    _Atomic int sending;                // blocked in send since send_started_ms; read by the wheel thread
+    _Atomic uint64_t send_started_ms;   // stored before sending is set
+    struct ConnectionContext *next_free;
+} ConnectionContext;
+
+int connection_pool_init(int capacity);
+
+// Blocks until a context is free; the context is cleared except for its arena
+ConnectionContext *connection_acquire(void);
+
+// Resets the arena and puts the context back on the free list
+void connection_release(ConnectionContext *conn);
+
+#endif // CONNECTION_H
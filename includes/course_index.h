@@ -0,0 +1,37 @@
+#ifndef COURSE_INDEX_H
+#define COURSE_INDEX_H
+
+#include "utils.h"
+#include "arena.h"
+
+// In-memory search index over the course catalog. A sorted array of
+// lower-cased keys (course code, full name and every word of the name)
+// answers prefix queries by binary search, and an inverted index maps each
+// word to the courses containing it. The index is built from courses.dat
+// on first use and kept current by add_course, remove_course and seat
+// updates; changes applied by a replica invalidate it instead.
+
+typedef struct {
+    char prefix[MAX_NAME_LEN];   // start of the code, the name or a name word; "" for any
+    char keywords[MAX_NAME_LEN]; // words that must all appear in the code or name; "" for any
+    int credits;                 // exact credits, 0 for any
+    int min_free_seats;          // at least this many available seats, 0 for any
+} CourseQuery;
+
+// Matching courses ordered by course code in an array taken from the
+// caller's arena; returns the number of matches or -1 on error
+int course_index_search(const CourseQuery *query, Arena *arena, Course **results);
+
+// Up to limit courses whose code sorts after `after` ("" for the start)
+// and with at least min_free_seats available, ordered by course code, in
+// an array taken from the caller's arena. The walk starts at `after` in a
+// code-sorted array, so paging through the catalog visits each course once.
+int course_index_page(const char *after, int min_free_seats, int limit, Arena *arena, Course **results);
+
+// Maintenance hooks, called by file_operations.c with course_file_mutex held
+void course_index_add(const Course *course);
+void course_index_remove(const char *course_code);
+void course_index_update(const Course *course);
+void course_index_invalidate(void);
+
+#endif // COURSE_INDEX_H
@@ -0,0 +1,41 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "utils.h"
+#include "arena.h"
+
+// Table export for admins. An export reads one snapshot of the tables in
+// EXPORT_READ_SIZE sequential reads, encodes the rows as CSV or JSON into
+// a chunk buffer and sends each chunk as it fills. Sending blocks while
+// the client is behind, which holds the export back instead of buffering
+// it, so no table lock is held for the duration and memory use does not
+// grow with the row count. The roster view, which joins enrollments with
+// student and course names, also keeps those names in memory. Passwords
+// are never exported.
+#define EXPORT_READ_SIZE (256 * 1024)
+#define EXPORT_CHUNK_SIZE (64 * 1024)
+
+enum {
+    EXPORT_CSV,
+    EXPORT_JSON
+};
+
+enum {
+    EXPORT_STUDENTS,
+    EXPORT_FACULTY,
+    EXPORT_COURSES,
+    EXPORT_ENROLLMENTS,     // active enrollments from every partition
+    EXPORT_ROSTER           // active enrollments with student and course names
+};
+
+// The view or format with this name, or -1
+int export_view_parse(const char *name);
+int export_format_parse(const char *name);
+
+// Stream a view with a header (CSV) or as an array of objects (JSON).
+// Buffers come from the arena. Returns the number of rows, or -1 when the
+// snapshot could not be read or the client went away, in which case the
+// output is incomplete.
+long long export_view(int client_socket, Arena *arena, int view, int format);
+
+#endif // EXPORT_H
@@ -2,6 +2,7 @@
 #define FILE_OPERATIONS_H
 
 #include "utils.h"
+#include "pagination.h"
 
 // Lock types for file operations
 #define READ_LOCK F_RDLCK
@@ -11,25 +12,98 @@
 // File locking functions
 int apply_lock(int fd, int lock_type);
 
+// Enrollments are split into partitions by hash of student_id
+#define MAX_ENROLL_PARTITIONS 16
+#define DEFAULT_ENROLL_PARTITIONS 1
+
+// Table identifiers shared by the change log, snapshots and checkpoints.
+// Enrollment partition i is table TABLE_STUDENT_COURSE + i.
+enum {
+    TABLE_STUDENT,
+    TABLE_FACULTY,
+    TABLE_COURSE,
+    TABLE_STUDENT_COURSE
+};
+#define MAX_TABLES (TABLE_STUDENT_COURSE + MAX_ENROLL_PARTITIONS + 1) // + aggregates
+
+// Table registry
+int table_count(void);
+const char *table_path(int table);
+pthread_mutex_t *table_mutex(int table);
+void lock_all_tables(void);
+void unlock_all_tables(void);
+
+// Enrollment partitions; init moves existing enrollments into the new
+// layout when the partition count differs from the one on disk
+int enroll_partitions_init(int partitions);
+int enroll_partition_count(void);
+int enroll_partition_of(const char *student_id);
+
+// The aggregate table follows the enrollment partitions
+int table_aggregate(void);
+
+// Logged writes for modules that keep their own tables; caller holds the table mutex
+int table_append(int table, int fd, const void *record, size_t len);
+int table_overwrite(int table, int fd, off_t offset, const void *record, size_t len);
+
+// Table-level writes used by replication and the aggregate rebuild; callers
+// of table_replace hold the table mutex
+int table_replace(int table, const char *temp_path, off_t first_changed);
+int table_apply_change(int table, off_t offset, const void *data, size_t len, off_t new_size);
+
+// Lookups copy the record into caller-owned storage and return 1 when
+// found, 0 when not found and -1 on error. A lookup by student, faculty or
+// course ID first asks the table's Bloom filter, so a missing ID is
+// usually answered without reading the file.
+int id_filters_init(void);
+
+// Students and enrollments are found through B+tree index files beside
+// their tables, read through a bounded page pool. Init opens them and
+// rebuilds any that no longer match their table; otherwise that happens on
+// first use.
+int record_indexes_init(void);
+
+// Write out the record indexes changed since the last call, stamped with
+// their tables. Called at checkpoints with every table mutex held.
+void record_indexes_sync(void);
+
+// Updates are optimistic: a caller reads a record, collects the changes
+// without holding a lock, and passes the record as it read it. The stored
+// record serves as its own version. It is replaced only if it still equals
+// that copy byte for byte; otherwise nothing is written and UPDATE_CONFLICT
+// is returned, and the caller may read the record again and retry. A
+// changed version field would have meant a new on-disk record layout. An
+// update returns 0, or -1 on error or when the record no longer exists.
+#define UPDATE_CONFLICT -2
+
 // Student-related operations
 int add_student(Student *student);
-Student* find_student(const char *student_id);
-int update_student(Student updated_student);
+int find_student(const char *student_id, Student *student);
+int update_student(const Student *expected, const Student *updated);
 int activate_deactivate_student(const char *student_id, int activate_flag);
 
 // Faculty-related operations
 int add_faculty(Faculty *faculty);
-Faculty* find_faculty(const char *faculty_id);
-int update_faculty(Faculty updated_faculty);
+int find_faculty(const char *faculty_id, Faculty *faculty);
+int update_faculty(const Faculty *expected, const Faculty *updated);
 
-// Course-related operations
+// Course-related operations; remove_course also removes the course's enrollments
 int add_course(Course *course);
 int remove_course(char *course_id);
-Course* find_course(const char *course_code);
+int find_course(const char *course_code, Course *course);
+int update_course_seats(const char *course_code, int delta);
 
-// Student-Course relationship operations
+// Student-Course relationship operations. Enrolling takes a seat and
+// returns -1 when the course does not exist or is full, -2 when already
+// enrolled, -3 when the student already has MAX_COURSES courses and -4 on
+// error. Dropping gives the seat back and returns 1, or 0 when not
+// enrolled, or -1 on error.
 int enroll_student_course(StudentCourse *sc);
 int is_student_enrolled(const char *student_id, const char *course_code);
 int remove_student_course_by_course(char *course_id);
+int drop_student_course(const char *student_id, const char *course_code);
+// Gather the next page of a course's enrollments (StudentCourse records
+// keyed by student ID) from every partition in parallel
+int list_course_enrollments(const char *course_code, Page *page);
 
 #endif // FILE_OPERATIONS_H
\ No newline at end of file
@@ -1,11 +1,25 @@
 #ifndef HANDLER_H
 #define HANDLER_H
 
-void admin_handler(int client_socket);
+#include "connection.h"
 
-void faculty_handler(int client_socket,const char *faculty_id);
+// Each handler serves one session from its pooled connection context;
+// request-scoped storage comes from the context's arena, which is reset
+// before every request
 
-void student_handler(int client_socker,const char *student_id);
+void admin_handler(ConnectionContext *conn);
+
+void faculty_handler(ConnectionContext *conn);
+
+void student_handler(ConnectionContext *conn);
+
+int reject_if_read_only(int client_socket);
+
+// Called after the reply to each request, see server.c
+void finish_request(ConnectionContext *conn);
+
+// Wait for the next message or for event_fd, see server.c
+int wait_for_message(ConnectionContext *conn, int event_fd, int timeout_ms);
 
 
 #endif
\ No newline at end of file
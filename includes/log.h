@@ -0,0 +1,47 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Asynchronous logger. A thread formats its record straight into a slot
+// of its own single-producer ring and returns; it never blocks and never
+// takes a lock. A background thread drains every ring in batches and
+// appends them to the log file as logfmt lines
+//     ts=2026-01-01T12:00:00.000000Z level=info tid=4242 msg="..."
+// A record that finds its ring full is dropped and counted, and the count
+// is logged by the flusher. Values of password, token and secret fields
+// are redacted before anything reaches the file.
+#define LOG_RING_RECORDS 256
+#define LOG_RECORD_TEXT 232
+#define LOG_FLUSH_INTERVAL_MS 100
+#define DEFAULT_LOG_FILE "academia_server.log"
+
+enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+// Start the flusher; path "-" logs to stdout. Records written before
+// log_init go straight to stderr.
+int log_init(const char *path, int level);
+
+// "debug", "info", "warn" or "error"; -1 for anything else
+int log_level_parse(const char *name);
+
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Drain every ring now; also runs at exit
+void log_flush(void);
+
+uint64_t log_dropped(void);
+
+#define log_debug(...) log_write(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_write(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_write(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_write(LOG_ERROR, __VA_ARGS__)
+
+#endif // LOG_H
@@ -0,0 +1,52 @@
+#ifndef PAGINATION_H
+#define PAGINATION_H
+
+#include "utils.h"
+#include "arena.h"
+
+// Cursor-based pagination for listings. Records are returned in the order
+// of a unique string key; a page holds at most LISTING_PAGE_SIZE records
+// whose key sorts after the last key already sent. Each page is gathered
+// with one scan under the table lock, then sent as a single message that
+// fits the client's receive buffer. When more records follow, the page
+// ends with an opaque continuation token bound to the listing, which the
+// client sends back to get the next page.
+#define LISTING_PAGE_SIZE 8
+
+typedef struct {
+    char kind;                  // separates the token spaces of different listings
+    const char *title;
+    const char *columns;
+    const char *empty_message;
+    size_t record_size;
+    const char *(*key)(const void *record);                      // unique sort key
+    void (*format)(const void *record, char *row, size_t size);  // one output line
+} Listing;
+
+typedef struct {
+    const Listing *listing;
+    Arena *arena;               // the session arena holding the records
+    const char *scope;          // e.g. the course whose enrollments are listed, "" for none
+    char after[MAX_NAME_LEN];   // key of the last record sent, "" before the first page
+    char *records;              // up to LISTING_PAGE_SIZE records in key order
+    size_t count;
+    int more;                   // a record after the page was seen
+    int all;                    // the client asked for every remaining page
+} Page;
+
+// The page's records live in the arena until the session's next reset
+int page_begin(Page *page, Arena *arena, const Listing *listing, const char *scope);
+
+// Offer a scanned record; keeps the smallest keys after page->after
+void page_offer(Page *page, const void *record);
+
+// Merge a page gathered separately for the same listing and cursor
+void page_merge(Page *page, const Page *other);
+
+// Send the page; returns 1 after the client asked for the next page (the
+// page is then empty and positioned after the last record sent) and 0 when
+// the listing is finished or the client is gone. Once the client answered PAGE_ALL, the
+// remaining pages are sent without a token or prompt.
+int page_send(int client_socket, Page *page);
+
+#endif // PAGINATION_H
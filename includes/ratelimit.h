@@ -0,0 +1,35 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include "utils.h"
+
+// Token buckets keyed by client address or account. A bucket holds up to
+// burst tokens and gains rate tokens per second; each connection or
+// request takes one. Buckets are refilled lazily when they are next used.
+//
+// They live in a fixed table of RATE_SETS sets of RATE_WAYS entries, each
+// set with its own mutex. A key always maps to the same set; when the set
+// is full, the entry used longest ago is replaced. An evicted key starts
+// again with a full bucket, so the table must be large enough that an
+// active key is not evicted before its bucket would have refilled anyway.
+#define RATE_SETS 1024
+#define RATE_WAYS 8
+#define RATE_KEY_LEN 48
+
+enum {
+    RATE_CONNECT,           // connections per client address, at accept
+    RATE_REQUEST_IP,        // requests per client address
+    RATE_REQUEST_ACCOUNT,   // requests per logged-in account
+    RATE_CLASS_COUNT
+};
+
+// Parse "RATE" or "RATE:BURST" (tokens per second, burst defaults to
+// RATE) and enable the class; returns -1 for a malformed limit
+int rate_limit_configure(int bucket_class, const char *spec);
+
+int rate_limit_enabled(int bucket_class);
+
+// Take a token for key; returns 0, or the milliseconds until one is available
+unsigned int rate_limit_take(int bucket_class, const char *key);
+
+#endif // RATELIMIT_H
@@ -0,0 +1,30 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Hot-standby replication. A primary started with --replication-port
+// streams every committed table change to connected replicas. A replica
+// started with --replica-of HOST:PORT first receives a full copy of the
+// tables taken from a copy-on-write snapshot, then applies the change
+// stream to its own data/ directory and serves read-only sessions until
+// it is promoted with SIGUSR1.
+
+// Accept replicas on port (0 disables)
+int replication_listen(int port);
+
+// Follow a primary; the server stays read-only until promoted
+int replication_follow(const char *host, int port);
+
+// Stop following the primary and accept writes
+void replication_promote(void);
+
+int replication_is_read_only(void);
+
+// Queue a committed change for every connected replica; called with the
+// table mutex held so changes to one table are streamed in commit order
+void replication_publish(int table, uint64_t lsn, off_t offset, const void *data, size_t len, off_t new_size);
+
+#endif // REPLICATION_H
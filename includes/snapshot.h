@@ -0,0 +1,30 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "utils.h"
+
+// Granularity of copy-on-write preservation and checkpoint pages
+#define TABLE_PAGE_SIZE 4096
+
+// A point-in-time view of every table. Writers copy a page into each
+// active snapshot before modifying it, so readers of the snapshot never
+// see changes made after it was taken and never hold a table lock for
+// longer than a single read.
+typedef struct Snapshot Snapshot;
+
+// Take a snapshot; the _locked variant expects lock_all_tables() to be held
+Snapshot *snapshot_create(void);
+Snapshot *snapshot_create_locked(void);
+void snapshot_release(Snapshot *snapshot);
+
+// Size of a table at the time the snapshot was taken
+off_t snapshot_table_size(Snapshot *snapshot, int table);
+
+// Read table bytes as of the snapshot; returns bytes read or -1
+ssize_t snapshot_read(Snapshot *snapshot, int table, off_t offset, void *buf, size_t len);
+
+// Copy-on-write hook: called with the table mutex held, before the byte
+// range [offset, offset + len) of the table file is overwritten
+void snapshot_preserve(int table, off_t offset, size_t len);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Server counters. Updates are relaxed atomic adds; every
+// DEFAULT_STATS_INTERVAL seconds (--stats-interval) the current values
+// are written to the log as one line.
+#define DEFAULT_STATS_INTERVAL 60
+
+enum {
+    STAT_SESSIONS,          // connections accepted
+    STAT_ACTIVE_SESSIONS,   // gauge
+    STAT_LOGIN_FAILURES,
+    STAT_TIMEOUT_LOGIN,     // closed before logging in within --login-timeout
+    STAT_TIMEOUT_IDLE,      // no message within --idle-timeout
+    STAT_TIMEOUT_WRITE,     // reply not delivered within --write-timeout
+    STAT_THROTTLED_CONNECTS,
+    STAT_THROTTLED_REQUESTS,
+    STAT_UPDATE_CONFLICTS,  // optimistic updates refused, see update_student
+    STAT_INDEX_READS,       // B+tree pages read into a buffer pool
+    STAT_INDEX_WRITES,      // B+tree pages written back
+    STAT_WATCHERS,          // gauge: sessions watching seat availability
+    STAT_SEAT_UPDATES,      // seat updates pushed to watching sessions
+    STAT_CATALOG_DELTAS,    // catalog syncs answered with the changes only
+    STAT_CATALOG_REFRESHES, // catalog syncs answered with the whole catalog
+    STAT_COUNT
+};
+
+void stats_add(int counter, int64_t delta);
+int64_t stats_get(int counter);
+
+// Log the counters every interval_seconds; 0 disables
+void stats_start(int interval_seconds);
+
+// Write the counters to the log now
+void stats_log(void);
+
+#endif // STATS_H
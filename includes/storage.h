@@ -0,0 +1,96 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "utils.h"
+
+// Storage backends. The POSIX backend performs each request with a
+// blocking pread/pwrite on the calling thread; the io_uring backend queues
+// a whole batch with one io_uring_enter and a completion thread wakes the
+// submitter, so a caller can keep working (e.g. sending rows to the
+// client) while the next block is read.
+#define STORAGE_POSIX "posix"
+#define STORAGE_IO_URING "io_uring"
+
+#define STORAGE_READ 0
+#define STORAGE_WRITE 1
+
+typedef struct {
+    int opcode;      // STORAGE_READ or STORAGE_WRITE
+    int fd;
+    void *buf;
+    size_t len;
+    off_t offset;
+    ssize_t result;  // bytes transferred, or -errno
+    volatile int done;
+} StorageRequest;
+
+typedef struct {
+    const char *name;
+    int (*init)(void);
+    void (*submit)(StorageRequest *requests, int count);
+    void (*wait)(StorageRequest *requests, int count);
+} StorageBackend;
+
+// Select a backend by name; falls back to POSIX if it cannot be started
+int storage_init(const char *name);
+const char *storage_backend_name(void);
+
+// Asynchronous interface: submit returns once the requests are queued,
+// wait blocks until every one of them has completed
+void storage_submit(StorageRequest *requests, int count);
+void storage_wait(StorageRequest *requests, int count);
+
+// Synchronous convenience wrappers with pread/pwrite semantics
+ssize_t storage_pread(int fd, void *buf, size_t len, off_t offset);
+ssize_t storage_pwrite(int fd, const void *buf, size_t len, off_t offset);
+
+// ==================== Record Scanner ====================
+// Sequential scan over fixed-size records that reads SCAN_BLOCK_SIZE bytes
+// per request and keeps the next block in flight while the current one is
+// being processed.
+#define SCAN_BLOCK_SIZE (16 * 1024)
+
+typedef struct {
+    int fd;
+    size_t record_size;
+    size_t block_records;    // whole records per block
+    char blocks[2][SCAN_BLOCK_SIZE];
+    StorageRequest request[2];
+    int in_flight[2];
+    off_t block_offset[2];   // file offset each buffer was read from
+    int current;             // block holding the records being returned, -1 before the first
+    size_t position;         // byte position inside the current block
+    size_t available;        // valid bytes in the current block
+    off_t next_offset;       // file offset of the next block to request
+    off_t record_offset;     // file offset of the record last returned
+    int eof;                 // a short block was read, nothing follows it
+} RecordScanner;
+
+void scan_open(RecordScanner *scan, int fd, size_t record_size);
+const void *scan_next(RecordScanner *scan);
+
+// Equality test of a fixed-width string field against a key, as strncmp
+// over the field size would decide it. scan_next_match searches the rest
+// of each block in one loop; on x86-64 a field of up to 32 bytes takes one
+// or two SSE2 compares instead of a strcmp call per record.
+#define MATCH_CHUNK 16
+#define MATCH_MAX_CHUNKS 2
+
+typedef struct {
+    size_t offset;          // of the field in the record
+    size_t len;             // bytes compared: the key and its terminator, or the whole field
+    char key[MATCH_CHUNK * MATCH_MAX_CHUNKS];
+    int chunk_count;        // 16-byte compares per record, 0 for a longer key
+    int masks[MATCH_MAX_CHUNKS]; // bytes of each chunk that must be equal
+    const char *long_key;   // compared with memcmp when chunk_count is 0
+} FieldMatch;
+
+void field_match_init(FieldMatch *match, size_t field_offset, size_t field_size, const char *key);
+int field_matches(const FieldMatch *match, const void *record);
+
+// The next record whose field matches; match must outlive the scan
+const void *scan_next_match(RecordScanner *scan, const FieldMatch *match);
+off_t scan_offset(const RecordScanner *scan);
+void scan_close(RecordScanner *scan);
+
+#endif // STORAGE_H
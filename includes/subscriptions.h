@@ -0,0 +1,57 @@
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include "utils.h"
+
+// Seat-availability subscriptions. A session watching a set of courses
+// registers one Watch per course in a hash table keyed by course code.
+// Every change of a course's available seats is published to the watches
+// of that course: the latest value is stored in the watch and the
+// subscriber's eventfd is signalled once, however many changes follow.
+// The session thread then takes all pending values at once, so a burst of
+// changes costs the subscriber one message, and a value that changed back
+// before it was taken is not reported at all.
+#define SUBSCRIPTION_BUCKETS 256
+#define WATCH_MAX_COURSES 16
+
+// A session sends at most one update per WATCH_COALESCE_MS; changes made
+// in between are merged into the next one
+#define WATCH_COALESCE_MS 200
+
+// Seat values of a course that does not exist (any more)
+#define WATCH_GONE -1
+
+typedef struct Watch {
+    char course_code[MAX_COURSE_CODE_LEN];
+    int seats;                  // latest published value
+    int sent;                   // value last taken by the subscriber
+    int pending;                // seats changed since the last take
+    struct Subscriber *owner;
+    struct Watch *next;         // in the hash bucket
+} Watch;
+
+typedef struct Subscriber {
+    int event_fd;
+    int signalled;              // event_fd holds an unread wakeup
+    int count;
+    Watch watches[WATCH_MAX_COURSES];
+} Subscriber;
+
+// Register a watch on each of count distinct course codes. Returns 0, or
+// -1 when no eventfd could be created.
+int subscriber_open(Subscriber *sub, const char (*codes)[MAX_COURSE_CODE_LEN], int count);
+void subscriber_close(Subscriber *sub);
+
+// The current value of watch i, read after subscriber_open; it is only
+// used when no change was published in between, which would be newer
+void subscriber_seed(Subscriber *sub, int i, int seats);
+
+// Format the pending changes into buffer as " CODE=SEATS" words, with
+// "gone" for a removed course, and reset the wakeup. Returns the number of
+// changed courses.
+int subscriber_take(Subscriber *sub, char *buffer, size_t size);
+
+// Called with course_file_mutex held, after the change is written
+void subscriptions_publish(const char *course_code, int seats);
+
+#endif // SUBSCRIPTIONS_H
@@ -0,0 +1,44 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Hierarchical timer wheel. One thread advances the wheel every
+// TIMER_TICK_MS; timers live on intrusive lists in TIMER_LEVELS levels of
+// TIMER_LEVEL_SLOTS slots, each level covering TIMER_LEVEL_SLOTS times the
+// span of the one below. Scheduling, rescheduling and cancelling are O(1)
+// list operations and make no system call; a timer is moved down a level
+// only when the level below wraps. Timeouts are clamped to the span of
+// the top level (about 19 days).
+#define TIMER_TICK_MS 100
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4
+
+typedef struct TimerEntry {
+    struct TimerEntry *next;
+    struct TimerEntry *prev;
+    uint64_t expires;               // tick
+    int armed;
+    // Called from the wheel thread with the wheel locked, so it must not
+    // call back into the wheel; returns 0, or milliseconds to fire again
+    unsigned int (*expire)(struct TimerEntry *entry);
+} TimerEntry;
+
+// Start the wheel thread
+int timer_wheel_start(void);
+
+void timer_init(TimerEntry *entry, unsigned int (*expire)(TimerEntry *entry));
+
+// Fire after ms (rounded up to whole ticks); replaces an earlier schedule
+void timer_schedule(TimerEntry *entry, unsigned int ms);
+
+// When this returns the timer will not fire, and is not firing
+void timer_cancel(TimerEntry *entry);
+
+// Milliseconds on the wheel's clock
+uint64_t timer_now_ms(void);
+
+#endif // TIMER_WHEEL_H
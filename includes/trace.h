@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// Span tracing. A span covers a session, a login, a menu helper, a table
+// operation, a blocked lock or a socket send/receive. Each thread records
+// finished spans into its own ring buffer, keeping the most recent
+// TRACE_RING_EVENTS; a thread's ring is handed to the next thread when it
+// exits. trace_dump (SIGUSR2) writes every ring as Chrome trace-event JSON
+// for chrome://tracing or Perfetto. Tracing is off unless the server was
+// started with --trace FILE; a disabled span costs one branch.
+#define TRACE_RING_EVENTS 4096
+
+typedef struct {
+    const char *category;
+    const char *name;
+    uint64_t start_ns;  // 0 when tracing was off at the start
+} TraceSpan;
+
+// Enable tracing; dumps go to path
+int trace_init(const char *path);
+int trace_enabled(void);
+
+TraceSpan trace_span_begin(const char *category, const char *name);
+void trace_span_end(TraceSpan *span);
+
+// Name the calling thread in the trace (e.g. "session 127.0.0.1:5000")
+void trace_thread_name(const char *name);
+
+// pthread_mutex_lock that records a "lock wait" span when the mutex was busy
+void trace_mutex_lock(pthread_mutex_t *mutex);
+
+// Write all rings to the trace file; returns -1 on error
+int trace_dump(void);
+
+// A span that ends when the enclosing block is left, on every return path
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(category, name) \
+    TraceSpan TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(trace_span_end))) = \
+        trace_span_begin(category, name)
+#define TRACE_FUNCTION(category) TRACE_SPAN(category, __func__)
+
+#endif // TRACE_H
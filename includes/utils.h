@@ -24,6 +24,31 @@
 #define PORT 8080
 #define BUFFER_SIZE 1024
 
+// Paged listings end with these lines while more records follow; the
+// client answers the prompt with the token, "*" for every remaining page
+// without further prompts, or "-" to stop
+#define PAGE_TOKEN_LABEL "Next page token: "
+#define PAGE_PROMPT "Enter next page token (* for all, - to stop): "
+#define PAGE_ALL "*"
+
+// Line-framed clients get this line after the reply to each request, so
+// a client that pipelines requests can tell where one reply ends
+#define REPLY_END "\036\n"
+
+// A student watching seat availability gets WATCH_STARTED, then one line
+// per update, e.g. "Seats: CS414=3 CS415=gone", and WATCH_STOPPED once the
+// time is up or the client sent any message
+#define WATCH_STARTED "Watching seats; press Enter to stop.\n"
+#define SEATS_LABEL "Seats:"
+#define WATCH_STOPPED "Stopped watching.\n"
+
+// A catalog sync is answered with "Catalog: full|delta VERSION ROWS" and
+// ROWS change lines; a client that keeps the catalog sends VERSION back
+// with its next sync (0 when it has none), see catalog.h
+#define CATALOG_LABEL "Catalog:"
+#define CATALOG_FULL "full"
+#define CATALOG_DELTA "delta"
+
 // ==================== Data Structures ====================
 typedef struct {
     char student_id[MAX_ID_LEN];
@@ -57,14 +82,19 @@ typedef struct {
 #define STUDENT_FILE "data/students.dat"
 #define FACULTY_FILE "data/faculty.dat"
 #define COURSE_FILE "data/courses.dat"
-#define STUDENT_COURSE_FILE "data/student_courses.dat"
+#define STUDENT_COURSE_FILE "data/student_courses.dat"          // single-partition layout
+#define STUDENT_COURSE_PARTITION_FILE "data/student_courses.%d.dat" // partition i of N > 1
+#define STUDENT_COURSE_META_FILE "data/student_courses.meta"       // partition count on disk
+#define AGGREGATE_FILE "data/aggregates.dat"
+#define AGGREGATE_TEMP_FILE "data/aggregates.dat.tmp"
+#define AGGREGATE_STAMP_FILE "data/aggregates.stamp"               // tables the aggregates last matched
 #define TEMP_FILE "data/temp_courses.dat"
-#define TEMP_SC_FILE "data/temp_student_course.dat"
 
 // ==================== Mutex Declarations ====================
 extern pthread_mutex_t student_file_mutex;
 extern pthread_mutex_t faculty_file_mutex;
 extern pthread_mutex_t course_file_mutex;
-extern pthread_mutex_t student_course_file_mutex;
+extern pthread_mutex_t student_course_file_mutex[]; // one per enrollment partition
+extern pthread_mutex_t aggregate_file_mutex;
 
 #endif // DATA_STRUCTURES_H
\ No newline at end of file
@@ -5,27 +5,45 @@
 #include "utils.h"
 #include "file_operations.h"
 #include "handler.h"
+#include "aggregates.h"
+#include "export.h"
+#include "analytics.h"
+#include "trace.h"
+#include "log.h"
+#include "stats.h"
 
-extern void send_message(int socket, const char *message);
-extern void receive_message(int socket, char *buffer, int size);
+extern int send_message(int socket, const char *message);
+extern int receive_message(int socket, char *buffer, int size);
 
 void add_student_helper(int client_socket) { // helper function to add students
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     Student student;
 
     send_message(client_socket, "Enter Student ID: ");
-    receive_message(client_socket, student.student_id, MAX_ID_LEN);
+    if (receive_message(client_socket, student.student_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
     // Check if student already exists
-    if (find_student(student.student_id) != NULL) {
+    Student existing;
+    if (find_student(student.student_id, &existing) != 0) {
         send_message(client_socket, "Student ID already exists!\n");
         return;
     }
 
     send_message(client_socket, "Enter Student Name: ");
-    receive_message(client_socket, student.name, MAX_NAME_LEN);
+    if (receive_message(client_socket, student.name, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
 
     send_message(client_socket, "Enter Password: ");
-    receive_message(client_socket, student.password, MAX_PASSWORD_LEN);
+    if (receive_message(client_socket, student.password, MAX_PASSWORD_LEN) < 0) {
+        return; // the session ended
+    }
 
     student.is_active = 1;
 
@@ -37,42 +55,65 @@ void add_student_helper(int client_socket) { // helper function to add students
 }
 
 void view_student_details_helper(int client_socket) {
+    TRACE_FUNCTION("helper");
     char student_id[MAX_ID_LEN];
 
     send_message(client_socket, "Enter Student ID: ");
-    receive_message(client_socket, student_id, MAX_ID_LEN);
+    if (receive_message(client_socket, student_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Student *student = find_student(student_id);
-    if (student == NULL) {
+    Student student;
+    if (find_student(student_id, &student) != 1) {
         send_message(client_socket, "Student not found!\n");
         return;
     }
 
+    // Course count and credits come from the materialized aggregates
+    Aggregate load;
+    if (aggregates_get(AGGREGATE_STUDENT, student.student_id, &load) == -1) {
+        memset(&load, 0, sizeof(load));
+    }
+
     char buffer[BUFFER_SIZE];
     snprintf(buffer, BUFFER_SIZE, 
-            "\nStudent ID: %s\nName: %s\nStatus: %s\n",
-            student->student_id,
-            student->name,
-            student->is_active ? "Active" : "Inactive");
+            "\nStudent ID: %s\nName: %s\nStatus: %s\nCourses: %d of %d\nCredits: %d\n",
+            student.student_id,
+            student.name,
+            student.is_active ? "Active" : "Inactive",
+            load.courses, MAX_COURSES,
+            load.credits);
     send_message(client_socket, buffer);
 }
 
 void add_faculty_helper(int client_socket) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     Faculty faculty;
 
     send_message(client_socket, "Enter Faculty ID: ");
-    receive_message(client_socket, faculty.faculty_id, MAX_ID_LEN);
+    if (receive_message(client_socket, faculty.faculty_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
-    if (find_faculty(faculty.faculty_id) != NULL) {
+    Faculty existing;
+    if (find_faculty(faculty.faculty_id, &existing) != 0) {
         send_message(client_socket, "Faculty ID already exists!\n");
         return;
     }
 
     send_message(client_socket, "Enter Faculty Name: ");
-    receive_message(client_socket, faculty.name, MAX_NAME_LEN);
+    if (receive_message(client_socket, faculty.name, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
 
     send_message(client_socket, "Enter Password: ");
-    receive_message(client_socket, faculty.password, MAX_PASSWORD_LEN);
+    if (receive_message(client_socket, faculty.password, MAX_PASSWORD_LEN) < 0) {
+        return; // the session ended
+    }
 
     if (add_faculty(&faculty) > 0) {
         send_message(client_socket, "Faculty added successfully!\n");
@@ -82,13 +123,16 @@ void add_faculty_helper(int client_socket) {
 }
 
 void view_faculty_details_helper(int client_socket) {
+    TRACE_FUNCTION("helper");
     char faculty_id[MAX_ID_LEN];
 
     send_message(client_socket, "Enter Faculty ID: ");
-    receive_message(client_socket, faculty_id, MAX_ID_LEN);
+    if (receive_message(client_socket, faculty_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Faculty *faculty = find_faculty(faculty_id);
-    if (faculty == NULL) {
+    Faculty faculty;
+    if (find_faculty(faculty_id, &faculty) != 1) {
         send_message(client_socket, "Faculty not found!\n");
         return;
     }
@@ -96,16 +140,23 @@ void view_faculty_details_helper(int client_socket) {
     char buffer[BUFFER_SIZE];
     snprintf(buffer, BUFFER_SIZE,
              "\nFaculty ID: %s\nName: %s\n",
-             faculty->faculty_id,
-             faculty->name);
+             faculty.faculty_id,
+             faculty.name);
 
     send_message(client_socket, buffer);
 }
 
 void activate_helper(int client_socket, int activate_flag) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     char student_id[MAX_ID_LEN];
     send_message(client_socket, "Enter Student ID: ");
-    receive_message(client_socket, student_id, MAX_ID_LEN);
+    if (receive_message(client_socket, student_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
     int result = activate_deactivate_student(student_id, activate_flag);
     if (result == 1) {
@@ -122,85 +173,265 @@ void activate_helper(int client_socket, int activate_flag) {
 }
 
 void update_student_helper(int client_socket) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     char student_id[MAX_ID_LEN];
 
     send_message(client_socket, "Enter Student ID to update: ");
-    receive_message(client_socket, student_id, MAX_ID_LEN);
+    if (receive_message(client_socket, student_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Student *student = find_student(student_id);
-    if (student == NULL) {
+    Student student;
+    if (find_student(student_id, &student) != 1) {
         send_message(client_socket, "Student not found!\n");
         return;
     }
 
-    Student updated = *student;
+    Student updated = student;
     char buffer[BUFFER_SIZE];
 
     send_message(client_socket, "Enter new Name (leave blank to keep current): ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     if (strlen(buffer) > 0) {
         strncpy(updated.name, buffer, MAX_NAME_LEN);
         updated.name[MAX_NAME_LEN-1] = '\0'; // ensure null-termination
     }
 
     send_message(client_socket, "Enter new Password (leave blank to keep current): ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     if (strlen(buffer) > 0) {
         strncpy(updated.password, buffer, MAX_PASSWORD_LEN);
         updated.password[MAX_PASSWORD_LEN-1] = '\0'; // ensure null-termination
     }
 
-    if (update_student(updated) == 0) {
+    int result = update_student(&student, &updated);
+    if (result == 0) {
         send_message(client_socket, "Student updated successfully!\n");
+    } else if (result == UPDATE_CONFLICT) {
+        stats_add(STAT_UPDATE_CONFLICTS, 1);
+        send_message(client_socket, "Student was changed by another session meanwhile; nothing was saved. Please retry.\n");
     } else {
         send_message(client_socket, "Failed to update student.\n");
     }
 }
 
 void update_faculty_helper(int client_socket) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     char faculty_id[MAX_ID_LEN];
 
     send_message(client_socket, "Enter Faculty ID to update: ");
-    receive_message(client_socket, faculty_id, MAX_ID_LEN);
+    if (receive_message(client_socket, faculty_id, MAX_ID_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Faculty *faculty = find_faculty(faculty_id);
-    if (faculty == NULL) {
+    Faculty faculty;
+    if (find_faculty(faculty_id, &faculty) != 1) {
         send_message(client_socket, "Faculty not found!\n");
         return;
     }
 
-    Faculty updated = *faculty;
+    Faculty updated = faculty;
     char buffer[BUFFER_SIZE];
 
     send_message(client_socket, "Enter new Name (leave blank to keep current): ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     if (strlen(buffer) > 0) {
         strncpy(updated.name, buffer, MAX_NAME_LEN);
         updated.name[MAX_NAME_LEN-1] = '\0'; // ensure null-termination
     }
 
     send_message(client_socket, "Enter new Password (leave blank to keep current): ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     if (strlen(buffer) > 0) {
         strncpy(updated.password, buffer, MAX_PASSWORD_LEN);
         updated.password[MAX_PASSWORD_LEN-1] = '\0'; // ensure null-termination
     }
 
-    if (update_faculty(updated) == 0) {
+    int result = update_faculty(&faculty, &updated);
+    if (result == 0) {
         send_message(client_socket, "Faculty updated successfully!\n");
+    } else if (result == UPDATE_CONFLICT) {
+        stats_add(STAT_UPDATE_CONFLICTS, 1);
+        send_message(client_socket, "Faculty was changed by another session meanwhile; nothing was saved. Please retry.\n");
     } else {
         send_message(client_socket, "Failed to update faculty.\n");
     }
 }
 
-void admin_handler(int client_socket) {
-    char buffer[BUFFER_SIZE];
+// Stream a table or the roster as CSV or JSON, followed by one status
+// line. The reply can be any size, so it is only offered to line clients,
+// which find its end by the REPLY_END marker.
+void export_helper(ConnectionContext *conn) {
+    TRACE_FUNCTION("helper");
+    int client_socket = conn->socket;
+    char view_name[MAX_NAME_LEN];
+    char format_name[MAX_NAME_LEN];
+
+    send_message(client_socket, "Enter table (students, faculty, courses, enrollments, roster): ");
+    if (receive_message(client_socket, view_name, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
+    send_message(client_socket, "Enter format (csv, json): ");
+    if (receive_message(client_socket, format_name, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
+
+    int view = export_view_parse(view_name);
+    int format = export_format_parse(format_name);
+    if (view == -1 || format == -1) {
+        send_message(client_socket, "Unknown table or format.\n");
+        return;
+    }
+    if (conn->framing != FRAMING_LINES) {
+        send_message(client_socket, "Export needs a batch client: academia_client --batch.\n");
+        return;
+    }
+
+    long long rows = export_view(client_socket, &conn->arena, view, format);
+    if (rows < 0) {
+        log_error("export of %s failed", view_name);
+        send_message(client_socket, "Export failed; the data above is incomplete.\n");
+        return;
+    }
+    log_info("exported %s as %s, rows=%lld", view_name, format_name, rows);
+    snprintf(conn->send_buffer, BUFFER_SIZE, "Exported %lld rows.\n", rows);
+    send_message(client_socket, conn->send_buffer);
+}
+
+static int compare_by_enrolled(const void *a, const void *b) {
+    const CourseStats *x = *(const CourseStats *const *)a, *y = *(const CourseStats *const *)b;
+    return (y->active > x->active) - (y->active < x->active);
+}
+
+// Demand counts every enrollment granted, including the ones dropped since
+static int compare_by_demand(const void *a, const void *b) {
+    const CourseStats *x = *(const CourseStats *const *)a, *y = *(const CourseStats *const *)b;
+    int dx = x->active + x->dropped, dy = y->active + y->dropped;
+    return (dy > dx) - (dy < dx);
+}
+
+static int percent_of(long long part, long long whole) {
+    return whole > 0 ? (int)(part * 100 / whole) : 0;
+}
+
+// Term-level numbers from one snapshot, computed by parallel workers; see analytics.h
+void analytics_helper(ConnectionContext *conn) {
+    TRACE_FUNCTION("helper");
+    int client_socket = conn->socket;
+    char *line = conn->send_buffer;
+    AnalyticsReport report;
+
+    if (analytics_run(&conn->arena, &report) == -1) {
+        log_error("analytics run failed");
+        send_message(client_socket, "Error computing analytics.\n");
+        return;
+    }
+    log_info("analytics: %d courses, %lld enrollments, %d workers, %.1f ms",
+             report.course_count, report.active + report.dropped, report.workers, report.elapsed_ms);
+
+    long long seats = 0, taken = 0;
+    int full = 0, mismatched = 0;
+    const CourseStats **ranked = arena_alloc(&conn->arena, (report.course_count ? report.course_count : 1) * sizeof(*ranked));
+    if (!ranked) {
+        send_message(client_socket, "Error computing analytics.\n");
+        return;
+    }
+    for (int c = 0; c < report.course_count; c++) {
+        const CourseStats *course = &report.courses[c];
+        seats += course->max_seats;
+        taken += course->max_seats - course->available_seats;
+        mismatched += course->active != course->max_seats - course->available_seats;
+        if (course->max_seats > 0 && course->available_seats == 0) {
+            ranked[full++] = course; // full courses first, for the demand ranking
+        }
+    }
+
+    send_message(client_socket, "\n=== Term Analytics ===\n");
+    snprintf(line, BUFFER_SIZE, "Courses: %d, students: %lld, active enrollments: %lld, dropped: %lld\n"
+             "Seats taken: %lld of %lld (%d%%)\n",
+             report.course_count, report.students, report.active, report.dropped,
+             taken, seats, percent_of(taken, seats));
+    send_message(client_socket, line);
+
+    qsort(ranked, full, sizeof(*ranked), compare_by_demand);
+    send_message(client_socket, "\nMost demanded full courses:\nCode\tName\tEnrolled\tDropped\n");
+    for (int i = 0; i < full && i < ANALYTICS_TOP_COURSES; i++) {
+        snprintf(line, BUFFER_SIZE, "%s\t%s\t%d\t%d\n", ranked[i]->course_code, ranked[i]->name,
+                 ranked[i]->active, ranked[i]->dropped);
+        send_message(client_socket, line);
+    }
+    if (full == 0) {
+        send_message(client_socket, "No course is full.\n");
+    }
+
+    for (int c = 0; c < report.course_count; c++) {
+        ranked[c] = &report.courses[c];
+    }
+    qsort(ranked, report.course_count, sizeof(*ranked), compare_by_enrolled);
+    snprintf(line, BUFFER_SIZE, "\nEnrollments per course (top %d):\nCode\tName\tEnrolled\tSeats\tFill\n",
+             ANALYTICS_TOP_COURSES);
+    send_message(client_socket, line);
+    for (int i = 0; i < report.course_count && i < ANALYTICS_TOP_COURSES; i++) {
+        const CourseStats *course = ranked[i];
+        snprintf(line, BUFFER_SIZE, "%s\t%s\t%d\t%d\t%d%%\n", course->course_code, course->name, course->active,
+                 course->max_seats, percent_of(course->max_seats - course->available_seats, course->max_seats));
+        send_message(client_socket, line);
+    }
+
+    send_message(client_socket, "\nCredit load:\nCredits\tStudents\n");
+    for (int b = 0; b < CREDIT_BUCKETS; b++) {
+        int low = (b - 1) * CREDIT_BUCKET_WIDTH + 1, high = b * CREDIT_BUCKET_WIDTH;
+        if (b == 0) {
+            snprintf(line, BUFFER_SIZE, "0\t%lld\n", report.credit_load[b]);
+        } else if (b == CREDIT_BUCKETS - 1) {
+            snprintf(line, BUFFER_SIZE, "%d+\t%lld\n", low, report.credit_load[b]);
+        } else {
+            snprintf(line, BUFFER_SIZE, "%d-%d\t%lld\n", low, high, report.credit_load[b]);
+        }
+        send_message(client_socket, line);
+    }
+
+    if (mismatched > 0) {
+        snprintf(line, BUFFER_SIZE, "\nCourses whose free seats disagree with their enrollments: %d\n", mismatched);
+        send_message(client_socket, line);
+    }
+    if (report.orphans > 0) {
+        snprintf(line, BUFFER_SIZE, "Enrollments in courses no longer offered: %lld\n", report.orphans);
+        send_message(client_socket, line);
+    }
+    snprintf(line, BUFFER_SIZE, "\nComputed by %d worker%s in %.1f ms.\n", report.workers,
+             report.workers == 1 ? "" : "s", report.elapsed_ms);
+    send_message(client_socket, line);
+}
+
+void admin_handler(ConnectionContext *conn) {
+    int client_socket = conn->socket;
+    Arena *arena = &conn->arena;
+    char *buffer = conn->recv_buffer;
     int choice;
-    const char *msg = "i am reaching admin handler\n";
-    write(1, msg, strlen(msg));  // replace printf with write for stdout
+    log_debug("admin session started");
 
     while (1) {
-        receive_message(client_socket, buffer, BUFFER_SIZE);
+        arena_reset(arena); // storage of the previous request is released
+        if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+            return; // the client disconnected without logging out
+        }
         choice = atoi(buffer);
 
         switch(choice) {
@@ -244,9 +475,18 @@ void admin_handler(int client_socket) {
                 send_message(client_socket, "Logging out... Thank You!\n");
                 return;
 
+            case 10:
+                export_helper(conn);
+                break;
+
+            case 11:
+                analytics_helper(conn);
+                break;
+
             default:
                 send_message(client_socket, "Invalid choice. Please try again.\n");
                 break;
         }
+        finish_request(conn);
     }
 }
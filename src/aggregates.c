@@ -0,0 +1,549 @@
+#include "utils.h"
+#include "aggregates.h"
+#include "file_operations.h"
+#include "storage.h"
+#include "trace.h"
+#include "log.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define AGGREGATE_BUCKETS 4096
+#define AGGREGATE_STAMP_MAGIC 0x41475354u // "AGST"
+#define AGGREGATE_REBUILD_RETRY_SECONDS 5
+
+typedef struct AggregateEntry {
+    Aggregate value;
+    off_t offset;                 // record offset in the table, -1 until written
+    struct AggregateEntry *next;
+} AggregateEntry;
+
+// Size and mtime of every table the aggregates are computed from, and of
+// the aggregate table itself, taken when they were known to agree
+typedef struct {
+    uint32_t magic;
+    uint32_t table_count;
+    uint64_t size[MAX_TABLES];
+    uint64_t mtime_ns[MAX_TABLES];
+} AggregateStamp;
+
+// In-memory map of the aggregate table, guarded by the aggregate table
+// mutex. It is loaded from the file on first use and dropped after an
+// externally applied change, so the file stays the truth. An update that
+// could not be applied leaves the table stale: it is not read again until
+// a rebuild from the other tables has replaced it.
+static AggregateEntry *buckets[AGGREGATE_BUCKETS];
+static off_t *free_offsets;       // slots of removed records
+static size_t free_count;
+static size_t free_capacity;
+static int loaded = 0;
+static int stale = 0;
+static int rebuild_running = 0;
+static time_t rebuild_attempted;
+
+static int aggregates_build(void);
+
+// ==================== Map ====================
+
+static unsigned bucket_of(int kind, const char *key) {
+    unsigned hash = 5381 + kind;
+    while (*key) {
+        hash = hash * 33 + (unsigned char)*key++;
+    }
+    return hash % AGGREGATE_BUCKETS;
+}
+
+static AggregateEntry *lookup(int kind, const char *key) {
+    for (AggregateEntry *entry = buckets[bucket_of(kind, key)]; entry; entry = entry->next) {
+        if (entry->value.kind == kind && strcmp(entry->value.key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void map_clear(void) {
+    for (int b = 0; b < AGGREGATE_BUCKETS; b++) {
+        AggregateEntry *entry = buckets[b];
+        while (entry) {
+            AggregateEntry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        buckets[b] = NULL;
+    }
+    free(free_offsets);
+    free_offsets = NULL;
+    free_count = free_capacity = 0;
+    loaded = 0;
+}
+
+static int free_push(off_t offset) {
+    if (free_count == free_capacity) {
+        size_t capacity = free_capacity ? free_capacity * 2 : 64;
+        off_t *grown = realloc(free_offsets, capacity * sizeof(off_t));
+        if (!grown) {
+            return -1;
+        }
+        free_offsets = grown;
+        free_capacity = capacity;
+    }
+    free_offsets[free_count++] = offset;
+    return 0;
+}
+
+static AggregateEntry *map_insert(const Aggregate *value, off_t offset) {
+    AggregateEntry *entry = malloc(sizeof(AggregateEntry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->value = *value;
+    entry->value.key[MAX_ID_LEN - 1] = '\0';
+    entry->offset = offset;
+
+    unsigned bucket = bucket_of(value->kind, entry->value.key);
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    return entry;
+}
+
+// Entry for (kind, key), created with zero counts if it does not exist
+static AggregateEntry *get_or_create(int kind, const char *key) {
+    AggregateEntry *entry = lookup(kind, key);
+    if (!entry) {
+        Aggregate value;
+        memset(&value, 0, sizeof(value));
+        value.kind = kind;
+        snprintf(value.key, sizeof(value.key), "%s", key);
+        entry = map_insert(&value, -1);
+    }
+    return entry;
+}
+
+static void rebuild_schedule(void);
+
+static int map_load(void) {
+    if (loaded) {
+        return 0;
+    }
+    map_clear();
+    if (stale) {
+        rebuild_schedule(); // retried while the table stays stale
+        return -1;
+    }
+
+    int fd = open(AGGREGATE_FILE, O_RDONLY);
+    if (fd == -1) {
+        loaded = errno == ENOENT; // nothing recorded yet
+        return loaded ? 0 : -1;
+    }
+
+    RecordScanner scan;
+    const Aggregate *record;
+    int failed = 0;
+
+    scan_open(&scan, fd, sizeof(Aggregate));
+    while (!failed && (record = scan_next(&scan)) != NULL) {
+        if (record->kind == AGGREGATE_FREE) {
+            failed = free_push(scan_offset(&scan)) == -1;
+        } else {
+            failed = map_insert(record, scan_offset(&scan)) == NULL;
+        }
+    }
+    scan_close(&scan);
+    close(fd);
+
+    if (failed) {
+        map_clear();
+        return -1;
+    }
+    loaded = 1;
+    return 0;
+}
+
+// ==================== Table Writes ====================
+
+// Write an entry back to the table, taking a free slot for a new one
+static int persist(int fd, AggregateEntry *entry) {
+    if (!entry) {
+        return -1;
+    }
+    if (entry->offset == -1) {
+        if (free_count > 0) {
+            entry->offset = free_offsets[--free_count];
+        } else {
+            entry->offset = lseek(fd, 0, SEEK_END);
+            return table_append(table_aggregate(), fd, &entry->value, sizeof(Aggregate)) == sizeof(Aggregate) ? 0 : -1;
+        }
+    }
+    return table_overwrite(table_aggregate(), fd, entry->offset, &entry->value, sizeof(Aggregate));
+}
+
+static int remove_entry(int fd, AggregateEntry *entry) {
+    int result = 0;
+    if (entry->offset != -1) {
+        Aggregate empty;
+        memset(&empty, 0, sizeof(empty));
+        result = table_overwrite(table_aggregate(), fd, entry->offset, &empty, sizeof(Aggregate));
+        if (result == 0) {
+            result = free_push(entry->offset);
+        }
+    }
+
+    AggregateEntry **link = &buckets[bucket_of(entry->value.kind, entry->value.key)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    free(entry);
+    return result;
+}
+
+// ==================== Rebuild ====================
+
+// Recompute the table from the others on a thread of its own, since the
+// failed update's caller holds table mutexes that lock_all_tables would
+// have to take out of order
+static void *rebuild_thread(void *arg) {
+    (void)arg;
+    lock_all_tables();
+    rebuild_attempted = time(NULL);
+    if (stale) {
+        if (aggregates_build() == 0) {
+            stale = 0;
+            log_info("aggregates: rebuilt from the course and enrollment tables");
+        } else {
+            log_error("aggregates: rebuild failed, retrying in %d s", AGGREGATE_REBUILD_RETRY_SECONDS);
+        }
+    }
+    rebuild_running = 0;
+    unlock_all_tables();
+    return NULL;
+}
+
+// Caller holds the aggregate table mutex
+static void rebuild_schedule(void) {
+    if (rebuild_running || time(NULL) - rebuild_attempted < AGGREGATE_REBUILD_RETRY_SECONDS) {
+        return;
+    }
+    pthread_t tid;
+    rebuild_running = 1;
+    if (pthread_create(&tid, NULL, rebuild_thread, NULL) != 0) {
+        rebuild_running = 0;
+        return;
+    }
+    pthread_detach(tid);
+}
+
+// The change the caller made to its table is not reflected in the
+// aggregates; caller holds the aggregate table mutex
+static void mark_stale(void) {
+    if (!stale) {
+        log_error("aggregates: an update failed, rebuilding the aggregate table");
+    }
+    map_clear();
+    stale = 1;
+    rebuild_schedule();
+}
+
+// Lock the aggregate table, load the map and open the file for an update
+static int update_begin(void) {
+    trace_mutex_lock(table_mutex(table_aggregate())); // Lock the aggregate table mutex
+
+    int fd = map_load() == 0 ? open(AGGREGATE_FILE, O_RDWR | O_CREAT, 0644) : -1;
+    if (fd == -1) {
+        mark_stale();
+        pthread_mutex_unlock(table_mutex(table_aggregate())); // Unlock the mutex before returning
+    }
+    return fd;
+}
+
+static void update_end(int fd, int failed) {
+    if (failed) {
+        mark_stale();
+    }
+    close(fd);
+    pthread_mutex_unlock(table_mutex(table_aggregate())); // Unlock the mutex
+}
+
+// ==================== Aggregate Operations ====================
+
+int aggregates_get(int kind, const char *key, Aggregate *aggregate) {
+    trace_mutex_lock(table_mutex(table_aggregate())); // Lock the aggregate table mutex
+
+    if (map_load() == -1) {
+        pthread_mutex_unlock(table_mutex(table_aggregate())); // Unlock the mutex before returning
+        return -1;
+    }
+
+    AggregateEntry *entry = lookup(kind, key);
+    if (entry) {
+        *aggregate = entry->value;
+    } else {
+        memset(aggregate, 0, sizeof(*aggregate));
+        aggregate->kind = kind;
+        snprintf(aggregate->key, sizeof(aggregate->key), "%s", key);
+    }
+
+    pthread_mutex_unlock(table_mutex(table_aggregate())); // Unlock the mutex
+    return 0;
+}
+
+void aggregates_course_added(const Course *course) {
+    int fd = update_begin();
+    if (fd == -1) {
+        return;
+    }
+
+    AggregateEntry *entry = get_or_create(AGGREGATE_COURSE, course->course_code);
+    AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, course->faculty_id);
+    int failed = !entry || !faculty;
+    if (!failed) {
+        entry->value.credits = course->credits;
+        snprintf(entry->value.faculty_id, sizeof(entry->value.faculty_id), "%s", course->faculty_id);
+        faculty->value.courses++;
+        failed = persist(fd, entry) == -1 || persist(fd, faculty) == -1;
+    }
+
+    update_end(fd, failed);
+}
+
+void aggregates_course_removed(const char *course_code) {
+    int fd = update_begin();
+    if (fd == -1) {
+        return;
+    }
+
+    int failed = 0;
+    AggregateEntry *entry = lookup(AGGREGATE_COURSE, course_code);
+    if (entry) {
+        AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, entry->value.faculty_id);
+        if (faculty) {
+            faculty->value.courses--;
+            faculty->value.enrolled -= entry->value.enrolled;
+        }
+        failed = persist(fd, faculty) == -1 || remove_entry(fd, entry) == -1;
+    }
+
+    update_end(fd, failed);
+}
+
+void aggregates_enrollment_changed(const char *student_id, const char *course_code, int delta) {
+    int fd = update_begin();
+    if (fd == -1) {
+        return;
+    }
+
+    AggregateEntry *student = get_or_create(AGGREGATE_STUDENT, student_id);
+    AggregateEntry *course = lookup(AGGREGATE_COURSE, course_code);
+    int failed = !student;
+    if (!failed) {
+        student->value.courses += delta;
+        if (course) {
+            student->value.credits += delta * course->value.credits;
+        }
+        failed = persist(fd, student) == -1;
+    }
+
+    if (!failed && course) {
+        AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, course->value.faculty_id);
+        course->value.enrolled += delta;
+        if (faculty) {
+            faculty->value.enrolled += delta;
+        }
+        failed = persist(fd, course) == -1 || persist(fd, faculty) == -1;
+    }
+
+    update_end(fd, failed);
+}
+
+void aggregates_enrollments_removed(const char *course_code, const char (*student_ids)[MAX_ID_LEN], int count) {
+    if (count == 0) {
+        return;
+    }
+
+    int fd = update_begin();
+    if (fd == -1) {
+        return;
+    }
+
+    AggregateEntry *course = lookup(AGGREGATE_COURSE, course_code);
+    int credits = course ? course->value.credits : 0;
+    int failed = 0;
+
+    for (int i = 0; i < count && !failed; i++) {
+        AggregateEntry *student = lookup(AGGREGATE_STUDENT, student_ids[i]);
+        if (student) {
+            student->value.courses--;
+            student->value.credits -= credits;
+            failed = persist(fd, student) == -1;
+        }
+    }
+
+    if (!failed && course) {
+        AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, course->value.faculty_id);
+        course->value.enrolled -= count;
+        if (faculty) {
+            faculty->value.enrolled -= count;
+        }
+        failed = persist(fd, course) == -1 || persist(fd, faculty) == -1;
+    }
+
+    update_end(fd, failed);
+}
+
+// Caller holds the aggregate table mutex
+void aggregates_invalidate(void) {
+    map_clear();
+}
+
+// ==================== Initial Build ====================
+
+// Compute every aggregate from the course and enrollment tables and write
+// the aggregate table. Caller holds every table mutex.
+static int aggregates_build(void) {
+    map_clear();
+    loaded = 1;
+
+    RecordScanner scan;
+    int failed = 0;
+    int fd = open(COURSE_FILE, O_RDONLY);
+    if (fd != -1) {
+        const Course *course;
+        scan_open(&scan, fd, sizeof(Course));
+        while (!failed && (course = scan_next(&scan)) != NULL) {
+            AggregateEntry *entry = get_or_create(AGGREGATE_COURSE, course->course_code);
+            AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, course->faculty_id);
+            failed = !entry || !faculty;
+            if (!failed) {
+                entry->value.credits = course->credits;
+                snprintf(entry->value.faculty_id, sizeof(entry->value.faculty_id), "%s", course->faculty_id);
+                faculty->value.courses++;
+            }
+        }
+        scan_close(&scan);
+        close(fd);
+    }
+
+    for (int p = 0; p < enroll_partition_count() && !failed; p++) {
+        fd = open(table_path(TABLE_STUDENT_COURSE + p), O_RDONLY);
+        if (fd == -1) {
+            continue;
+        }
+
+        const StudentCourse *sc;
+        scan_open(&scan, fd, sizeof(StudentCourse));
+        while (!failed && (sc = scan_next(&scan)) != NULL) {
+            if (!sc->is_enrolled) {
+                continue;
+            }
+            AggregateEntry *student = get_or_create(AGGREGATE_STUDENT, sc->student_id);
+            AggregateEntry *course = lookup(AGGREGATE_COURSE, sc->course_code);
+            failed = !student;
+            if (!failed) {
+                student->value.courses++;
+            }
+            if (!failed && course) {
+                AggregateEntry *faculty = get_or_create(AGGREGATE_FACULTY, course->value.faculty_id);
+                failed = !faculty;
+                if (!failed) {
+                    student->value.credits += course->value.credits;
+                    course->value.enrolled++;
+                    faculty->value.enrolled++;
+                }
+            }
+        }
+        scan_close(&scan);
+        close(fd);
+    }
+
+    // Write the records to a copy and swap it in, so the change log and
+    // replicas see the new table as one change
+    fd = failed ? -1 : open(AGGREGATE_TEMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (int b = 0; b < AGGREGATE_BUCKETS && fd != -1 && !failed; b++) {
+        for (AggregateEntry *entry = buckets[b]; entry && !failed; entry = entry->next) {
+            failed = write(fd, &entry->value, sizeof(Aggregate)) != sizeof(Aggregate);
+        }
+    }
+    if (fd != -1) {
+        failed |= fsync(fd) == -1;
+        close(fd);
+    }
+
+    map_clear(); // loaded from the new table on next use
+    if (fd == -1 || failed) {
+        remove(AGGREGATE_TEMP_FILE);
+        return -1;
+    }
+    return table_replace(table_aggregate(), AGGREGATE_TEMP_FILE, 0);
+}
+
+// ==================== Stamp ====================
+
+static int stamp_take(AggregateStamp *stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->magic = AGGREGATE_STAMP_MAGIC;
+    stamp->table_count = table_count();
+
+    for (int t = TABLE_COURSE; t < table_count(); t++) {
+        struct stat st;
+        if (stat(table_path(t), &st) == -1) {
+            if (errno != ENOENT) {
+                return -1;
+            }
+            continue; // no file yet
+        }
+        stamp->size[t] = st.st_size;
+        stamp->mtime_ns[t] = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    return 0;
+}
+
+static int stamp_matches(void) {
+    AggregateStamp saved, current;
+    int fd = open(AGGREGATE_STAMP_FILE, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    int complete = read(fd, &saved, sizeof(saved)) == sizeof(saved);
+    close(fd);
+
+    return complete && access(AGGREGATE_FILE, F_OK) == 0 && stamp_take(&current) == 0 &&
+           memcmp(&saved, &current, sizeof(saved)) == 0;
+}
+
+void aggregates_stamp(void) {
+    AggregateStamp stamp;
+    if (stale || stamp_take(&stamp) == -1) {
+        remove(AGGREGATE_STAMP_FILE);
+        return;
+    }
+    int fd = open(AGGREGATE_STAMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    if (write(fd, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+        close(fd);
+        remove(AGGREGATE_STAMP_FILE); // a torn stamp never matches, but leave none
+        return;
+    }
+    close(fd);
+}
+
+int aggregates_init(void) {
+    lock_all_tables();
+
+    int result = 0;
+    if (!stamp_matches()) {
+        log_info("aggregates: %s does not match the tables, rebuilding it", AGGREGATE_FILE);
+        result = aggregates_build();
+    }
+    if (result == 0) {
+        aggregates_stamp();
+    }
+
+    unlock_all_tables();
+    return result;
+}
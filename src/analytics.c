@@ -0,0 +1,262 @@
+#include "analytics.h"
+#include "aggregates.h"
+#include "file_operations.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <time.h>
+
+static int configured_workers = 0;
+
+typedef struct {
+    int table;
+    off_t offset;
+    size_t len;
+} ScanSlice;
+
+// One worker's share of the result; only the worker writes it until joined
+typedef struct {
+    int *active;                // per course of the catalog
+    int *dropped;
+    long long orphans;
+    long long credit_load[CREDIT_BUCKETS];
+    char *buffer;               // ANALYTICS_SLICE_SIZE bytes
+    int failed;
+} WorkerPartial;
+
+typedef struct {
+    Snapshot *snapshot;
+    const ScanSlice *slices;
+    int slice_count;
+    _Atomic int next_slice;
+    const CourseStats *courses; // the catalog, ordered by code
+    int course_count;
+    int aggregate_table;
+} AnalyticsRun;
+
+typedef struct {
+    AnalyticsRun *run;
+    WorkerPartial *partial;
+} WorkerArg;
+
+void analytics_configure(int workers) {
+    configured_workers = workers;
+}
+
+static int worker_count(void) {
+    int workers = configured_workers;
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 1;
+    }
+    return workers < ANALYTICS_MAX_WORKERS ? workers : ANALYTICS_MAX_WORKERS;
+}
+
+// Orders the catalog and looks codes up in it; a CourseStats starts with
+// its code, so both a code and an element can be the key
+static int compare_course_code(const void *key, const void *element) {
+    return strncmp(key, ((const CourseStats *)element)->course_code, MAX_COURSE_CODE_LEN);
+}
+
+// ==================== Workers ====================
+
+static void count_enrollments(const AnalyticsRun *run, WorkerPartial *partial, const char *data, size_t len) {
+    for (size_t i = 0; i + sizeof(StudentCourse) <= len; i += sizeof(StudentCourse)) {
+        const StudentCourse *sc = (const StudentCourse *)(data + i);
+        const CourseStats *course = bsearch(sc->course_code, run->courses, run->course_count,
+                                            sizeof(CourseStats), compare_course_code);
+        if (!course) {
+            partial->orphans += sc->is_enrolled;
+        } else if (sc->is_enrolled) {
+            partial->active[course - run->courses]++;
+        } else {
+            partial->dropped[course - run->courses]++;
+        }
+    }
+}
+
+static void count_credit_load(WorkerPartial *partial, const char *data, size_t len) {
+    for (size_t i = 0; i + sizeof(Aggregate) <= len; i += sizeof(Aggregate)) {
+        const Aggregate *aggregate = (const Aggregate *)(data + i);
+        if (aggregate->kind != AGGREGATE_STUDENT || aggregate->credits <= 0) {
+            continue; // students without credits are counted at the merge
+        }
+        int bucket = (aggregate->credits - 1) / CREDIT_BUCKET_WIDTH + 1;
+        partial->credit_load[bucket < CREDIT_BUCKETS ? bucket : CREDIT_BUCKETS - 1]++;
+    }
+}
+
+static void *analytics_worker(void *arg) {
+    TRACE_FUNCTION("analytics");
+    AnalyticsRun *run = ((WorkerArg *)arg)->run;
+    WorkerPartial *partial = ((WorkerArg *)arg)->partial;
+
+    int s;
+    while (!partial->failed && (s = run->next_slice++) < run->slice_count) {
+        const ScanSlice *slice = &run->slices[s];
+        if (snapshot_read(run->snapshot, slice->table, slice->offset, partial->buffer, slice->len) != (ssize_t)slice->len) {
+            partial->failed = 1;
+        } else if (slice->table == run->aggregate_table) {
+            count_credit_load(partial, partial->buffer, slice->len);
+        } else {
+            count_enrollments(run, partial, partial->buffer, slice->len);
+        }
+    }
+    return NULL;
+}
+
+// ==================== Planning ====================
+
+// Cut a table into slices of whole records
+static int add_slices(Snapshot *snapshot, int table, size_t record_size, ScanSlice *slices, int count) {
+    off_t size = snapshot_table_size(snapshot, table) / record_size * record_size;
+    size_t step = ANALYTICS_SLICE_SIZE / record_size * record_size;
+
+    for (off_t offset = 0; offset < size; offset += step) {
+        slices[count].table = table;
+        slices[count].offset = offset;
+        slices[count].len = (size_t)(size - offset) < step ? (size_t)(size - offset) : step;
+        count++;
+    }
+    return count;
+}
+
+static int slice_count_of(Snapshot *snapshot, int table, size_t record_size) {
+    size_t step = ANALYTICS_SLICE_SIZE / record_size * record_size;
+    off_t size = snapshot_table_size(snapshot, table) / record_size * record_size;
+    return (size + step - 1) / step;
+}
+
+// The catalog is small; it is read in one go and sorted for lookups by code
+static int load_catalog(Snapshot *snapshot, Arena *arena, AnalyticsReport *report) {
+    size_t count = snapshot_table_size(snapshot, TABLE_COURSE) / sizeof(Course);
+    Course *records = arena_alloc(arena, (count ? count : 1) * sizeof(Course));
+    report->courses = arena_alloc(arena, (count ? count : 1) * sizeof(CourseStats));
+    if (!records || !report->courses ||
+        snapshot_read(snapshot, TABLE_COURSE, 0, records, count * sizeof(Course)) != (ssize_t)(count * sizeof(Course))) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        CourseStats *stats = &report->courses[i];
+        memset(stats, 0, sizeof(*stats));
+        snprintf(stats->course_code, sizeof(stats->course_code), "%.*s", MAX_COURSE_CODE_LEN - 1, records[i].course_code);
+        snprintf(stats->name, sizeof(stats->name), "%.*s", MAX_NAME_LEN - 1, records[i].name);
+        stats->credits = records[i].credits;
+        stats->max_seats = records[i].max_seats;
+        stats->available_seats = records[i].available_seats;
+    }
+    qsort(report->courses, count, sizeof(CourseStats), compare_course_code);
+    report->course_count = count;
+    return 0;
+}
+
+// ==================== Run ====================
+
+int analytics_run(Arena *arena, AnalyticsReport *report) {
+    TRACE_FUNCTION("analytics");
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    memset(report, 0, sizeof(*report));
+
+    Snapshot *snapshot = snapshot_create();
+    if (!snapshot) {
+        return -1;
+    }
+    report->students = snapshot_table_size(snapshot, TABLE_STUDENT) / sizeof(Student);
+    if (load_catalog(snapshot, arena, report) == -1) {
+        snapshot_release(snapshot);
+        return -1;
+    }
+
+    AnalyticsRun run;
+    run.snapshot = snapshot;
+    run.courses = report->courses;
+    run.course_count = report->course_count;
+    run.aggregate_table = table_aggregate();
+    run.next_slice = 0;
+
+    int slice_count = slice_count_of(snapshot, run.aggregate_table, sizeof(Aggregate));
+    for (int p = 0; p < enroll_partition_count(); p++) {
+        slice_count += slice_count_of(snapshot, TABLE_STUDENT_COURSE + p, sizeof(StudentCourse));
+    }
+    ScanSlice *slices = arena_alloc(arena, (slice_count ? slice_count : 1) * sizeof(ScanSlice));
+    if (!slices) {
+        snapshot_release(snapshot);
+        return -1;
+    }
+    int count = 0;
+    for (int p = 0; p < enroll_partition_count(); p++) {
+        count = add_slices(snapshot, TABLE_STUDENT_COURSE + p, sizeof(StudentCourse), slices, count);
+    }
+    count = add_slices(snapshot, run.aggregate_table, sizeof(Aggregate), slices, count);
+    run.slices = slices;
+    run.slice_count = count;
+
+    // No more workers than slices; the calling thread is worker 0
+    int workers = worker_count();
+    if (workers > count) {
+        workers = count > 0 ? count : 1;
+    }
+    WorkerPartial partials[ANALYTICS_MAX_WORKERS];
+    WorkerArg args[ANALYTICS_MAX_WORKERS];
+    pthread_t threads[ANALYTICS_MAX_WORKERS];
+    int started_threads[ANALYTICS_MAX_WORKERS] = {0};
+    size_t counters = (report->course_count ? report->course_count : 1) * sizeof(int);
+
+    for (int w = 0; w < workers; w++) {
+        memset(&partials[w], 0, sizeof(WorkerPartial));
+        partials[w].active = arena_alloc(arena, counters);
+        partials[w].dropped = arena_alloc(arena, counters);
+        partials[w].buffer = arena_alloc(arena, ANALYTICS_SLICE_SIZE);
+        if (!partials[w].active || !partials[w].dropped || !partials[w].buffer) {
+            workers = w; // run with the workers that have their storage
+            break;
+        }
+        memset(partials[w].active, 0, counters);
+        memset(partials[w].dropped, 0, counters);
+        args[w].run = &run;
+        args[w].partial = &partials[w];
+    }
+    if (workers == 0) {
+        snapshot_release(snapshot);
+        return -1;
+    }
+    for (int w = 1; w < workers; w++) {
+        started_threads[w] = pthread_create(&threads[w], NULL, analytics_worker, &args[w]) == 0;
+    }
+    analytics_worker(&args[0]); // slices of a worker that failed to start are taken by the others
+    for (int w = 1; w < workers; w++) {
+        if (started_threads[w]) {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    snapshot_release(snapshot);
+
+    // Merge the partial results
+    int failed = 0;
+    for (int w = 0; w < workers; w++) {
+        const WorkerPartial *partial = &partials[w];
+        failed |= partial->failed;
+        for (int c = 0; c < report->course_count; c++) {
+            report->courses[c].active += partial->active[c];
+            report->courses[c].dropped += partial->dropped[c];
+            report->active += partial->active[c];
+            report->dropped += partial->dropped[c];
+        }
+        for (int b = 0; b < CREDIT_BUCKETS; b++) {
+            report->credit_load[b] += partial->credit_load[b];
+        }
+        report->orphans += partial->orphans;
+    }
+    long long with_credits = 0;
+    for (int b = 1; b < CREDIT_BUCKETS; b++) {
+        with_credits += report->credit_load[b];
+    }
+    report->credit_load[0] = report->students > with_credits ? report->students - with_credits : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    report->workers = workers;
+    report->elapsed_ms = (finished.tv_sec - started.tv_sec) * 1e3 + (finished.tv_nsec - started.tv_nsec) / 1e6;
+    return failed ? -1 : 0;
+}
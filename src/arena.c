@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+struct ArenaBlock {
+    ArenaBlock *next;    // the previously filled block
+    size_t size;         // usable bytes in data
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Free blocks pushed on top of `keep`
+static void free_blocks_above(Arena *arena, ArenaBlock *keep) {
+    while (arena->head && arena->head != keep) {
+        ArenaBlock *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+    arena->used = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size ? size : 1);
+
+    if (!arena->head || arena->used + size > arena->head->size) {
+        // Oversized requests get a block of their own
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->size = block_size;
+        arena->head = block;
+        arena->used = 0;
+    }
+
+    void *p = arena->head->data + arena->used;
+    arena->used += size;
+    return p;
+}
+
+char *arena_strdup(Arena *arena, const char *text) {
+    size_t len = strlen(text) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, text, len);
+    }
+    return copy;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+    ArenaMark mark = {arena->head, arena->used};
+    return mark;
+}
+
+void arena_rewind(Arena *arena, ArenaMark mark) {
+    free_blocks_above(arena, mark.block);
+    arena->used = mark.used;
+}
+
+void arena_reset(Arena *arena) {
+    if (!arena->head) {
+        return;
+    }
+    // Keep the oldest block unless it was an oversized one; a session's
+    // later requests reuse it
+    ArenaBlock *first = arena->head;
+    while (first->next) {
+        first = first->next;
+    }
+    free_blocks_above(arena, first->size == ARENA_BLOCK_SIZE ? first : NULL);
+    arena->used = 0;
+}
+
+void arena_destroy(Arena *arena) {
+    free_blocks_above(arena, NULL);
+    arena->used = 0;
+}
@@ -0,0 +1,66 @@
+#include "bloom.h"
+
+#include <stdlib.h>
+
+// 64-bit FNV-1a, finished with a multiply-xorshift so that both halves
+// are well mixed; the halves drive the double-hashing probe sequence
+static uint64_t bloom_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+int bloom_init(BloomFilter *filter, size_t capacity) {
+    size_t words = (capacity * BLOOM_BITS_PER_KEY + 63) / 64;
+    if (words == 0) {
+        words = 1;
+    }
+    filter->bits = calloc(words, sizeof(uint64_t));
+    if (!filter->bits) {
+        return -1;
+    }
+    filter->bit_count = words * 64;
+    filter->capacity = capacity;
+    filter->count = 0;
+    return 0;
+}
+
+void bloom_free(BloomFilter *filter) {
+    free(filter->bits);
+    filter->bits = NULL;
+    filter->bit_count = 0;
+    filter->capacity = 0;
+    filter->count = 0;
+}
+
+void bloom_add(BloomFilter *filter, const char *key, size_t len) {
+    uint64_t hash = bloom_hash(key, len);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1; // odd, so the probes differ
+
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (h1 + (uint64_t)i * h2) % filter->bit_count;
+        filter->bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+    filter->count++;
+}
+
+int bloom_may_contain(const BloomFilter *filter, const char *key, size_t len) {
+    uint64_t hash = bloom_hash(key, len);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        size_t bit = (h1 + (uint64_t)i * h2) % filter->bit_count;
+        if (!(filter->bits[bit / 64] & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,467 @@
+#include "btree.h"
+#include "storage.h"
+#include "stats.h"
+
+#include <errno.h>
+
+#define BTREE_MAGIC 0x45525442u // "BTRE"
+#define BTREE_VERSION 1
+
+// Page 0 starts with the header; nodes follow, one per page
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t root;          // 0 while the tree is empty
+    uint32_t page_count;
+    uint32_t stamp_valid;
+    uint64_t entries;
+    uint64_t stamp_size;
+    uint64_t stamp_mtime_ns;
+} BTreeHeader;
+
+// A node is this header followed by count entries sorted by key. A leaf
+// entry is the key and a uint64_t value; an internal entry is the key and
+// the uint32_t page of the child holding keys from that key up to the next
+// entry's key, and link is the child for keys below the first entry.
+typedef struct {
+    uint16_t leaf;
+    uint16_t count;
+    uint32_t link;          // leaf: right sibling; internal: leftmost child
+} BTreeNode;
+
+// ==================== Buffer Pool ====================
+
+static int frame_write(BTree *tree, BTreeFrame *frame) {
+    if (storage_pwrite(tree->fd, frame->data, BTREE_PAGE_SIZE,
+                       (off_t)frame->page_no * BTREE_PAGE_SIZE) != BTREE_PAGE_SIZE) {
+        return -1;
+    }
+    frame->dirty = 0;
+    stats_add(STAT_INDEX_WRITES, 1);
+    return 0;
+}
+
+// Clock: sweep the frames, clearing reference bits, until an unpinned
+// frame that was not used since the last sweep comes round. A dirty
+// victim is written back before it is reused.
+static BTreeFrame *frame_victim(BTree *tree) {
+    for (int step = 0; step < 2 * BTREE_POOL_PAGES + 1; step++) {
+        BTreeFrame *frame = &tree->frames[tree->hand];
+        tree->hand = (tree->hand + 1) % BTREE_POOL_PAGES;
+
+        if (frame->pins) {
+            continue;
+        }
+        if (frame->page_no && frame->referenced) {
+            frame->referenced = 0;
+            continue;
+        }
+        if (frame->dirty && frame_write(tree, frame) != 0) {
+            return NULL;
+        }
+        frame->page_no = 0;
+        return frame;
+    }
+    return NULL; // every frame is pinned
+}
+
+// Pin the page, reading it if it is not in the pool
+static BTreeFrame *frame_get(BTree *tree, uint32_t page_no) {
+    if (page_no == 0 || page_no >= tree->page_count) {
+        return NULL;
+    }
+    for (int i = 0; i < BTREE_POOL_PAGES; i++) {
+        BTreeFrame *frame = &tree->frames[i];
+        if (frame->page_no == page_no) {
+            frame->pins++;
+            frame->referenced = 1;
+            return frame;
+        }
+    }
+
+    BTreeFrame *frame = frame_victim(tree);
+    if (!frame) {
+        return NULL;
+    }
+    if (storage_pread(tree->fd, frame->data, BTREE_PAGE_SIZE,
+                      (off_t)page_no * BTREE_PAGE_SIZE) != BTREE_PAGE_SIZE) {
+        return NULL;
+    }
+    stats_add(STAT_INDEX_READS, 1);
+    frame->page_no = page_no;
+    frame->pins = 1;
+    frame->referenced = 1;
+    frame->dirty = 0;
+    return frame;
+}
+
+// Pin a new zeroed page at the end of the file
+static BTreeFrame *frame_new(BTree *tree) {
+    BTreeFrame *frame = frame_victim(tree);
+    if (!frame) {
+        return NULL;
+    }
+    memset(frame->data, 0, BTREE_PAGE_SIZE);
+    frame->page_no = tree->page_count++;
+    frame->pins = 1;
+    frame->referenced = 1;
+    frame->dirty = 1;
+    return frame;
+}
+
+static void frame_put(BTreeFrame *frame, int dirty) {
+    frame->dirty |= dirty;
+    frame->pins--;
+}
+
+static void frames_clear(BTree *tree) {
+    for (int i = 0; i < BTREE_POOL_PAGES; i++) {
+        tree->frames[i].page_no = 0;
+        tree->frames[i].pins = 0;
+        tree->frames[i].referenced = 0;
+        tree->frames[i].dirty = 0;
+    }
+    tree->hand = 0;
+}
+
+// ==================== Nodes ====================
+
+static size_t entry_size(const BTree *tree, int leaf) {
+    return tree->key_size + (leaf ? sizeof(uint64_t) : sizeof(uint32_t));
+}
+
+static int node_capacity(const BTree *tree, int leaf) {
+    return (BTREE_PAGE_SIZE - sizeof(BTreeNode)) / entry_size(tree, leaf);
+}
+
+static char *node_entry(const BTree *tree, char *page, int i) {
+    const BTreeNode *node = (const BTreeNode *)page;
+    return page + sizeof(BTreeNode) + i * entry_size(tree, node->leaf);
+}
+
+// First entry whose key is not below key (or above it, when after is set)
+static int node_search(const BTree *tree, char *page, const char *key, int after) {
+    const BTreeNode *node = (const BTreeNode *)page;
+    int low = 0, high = node->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(node_entry(tree, page, mid), key, tree->key_size);
+        if (cmp < 0 || (after && cmp == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static uint32_t node_child(const BTree *tree, char *page, const char *key) {
+    const BTreeNode *node = (const BTreeNode *)page;
+    int i = node_search(tree, page, key, 1);
+    if (i == 0) {
+        return node->link;
+    }
+    uint32_t child;
+    memcpy(&child, node_entry(tree, page, i - 1) + tree->key_size, sizeof(child));
+    return child;
+}
+
+// Insert entry at position i of the pinned node. When the node is full it
+// is split: returns 1 with the key and page the parent must add for the
+// new right node, 0 when it fitted and -1 on error.
+static int node_insert(BTree *tree, BTreeFrame *frame, int i, const char *entry,
+                       char *separator, uint32_t *right_page) {
+    BTreeNode *node = (BTreeNode *)frame->data;
+    size_t size = entry_size(tree, node->leaf);
+    char *entries = node_entry(tree, frame->data, 0);
+
+    frame->dirty = 1;
+    if (node->count < node_capacity(tree, node->leaf)) {
+        memmove(entries + (i + 1) * size, entries + i * size, (node->count - i) * size);
+        memcpy(entries + i * size, entry, size);
+        node->count++;
+        return 0;
+    }
+
+    // Lay the count + 1 entries out in order, then share them out
+    char merged[BTREE_PAGE_SIZE + BTREE_MAX_KEY + sizeof(uint64_t)];
+    int total = node->count + 1;
+    memcpy(merged, entries, i * size);
+    memcpy(merged + i * size, entry, size);
+    memcpy(merged + (i + 1) * size, entries + i * size, (node->count - i) * size);
+
+    BTreeFrame *right = frame_new(tree);
+    if (!right) {
+        return -1;
+    }
+    BTreeNode *right_node = (BTreeNode *)right->data;
+    char *right_entries = node_entry(tree, right->data, 0);
+    // Keys arriving in ascending order (a rebuild, IDs handed out in
+    // sequence) overflow the rightmost node; leaving the left node full
+    // instead of halving it keeps such runs packed
+    int left_count = total / 2;
+    if (i == node->count) {
+        left_count = node->leaf ? total - 1 : total - 2;
+    }
+    const char *middle = merged + left_count * size;
+
+    right_node->leaf = node->leaf;
+    memcpy(separator, middle, tree->key_size);
+    if (node->leaf) {
+        // The separator is copied up and stays the right leaf's first key
+        right_node->count = total - left_count;
+        memcpy(right_entries, middle, right_node->count * size);
+        right_node->link = node->link;
+        node->link = right->page_no;
+    } else {
+        // The middle key moves up; its child becomes the right node's leftmost
+        right_node->count = total - left_count - 1;
+        memcpy(&right_node->link, middle + tree->key_size, sizeof(uint32_t));
+        memcpy(right_entries, middle + size, right_node->count * size);
+    }
+    node->count = left_count;
+    memcpy(entries, merged, left_count * size);
+
+    *right_page = right->page_no;
+    frame_put(right, 1);
+    return 1;
+}
+
+// Pin the leaf that holds or would hold key, recording the internal pages
+// passed on the way in path when it is set
+static BTreeFrame *leaf_for(BTree *tree, const char *key, uint32_t *path, int *depth) {
+    uint32_t page_no = tree->root;
+    int level = 0;
+
+    for (;;) {
+        BTreeFrame *frame = frame_get(tree, page_no);
+        if (!frame) {
+            return NULL;
+        }
+        if (((BTreeNode *)frame->data)->leaf) {
+            if (depth) {
+                *depth = level;
+            }
+            return frame;
+        }
+        if (level == BTREE_MAX_DEPTH) {
+            frame_put(frame, 0);
+            return NULL;
+        }
+        if (path) {
+            path[level] = page_no;
+        }
+        level++;
+        page_no = node_child(tree, frame->data, key);
+        frame_put(frame, 0);
+    }
+}
+
+// ==================== Tree ====================
+
+static int header_write(BTree *tree) {
+    BTreeHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BTREE_MAGIC;
+    header.version = BTREE_VERSION;
+    header.key_size = tree->key_size;
+    header.root = tree->root;
+    header.page_count = tree->page_count;
+    header.stamp_valid = tree->stamp_valid;
+    header.entries = tree->entries;
+    header.stamp_size = tree->stamp.size;
+    header.stamp_mtime_ns = tree->stamp.mtime_ns;
+    return storage_pwrite(tree->fd, &header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+}
+
+int btree_open(BTree *tree, const char *path, size_t key_size) {
+    if (key_size == 0 || key_size > BTREE_MAX_KEY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(tree, 0, sizeof(*tree));
+    tree->key_size = key_size;
+    tree->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (tree->fd == -1) {
+        return -1;
+    }
+    tree->pool = malloc((size_t)BTREE_POOL_PAGES * BTREE_PAGE_SIZE);
+    if (!tree->pool) {
+        close(tree->fd);
+        return -1;
+    }
+    for (int i = 0; i < BTREE_POOL_PAGES; i++) {
+        tree->frames[i].data = tree->pool + (size_t)i * BTREE_PAGE_SIZE;
+    }
+
+    BTreeHeader header;
+    off_t file_size = lseek(tree->fd, 0, SEEK_END);
+    if (storage_pread(tree->fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == BTREE_MAGIC && header.version == BTREE_VERSION &&
+        header.key_size == key_size && header.page_count >= 1 && header.root < header.page_count &&
+        (header.page_count == 1 || (off_t)header.page_count * BTREE_PAGE_SIZE <= file_size)) {
+        tree->root = header.root;
+        tree->page_count = header.page_count;
+        tree->entries = header.entries;
+        tree->stamp_valid = header.stamp_valid;
+        tree->stamp.size = header.stamp_size;
+        tree->stamp.mtime_ns = header.stamp_mtime_ns;
+    } else {
+        tree->page_count = 1; // unusable until reset and rebuilt
+    }
+    return 0;
+}
+
+void btree_close(BTree *tree) {
+    free(tree->pool);
+    tree->pool = NULL;
+    if (tree->fd != -1) {
+        close(tree->fd);
+    }
+    tree->fd = -1;
+}
+
+int btree_matches(const BTree *tree, const BTreeStamp *stamp) {
+    return tree->stamp_valid && tree->stamp.size == stamp->size &&
+           tree->stamp.mtime_ns == stamp->mtime_ns;
+}
+
+int btree_reset(BTree *tree) {
+    frames_clear(tree);
+    tree->root = 0;
+    tree->page_count = 1;
+    tree->entries = 0;
+    tree->stamp_valid = 0;
+    if (ftruncate(tree->fd, 0) == -1) {
+        return -1;
+    }
+    return header_write(tree);
+}
+
+int btree_find(BTree *tree, const char *key, uint64_t *value) {
+    if (tree->root == 0) {
+        return 0;
+    }
+
+    BTreeFrame *leaf = leaf_for(tree, key, NULL, NULL);
+    if (!leaf) {
+        return -1;
+    }
+    const BTreeNode *node = (const BTreeNode *)leaf->data;
+    int i = node_search(tree, leaf->data, key, 0);
+    int found = i < node->count && memcmp(node_entry(tree, leaf->data, i), key, tree->key_size) == 0;
+    if (found) {
+        memcpy(value, node_entry(tree, leaf->data, i) + tree->key_size, sizeof(*value));
+    }
+    frame_put(leaf, 0);
+    return found;
+}
+
+// A failure part way through a split leaves the tree unusable until reset
+int btree_insert(BTree *tree, const char *key, uint64_t value) {
+    if (tree->root == 0) {
+        BTreeFrame *root = frame_new(tree);
+        if (!root) {
+            return -1;
+        }
+        ((BTreeNode *)root->data)->leaf = 1;
+        tree->root = root->page_no;
+        frame_put(root, 1);
+    }
+
+    uint32_t path[BTREE_MAX_DEPTH];
+    int depth;
+    BTreeFrame *frame = leaf_for(tree, key, path, &depth);
+    if (!frame) {
+        return -1;
+    }
+    const BTreeNode *node = (const BTreeNode *)frame->data;
+    int i = node_search(tree, frame->data, key, 0);
+    if (i < node->count && memcmp(node_entry(tree, frame->data, i), key, tree->key_size) == 0) {
+        frame_put(frame, 0);
+        return 0;
+    }
+
+    char entry[BTREE_MAX_KEY + sizeof(uint64_t)];
+    char separator[BTREE_MAX_KEY];
+    uint32_t right;
+    memcpy(entry, key, tree->key_size);
+    memcpy(entry + tree->key_size, &value, sizeof(value));
+    int split = node_insert(tree, frame, i, entry, separator, &right);
+    frame_put(frame, 0);
+    if (split == -1) {
+        return -1;
+    }
+    tree->entries++;
+
+    // Carry splits up the recorded path, growing a new root at the top
+    while (split == 1) {
+        memcpy(entry, separator, tree->key_size);
+        memcpy(entry + tree->key_size, &right, sizeof(right));
+
+        if (depth == 0) {
+            BTreeFrame *root = frame_new(tree);
+            if (!root) {
+                return -1;
+            }
+            BTreeNode *root_node = (BTreeNode *)root->data;
+            root_node->count = 1;
+            root_node->link = tree->root;
+            memcpy(node_entry(tree, root->data, 0), entry, entry_size(tree, 0));
+            tree->root = root->page_no;
+            frame_put(root, 1);
+            break;
+        }
+
+        BTreeFrame *parent = frame_get(tree, path[--depth]);
+        if (!parent) {
+            return -1;
+        }
+        int position = node_search(tree, parent->data, separator, 1);
+        split = node_insert(tree, parent, position, entry, separator, &right);
+        frame_put(parent, 0);
+        if (split == -1) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int btree_delete(BTree *tree, const char *key) {
+    if (tree->root == 0) {
+        return 0;
+    }
+
+    BTreeFrame *leaf = leaf_for(tree, key, NULL, NULL);
+    if (!leaf) {
+        return -1;
+    }
+    BTreeNode *node = (BTreeNode *)leaf->data;
+    int i = node_search(tree, leaf->data, key, 0);
+    if (i >= node->count || memcmp(node_entry(tree, leaf->data, i), key, tree->key_size) != 0) {
+        frame_put(leaf, 0);
+        return 0;
+    }
+
+    size_t size = entry_size(tree, 1);
+    char *entry = node_entry(tree, leaf->data, i);
+    memmove(entry, entry + size, (node->count - i - 1) * size);
+    node->count--;
+    tree->entries--;
+    frame_put(leaf, 1);
+    return 1;
+}
+
+int btree_sync(BTree *tree, const BTreeStamp *stamp) {
+    for (int i = 0; i < BTREE_POOL_PAGES; i++) {
+        BTreeFrame *frame = &tree->frames[i];
+        if (frame->page_no && frame->dirty && frame_write(tree, frame) != 0) {
+            return -1;
+        }
+    }
+    tree->stamp = *stamp;
+    tree->stamp_valid = 1;
+    return header_write(tree);
+}
@@ -0,0 +1,71 @@
+#include "capture.h"
+
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <time.h>
+
+static int capture_fd = -1;
+static uint64_t start_us;
+static atomic_uint next_session;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int capture_init(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    if (write(fd, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != CAPTURE_MAGIC_LEN) {
+        close(fd);
+        return -1;
+    }
+    start_us = monotonic_us();
+    capture_fd = fd;
+    return 0;
+}
+
+int capture_enabled(void) {
+    return capture_fd != -1;
+}
+
+uint64_t capture_now_us(void) {
+    return monotonic_us() - start_us;
+}
+
+// One writev per record: O_APPEND keeps records from different session
+// threads whole without a lock
+static void capture_write(uint32_t session, uint32_t type, uint64_t time_us, uint64_t length,
+                          const void *data, size_t data_len) {
+    CaptureRecord record = {time_us, session, type, length};
+    struct iovec iov[2] = {
+        {&record, sizeof(record)},
+        {(void *)data, data_len}
+    };
+
+    // A failed write is not reported to the session; the replay sees a shorter session
+    writev(capture_fd, iov, data_len > 0 ? 2 : 1);
+}
+
+uint32_t capture_open(void) {
+    uint32_t session = atomic_fetch_add(&next_session, 1);
+    if (capture_enabled()) {
+        capture_write(session, CAPTURE_OPEN, capture_now_us(), 0, NULL, 0);
+    }
+    return session;
+}
+
+void capture_data(uint32_t session, const void *data, size_t len) {
+    capture_write(session, CAPTURE_DATA, capture_now_us(), len, data, len);
+}
+
+void capture_reply(uint32_t session, uint64_t time_us, uint64_t bytes) {
+    capture_write(session, CAPTURE_REPLY, time_us, bytes, NULL, 0);
+}
+
+void capture_close(uint32_t session) {
+    capture_write(session, CAPTURE_CLOSE, capture_now_us(), 0, NULL, 0);
+}
@@ -0,0 +1,190 @@
+#include "catalog.h"
+#include "file_operations.h"
+#include "storage.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <sys/stat.h>
+#include <time.h>
+
+extern int send_message(int socket, const char *message);
+
+// Room left in the chunk before a row is added; a row is well below this
+#define CATALOG_ROW_MAX 256
+
+typedef struct {
+    uint64_t version;
+    char kind;                  // CATALOG_UPSERT, CATALOG_REMOVE or CATALOG_SEATS
+    Course course;              // the course after the change; only the code for a removal
+} CatalogChange;
+
+// Changes first_version + 1 .. version are in the ring at version % size
+static CatalogChange changes[CATALOG_LOG_SIZE];
+static uint64_t version;
+static uint64_t first_version;
+
+void catalog_init(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    trace_mutex_lock(&course_file_mutex); // Lock the course file mutex
+    version = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    first_version = version;
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+}
+
+static void log_change(char kind, const Course *course) {
+    CatalogChange *change = &changes[++version % CATALOG_LOG_SIZE];
+    change->version = version;
+    change->kind = kind;
+    change->course = *course;
+    if (version - first_version > CATALOG_LOG_SIZE) {
+        first_version = version - CATALOG_LOG_SIZE; // the oldest change was overwritten
+    }
+}
+
+void catalog_course_added(const Course *course) {
+    log_change(CATALOG_UPSERT, course);
+}
+
+void catalog_course_removed(const char *course_code) {
+    Course course;
+    memset(&course, 0, sizeof(course));
+    snprintf(course.course_code, sizeof(course.course_code), "%s", course_code);
+    log_change(CATALOG_REMOVE, &course);
+}
+
+void catalog_seats_changed(const Course *course) {
+    log_change(CATALOG_SEATS, course);
+}
+
+void catalog_invalidate(void) {
+    first_version = ++version;
+}
+
+// ==================== Sync ====================
+
+// Groups the changes by course, oldest first within a course
+static int compare_changes(const void *a, const void *b) {
+    const CatalogChange *x = a, *y = b;
+    int cmp = strncmp(x->course.course_code, y->course.course_code, MAX_COURSE_CODE_LEN);
+    return cmp ? cmp : (x->version > y->version) - (x->version < y->version);
+}
+
+// Reduce the changes of each course to one: its latest state. Seat changes
+// of a course added within the range become part of the added row, since
+// the client has not seen that course yet. Returns the new count.
+static size_t coalesce_changes(CatalogChange *list, size_t count) {
+    size_t kept = 0;
+
+    qsort(list, count, sizeof(CatalogChange), compare_changes);
+    for (size_t i = 0; i < count;) {
+        size_t last = i;
+        int added = 0;
+        while (last + 1 < count && strncmp(list[last + 1].course.course_code, list[i].course.course_code,
+                                          MAX_COURSE_CODE_LEN) == 0) {
+            added |= list[last].kind == CATALOG_UPSERT;
+            last++;
+        }
+        list[kept] = list[last];
+        if (list[kept].kind == CATALOG_SEATS && added) {
+            list[kept].kind = CATALOG_UPSERT;
+        }
+        kept++;
+        i = last + 1;
+    }
+    return kept;
+}
+
+// Copy the whole course table; caller holds course_file_mutex
+static CatalogChange *read_catalog(Arena *arena, size_t *count) {
+    int fd = open(COURSE_FILE, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    CatalogChange *list = NULL;
+    if (fstat(fd, &st) == 0) {
+        size_t capacity = st.st_size / sizeof(Course);
+        list = arena_alloc(arena, (capacity ? capacity : 1) * sizeof(CatalogChange));
+    }
+
+    *count = 0;
+    if (list) {
+        size_t capacity = st.st_size / sizeof(Course);
+        RecordScanner scan;
+        const Course *course;
+
+        scan_open(&scan, fd, sizeof(Course));
+        while (*count < capacity && (course = scan_next(&scan)) != NULL) {
+            list[*count].kind = CATALOG_UPSERT;
+            list[*count].course = *course;
+            (*count)++;
+        }
+        scan_close(&scan);
+    }
+    close(fd);
+    return list;
+}
+
+static size_t format_change(const CatalogChange *change, char *row, size_t size) {
+    const Course *course = &change->course;
+    switch (change->kind) {
+        case CATALOG_UPSERT:
+            return snprintf(row, size, "%c\t%.*s\t%.*s\t%.*s\t%d\t%d\t%d\n", CATALOG_UPSERT,
+                            MAX_COURSE_CODE_LEN - 1, course->course_code,
+                            MAX_NAME_LEN - 1, course->name,
+                            MAX_ID_LEN - 1, course->faculty_id,
+                            course->credits, course->max_seats, course->available_seats);
+        case CATALOG_REMOVE:
+            return snprintf(row, size, "%c\t%.*s\n", CATALOG_REMOVE,
+                            MAX_COURSE_CODE_LEN - 1, course->course_code);
+        default:
+            return snprintf(row, size, "%c\t%.*s\t%d\n", CATALOG_SEATS,
+                            MAX_COURSE_CODE_LEN - 1, course->course_code, course->available_seats);
+    }
+}
+
+long long catalog_sync(int client_socket, Arena *arena, uint64_t since) {
+    TRACE_FUNCTION("catalog");
+    char *chunk = arena_alloc(arena, CATALOG_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+
+    // Copy what the client needs under the lock and send it after unlocking
+    trace_mutex_lock(&course_file_mutex); // Lock the course file mutex
+    uint64_t current = version;
+    int full = since == 0 || since < first_version || since > current;
+    size_t count = 0;
+    CatalogChange *list;
+    if (full) {
+        list = read_catalog(arena, &count);
+    } else {
+        count = current - since;
+        list = arena_alloc(arena, (count ? count : 1) * sizeof(CatalogChange));
+        for (size_t i = 0; list && i < count; i++) {
+            list[i] = changes[(since + 1 + i) % CATALOG_LOG_SIZE];
+        }
+    }
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+    if (!list) {
+        return -1;
+    }
+    if (!full) {
+        count = coalesce_changes(list, count);
+    }
+    stats_add(full ? STAT_CATALOG_REFRESHES : STAT_CATALOG_DELTAS, 1);
+
+    size_t len = snprintf(chunk, CATALOG_CHUNK_SIZE, "%s %s %llu %zu\n", CATALOG_LABEL,
+                          full ? CATALOG_FULL : CATALOG_DELTA, (unsigned long long)current, count);
+    for (size_t i = 0; i < count; i++) {
+        if (len + CATALOG_ROW_MAX >= CATALOG_CHUNK_SIZE) {
+            if (send_message(client_socket, chunk) == -1) { // blocks while the client is behind
+                return -1;
+            }
+            len = 0;
+        }
+        len += format_change(&list[i], chunk + len, CATALOG_CHUNK_SIZE - len);
+    }
+    return send_message(client_socket, chunk) == -1 ? -1 : (long long)count;
+}
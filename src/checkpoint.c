@@ -0,0 +1,680 @@
+#include "utils.h"
+#include "file_operations.h"
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "log.h"
+#include "aggregates.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define CHANGELOG_MAGIC 0x41434c47u  // "ACLG"
+#define CHECKPOINT_MAGIC 0x41434b50u // "ACKP"
+
+// One change log entry: after-image of a byte range of a table file
+typedef struct {
+    uint32_t magic;
+    uint32_t table;
+    uint64_t lsn;
+    int64_t offset;
+    int64_t new_size;
+    uint64_t length;
+} ChangeRecord;
+
+// Checkpoint file layout: header, then page_count (PageHeader, page) pairs
+typedef struct {
+    uint32_t magic;
+    uint32_t is_full;
+    uint64_t seq;
+    uint64_t base_seq; // seq of the full checkpoint this one builds on
+    uint64_t lsn;      // every change up to this LSN is included
+    uint32_t table_count;
+    uint32_t reserved;
+    int64_t table_size[MAX_TABLES];
+    uint64_t page_count;
+} CheckpointHeader;
+
+typedef struct {
+    uint32_t table;
+    uint32_t reserved;
+    uint64_t page_no;
+} PageHeader;
+
+// Change log state, guarded by changelog_mutex
+static pthread_mutex_t changelog_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int changelog_enabled = 0;
+static int changelog_fd = -1;
+static uint64_t next_lsn = 1;
+static uint64_t synced_lsn = 0;     // every change up to here reached the disk
+static off_t segment_size = 0;      // bytes written to the current segment
+static off_t synced_size = 0;       // bytes of the current segment known to be on disk
+static int syncing = 0;             // a writer is running fdatasync for the group
+static int changelog_failed = 0;    // a sync failed, so changes are refused until restart
+static pthread_cond_t synced_cond = PTHREAD_COND_INITIALIZER;
+
+// Pages changed since the last checkpoint, guarded by the table mutexes
+static unsigned char *dirty_pages[MAX_TABLES];
+static size_t dirty_capacity[MAX_TABLES];
+
+// Checkpoint state, only touched by the checkpoint thread after init
+static pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t last_seq = 0;
+static uint64_t last_full_seq = 0;
+static uint64_t last_lsn = 0;
+static int incrementals_since_full = 0;
+static int force_full = 1; // dirty pages are not persisted, so start with a full checkpoint
+static int interval = DEFAULT_CHECKPOINT_INTERVAL;
+static int full_every = DEFAULT_CHECKPOINT_FULL_EVERY;
+
+// ==================== File Helpers ====================
+
+static void segment_path(char *buf, size_t size, uint64_t start_lsn) {
+    snprintf(buf, size, "%s/wal-%016llx.log", CHANGELOG_DIR, (unsigned long long)start_lsn);
+}
+
+static void checkpoint_path(char *buf, size_t size, uint64_t seq) {
+    snprintf(buf, size, "%s/ckpt-%016llx.dat", CHECKPOINT_DIR, (unsigned long long)seq);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Collect the numeric suffixes of "<prefix><hex><suffix>" files in dir, sorted
+static size_t list_numbered(const char *dir, const char *prefix, const char *suffix, uint64_t **out) {
+    *out = NULL;
+    DIR *d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+
+    size_t count = 0, capacity = 0;
+    size_t prefix_len = strlen(prefix);
+    struct dirent *entry;
+
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0) {
+            continue;
+        }
+        char *end;
+        unsigned long long value = strtoull(entry->d_name + prefix_len, &end, 16);
+        if (end == entry->d_name + prefix_len || strcmp(end, suffix) != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            uint64_t *grown = realloc(*out, capacity * sizeof(uint64_t));
+            if (!grown) {
+                break;
+            }
+            *out = grown;
+        }
+        (*out)[count++] = value;
+    }
+
+    closedir(d);
+    qsort(*out, count, sizeof(uint64_t), compare_u64);
+    return count;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// ==================== Change Log ====================
+
+static void mark_dirty(int table, off_t offset, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    size_t last = (offset + len - 1) / TABLE_PAGE_SIZE;
+    if (last >= dirty_capacity[table]) {
+        size_t capacity = dirty_capacity[table] ? dirty_capacity[table] : 64;
+        while (capacity <= last) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(dirty_pages[table], capacity);
+        if (!grown) {
+            force_full = 1; // cannot track this change, fall back to a full checkpoint
+            return;
+        }
+        memset(grown + dirty_capacity[table], 0, capacity - dirty_capacity[table]);
+        dirty_pages[table] = grown;
+        dirty_capacity[table] = capacity;
+    }
+
+    for (size_t p = offset / TABLE_PAGE_SIZE; p <= last; p++) {
+        dirty_pages[table][p] = 1;
+    }
+}
+
+// Make the segment starting at start_lsn the current one; caller holds changelog_mutex
+static int open_segment(uint64_t start_lsn) {
+    char path[256];
+    segment_path(path, sizeof(path), start_lsn);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    off_t size = fd == -1 ? 0 : lseek(fd, 0, SEEK_END);
+    segment_size = synced_size = size > 0 ? size : 0;
+    return fd;
+}
+
+uint64_t changelog_record(int table, off_t offset, const void *data, size_t len, off_t new_size) {
+    mark_dirty(table, offset, len);
+
+    pthread_mutex_lock(&changelog_mutex);
+    if (changelog_failed) {
+        pthread_mutex_unlock(&changelog_mutex);
+        return 0;
+    }
+    ChangeRecord record = {CHANGELOG_MAGIC, table, next_lsn, offset, new_size, len};
+
+    if (changelog_enabled && changelog_fd != -1) {
+        struct iovec iov[2] = {
+            {&record, sizeof(record)},
+            {(void *)data, len}
+        };
+        ssize_t written = writev(changelog_fd, iov, 2);
+        if (written != (ssize_t)(sizeof(record) + len)) {
+            log_error("change log write failed: %s", written == -1 ? strerror(errno) : "short write");
+            // Cut the partial record off, or replay would stop in front of
+            // every record logged after it
+            if (written > 0 && ftruncate(changelog_fd, segment_size) == -1) {
+                log_error("change log truncate failed: %s; refusing changes until restart", strerror(errno));
+                changelog_failed = 1;
+            }
+            pthread_mutex_unlock(&changelog_mutex);
+            return 0;
+        }
+        next_lsn++;
+        segment_size += written;
+
+        // Group commit: one writer syncs everything logged so far while the
+        // others wait for it. The segment cannot rotate meanwhile, since
+        // rotation takes every table mutex and each waiter holds one.
+        while (synced_lsn < record.lsn && !changelog_failed) {
+            if (syncing) {
+                pthread_cond_wait(&synced_cond, &changelog_mutex);
+                continue;
+            }
+            uint64_t target = next_lsn - 1;
+            off_t target_size = segment_size;
+            int fd = changelog_fd;
+            syncing = 1;
+            pthread_mutex_unlock(&changelog_mutex);
+            int synced = fdatasync(fd);
+            pthread_mutex_lock(&changelog_mutex);
+            if (synced == -1) {
+                // After a failed sync the kernel may have dropped the pages,
+                // so nothing logged since the last sync can be trusted. Its
+                // changes are failed and undone by their writers; cut them
+                // off the log so recovery does not bring them back.
+                log_error("change log sync failed: %s; refusing changes until restart", strerror(errno));
+                if (ftruncate(fd, synced_size) == 0) {
+                    segment_size = synced_size;
+                }
+                changelog_failed = 1;
+            } else {
+                synced_lsn = target;
+                synced_size = target_size;
+            }
+            syncing = 0;
+            pthread_cond_broadcast(&synced_cond);
+        }
+        if (synced_lsn < record.lsn) {
+            pthread_mutex_unlock(&changelog_mutex);
+            return 0;
+        }
+    } else {
+        next_lsn++;
+    }
+
+    pthread_mutex_unlock(&changelog_mutex);
+    return record.lsn;
+}
+
+// Walk one segment; apply records newer than after_lsn when apply is set
+static int replay_segment(uint64_t start_lsn, uint64_t after_lsn, int apply, uint64_t *max_lsn) {
+    char path[256];
+    segment_path(path, sizeof(path), start_lsn);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int table_fds[MAX_TABLES];
+    for (int t = 0; t < MAX_TABLES; t++) {
+        table_fds[t] = -1;
+    }
+
+    char *data = NULL;
+    size_t data_capacity = 0;
+    ChangeRecord record;
+    int applied = 0;
+
+    while (read_all(fd, &record, sizeof(record)) == 0) {
+        if (record.magic != CHANGELOG_MAGIC || record.table >= (uint32_t)table_count()) {
+            break; // torn tail from a crash, or a log from another partition layout
+        }
+        if (record.length > data_capacity) {
+            char *grown = realloc(data, record.length);
+            if (!grown) {
+                break;
+            }
+            data = grown;
+            data_capacity = record.length;
+        }
+        if (read_all(fd, data, record.length) == -1) {
+            break;
+        }
+        if (record.lsn > *max_lsn) {
+            *max_lsn = record.lsn;
+        }
+        if (!apply || record.lsn <= after_lsn) {
+            continue;
+        }
+
+        int t = record.table;
+        if (table_fds[t] == -1) {
+            table_fds[t] = open(table_path(t), O_WRONLY | O_CREAT, 0644);
+        }
+        if (table_fds[t] == -1 ||
+            pwrite(table_fds[t], data, record.length, record.offset) != (ssize_t)record.length ||
+            ftruncate(table_fds[t], record.new_size) == -1) {
+            log_error("change log replay failed: %s", strerror(errno));
+            continue;
+        }
+        applied++;
+    }
+
+    for (int t = 0; t < MAX_TABLES; t++) {
+        if (table_fds[t] != -1) {
+            close(table_fds[t]);
+        }
+    }
+    free(data);
+    close(fd);
+    return applied;
+}
+
+// ==================== Checkpoints ====================
+
+static int read_checkpoint_header(uint64_t seq, CheckpointHeader *header) {
+    char path[256];
+    checkpoint_path(path, sizeof(path), seq);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = read_all(fd, header, sizeof(*header));
+    close(fd);
+
+    if (result == -1 || header->magic != CHECKPOINT_MAGIC || header->table_count > MAX_TABLES) {
+        return -1;
+    }
+    return 0;
+}
+
+static int apply_checkpoint(uint64_t seq, CheckpointHeader *header) {
+    char path[256];
+    checkpoint_path(path, sizeof(path), seq);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || read_all(fd, header, sizeof(*header)) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    int table_fds[MAX_TABLES];
+    for (uint32_t t = 0; t < header->table_count; t++) {
+        int flags = O_WRONLY | O_CREAT | (header->is_full ? O_TRUNC : 0);
+        table_fds[t] = open(table_path(t), flags, 0644);
+    }
+
+    char page[TABLE_PAGE_SIZE];
+    PageHeader page_header;
+    int result = 0;
+
+    for (uint64_t i = 0; i < header->page_count; i++) {
+        if (read_all(fd, &page_header, sizeof(page_header)) == -1 ||
+            read_all(fd, page, sizeof(page)) == -1 ||
+            page_header.table >= header->table_count) {
+            result = -1;
+            break;
+        }
+        int t = page_header.table;
+        off_t offset = (off_t)page_header.page_no * TABLE_PAGE_SIZE;
+        off_t len = header->table_size[t] - offset;
+        if (len > TABLE_PAGE_SIZE) {
+            len = TABLE_PAGE_SIZE;
+        }
+        if (len > 0 && table_fds[t] != -1) {
+            pwrite(table_fds[t], page, len, offset);
+        }
+    }
+
+    for (uint32_t t = 0; t < header->table_count; t++) {
+        if (table_fds[t] != -1) {
+            if (ftruncate(table_fds[t], header->table_size[t]) == -1) {
+                result = -1;
+            }
+            close(table_fds[t]);
+        }
+    }
+
+    close(fd);
+    return result;
+}
+
+// Write every page for a full checkpoint, otherwise only the pages marked in pages[t]
+static int write_checkpoint(const char *path, CheckpointHeader *header,
+                            Snapshot *snapshot, unsigned char **pages, size_t *page_limit) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (write_all(fd, header, sizeof(*header)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    char page[TABLE_PAGE_SIZE];
+    for (uint32_t t = 0; t < header->table_count; t++) {
+        size_t npages = (header->table_size[t] + TABLE_PAGE_SIZE - 1) / TABLE_PAGE_SIZE;
+        for (size_t p = 0; p < npages; p++) {
+            if (!header->is_full && (p >= page_limit[t] || !pages[t][p])) {
+                continue;
+            }
+
+            memset(page, 0, sizeof(page));
+            PageHeader page_header = {t, 0, p};
+            if (snapshot_read(snapshot, t, (off_t)p * TABLE_PAGE_SIZE, page, sizeof(page)) == -1 ||
+                write_all(fd, &page_header, sizeof(page_header)) == -1 ||
+                write_all(fd, page, sizeof(page)) == -1) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+static void remove_obsolete_files(uint64_t keep_from_seq, uint64_t covered_lsn) {
+    char path[256];
+    uint64_t *numbers;
+    size_t count;
+
+    count = list_numbered(CHECKPOINT_DIR, "ckpt-", ".dat", &numbers);
+    for (size_t i = 0; i < count; i++) {
+        if (numbers[i] < keep_from_seq) {
+            checkpoint_path(path, sizeof(path), numbers[i]);
+            unlink(path);
+        }
+    }
+    free(numbers);
+
+    // A segment is obsolete when the next one starts at or before covered_lsn + 1
+    count = list_numbered(CHANGELOG_DIR, "wal-", ".log", &numbers);
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (numbers[i + 1] <= covered_lsn + 1) {
+            segment_path(path, sizeof(path), numbers[i]);
+            unlink(path);
+        }
+    }
+    free(numbers);
+}
+
+int checkpoint_run(int full) {
+    pthread_mutex_lock(&checkpoint_mutex);
+
+    // Freeze every table just long enough to pick the LSN, rotate the log,
+    // collect the dirty page set and register the copy-on-write snapshot
+    lock_all_tables();
+    pthread_mutex_lock(&changelog_mutex);
+
+    uint64_t lsn = next_lsn - 1;
+    full = full || force_full || last_full_seq == 0 || incrementals_since_full >= full_every;
+    if (!full && lsn == last_lsn) {
+        pthread_mutex_unlock(&changelog_mutex);
+        unlock_all_tables();
+        pthread_mutex_unlock(&checkpoint_mutex);
+        return 0; // nothing changed since the last checkpoint
+    }
+
+    if (changelog_fd != -1) {
+        close(changelog_fd);
+    }
+    changelog_fd = open_segment(next_lsn);
+    pthread_mutex_unlock(&changelog_mutex);
+
+    Snapshot *snapshot = snapshot_create_locked();
+    CheckpointHeader header = {0};
+    unsigned char *pages[MAX_TABLES] = {0};
+    size_t page_limit[MAX_TABLES] = {0};
+
+    header.magic = CHECKPOINT_MAGIC;
+    header.is_full = full;
+    header.seq = last_seq + 1;
+    header.base_seq = full ? header.seq : last_full_seq;
+    header.lsn = lsn;
+    header.table_count = table_count();
+
+    for (int t = 0; snapshot && t < table_count(); t++) {
+        header.table_size[t] = snapshot_table_size(snapshot, t);
+        size_t npages = (header.table_size[t] + TABLE_PAGE_SIZE - 1) / TABLE_PAGE_SIZE;
+        if (full) {
+            header.page_count += npages;
+            free(dirty_pages[t]);
+        } else {
+            // Take ownership of the dirty map; writers start a fresh one
+            pages[t] = dirty_pages[t];
+            page_limit[t] = dirty_capacity[t];
+            for (size_t p = 0; p < npages && p < page_limit[t]; p++) {
+                header.page_count += pages[t][p];
+            }
+        }
+        dirty_pages[t] = NULL;
+        dirty_capacity[t] = 0;
+    }
+    force_full = 0;
+    // No change is half applied while every table is locked
+    record_indexes_sync();
+    aggregates_stamp();
+    unlock_all_tables();
+
+    char path[256], temp_path[sizeof(path) + 4];
+    checkpoint_path(path, sizeof(path), header.seq);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+    int result = -1;
+    if (snapshot && write_checkpoint(temp_path, &header, snapshot, pages, page_limit) == 0 &&
+        rename(temp_path, path) == 0) {
+        result = 0;
+    }
+    snapshot_release(snapshot);
+
+    for (int t = 0; t < table_count(); t++) {
+        free(pages[t]);
+    }
+
+    if (result == 0) {
+        last_seq = header.seq;
+        last_lsn = lsn;
+        if (full) {
+            last_full_seq = header.seq;
+            incrementals_since_full = 0;
+        } else {
+            incrementals_since_full++;
+        }
+        remove_obsolete_files(last_full_seq, lsn);
+    } else {
+        log_error("checkpoint failed: %s", strerror(errno));
+        unlink(temp_path);
+        force_full = 1; // the dirty pages handed to this checkpoint are lost
+    }
+
+    pthread_mutex_unlock(&checkpoint_mutex);
+    return result;
+}
+
+static void *checkpoint_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        sleep(interval);
+        checkpoint_run(0);
+    }
+    return NULL;
+}
+
+// ==================== Start-up and Recovery ====================
+
+int checkpoint_init(int interval_seconds, int full_every_count) {
+    interval = interval_seconds;
+    full_every = full_every_count > 0 ? full_every_count : DEFAULT_CHECKPOINT_FULL_EVERY;
+    if (interval <= 0) {
+        return 0; // checkpointing disabled, the change log stays off too
+    }
+
+    mkdir(CHECKPOINT_DIR, 0755);
+    mkdir(CHANGELOG_DIR, 0755);
+
+    uint64_t *numbers;
+    size_t count = list_numbered(CHECKPOINT_DIR, "ckpt-", ".dat", &numbers);
+    for (size_t i = 0; i < count; i++) {
+        CheckpointHeader header;
+        if (read_checkpoint_header(numbers[i], &header) == 0) {
+            last_seq = header.seq;
+            last_lsn = header.lsn;
+        }
+    }
+    free(numbers);
+
+    uint64_t max_lsn = last_lsn;
+    count = list_numbered(CHANGELOG_DIR, "wal-", ".log", &numbers);
+    for (size_t i = 0; i < count; i++) {
+        if (numbers[i] > max_lsn + 1) {
+            max_lsn = numbers[i] - 1;
+        }
+        replay_segment(numbers[i], 0, 0, &max_lsn);
+    }
+    free(numbers);
+
+    pthread_mutex_lock(&changelog_mutex);
+    next_lsn = max_lsn + 1;
+    changelog_fd = open_segment(next_lsn);
+    changelog_enabled = changelog_fd != -1;
+    pthread_mutex_unlock(&changelog_mutex);
+
+    return changelog_enabled ? 0 : -1;
+}
+
+int checkpoint_start(void) {
+    if (interval <= 0) {
+        return 0;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, checkpoint_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+int checkpoint_recover(void) {
+    uint64_t *numbers;
+    size_t count = list_numbered(CHECKPOINT_DIR, "ckpt-", ".dat", &numbers);
+
+    // Start from the newest full checkpoint and apply the incrementals built on it
+    size_t base = count;
+    CheckpointHeader header;
+    for (size_t i = count; i-- > 0;) {
+        if (read_checkpoint_header(numbers[i], &header) == 0 && header.is_full) {
+            base = i;
+            break;
+        }
+    }
+    if (base == count) {
+        free(numbers);
+        log_error("recovery: no full checkpoint found in %s", CHECKPOINT_DIR);
+        return -1;
+    }
+
+    if (header.table_count != (uint32_t)table_count()) {
+        free(numbers);
+        log_error("recovery: checkpoint has %u tables, this server has %d (check --enroll-partitions)",
+                  header.table_count, table_count());
+        return -1;
+    }
+
+    uint64_t base_seq = numbers[base];
+    uint64_t lsn = 0;
+    for (size_t i = base; i < count; i++) {
+        if (read_checkpoint_header(numbers[i], &header) == -1 || header.base_seq != base_seq ||
+            numbers[i] != base_seq + (i - base)) {
+            break; // chain ends at the first missing or foreign checkpoint
+        }
+        if (apply_checkpoint(numbers[i], &header) == -1) {
+            free(numbers);
+            log_error("recovery: checkpoint %llu is damaged", (unsigned long long)numbers[i]);
+            return -1;
+        }
+        lsn = header.lsn;
+    }
+    free(numbers);
+
+    uint64_t max_lsn = lsn;
+    int replayed = 0;
+    count = list_numbered(CHANGELOG_DIR, "wal-", ".log", &numbers);
+    for (size_t i = 0; i < count; i++) {
+        int applied = replay_segment(numbers[i], lsn, 1, &max_lsn);
+        if (applied > 0) {
+            replayed += applied;
+        }
+    }
+    free(numbers);
+
+    log_info("recovery: restored checkpoint at LSN %llu and replayed %d log records",
+             (unsigned long long)lsn, replayed);
+    return 0;
+}
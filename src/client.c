@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <poll.h>
 
 // Client-side menu texts
 const char* WELCOME_MSG = 
@@ -20,7 +21,9 @@ const char* STUDENT_MENU =
     "3. Drop Course\n"
     "4. View Enrolled Courses\n"
     "5. Change Password\n"
-    "6. Logout\n"
+    "6. Search Courses\n"
+    "7. Watch Seat Availability\n"
+    "8. Logout\n"
     "Enter your choice: ";
 
 const char* FACULTY_MENU =
@@ -30,7 +33,8 @@ const char* FACULTY_MENU =
     "3. Remove Course\n"
     "4. View Course Enrollments\n"
     "5. Change Password\n"
-    "6. Logout\n"
+    "6. View Course Load\n"
+    "7. Logout\n"
     "Enter your choice: ";
 
 const char* ADMIN_MENU =
@@ -44,9 +48,11 @@ const char* ADMIN_MENU =
     "7. Modify Student Details\n"
     "8. Modify Faculty Details\n"
     "9. Logout\n"
+    "10. Export Tables (batch client only)\n"
+    "11. View Term Analytics\n"
     "Enter your choice: ";
 
-int connect_to_server() {
+int connect_to_server(int port) {
     int sock;
     struct sockaddr_in server_addr;
 
@@ -58,14 +64,12 @@ int connect_to_server() {
 
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-    server_addr.sin_port = htons(PORT);
+    server_addr.sin_port = htons(port);
 
     if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("connect() failed");
         exit(EXIT_FAILURE);
     }
-    const char *msg = "Connected to server!\n";
-    write(STDOUT_FILENO, msg, strlen(msg));
     return sock;
 }
     
@@ -88,13 +92,343 @@ void receive_message(int socket, char *buffer, int size) {
 
 
 
+// Read the answer to a server prompt from stdin and send it. At a page
+// prompt an empty line asks for the next page with the token the server
+// offered; "-" stops the listing.
+void answer_prompt(int sock, char *buffer, int size) {
+    char token[BUFFER_SIZE] = "";
+    const char *label = strstr(buffer, PAGE_TOKEN_LABEL);
+    if (label && strstr(buffer, PAGE_PROMPT)) {
+        label += strlen(PAGE_TOKEN_LABEL);
+        snprintf(token, sizeof(token), "%.*s", (int)strcspn(label, "\n"), label);
+    }
+
+    fgets(buffer, size, stdin);
+    buffer[strcspn(buffer, "\n")] = '\0'; // remove newline
+    if (buffer[0] == '\0' && token[0] != '\0') {
+        snprintf(buffer, size, "%s", token);
+    }
+    send_message(sock, buffer);
+}
+
+// Print seat updates as they arrive until the watch ends; Enter stops it
+void watch_seats(int sock, char *buffer, int size) {
+    struct pollfd fds[2] = {{sock, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+
+    while (strstr(buffer, WATCH_STOPPED) == NULL) {
+        if (poll(fds, 2, -1) < 0) {
+            perror("poll failed");
+            exit(EXIT_FAILURE);
+        }
+        if (fds[1].revents) {
+            fgets(buffer, size, stdin);
+            send_message(sock, "stop");
+            fds[1].fd = -1; // the rest is the server's
+        }
+        if (fds[0].revents) {
+            receive_message(sock, buffer, size);
+            if (buffer[0] == '\0') {
+                exit(0); // the server closed the session
+            }
+            printf("%s", buffer);
+            fflush(stdout);
+        }
+    }
+}
+
+// ==================== Catalog Cache ====================
+// The student's copy of the course catalog, in course code order. View All
+// Courses syncs it instead of fetching the listing: the server answers the
+// version held with only the courses changed since, or with the whole
+// catalog when that version is too old. With --catalog-cache FILE the copy
+// is loaded at start and saved after each sync in the form of a full sync
+// reply, so the next session starts from the version this one saw.
+
+typedef struct {
+    Course *courses;
+    int count;
+    int capacity;
+    unsigned long long version;     // 0 until the first sync
+} CatalogCache;
+
+static CatalogCache catalog;
+static const char *catalog_path;    // --catalog-cache, or NULL
+
+// Index of the course, or -(insertion point) - 1
+static int catalog_find(const char *course_code) {
+    int low = 0, high = catalog.count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        int cmp = strcmp(catalog.courses[mid].course_code, course_code);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -low - 1;
+}
+
+static void catalog_upsert(const Course *course) {
+    int at = catalog_find(course->course_code);
+    if (at >= 0) {
+        catalog.courses[at] = *course;
+        return;
+    }
+    at = -at - 1;
+    if (catalog.count == catalog.capacity) {
+        catalog.capacity = catalog.capacity ? 2 * catalog.capacity : 64;
+        catalog.courses = realloc(catalog.courses, catalog.capacity * sizeof(Course));
+        if (!catalog.courses) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memmove(&catalog.courses[at + 1], &catalog.courses[at], (catalog.count - at) * sizeof(Course));
+    catalog.courses[at] = *course;
+    catalog.count++;
+}
+
+// Split a line at tabs; returns the number of fields
+static int split_fields(char *line, char **fields, int max_fields) {
+    int count = 0;
+    while (count < max_fields) {
+        fields[count++] = line;
+        line = strchr(line, '\t');
+        if (!line) {
+            break;
+        }
+        *line++ = '\0';
+    }
+    return count;
+}
+
+// Apply one change row; returns 0, or -1 for a malformed row
+static int catalog_apply_row(char *row) {
+    char *fields[7];
+    int n = split_fields(row, fields, 7);
+    Course course;
+    int at;
+
+    memset(&course, 0, sizeof(course));
+    switch (fields[0][0]) {
+        case '+':
+            if (n != 7) {
+                return -1;
+            }
+            snprintf(course.course_code, sizeof(course.course_code), "%s", fields[1]);
+            snprintf(course.name, sizeof(course.name), "%s", fields[2]);
+            snprintf(course.faculty_id, sizeof(course.faculty_id), "%s", fields[3]);
+            course.credits = atoi(fields[4]);
+            course.max_seats = atoi(fields[5]);
+            course.available_seats = atoi(fields[6]);
+            catalog_upsert(&course);
+            return 0;
+        case '-':
+            if (n != 2) {
+                return -1;
+            }
+            if ((at = catalog_find(fields[1])) >= 0) {
+                memmove(&catalog.courses[at], &catalog.courses[at + 1], (catalog.count - at - 1) * sizeof(Course));
+                catalog.count--;
+            }
+            return 0;
+        case '=':
+            if (n != 3) {
+                return -1;
+            }
+            if ((at = catalog_find(fields[1])) >= 0) {
+                catalog.courses[at].available_seats = atoi(fields[2]);
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Apply a sync reply (prompts before it are skipped). Returns the number
+// of rows, or -1 when the reply is not a catalog, e.g. an error message.
+static int catalog_apply(char *reply, int *full) {
+    char *header = strstr(reply, CATALOG_LABEL);
+    char kind[16];
+    unsigned long long version;
+    int rows;
+
+    if (!header || sscanf(header + strlen(CATALOG_LABEL), "%15s %llu %d", kind, &version, &rows) != 3) {
+        return -1;
+    }
+    *full = strcmp(kind, CATALOG_FULL) == 0;
+    if (*full) {
+        catalog.count = 0;
+    }
+
+    char *line = strchr(header, '\n');
+    for (int i = 0; i < rows; i++) {
+        char *end = line ? strchr(line + 1, '\n') : NULL;
+        if (!end) {
+            catalog.version = 0; // incomplete; the next sync starts over
+            return -1;
+        }
+        *end = '\0';
+        if (catalog_apply_row(line + 1) == -1) {
+            catalog.version = 0;
+            return -1;
+        }
+        line = end;
+    }
+    catalog.version = version;
+    return rows;
+}
+
+// The Available Courses listing from the cache; the caller frees it
+static char *catalog_format(void) {
+    size_t capacity = BUFFER_SIZE + (size_t)catalog.count * (sizeof(Course) + 32);
+    char *text = malloc(capacity);
+    if (!text) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = snprintf(text, capacity, "\n=== Available Courses ===\nCode\tName\tFaculty\tCredits\tAvailable Seats\n");
+    int shown = 0;
+    for (int i = 0; i < catalog.count; i++) {
+        const Course *course = &catalog.courses[i];
+        if (course->available_seats > 0) {
+            len += snprintf(text + len, capacity - len, "%s\t%s\t%s\t%d\t%d\n",
+                            course->course_code, course->name, course->faculty_id,
+                            course->credits, course->available_seats);
+            shown++;
+        }
+    }
+    if (!shown) {
+        snprintf(text + len, capacity - len, "No available courses found.\n");
+    }
+    return text;
+}
+
+static void catalog_load(void) {
+    FILE *file = fopen(catalog_path, "r");
+    if (!file) {
+        return; // no cache yet
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = malloc(size + 1);
+    int full;
+    if (text && fread(text, 1, size, file) == (size_t)size) {
+        text[size] = '\0';
+        if (catalog_apply(text, &full) == -1) {
+            catalog.count = 0; // unreadable; start from a full sync
+        }
+    }
+    free(text);
+    fclose(file);
+}
+
+// Written beside the cache and renamed over it, so a crash leaves the old one
+static void catalog_save(void) {
+    char temp_path[BUFFER_SIZE];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", catalog_path);
+    FILE *file = fopen(temp_path, "w");
+    if (!file) {
+        perror(temp_path);
+        return;
+    }
+    fprintf(file, "%s %s %llu %d\n", CATALOG_LABEL, CATALOG_FULL, catalog.version, catalog.count);
+    for (int i = 0; i < catalog.count; i++) {
+        const Course *course = &catalog.courses[i];
+        fprintf(file, "+\t%s\t%s\t%s\t%d\t%d\t%d\n", course->course_code, course->name, course->faculty_id,
+                course->credits, course->max_seats, course->available_seats);
+    }
+    if (fclose(file) != 0 || rename(temp_path, catalog_path) != 0) {
+        perror(catalog_path);
+    }
+}
+
+// Read a sync reply of a menu session, which has no end marker: it is
+// complete after the header and as many rows as the header announced, or
+// after one line that is not a header (an error)
+static char *read_catalog_reply(int sock) {
+    size_t len = 0, capacity = 4 * BUFFER_SIZE;
+    char *data = malloc(capacity);
+
+    while (data) {
+        data[len] = '\0';
+        char *header = strstr(data, CATALOG_LABEL);
+        char *newline = strchr(header ? header : data, '\n');
+        int rows;
+        if (newline && (!header || sscanf(header + strlen(CATALOG_LABEL), "%*s %*s %d", &rows) != 1)) {
+            return data;
+        }
+        if (newline) {
+            for (char *p = newline + 1; rows > 0 && (p = strchr(p, '\n')) != NULL; p++) {
+                rows--;
+            }
+            if (rows == 0) {
+                return data;
+            }
+        }
+
+        if (capacity - len < BUFFER_SIZE) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+            if (!data) {
+                break;
+            }
+        }
+        ssize_t n = recv(sock, data + len, capacity - len - 1, 0);
+        if (n <= 0) {
+            exit(0); // the server closed the session
+        }
+        len += n;
+    }
+    perror("realloc failed");
+    exit(EXIT_FAILURE);
+}
+
+// View All Courses: sync the cache, then list its courses with free seats
+void view_catalog(int sock) {
+    char buffer[BUFFER_SIZE];
+    int full;
+
+    send_message(sock, "9");
+    receive_message(sock, buffer, sizeof(buffer)); // the version prompt
+    if (buffer[0] == '\0') {
+        exit(0); // the server closed the session
+    }
+    snprintf(buffer, sizeof(buffer), "%llu", catalog.version);
+    send_message(sock, buffer);
+
+    char *reply = read_catalog_reply(sock);
+    if (catalog_apply(reply, &full) == -1) {
+        printf("%s", reply);
+    } else {
+        if (catalog_path) {
+            catalog_save();
+        }
+        char *text = catalog_format();
+        printf("%s", text);
+        free(text);
+    }
+    fflush(stdout);
+    free(reply);
+}
+
 void handle_student(int sock) {
     char buffer[BUFFER_SIZE];
     
     while (1) {
         // 1. Display options to the user
-        write(STDOUT_FILENO, STUDENT_MENU, strlen(FACULTY_MENU));
+        write(STDOUT_FILENO, STUDENT_MENU, strlen(STUDENT_MENU));
         fgets(buffer, sizeof(buffer), stdin);
+        if (atoi(buffer) == 1) {
+            view_catalog(sock); // served from the cache after a sync
+            continue;
+        }
         
         // 2. Send choice to server
         send_message(sock, buffer);
@@ -108,11 +442,13 @@ void handle_student(int sock) {
             // If server says "Logging out...", break from main loop
             if (strstr(buffer, "Logging out") != NULL) exit(0);
             
+            if (strstr(buffer, WATCH_STARTED) != NULL) {
+                watch_seats(sock, buffer, sizeof(buffer));
+                break;
+            }
             // If server expects input (e.g. "Enter Student ID: ")
             if (strstr(buffer, "Enter") != NULL) {
-                fgets(buffer, sizeof(buffer), stdin);
-                buffer[strcspn(buffer, "\n")] = '\0'; // remove newline
-                send_message(sock, buffer);
+                answer_prompt(sock, buffer, sizeof(buffer));
             } else {
                 // Server printed a final message. Exit this sub-loop.
                 break;
@@ -142,9 +478,7 @@ void handle_faculty(int sock) {
             
             // If server expects input (e.g. "Enter Student ID: ")
             if (strstr(buffer, "Enter") != NULL) {
-                fgets(buffer, sizeof(buffer), stdin);
-                buffer[strcspn(buffer, "\n")] = '\0'; // remove newline
-                send_message(sock, buffer);
+                answer_prompt(sock, buffer, sizeof(buffer));
             } else {
                 // Server printed a final message. Exit this sub-loop.
                 break;
@@ -175,9 +509,7 @@ void handle_admin(int sock) {
             
             // If server expects input (e.g. "Enter Student ID: ")
             if (strstr(buffer, "Enter") != NULL) {
-                fgets(buffer, sizeof(buffer), stdin);
-                buffer[strcspn(buffer, "\n")] = '\0'; // remove newline
-                send_message(sock, buffer);
+                answer_prompt(sock, buffer, sizeof(buffer));
             } else {
                 // Server printed a final message. Exit this sub-loop.
                 break;
@@ -187,8 +519,478 @@ void handle_admin(int sock) {
     
 }
 
-int main() {
-    int sock = connect_to_server();
+// ==================== Batch Mode ====================
+// --batch FILE runs a command script on one connection instead of the
+// menus. Each command becomes one request line: the menu choice and the
+// answers to its prompts as tab-separated fields. Requests are sent ahead
+// of their replies, up to BATCH_PIPELINE_DEPTH at a time, and the server
+// ends each reply with REPLY_END. Every reply line is printed as
+//     <script line>\t<command>\t<text>
+// with the prompts removed.
+
+#define BATCH_MAX_ARGS 4
+#define BATCH_PIPELINE_DEPTH 32
+
+typedef struct {
+    int role;
+    const char *name;
+    const char *choice;
+    int min_args;
+    int max_args;
+    int paged;          // listing: ask for every page up front
+    int output;         // the last argument names a local file for the reply
+} BatchCommand;
+
+static const BatchCommand batch_commands[] = {
+    {1, "add-student", "1", 3, 3, 0, 0},       // ID NAME PASSWORD
+    {1, "student", "2", 1, 1, 0, 0},
+    {1, "add-faculty", "3", 3, 3, 0, 0},       // ID NAME PASSWORD
+    {1, "faculty", "4", 1, 1, 0, 0},
+    {1, "activate", "5", 1, 1, 0, 0},
+    {1, "block", "6", 1, 1, 0, 0},
+    {1, "update-student", "7", 1, 3, 0, 0},    // ID [NAME [PASSWORD]], "" keeps a value
+    {1, "update-faculty", "8", 1, 3, 0, 0},
+    {1, "logout", "9", 0, 0, 0, 0},
+    {1, "export", "10", 3, 3, 0, 1},        // TABLE FORMAT FILE
+    {1, "analytics", "11", 0, 0, 0, 0},
+    {2, "list", "1", 0, 0, 0, 0},
+    {2, "add", "2", 4, 4, 0, 0},               // CODE NAME CREDITS SEATS
+    {2, "remove", "3", 1, 1, 0, 0},
+    {2, "enrollments", "4", 1, 1, 1, 0},
+    {2, "passwd", "5", 1, 1, 0, 0},
+    {2, "load", "6", 0, 0, 0, 0},
+    {2, "logout", "7", 0, 0, 0, 0},
+    {3, "list", "1", 0, 0, 1, 0},
+    {3, "enroll", "2", 1, 1, 0, 0},
+    {3, "drop", "3", 1, 1, 0, 0},
+    {3, "enrolled", "4", 0, 0, 1, 0},
+    {3, "passwd", "5", 1, 1, 0, 0},
+    {3, "search", "6", 0, 4, 1, 0},            // [PREFIX [KEYWORDS [CREDITS [SEATS]]]]
+    {3, "watch", "7", 2, 2, 0, 0},             // "CODE..." SECONDS
+    {3, "logout", "8", 0, 0, 0, 0},
+    {3, "catalog", "9", 0, 0, 0, 0},           // sync the cache and list it, see view_catalog
+};
+
+typedef struct {
+    int line_number;        // in the script; 0 for the implicit logout
+    const char *name;
+    char request[BUFFER_SIZE];
+    char *output;           // local file for the reply, or NULL
+} BatchRequest;
+
+// Split a script line into words; "double quotes" keep spaces in a word
+static int split_words(char *line, char **words, int max_words) {
+    int count = 0;
+    char *p = line;
+
+    while (1) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            return count;
+        }
+        if (count == max_words) {
+            return -1;
+        }
+        if (*p == '"') {
+            words[count++] = ++p;
+            p += strcspn(p, "\"");
+            if (*p != '"') {
+                return -1;
+            }
+        } else {
+            words[count++] = p;
+            p += strcspn(p, " \t");
+        }
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+    }
+}
+
+static const BatchCommand *find_batch_command(int role, const char *name) {
+    for (size_t i = 0; i < sizeof(batch_commands) / sizeof(batch_commands[0]); i++) {
+        if (batch_commands[i].role == role && strcmp(batch_commands[i].name, name) == 0) {
+            return &batch_commands[i];
+        }
+    }
+    return NULL;
+}
+
+static void free_requests(BatchRequest *requests, int count) {
+    for (int i = 0; i < count; i++) {
+        free(requests[i].output);
+    }
+    free(requests);
+}
+
+// Parse the script into request lines; the first command must be
+// "login ROLE ID PASSWORD". Returns the request count or -1.
+static int parse_script(FILE *script, BatchRequest **out) {
+    char line[BUFFER_SIZE];
+    char *words[BATCH_MAX_ARGS + 2];
+    BatchRequest *requests = NULL;
+    int count = 0, capacity = 0, line_number = 0, role = 0, logged_out = 0;
+
+    while (fgets(line, sizeof(line), script)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        int n = split_words(line, words, BATCH_MAX_ARGS + 2);
+        if (n == 0) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "line %d: too many arguments or unterminated quote\n", line_number);
+            free_requests(requests, count);
+            return -1;
+        }
+        if (logged_out) {
+            fprintf(stderr, "line %d: command after logout\n", line_number);
+            free_requests(requests, count);
+            return -1;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            BatchRequest *grown = realloc(requests, (capacity + 1) * sizeof(BatchRequest)); // + implicit logout
+            if (!grown) {
+                free_requests(requests, count);
+                return -1;
+            }
+            requests = grown;
+        }
+        BatchRequest *request = &requests[count];
+        request->line_number = line_number;
+        request->output = NULL;
+
+        if (role == 0) {
+            static const char *roles[] = {"admin", "faculty", "student"};
+            for (int r = 0; n == 4 && strcmp(words[0], "login") == 0 && r < 3; r++) {
+                if (strcmp(words[1], roles[r]) == 0) {
+                    role = r + 1;
+                }
+            }
+            if (role == 0) {
+                fprintf(stderr, "line %d: the script must start with: login admin|faculty|student ID PASSWORD\n",
+                        line_number);
+                free_requests(requests, count);
+                return -1;
+            }
+            request->name = "login";
+            snprintf(request->request, sizeof(request->request), "%d\t%s\t%s", role, words[2], words[3]);
+            count++;
+            continue;
+        }
+
+        const BatchCommand *command = find_batch_command(role, words[0]);
+        if (!command || n - 1 < command->min_args || n - 1 > command->max_args) {
+            fprintf(stderr, "line %d: unknown command or wrong number of arguments: %s\n", line_number, words[0]);
+            free_requests(requests, count);
+            return -1;
+        }
+
+        // Unused answers are sent empty so no field spills into the next request
+        size_t len = snprintf(request->request, sizeof(request->request), "%s", command->choice);
+        for (int i = 1; i <= command->max_args - command->output; i++) {
+            len += snprintf(request->request + len, sizeof(request->request) - len, "\t%s", i < n ? words[i] : "");
+        }
+        if (command->paged) {
+            snprintf(request->request + len, sizeof(request->request) - len, "\t%s", PAGE_ALL);
+        }
+        if (command->output) {
+            request->output = strdup(words[n - 1]);
+        }
+        request->name = command->name;
+        logged_out = strcmp(command->name, "logout") == 0;
+        count++;
+    }
+
+    if (role == 0) {
+        fprintf(stderr, "empty script\n");
+        free_requests(requests, count);
+        return -1;
+    }
+    if (!logged_out) {
+        requests[count].line_number = 0;
+        requests[count].name = "logout";
+        requests[count].output = NULL;
+        snprintf(requests[count].request, sizeof(requests[count].request), "%s",
+                 find_batch_command(role, "logout")->choice);
+        count++;
+    }
+    *out = requests;
+    return count;
+}
+
+// Read until REPLY_END or end of stream; the reply is left NUL-terminated
+// at the start of *data and the bytes after the marker are kept. Returns
+// 1 at the marker, 0 at end of stream.
+static int read_reply(int sock, char **data, size_t *len, size_t *capacity, size_t *reply_len) {
+    size_t scanned = 0;
+
+    while (1) {
+        char *end = NULL;
+        for (char *p = *data + scanned; p + 1 < *data + *len; p++) {
+            if (memcmp(p, REPLY_END, 2) == 0) {
+                end = p;
+                break;
+            }
+        }
+        if (end) {
+            *reply_len = end - *data;
+            *end = '\0';
+            return 1;
+        }
+        scanned = *len > 0 ? *len - 1 : 0;
+
+        if (*capacity - *len < BUFFER_SIZE) {
+            *capacity = 2 * *capacity + BUFFER_SIZE;
+            *data = realloc(*data, *capacity);
+            if (!*data) {
+                perror("realloc failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = recv(sock, *data + *len, *capacity - *len - 1, 0);
+        if (n <= 0) {
+            (*data)[*len] = '\0';
+            *reply_len = *len;
+            return 0;
+        }
+        *len += n;
+    }
+}
+
+// A prompt is not followed by a newline, so it leads the text after it;
+// returns where that text starts in the line
+static const char *skip_prompts(const char *line, size_t len) {
+    const char *end = line + len;
+    while (end - line > 6 && strncmp(line, "Enter ", 6) == 0) {
+        const char *colon = line + 6;
+        while (colon + 1 < end && !(colon[0] == ':' && colon[1] == ' ')) {
+            colon++;
+        }
+        if (colon + 1 >= end) {
+            break;
+        }
+        line = colon + 2;
+    }
+    return line;
+}
+
+static const char *last_newline(const char *data, size_t len) {
+    while (len > 0) {
+        if (data[--len] == '\n') {
+            return data + len;
+        }
+    }
+    return NULL;
+}
+
+// Like read_reply, for a reply whose last line is a status: every line
+// before it is written to out as it arrives, so a reply of any size needs
+// no more memory than one receive, and only the status line is left as
+// the reply
+static int stream_reply(int sock, FILE *out, char **data, size_t *len, size_t *capacity, size_t *reply_len) {
+    int first = 1;
+
+    while (1) {
+        char *end = NULL;
+        for (char *p = *data; p + 1 < *data + *len; p++) {
+            if (memcmp(p, REPLY_END, 2) == 0) {
+                end = p;
+                break;
+            }
+        }
+
+        // Keep the last complete line, which may turn out to be the status
+        size_t limit = end ? (size_t)(end - *data) : *len;
+        const char *last = last_newline(*data, limit);
+        const char *before = last ? last_newline(*data, last - *data) : NULL;
+        if (before) {
+            size_t written = before + 1 - *data;
+            const char *start = first ? skip_prompts(*data, written) : *data;
+            first = 0;
+            if (fwrite(start, 1, *data + written - start, out) != (size_t)(*data + written - start)) {
+                return -1;
+            }
+            *len -= written;
+            memmove(*data, *data + written, *len);
+            if (end) {
+                end -= written;
+            }
+        }
+        if (end) {
+            *reply_len = end - *data;
+            *end = '\0';
+            return 1;
+        }
+
+        if (*capacity - *len < BUFFER_SIZE) {
+            *capacity = 2 * *capacity + BUFFER_SIZE;
+            *data = realloc(*data, *capacity);
+            if (!*data) {
+                perror("realloc failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = recv(sock, *data + *len, *capacity - *len - 1, 0);
+        if (n <= 0) {
+            (*data)[*len] = '\0';
+            *reply_len = *len;
+            return 0;
+        }
+        *len += n;
+    }
+}
+
+static void print_reply(const BatchRequest *request, char *reply) {
+    int printed = 0;
+    char *save = NULL;
+
+    for (char *line = strtok_r(reply, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        line = (char *)skip_prompts(line, strlen(line));
+        if (line[0] == '\0' || strncmp(line, PAGE_TOKEN_LABEL, strlen(PAGE_TOKEN_LABEL)) == 0) {
+            continue;
+        }
+        printf("%d\t%s\t%s\n", request->line_number, request->name, line);
+        printed = 1;
+    }
+    if (!printed) {
+        printf("%d\t%s\t\n", request->line_number, request->name);
+    }
+}
+
+int run_batch(int port, const char *path) {
+    FILE *script = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!script) {
+        perror(path);
+        return 1;
+    }
+    BatchRequest *requests;
+    int count = parse_script(script, &requests);
+    if (script != stdin) {
+        fclose(script);
+    }
+    if (count < 0) {
+        return 1;
+    }
+
+    int sock = connect_to_server(port);
+    char *out = malloc(BATCH_PIPELINE_DEPTH * (BUFFER_SIZE + 1));
+    char *data = NULL;
+    size_t len = 0, capacity = 0;
+    int sent = 0, done = 0, status = 0;
+
+    while (done < count) {
+        // Top the pipeline up with a single write
+        size_t out_len = 0;
+        while (sent < count && sent - done < BATCH_PIPELINE_DEPTH) {
+            // A watch ends at the next message, so nothing follows it early
+            if (sent > done && strcmp(requests[sent - 1].name, "watch") == 0) {
+                break;
+            }
+            // A sync sends the version the previous reply left in the cache
+            if (strcmp(requests[sent].name, "catalog") == 0) {
+                if (sent > done) {
+                    break;
+                }
+                size_t request_len = strlen(requests[sent].request);
+                snprintf(requests[sent].request + request_len, sizeof(requests[sent].request) - request_len,
+                         "\t%llu", catalog.version);
+            }
+            out_len += sprintf(out + out_len, "%s\n", requests[sent++].request);
+        }
+        if (out_len > 0) {
+            send_message(sock, out);
+        }
+
+        size_t reply_len;
+        int complete;
+        if (requests[done].output) {
+            FILE *out = fopen(requests[done].output, "w");
+            if (!out) {
+                perror(requests[done].output);
+                status = 1;
+                break;
+            }
+            complete = stream_reply(sock, out, &data, &len, &capacity, &reply_len);
+            if (fclose(out) != 0 || complete == -1) {
+                perror(requests[done].output);
+                status = 1;
+                break;
+            }
+        } else {
+            complete = read_reply(sock, &data, &len, &capacity, &reply_len);
+        }
+        int full;
+        if (complete && strcmp(requests[done].name, "catalog") == 0 && catalog_apply(data, &full) >= 0) {
+            if (catalog_path) {
+                catalog_save();
+            }
+            char *text = catalog_format();
+            printf("%d\t%s\tCatalog version %llu: %s\n", requests[done].line_number, requests[done].name,
+                   catalog.version, full ? "full refresh" : "changes applied");
+            print_reply(&requests[done], text);
+            free(text);
+        } else if (requests[done].line_number > 0) {
+            print_reply(&requests[done], data);
+        }
+
+        // Without a marker the server closed the session: expected after
+        // logout, otherwise the login failed or the connection broke
+        if (!complete) {
+            if (strcmp(requests[done].name, "logout") != 0) {
+                fprintf(stderr, "connection closed by server after line %d\n", requests[done].line_number);
+                status = 1;
+            }
+            break;
+        }
+        len -= reply_len + 2;
+        memmove(data, data + reply_len + 2, len);
+        done++;
+    }
+
+    fflush(stdout);
+    free(out);
+    free(data);
+    free_requests(requests, count);
+    close(sock);
+    return status;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--port PORT] [--batch FILE|-] [--catalog-cache FILE]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int port = PORT;
+    const char *batch = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--port") == 0 && has_value) {
+            port = atoi(argv[++i]); // e.g. a read-only replica
+        } else if (strcmp(argv[i], "--batch") == 0 && has_value) {
+            batch = argv[++i]; // a script file, or - for stdin
+        } else if (strcmp(argv[i], "--catalog-cache") == 0 && has_value) {
+            catalog_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (catalog_path) {
+        catalog_load();
+    }
+    if (batch) {
+        return run_batch(port, batch);
+    }
+
+    int sock = connect_to_server(port);
+    const char *msg = "Connected to server!\n";
+    write(STDOUT_FILENO, msg, strlen(msg));
     char buffer[BUFFER_SIZE];
 
     write(STDOUT_FILENO, WELCOME_MSG, strlen(WELCOME_MSG));
@@ -0,0 +1,58 @@
+#include "connection.h"
+
+static ConnectionContext *pool;
+static ConnectionContext *free_list;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_available = PTHREAD_COND_INITIALIZER;
+
+int connection_pool_init(int capacity) {
+    if (capacity <= 0) {
+        return -1;
+    }
+
+    pool = calloc(capacity, sizeof(ConnectionContext));
+    if (!pool) {
+        return -1;
+    }
+
+    for (int i = capacity - 1; i >= 0; i--) {
+        pool[i].socket = -1;
+        arena_init(&pool[i].arena);
+        pool[i].next_free = free_list;
+        free_list = &pool[i];
+    }
+    return 0;
+}
+
+ConnectionContext *connection_acquire(void) {
+    pthread_mutex_lock(&pool_mutex); // Lock the pool mutex
+    while (!free_list) {
+        pthread_cond_wait(&pool_available, &pool_mutex);
+    }
+    ConnectionContext *conn = free_list;
+    free_list = conn->next_free;
+    pthread_mutex_unlock(&pool_mutex); // Unlock the mutex
+
+    conn->next_free = NULL;
+    conn->socket = -1;
+    conn->role = 0;
+    conn->id[0] = '\0';
+    conn->framing = FRAMING_UNKNOWN;
+    conn->frame_len = 0;
+    conn->skip_line = 0;
+    conn->line_open = 0;
+    conn->request_open = 0;
+    conn->reply_bytes = 0;
+    return conn;
+}
+
+void connection_release(ConnectionContext *conn) {
+    // The arena keeps its first block for the next session
+    arena_reset(&conn->arena);
+
+    pthread_mutex_lock(&pool_mutex); // Lock the pool mutex
+    conn->next_free = free_list;
+    free_list = conn;
+    pthread_cond_signal(&pool_available);
+    pthread_mutex_unlock(&pool_mutex); // Unlock the mutex
+}
@@ -0,0 +1,535 @@
+#include "utils.h"
+#include "course_index.h"
+#include "storage.h"
+
+#include <ctype.h>
+
+#define WORD_BUCKETS 1024
+
+typedef struct {
+    char key[MAX_NAME_LEN]; // lower-cased code, name or name word
+    int slot;
+} PrefixKey;
+
+typedef struct WordPostings {
+    char word[MAX_NAME_LEN];
+    int *slots;             // courses containing the word, each listed once
+    int count;
+    int capacity;
+    struct WordPostings *next;
+} WordPostings;
+
+// Index state, guarded by index_lock. Writers also hold course_file_mutex,
+// which is always taken first.
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int index_valid = 0;
+
+static Course *courses;           // indexed by slot
+static unsigned char *slot_used;
+static int slot_count;            // slots in use or freed, never shrinks until a rebuild
+static int slot_capacity;
+
+static PrefixKey *prefix_keys;    // sorted by key, then slot
+static int prefix_count;
+static int prefix_capacity;
+
+static int *code_order;           // slots sorted by course code, then slot
+static int code_count;
+static int code_capacity;
+
+static WordPostings *words[WORD_BUCKETS];
+
+// ==================== Keys ====================
+
+static void lower_copy(char *dst, const char *src, size_t size) {
+    size_t i = 0;
+    for (; src[i] && i + 1 < size; i++) {
+        dst[i] = tolower((unsigned char)src[i]);
+    }
+    dst[i] = '\0';
+}
+
+// Copy the next alphanumeric word after *cursor into word, lower-cased
+static int next_word(const char **cursor, char *word, size_t size) {
+    const char *p = *cursor;
+    while (*p && !isalnum((unsigned char)*p)) {
+        p++;
+    }
+    if (!*p) {
+        *cursor = p;
+        return 0;
+    }
+
+    size_t len = 0;
+    while (*p && isalnum((unsigned char)*p)) {
+        if (len + 1 < size) {
+            word[len++] = tolower((unsigned char)*p);
+        }
+        p++;
+    }
+    word[len] = '\0';
+    *cursor = p;
+    return 1;
+}
+
+static unsigned word_bucket(const char *word) {
+    unsigned hash = 5381;
+    while (*word) {
+        hash = hash * 33 + (unsigned char)*word++;
+    }
+    return hash % WORD_BUCKETS;
+}
+
+// ==================== Prefix Array ====================
+
+static int prefix_compare(const char *key, int slot, const PrefixKey *entry) {
+    int cmp = strcmp(key, entry->key);
+    return cmp ? cmp : slot - entry->slot;
+}
+
+// First position whose key is not less than (key, slot)
+static int prefix_lower_bound(const char *key, int slot) {
+    int lo = 0, hi = prefix_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (prefix_compare(key, slot, &prefix_keys[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int prefix_insert(const char *key, int slot) {
+    int pos = prefix_lower_bound(key, slot);
+    if (pos < prefix_count && prefix_compare(key, slot, &prefix_keys[pos]) == 0) {
+        return 0; // a name word repeated within one course
+    }
+
+    if (prefix_count == prefix_capacity) {
+        int capacity = prefix_capacity ? prefix_capacity * 2 : 64;
+        PrefixKey *grown = realloc(prefix_keys, capacity * sizeof(PrefixKey));
+        if (!grown) {
+            return -1;
+        }
+        prefix_keys = grown;
+        prefix_capacity = capacity;
+    }
+
+    memmove(&prefix_keys[pos + 1], &prefix_keys[pos], (prefix_count - pos) * sizeof(PrefixKey));
+    snprintf(prefix_keys[pos].key, sizeof(prefix_keys[pos].key), "%s", key);
+    prefix_keys[pos].slot = slot;
+    prefix_count++;
+    return 0;
+}
+
+static void prefix_delete(const char *key, int slot) {
+    int pos = prefix_lower_bound(key, slot);
+    if (pos < prefix_count && prefix_compare(key, slot, &prefix_keys[pos]) == 0) {
+        memmove(&prefix_keys[pos], &prefix_keys[pos + 1], (prefix_count - pos - 1) * sizeof(PrefixKey));
+        prefix_count--;
+    }
+}
+
+// ==================== Code Order ====================
+
+static int code_compare(const char *course_code, int slot, int entry) {
+    int cmp = strcmp(course_code, courses[entry].course_code);
+    return cmp ? cmp : slot - entry;
+}
+
+// First position whose course sorts after course_code
+static int code_upper_bound(const char *course_code) {
+    int lo = 0, hi = code_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(course_code, courses[code_order[mid]].course_code) >= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// First position whose entry is not less than (course_code, slot)
+static int code_lower_bound(const char *course_code, int slot) {
+    int lo = 0, hi = code_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (code_compare(course_code, slot, code_order[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int code_insert(int slot) {
+    if (code_count == code_capacity) {
+        int capacity = code_capacity ? code_capacity * 2 : 64;
+        int *grown = realloc(code_order, capacity * sizeof(int));
+        if (!grown) {
+            return -1;
+        }
+        code_order = grown;
+        code_capacity = capacity;
+    }
+
+    int pos = code_lower_bound(courses[slot].course_code, slot);
+    memmove(&code_order[pos + 1], &code_order[pos], (code_count - pos) * sizeof(int));
+    code_order[pos] = slot;
+    code_count++;
+    return 0;
+}
+
+static void code_delete(int slot) {
+    int pos = code_lower_bound(courses[slot].course_code, slot);
+    if (pos < code_count && code_order[pos] == slot) {
+        memmove(&code_order[pos], &code_order[pos + 1], (code_count - pos - 1) * sizeof(int));
+        code_count--;
+    }
+}
+
+// ==================== Inverted Index ====================
+
+static WordPostings *word_find(const char *word) {
+    for (WordPostings *postings = words[word_bucket(word)]; postings; postings = postings->next) {
+        if (strcmp(postings->word, word) == 0) {
+            return postings;
+        }
+    }
+    return NULL;
+}
+
+static int word_insert(const char *word, int slot) {
+    WordPostings *postings = word_find(word);
+    if (!postings) {
+        postings = calloc(1, sizeof(WordPostings));
+        if (!postings) {
+            return -1;
+        }
+        snprintf(postings->word, sizeof(postings->word), "%s", word);
+        unsigned bucket = word_bucket(word);
+        postings->next = words[bucket];
+        words[bucket] = postings;
+    }
+
+    for (int i = 0; i < postings->count; i++) {
+        if (postings->slots[i] == slot) {
+            return 0;
+        }
+    }
+    if (postings->count == postings->capacity) {
+        int capacity = postings->capacity ? postings->capacity * 2 : 4;
+        int *grown = realloc(postings->slots, capacity * sizeof(int));
+        if (!grown) {
+            return -1;
+        }
+        postings->slots = grown;
+        postings->capacity = capacity;
+    }
+    postings->slots[postings->count++] = slot;
+    return 0;
+}
+
+static void word_delete(const char *word, int slot) {
+    WordPostings *postings = word_find(word);
+    if (!postings) {
+        return;
+    }
+    for (int i = 0; i < postings->count; i++) {
+        if (postings->slots[i] == slot) {
+            postings->slots[i] = postings->slots[--postings->count];
+            return;
+        }
+    }
+}
+
+// ==================== Index Maintenance ====================
+// Callers hold index_lock for writing
+
+static void index_clear(void) {
+    for (int b = 0; b < WORD_BUCKETS; b++) {
+        WordPostings *postings = words[b];
+        while (postings) {
+            WordPostings *next = postings->next;
+            free(postings->slots);
+            free(postings);
+            postings = next;
+        }
+        words[b] = NULL;
+    }
+    free(prefix_keys);
+    free(code_order);
+    free(courses);
+    free(slot_used);
+    prefix_keys = NULL;
+    code_order = NULL;
+    courses = NULL;
+    slot_used = NULL;
+    prefix_count = prefix_capacity = 0;
+    code_count = code_capacity = 0;
+    slot_count = slot_capacity = 0;
+    index_valid = 0;
+}
+
+// Add or remove every key of the course in slot
+static int index_keys(int slot, int insert) {
+    const Course *course = &courses[slot];
+    char key[MAX_NAME_LEN];
+    const char *cursor;
+    int result = 0;
+
+    lower_copy(key, course->course_code, sizeof(key));
+    if (insert) {
+        result |= prefix_insert(key, slot);
+        result |= word_insert(key, slot);
+    } else {
+        prefix_delete(key, slot);
+        word_delete(key, slot);
+    }
+
+    lower_copy(key, course->name, sizeof(key));
+    if (insert) {
+        result |= prefix_insert(key, slot);
+    } else {
+        prefix_delete(key, slot);
+    }
+
+    cursor = course->name;
+    while (next_word(&cursor, key, sizeof(key))) {
+        if (insert) {
+            result |= prefix_insert(key, slot);
+            result |= word_insert(key, slot);
+        } else {
+            prefix_delete(key, slot);
+            word_delete(key, slot);
+        }
+    }
+    return result;
+}
+
+static int index_insert(const Course *course) {
+    int slot = 0;
+    while (slot < slot_count && slot_used[slot]) {
+        slot++;
+    }
+
+    if (slot == slot_capacity) {
+        int capacity = slot_capacity ? slot_capacity * 2 : 64;
+        Course *grown_courses = realloc(courses, capacity * sizeof(Course));
+        if (!grown_courses) {
+            return -1;
+        }
+        courses = grown_courses;
+        unsigned char *grown_used = realloc(slot_used, capacity);
+        if (!grown_used) {
+            return -1;
+        }
+        slot_used = grown_used;
+        slot_capacity = capacity;
+    }
+    if (slot == slot_count) {
+        slot_count++;
+    }
+
+    courses[slot] = *course;
+    courses[slot].course_code[MAX_COURSE_CODE_LEN - 1] = '\0';
+    courses[slot].name[MAX_NAME_LEN - 1] = '\0';
+    slot_used[slot] = 1;
+    return code_insert(slot) | index_keys(slot, 1);
+}
+
+static void index_delete(int slot) {
+    code_delete(slot);
+    index_keys(slot, 0);
+    slot_used[slot] = 0;
+}
+
+// Slot of the first indexed course with this code, or -1
+static int index_find(const char *course_code) {
+    char key[MAX_NAME_LEN];
+    lower_copy(key, course_code, sizeof(key));
+
+    for (int pos = prefix_lower_bound(key, 0); pos < prefix_count && strcmp(prefix_keys[pos].key, key) == 0; pos++) {
+        if (strcmp(courses[prefix_keys[pos].slot].course_code, course_code) == 0) {
+            return prefix_keys[pos].slot;
+        }
+    }
+    return -1;
+}
+
+// Load every course from the table; caller holds course_file_mutex
+static int index_build(void) {
+    index_clear();
+
+    int fd = open(COURSE_FILE, O_RDONLY);
+    if (fd == -1) {
+        index_valid = 1; // no courses yet
+        return 0;
+    }
+
+    RecordScanner scan;
+    const Course *course;
+    int failed = 0;
+
+    scan_open(&scan, fd, sizeof(Course));
+    while (!failed && (course = scan_next(&scan)) != NULL) {
+        failed = index_insert(course) == -1;
+    }
+    scan_close(&scan);
+    close(fd);
+
+    if (failed) {
+        index_clear();
+        return -1;
+    }
+    index_valid = 1;
+    return 0;
+}
+
+void course_index_add(const Course *course) {
+    pthread_rwlock_wrlock(&index_lock);
+    // An index that has not been built yet will load the course from the file
+    if (index_valid && index_insert(course) == -1) {
+        index_clear();
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void course_index_remove(const char *course_code) {
+    pthread_rwlock_wrlock(&index_lock);
+    if (index_valid) {
+        int slot;
+        while ((slot = index_find(course_code)) != -1) {
+            index_delete(slot);
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void course_index_update(const Course *course) {
+    pthread_rwlock_wrlock(&index_lock);
+    if (index_valid) {
+        int slot = index_find(course->course_code);
+        if (slot != -1 && strcmp(courses[slot].name, course->name) == 0) {
+            courses[slot] = *course; // keys unchanged, e.g. a seat count update
+        } else {
+            if (slot != -1) {
+                index_delete(slot);
+            }
+            if (index_insert(course) == -1) {
+                index_clear();
+            }
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void course_index_invalidate(void) {
+    pthread_rwlock_wrlock(&index_lock);
+    index_clear();
+    pthread_rwlock_unlock(&index_lock);
+}
+
+// ==================== Search ====================
+
+static int compare_course_code(const void *a, const void *b) {
+    return strcmp(((const Course *)a)->course_code, ((const Course *)b)->course_code);
+}
+
+// Take index_lock for reading, building the index first if needed;
+// returns -1 without the lock when the build failed
+static int index_read_lock(void) {
+    pthread_rwlock_rdlock(&index_lock);
+    while (!index_valid) {
+        // Build under the course mutex so no writer changes the file meanwhile
+        pthread_rwlock_unlock(&index_lock);
+        pthread_mutex_lock(&course_file_mutex); // Lock the course file mutex
+        pthread_rwlock_wrlock(&index_lock);
+        int failed = !index_valid && index_build() == -1;
+        pthread_rwlock_unlock(&index_lock);
+        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+        if (failed) {
+            return -1;
+        }
+        pthread_rwlock_rdlock(&index_lock);
+    }
+    return 0;
+}
+
+int course_index_search(const CourseQuery *query, Arena *arena, Course **results) {
+    if (index_read_lock() == -1) {
+        return -1;
+    }
+
+    // stage[slot] counts the conditions a course has passed so far, so each
+    // condition only advances courses that passed all earlier ones
+    int *stage = arena_alloc(arena, (slot_count ? slot_count : 1) * sizeof(int));
+    Course *matches = arena_alloc(arena, (slot_count ? slot_count : 1) * sizeof(Course));
+    if (!stage || !matches) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    memset(stage, 0, slot_count * sizeof(int));
+
+    int required = 0;
+    char key[MAX_NAME_LEN];
+
+    lower_copy(key, query->prefix, sizeof(key));
+    if (key[0]) {
+        size_t len = strlen(key);
+        for (int pos = prefix_lower_bound(key, 0); pos < prefix_count && strncmp(prefix_keys[pos].key, key, len) == 0; pos++) {
+            stage[prefix_keys[pos].slot] = 1;
+        }
+        required++;
+    }
+
+    const char *cursor = query->keywords;
+    while (next_word(&cursor, key, sizeof(key))) {
+        WordPostings *postings = word_find(key);
+        for (int i = 0; postings && i < postings->count; i++) {
+            if (stage[postings->slots[i]] == required) {
+                stage[postings->slots[i]] = required + 1;
+            }
+        }
+        required++;
+    }
+
+    int count = 0;
+    for (int slot = 0; slot < slot_count; slot++) {
+        const Course *course = &courses[slot];
+        if (slot_used[slot] && stage[slot] == required &&
+            (query->credits == 0 || course->credits == query->credits) &&
+            course->available_seats >= query->min_free_seats) {
+            matches[count++] = *course;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    qsort(matches, count, sizeof(Course), compare_course_code);
+    *results = matches;
+    return count;
+}
+
+int course_index_page(const char *after, int min_free_seats, int limit, Arena *arena, Course **results) {
+    Course *matches = arena_alloc(arena, (limit > 0 ? limit : 1) * sizeof(Course));
+    if (!matches || index_read_lock() == -1) {
+        return -1;
+    }
+
+    int count = 0;
+    for (int pos = after[0] ? code_upper_bound(after) : 0; pos < code_count && count < limit; pos++) {
+        const Course *course = &courses[code_order[pos]];
+        if (course->available_seats >= min_free_seats) {
+            matches[count++] = *course;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    *results = matches;
+    return count;
+}
@@ -0,0 +1,400 @@
+#include "../includes/utils.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <dirent.h>
+
+// Synthetic data set generator. Writes students.dat, faculty.dat,
+// courses.dat and student_courses.dat into an empty data directory, for
+// benchmarks and stress runs that need reproducible inputs of any size.
+// Course popularity follows a Zipf distribution: the course of rank r is
+// picked with weight 1 / r^s, so with --zipf 1 the first course draws about
+// as many students as the next three put together. The same seed and
+// options always produce the same files.
+//
+// Enrollments are drawn student by student. A course that is full or
+// already taken by the student is drawn again, so with --seats the popular
+// courses fill up the way they do in a real registration. Without it every
+// course gets the seats it needed plus GEN_SPARE_SEATS_PERCENT. Either
+// way available_seats is max_seats minus the active enrollments written.
+// Every file goes out through one large buffer; the server builds
+// aggregates.dat, the indexes and the enrollment partitions at startup.
+
+#define GEN_WRITE_BUFFER (4 * 1024 * 1024)
+#define GEN_DRAW_ATTEMPTS 32            // draws per course slot before a student settles for fewer
+#define GEN_SPARE_SEATS_PERCENT 20
+#define GEN_STUDENT_PREFIX "GS"         // GS00000001...
+#define GEN_FACULTY_PREFIX "GF"         // GF00001...
+#define GEN_COURSE_PREFIX "GC"          // GC000001..., most popular first
+#define GEN_PASSWORD "pass"
+
+typedef struct {
+    const char *data_dir;
+    long students;
+    int faculty;
+    int courses;
+    int per_student;                    // mean courses per student
+    double zipf;
+    int seats;                          // 0: sized to the enrollments
+    int drop_percent;
+    uint64_t seed;
+} GenConfig;
+
+static GenConfig config = {"data", 100000, 100, 1000, 4, 1.0, 0, 10, 1};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ==================== Random Numbers ====================
+// xorshift64*: fast, and the same sequence on every platform for a seed
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void rng_seed(uint64_t seed) {
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1; // never zero
+    for (int i = 0; i < 8; i++) {
+        rng_next();
+    }
+}
+
+static double rng_unit(void) {
+    return (rng_next() >> 11) * 0x1.0p-53; // [0, 1)
+}
+
+static int rng_below(int n) {
+    return (int)(rng_unit() * n);
+}
+
+// ==================== Zipf Sampling ====================
+// Cumulative weights of the course ranks; a draw is a binary search for a
+// uniform value in them
+
+static double *zipf_cdf;
+
+static int zipf_init(int n, double s) {
+    zipf_cdf = malloc(n * sizeof(double));
+    if (!zipf_cdf) {
+        return -1;
+    }
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += 1.0 / pow(i + 1, s);
+        zipf_cdf[i] = total;
+    }
+    for (int i = 0; i < n; i++) {
+        zipf_cdf[i] /= total;
+    }
+    return 0;
+}
+
+static int zipf_draw(int n) {
+    double u = rng_unit();
+    int low = 0, high = n - 1;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (zipf_cdf[mid] <= u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// ==================== Buffered Output ====================
+
+typedef struct {
+    char path[512];
+    int fd;
+    char *buffer;
+    size_t len;
+} Output;
+
+static int output_open(Output *out, const char *file) {
+    snprintf(out->path, sizeof(out->path), "%s%s", config.data_dir, file + strlen("data"));
+    out->len = 0;
+    out->buffer = malloc(GEN_WRITE_BUFFER);
+    out->fd = open(out->path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (!out->buffer || out->fd == -1) {
+        perror(out->path);
+        free(out->buffer);
+        return -1;
+    }
+    return 0;
+}
+
+static int output_flush(Output *out) {
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t n = write(out->fd, out->buffer + done, out->len - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror(out->path);
+            return -1;
+        }
+        done += n;
+    }
+    out->len = 0;
+    return 0;
+}
+
+static int output_record(Output *out, const void *record, size_t size) {
+    if (out->len + size > GEN_WRITE_BUFFER && output_flush(out) == -1) {
+        return -1;
+    }
+    memcpy(out->buffer + out->len, record, size);
+    out->len += size;
+    return 0;
+}
+
+static int output_close(Output *out) {
+    int failed = output_flush(out) == -1;
+    failed |= close(out->fd) == -1;
+    free(out->buffer);
+    return failed ? -1 : 0;
+}
+
+// ==================== Data Directory ====================
+
+// Create the directory and its parents, then insist that it is empty:
+// derived files left from other data would not match the new tables
+static int prepare_data_dir(void) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s", config.data_dir);
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+        *slash = '/';
+    }
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        return -1;
+    }
+    struct dirent *entry;
+    int empty = 1;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            empty = 0;
+        }
+    }
+    closedir(dir);
+    if (!empty) {
+        fprintf(stderr, "%s is not empty; choose a new data directory\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// ==================== Tables ====================
+
+static int write_faculty(void) {
+    Output out;
+    if (output_open(&out, FACULTY_FILE) == -1) {
+        return -1;
+    }
+    int failed = 0;
+    for (int i = 0; i < config.faculty && !failed; i++) {
+        Faculty faculty;
+        memset(&faculty, 0, sizeof(faculty));
+        snprintf(faculty.faculty_id, sizeof(faculty.faculty_id), GEN_FACULTY_PREFIX "%05d", (i + 1) % 100000);
+        snprintf(faculty.name, sizeof(faculty.name), "Faculty %d", i + 1);
+        snprintf(faculty.password, sizeof(faculty.password), GEN_PASSWORD);
+        failed = output_record(&out, &faculty, sizeof(faculty)) == -1;
+    }
+    failed |= output_close(&out) == -1;
+    return failed ? -1 : 0;
+}
+
+// Students and their enrollments, drawn together so that each student's
+// picks can be checked against each other and against the seats left
+static int write_students(int *active, int *dropped, long long *enrollments) {
+    Output students, records;
+    if (output_open(&students, STUDENT_FILE) == -1) {
+        return -1;
+    }
+    if (output_open(&records, STUDENT_COURSE_FILE) == -1) {
+        output_close(&students);
+        return -1;
+    }
+
+    int failed = 0;
+    int open_courses = config.courses;  // courses with a free seat
+    for (long s = 0; s < config.students && !failed; s++) {
+        Student student;
+        memset(&student, 0, sizeof(student));
+        snprintf(student.student_id, sizeof(student.student_id), GEN_STUDENT_PREFIX "%08ld", (s + 1) % 100000000);
+        snprintf(student.name, sizeof(student.name), "Student %ld", s + 1);
+        snprintf(student.password, sizeof(student.password), GEN_PASSWORD);
+        student.is_active = 1;
+        failed = output_record(&students, &student, sizeof(student)) == -1;
+
+        // 0 to 2 * per_student courses, per_student on average
+        int wanted = rng_below(2 * config.per_student + 1);
+        if (wanted > MAX_COURSES) {
+            wanted = MAX_COURSES;
+        }
+        int picked[2 * MAX_COURSES];
+        int picks = 0, held = 0;
+        for (int attempt = 0; held < wanted && attempt < wanted * GEN_DRAW_ATTEMPTS && open_courses > 0; attempt++) {
+            int c = zipf_draw(config.courses);
+            int taken = config.seats && active[c] >= config.seats;
+            for (int p = 0; p < picks && !taken; p++) {
+                taken = picked[p] == c;
+            }
+            if (taken || picks == (int)(sizeof(picked) / sizeof(picked[0]))) {
+                continue;
+            }
+            picked[picks++] = c;
+
+            StudentCourse sc;
+            memset(&sc, 0, sizeof(sc));
+            snprintf(sc.student_id, sizeof(sc.student_id), "%s", student.student_id);
+            snprintf(sc.course_code, sizeof(sc.course_code), GEN_COURSE_PREFIX "%06d", (c + 1) % 1000000);
+            // A drop keeps its record and gives the seat back
+            sc.is_enrolled = rng_below(100) >= config.drop_percent;
+            if (sc.is_enrolled) {
+                held++;
+                if (++active[c] == config.seats) {
+                    open_courses--;
+                }
+            } else {
+                dropped[c]++;
+            }
+            (*enrollments)++;
+            failed |= output_record(&records, &sc, sizeof(sc)) == -1;
+        }
+    }
+    failed |= output_close(&records) == -1;
+    failed |= output_close(&students) == -1;
+    return failed ? -1 : 0;
+}
+
+static int write_courses(const int *active, int *full) {
+    Output out;
+    if (output_open(&out, COURSE_FILE) == -1) {
+        return -1;
+    }
+    int failed = 0;
+    *full = 0;
+    for (int c = 0; c < config.courses && !failed; c++) {
+        Course course;
+        memset(&course, 0, sizeof(course));
+        snprintf(course.course_code, sizeof(course.course_code), GEN_COURSE_PREFIX "%06d", (c + 1) % 1000000);
+        snprintf(course.name, sizeof(course.name), "Course %d", c + 1);
+        snprintf(course.faculty_id, sizeof(course.faculty_id), GEN_FACULTY_PREFIX "%05d", (c % config.faculty + 1) % 100000);
+        course.credits = 1 + rng_below(4);
+        course.max_seats = config.seats ? config.seats
+                                        : active[c] + active[c] * GEN_SPARE_SEATS_PERCENT / 100 + 1;
+        course.available_seats = course.max_seats - active[c];
+        *full += course.available_seats == 0;
+        failed = output_record(&out, &course, sizeof(course)) == -1;
+    }
+    failed |= output_close(&out) == -1;
+    return failed ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--data DIR] [--students N] [--faculty N] [--courses N]\n"
+            "          [--per-student N] [--zipf S] [--seats N] [--drop-percent P] [--seed N]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--data") == 0 && has_value) {
+            config.data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--students") == 0 && has_value) {
+            config.students = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--faculty") == 0 && has_value) {
+            config.faculty = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--courses") == 0 && has_value) {
+            config.courses = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--per-student") == 0 && has_value) {
+            config.per_student = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--zipf") == 0 && has_value) {
+            config.zipf = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seats") == 0 && has_value) {
+            config.seats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--drop-percent") == 0 && has_value) {
+            config.drop_percent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            config.seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    // The ID formats hold 8, 5 and 6 digits; the formatting wraps beyond them
+    if (config.students < 0 || config.students > 99999999 || config.faculty < 1 || config.faculty > 99999 ||
+        config.courses < 1 || config.courses > 999999 || config.per_student < 0 ||
+        config.per_student > MAX_COURSES / 2 || config.zipf < 0 || config.seats < 0 ||
+        config.drop_percent < 0 || config.drop_percent > 100) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    double started = now_seconds();
+    int *active = calloc(config.courses, sizeof(int));
+    int *dropped = calloc(config.courses, sizeof(int));
+    if (!active || !dropped || zipf_init(config.courses, config.zipf) == -1) {
+        perror("datagen");
+        return EXIT_FAILURE;
+    }
+    rng_seed(config.seed);
+
+    long long enrollments = 0;
+    int full = 0;
+    if (prepare_data_dir() == -1 || write_faculty() == -1 ||
+        write_students(active, dropped, &enrollments) == -1 || write_courses(active, &full) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    long long active_total = 0, dropped_total = 0;
+    int busiest = 0;
+    for (int c = 0; c < config.courses; c++) {
+        active_total += active[c];
+        dropped_total += dropped[c];
+        busiest = active[c] > busiest ? active[c] : busiest;
+    }
+    double elapsed = now_seconds() - started;
+    double megabytes = (config.students * sizeof(Student) + config.faculty * sizeof(Faculty) +
+                        config.courses * sizeof(Course) + enrollments * sizeof(StudentCourse)) / 1e6;
+
+    printf("Students: %ld, faculty: %d, courses: %d (%d full)\n",
+           config.students, config.faculty, config.courses, full);
+    printf("Enrollments: %lld (%lld active, %lld dropped); busiest course: %d active\n",
+           enrollments, active_total, dropped_total, busiest);
+    printf("Wrote %.1f MB to %s in %.2f s (%.0f MB/s)\n",
+           megabytes, config.data_dir, elapsed, elapsed > 0 ? megabytes / elapsed : 0);
+
+    free(zipf_cdf);
+    free(active);
+    free(dropped);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+#include "export.h"
+#include "file_operations.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <stddef.h>
+
+// Room left in the chunk before a row is encoded; a row's text fields,
+// escaped, stay well below this
+#define EXPORT_ROW_MAX 2048
+
+extern int send_message(int socket, const char *message);
+
+typedef struct {
+    const char *name;
+    size_t offset;
+    size_t size;        // field size of a text column; 0 for an int column
+} ExportColumn;
+
+typedef struct {
+    const char *name;
+    const ExportColumn *columns;
+    int column_count;
+} ExportView;
+
+// A row of the roster view
+typedef struct {
+    char student_id[MAX_ID_LEN];
+    char student_name[MAX_NAME_LEN];
+    char course_code[MAX_COURSE_CODE_LEN];
+    char course_name[MAX_NAME_LEN];
+    char faculty_id[MAX_ID_LEN];
+} RosterRow;
+
+static const ExportColumn student_columns[] = {
+    {"student_id", offsetof(Student, student_id), MAX_ID_LEN},
+    {"name", offsetof(Student, name), MAX_NAME_LEN},
+    {"is_active", offsetof(Student, is_active), 0}
+};
+
+static const ExportColumn faculty_columns[] = {
+    {"faculty_id", offsetof(Faculty, faculty_id), MAX_ID_LEN},
+    {"name", offsetof(Faculty, name), MAX_NAME_LEN}
+};
+
+static const ExportColumn course_columns[] = {
+    {"course_code", offsetof(Course, course_code), MAX_COURSE_CODE_LEN},
+    {"name", offsetof(Course, name), MAX_NAME_LEN},
+    {"faculty_id", offsetof(Course, faculty_id), MAX_ID_LEN},
+    {"credits", offsetof(Course, credits), 0},
+    {"max_seats", offsetof(Course, max_seats), 0},
+    {"available_seats", offsetof(Course, available_seats), 0}
+};
+
+static const ExportColumn enrollment_columns[] = {
+    {"student_id", offsetof(StudentCourse, student_id), MAX_ID_LEN},
+    {"course_code", offsetof(StudentCourse, course_code), MAX_COURSE_CODE_LEN}
+};
+
+static const ExportColumn roster_columns[] = {
+    {"student_id", offsetof(RosterRow, student_id), MAX_ID_LEN},
+    {"student_name", offsetof(RosterRow, student_name), MAX_NAME_LEN},
+    {"course_code", offsetof(RosterRow, course_code), MAX_COURSE_CODE_LEN},
+    {"course_name", offsetof(RosterRow, course_name), MAX_NAME_LEN},
+    {"faculty_id", offsetof(RosterRow, faculty_id), MAX_ID_LEN}
+};
+
+#define VIEW(name, columns) {name, columns, sizeof(columns) / sizeof(columns[0])}
+
+// Indexed by EXPORT_STUDENTS...
+static const ExportView views[] = {
+    VIEW("students", student_columns),
+    VIEW("faculty", faculty_columns),
+    VIEW("courses", course_columns),
+    VIEW("enrollments", enrollment_columns),
+    VIEW("roster", roster_columns)
+};
+
+static const char *formats[] = {"csv", "json"};
+
+int export_view_parse(const char *name) {
+    for (size_t i = 0; i < sizeof(views) / sizeof(views[0]); i++) {
+        if (strcmp(views[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int export_format_parse(const char *name) {
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(formats[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// ==================== Encoding ====================
+
+typedef struct {
+    int socket;
+    int format;
+    const ExportView *view;
+    char *chunk;                // EXPORT_CHUNK_SIZE bytes and a terminator
+    size_t len;
+    long long rows;
+    int closed;                 // the client is gone; the scan stops
+} ExportStream;
+
+static void stream_flush(ExportStream *stream) {
+    if (stream->len == 0) {
+        return;
+    }
+    stream->chunk[stream->len] = '\0';
+    if (send_message(stream->socket, stream->chunk) == -1) { // blocks while the client is behind
+        stream->closed = 1;
+    }
+    stream->len = 0;
+}
+
+static void put(ExportStream *stream, const char *text) {
+    size_t len = strlen(text);
+    memcpy(stream->chunk + stream->len, text, len);
+    stream->len += len;
+}
+
+static void put_char(ExportStream *stream, char c) {
+    stream->chunk[stream->len++] = c;
+}
+
+// CSV fields are quoted only when they contain a separator, quote or line break
+static void put_csv_text(ExportStream *stream, const char *text, size_t len) {
+    int quoted = 0;
+    for (size_t i = 0; i < len && !quoted; i++) {
+        quoted = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+    }
+    if (!quoted) {
+        memcpy(stream->chunk + stream->len, text, len);
+        stream->len += len;
+        return;
+    }
+
+    put_char(stream, '"');
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '"') {
+            put_char(stream, '"');
+        }
+        put_char(stream, text[i]);
+    }
+    put_char(stream, '"');
+}
+
+static void put_json_text(ExportStream *stream, const char *text, size_t len) {
+    put_char(stream, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            put_char(stream, '\\');
+            put_char(stream, c);
+        } else if (c < 0x20) {
+            stream->len += sprintf(stream->chunk + stream->len, "\\u%04x", c);
+        } else {
+            put_char(stream, c);
+        }
+    }
+    put_char(stream, '"');
+}
+
+static void stream_begin(ExportStream *stream) {
+    if (stream->format == EXPORT_JSON) {
+        put(stream, "[\n");
+        return;
+    }
+    for (int c = 0; c < stream->view->column_count; c++) {
+        if (c > 0) {
+            put_char(stream, ',');
+        }
+        put(stream, stream->view->columns[c].name);
+    }
+    put_char(stream, '\n');
+}
+
+static int stream_row(ExportStream *stream, const char *record) {
+    if (EXPORT_CHUNK_SIZE - stream->len < EXPORT_ROW_MAX) {
+        stream_flush(stream);
+        if (stream->closed) {
+            return -1;
+        }
+    }
+
+    if (stream->format == EXPORT_JSON) {
+        put(stream, stream->rows > 0 ? ",\n{" : "{");
+    }
+    for (int c = 0; c < stream->view->column_count; c++) {
+        const ExportColumn *column = &stream->view->columns[c];
+        const char *field = record + column->offset;
+
+        if (stream->format == EXPORT_JSON) {
+            put(stream, c > 0 ? ",\"" : "\"");
+            put(stream, column->name);
+            put(stream, "\":");
+        } else if (c > 0) {
+            put_char(stream, ',');
+        }
+
+        if (column->size == 0) {
+            int value;
+            memcpy(&value, field, sizeof(value));
+            stream->len += sprintf(stream->chunk + stream->len, "%d", value);
+        } else if (stream->format == EXPORT_JSON) {
+            put_json_text(stream, field, strnlen(field, column->size));
+        } else {
+            put_csv_text(stream, field, strnlen(field, column->size));
+        }
+    }
+    put(stream, stream->format == EXPORT_JSON ? "}" : "\n");
+    stream->rows++;
+    return 0;
+}
+
+static void stream_end(ExportStream *stream) {
+    if (stream->format == EXPORT_JSON) {
+        put(stream, stream->rows > 0 ? "\n]\n" : "]\n");
+    }
+    stream_flush(stream);
+}
+
+// ==================== Snapshot Scans ====================
+
+// Visit every record of the table as of the snapshot, reading whole
+// records EXPORT_READ_SIZE bytes at a time into buffer; a visitor
+// returns -1 to stop the scan
+static int scan_snapshot(Snapshot *snapshot, int table, size_t record_size, char *buffer,
+                         int (*visit)(const void *record, void *arg), void *arg) {
+    off_t size = snapshot_table_size(snapshot, table);
+    size_t batch = EXPORT_READ_SIZE / record_size * record_size;
+
+    for (off_t offset = 0; offset + (off_t)record_size <= size; offset += batch) {
+        size_t want = (size_t)(size - offset) < batch ? (size - offset) / record_size * record_size : batch;
+        if (snapshot_read(snapshot, table, offset, buffer, want) != (ssize_t)want) {
+            return -1;
+        }
+        for (size_t i = 0; i < want; i += record_size) {
+            if (visit(buffer + i, arg) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int visit_row(const void *record, void *arg) {
+    return stream_row(arg, record);
+}
+
+static int visit_enrollment(const void *record, void *arg) {
+    const StudentCourse *sc = record;
+    return sc->is_enrolled ? stream_row(arg, record) : 0;
+}
+
+// Every active enrollment, partition by partition
+static int scan_enrollments(Snapshot *snapshot, char *buffer, int (*visit)(const void *record, void *arg), void *arg) {
+    for (int p = 0; p < enroll_partition_count(); p++) {
+        if (scan_snapshot(snapshot, TABLE_STUDENT_COURSE + p, sizeof(StudentCourse), buffer, visit, arg) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// ==================== Roster Join ====================
+
+// Names looked up by ID; sorted by key for bsearch
+typedef struct {
+    char key[MAX_ID_LEN];
+    char name[MAX_NAME_LEN];
+    char owner[MAX_ID_LEN];     // the course's faculty
+} JoinName;
+
+typedef struct {
+    JoinName *names;
+    size_t count;
+} JoinTable;
+
+typedef struct {
+    ExportStream *stream;
+    JoinTable students;
+    JoinTable courses;
+} RosterJoin;
+
+static int compare_join_names(const void *a, const void *b) {
+    return strcmp(((const JoinName *)a)->key, ((const JoinName *)b)->key);
+}
+
+static int collect_student(const void *record, void *arg) {
+    const Student *student = record;
+    JoinTable *table = arg;
+    JoinName *entry = &table->names[table->count++];
+    snprintf(entry->key, sizeof(entry->key), "%.*s", MAX_ID_LEN - 1, student->student_id);
+    snprintf(entry->name, sizeof(entry->name), "%.*s", MAX_NAME_LEN - 1, student->name);
+    entry->owner[0] = '\0';
+    return 0;
+}
+
+static int collect_course(const void *record, void *arg) {
+    const Course *course = record;
+    JoinTable *table = arg;
+    JoinName *entry = &table->names[table->count++];
+    snprintf(entry->key, sizeof(entry->key), "%.*s", MAX_COURSE_CODE_LEN - 1, course->course_code);
+    snprintf(entry->name, sizeof(entry->name), "%.*s", MAX_NAME_LEN - 1, course->name);
+    snprintf(entry->owner, sizeof(entry->owner), "%.*s", MAX_ID_LEN - 1, course->faculty_id);
+    return 0;
+}
+
+static int load_join_table(Snapshot *snapshot, int table, size_t record_size, Arena *arena, char *buffer,
+                           int (*collect)(const void *record, void *arg), JoinTable *join) {
+    size_t records = snapshot_table_size(snapshot, table) / record_size;
+    join->names = arena_alloc(arena, (records ? records : 1) * sizeof(JoinName));
+    join->count = 0;
+    if (!join->names || scan_snapshot(snapshot, table, record_size, buffer, collect, join) == -1) {
+        return -1;
+    }
+    qsort(join->names, join->count, sizeof(JoinName), compare_join_names);
+    return 0;
+}
+
+static const JoinName *join_find(const JoinTable *join, const char *key) {
+    JoinName probe;
+    snprintf(probe.key, sizeof(probe.key), "%s", key);
+    return bsearch(&probe, join->names, join->count, sizeof(JoinName), compare_join_names);
+}
+
+static int visit_roster(const void *record, void *arg) {
+    const StudentCourse *sc = record;
+    RosterJoin *join = arg;
+    if (!sc->is_enrolled) {
+        return 0;
+    }
+
+    RosterRow row;
+    memset(&row, 0, sizeof(row));
+    snprintf(row.student_id, sizeof(row.student_id), "%.*s", MAX_ID_LEN - 1, sc->student_id);
+    snprintf(row.course_code, sizeof(row.course_code), "%.*s", MAX_COURSE_CODE_LEN - 1, sc->course_code);
+
+    const JoinName *student = join_find(&join->students, row.student_id);
+    if (student) {
+        memcpy(row.student_name, student->name, sizeof(row.student_name));
+    }
+    const JoinName *course = join_find(&join->courses, row.course_code);
+    if (course) {
+        memcpy(row.course_name, course->name, sizeof(row.course_name));
+        memcpy(row.faculty_id, course->owner, sizeof(row.faculty_id));
+    }
+    return stream_row(join->stream, (const char *)&row);
+}
+
+static int export_roster(Snapshot *snapshot, Arena *arena, char *buffer, ExportStream *stream) {
+    RosterJoin join = {stream, {NULL, 0}, {NULL, 0}};
+    if (load_join_table(snapshot, TABLE_STUDENT, sizeof(Student), arena, buffer, collect_student, &join.students) == -1 ||
+        load_join_table(snapshot, TABLE_COURSE, sizeof(Course), arena, buffer, collect_course, &join.courses) == -1) {
+        return -1;
+    }
+    return scan_enrollments(snapshot, buffer, visit_roster, &join);
+}
+
+// ==================== Export ====================
+
+long long export_view(int client_socket, Arena *arena, int view, int format) {
+    TRACE_FUNCTION("file");
+    ExportStream stream = {client_socket, format, &views[view], NULL, 0, 0, 0};
+    stream.chunk = arena_alloc(arena, EXPORT_CHUNK_SIZE + 1);
+    char *buffer = arena_alloc(arena, EXPORT_READ_SIZE);
+    if (!stream.chunk || !buffer) {
+        return -1;
+    }
+
+    // Writers copy pages aside for the snapshot, so the scans below read
+    // one point in time without holding any table lock
+    Snapshot *snapshot = snapshot_create();
+    if (!snapshot) {
+        return -1;
+    }
+
+    int result;
+    stream_begin(&stream);
+    switch (view) {
+        case EXPORT_STUDENTS:
+            result = scan_snapshot(snapshot, TABLE_STUDENT, sizeof(Student), buffer, visit_row, &stream);
+            break;
+        case EXPORT_FACULTY:
+            result = scan_snapshot(snapshot, TABLE_FACULTY, sizeof(Faculty), buffer, visit_row, &stream);
+            break;
+        case EXPORT_COURSES:
+            result = scan_snapshot(snapshot, TABLE_COURSE, sizeof(Course), buffer, visit_row, &stream);
+            break;
+        case EXPORT_ENROLLMENTS:
+            result = scan_enrollments(snapshot, buffer, visit_enrollment, &stream);
+            break;
+        default:
+            result = export_roster(snapshot, arena, buffer, &stream);
+            break;
+    }
+    snapshot_release(snapshot);
+    if (result == 0) {
+        stream_end(&stream);
+    } else {
+        // The array is left open, so a JSON reader sees the failure too; the
+        // status line that follows still starts on a line of its own
+        if (format == EXPORT_JSON) {
+            put_char(&stream, '\n');
+        }
+        stream_flush(&stream);
+    }
+
+    return result == 0 ? stream.rows : -1;
+}
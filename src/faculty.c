@@ -1,12 +1,21 @@
 #include "utils.h"
 #include "file_operations.h"
 #include "handler.h"
+#include "aggregates.h"
+#include "storage.h"
+#include "trace.h"
+#include "stats.h"
 
-extern void send_message(int socket, const char *message);
-extern void receive_message(int socket, char *buffer, int size);
+#include <stddef.h>
+#include <sys/stat.h>
 
-void view_faculty_courses_helper(int client_socket, const char *faculty_id) {
-    pthread_mutex_lock(&course_file_mutex); // Lock the course file mutex
+extern int send_message(int socket, const char *message);
+extern int receive_message(int socket, char *buffer, int size);
+
+void view_faculty_courses_helper(int client_socket, const char *faculty_id, Arena *arena) {
+    TRACE_FUNCTION("helper");
+    // Copy the faculty's courses under the lock and send them after unlocking
+    trace_mutex_lock(&course_file_mutex); // Lock the course file mutex
 
     int fd = open(COURSE_FILE, O_RDONLY);
     if (fd == -1) {
@@ -15,56 +24,95 @@ void view_faculty_courses_helper(int client_socket, const char *faculty_id) {
         return;
     }
 
-    Course course;
+    struct stat st;
+    size_t capacity = 0;
+    Course *courses = NULL;
+    if (fstat(fd, &st) == 0) {
+        capacity = st.st_size / sizeof(Course);
+        courses = arena_alloc(arena, (capacity ? capacity : 1) * sizeof(Course));
+    }
+    if (!courses) {
+        close(fd);
+        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
+        send_message(client_socket, "Error accessing course records.\n");
+        return;
+    }
+
+    RecordScanner scan;
+    FieldMatch match;
+    const Course *course;
+    size_t count = 0;
+
+    field_match_init(&match, offsetof(Course, faculty_id), MAX_ID_LEN, faculty_id);
+    scan_open(&scan, fd, sizeof(Course));
+    while (count < capacity && (course = scan_next_match(&scan, &match)) != NULL) {
+        courses[count++] = *course;
+    }
+    scan_close(&scan);
+    close(fd);
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+
     char buffer[BUFFER_SIZE];
-    int count = 0;
 
     send_message(client_socket, "\n=== Your Courses ===\n");
-    send_message(client_socket, "Code\tName\tCredits\tAvailable Seats\n");
-
-    while (read(fd, &course, sizeof(Course)) > 0) {
-        if (strcmp(course.faculty_id, faculty_id) == 0) {
-            snprintf(buffer, BUFFER_SIZE, "%s\t%s\t%d\t%d\n",
-                     course.course_code,
-                     course.name,
-                     course.credits,
-                     course.available_seats);
-            send_message(client_socket, buffer); // Send each line immediately
-            count++;
+    send_message(client_socket, "Code\tName\tCredits\tAvailable Seats\tEnrolled\n");
+
+    for (size_t i = 0; i < count; i++) {
+        Aggregate load;
+        if (aggregates_get(AGGREGATE_COURSE, courses[i].course_code, &load) == -1) {
+            load.enrolled = 0;
         }
+        snprintf(buffer, BUFFER_SIZE, "%s\t%s\t%d\t%d\t%d\n",
+                 courses[i].course_code,
+                 courses[i].name,
+                 courses[i].credits,
+                 courses[i].available_seats,
+                 load.enrolled);
+        send_message(client_socket, buffer); // Send each line immediately
     }
 
     if (count == 0) {
         send_message(client_socket, "No courses found.\n");
     }
-
-    close(fd);
-    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
 }
 
 void add_course_helper(int client_socket, const char *faculty_id) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     Course course;
     char buffer[BUFFER_SIZE];
     
     send_message(client_socket, "Enter Course Code: ");
-    receive_message(client_socket, course.course_code, MAX_COURSE_CODE_LEN);
+    if (receive_message(client_socket, course.course_code, MAX_COURSE_CODE_LEN) < 0) {
+        return; // the session ended
+    }
     
-    if (find_course(course.course_code) != NULL) {
+    Course existing;
+    if (find_course(course.course_code, &existing) != 0) {
         send_message(client_socket, "Course code already exists!\n");
         return;
     }
     
     send_message(client_socket, "Enter Course Name: ");
-    receive_message(client_socket, course.name, MAX_NAME_LEN);
+    if (receive_message(client_socket, course.name, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
     
     strcpy(course.faculty_id, faculty_id);
     
     send_message(client_socket, "Enter Credits: ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     course.credits = atoi(buffer);
     
     send_message(client_socket, "Enter Maximum Seats: ");
-    receive_message(client_socket, buffer, BUFFER_SIZE);
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
     course.max_seats = atoi(buffer);
     course.available_seats = course.max_seats;
     
@@ -77,182 +125,145 @@ void add_course_helper(int client_socket, const char *faculty_id) {
 }
 
 void remove_course_helper(int client_socket, const char *faculty_id) {
-    char course_code[MAX_COURSE_CODE_LEN];
-
-    send_message(client_socket, "Enter Course Code to Remove: ");
-    receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN);
-
-    // Verify that the course exists and is owned by the faculty
-    Course *course = find_course(course_code);
-    if (!course || strcmp(course->faculty_id, faculty_id) != 0) {
-        send_message(client_socket, "Course not found or you don't own this course.\n");
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
         return;
     }
 
-    // Lock the course file for thread safety
-    pthread_mutex_lock(&course_file_mutex);
+    char course_code[MAX_COURSE_CODE_LEN];
 
-    int course_fd = open(COURSE_FILE, O_RDWR);
-    if (course_fd == -1) {
-        send_message(client_socket, "Error accessing course records.\n");
-        pthread_mutex_unlock(&course_file_mutex);
-        return;
+    send_message(client_socket, "Enter Course Code to Remove: ");
+    if (receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN) < 0) {
+        return; // the session ended
     }
 
-    int temp_fd = open(TEMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (temp_fd == -1) {
-        send_message(client_socket, "Error creating temporary file.\n");
-        close(course_fd);
-        pthread_mutex_unlock(&course_file_mutex);
+    // Verify that the course exists and is owned by the faculty
+    Course course;
+    if (find_course(course_code, &course) != 1 || strcmp(course.faculty_id, faculty_id) != 0) {
+        send_message(client_socket, "Course not found or you don't own this course.\n");
         return;
     }
 
-    Course temp_course;
-    int course_removed = 0;
-
-    // Copy all courses except the one to be removed to the temporary file
-    while (read(course_fd, &temp_course, sizeof(Course)) > 0) {
-        if (strcmp(temp_course.course_code, course_code) != 0) {
-            write(temp_fd, &temp_course, sizeof(Course));
-        } else {
-            course_removed = 1;
-        }
-    }
-
-    close(course_fd);
-    close(temp_fd);
-
-    // Replace the original file with the temporary file
-    if (course_removed) {
-        rename(TEMP_FILE, COURSE_FILE);
+    // Removes the associated student-course relationships as well
+    if (remove_course(course_code) == 0) {
         send_message(client_socket, "Course removed successfully.\n");
     } else {
-        unlink(TEMP_FILE);
         send_message(client_socket, "Failed to remove course.\n");
     }
+}
 
-    pthread_mutex_unlock(&course_file_mutex);
-
-    // Remove associated student-course relationships
-    pthread_mutex_lock(&student_course_file_mutex);
-
-    int sc_fd = open(STUDENT_COURSE_FILE, O_RDWR);
-    if (sc_fd == -1) {
-        send_message(client_socket, "Error accessing student-course records.\n");
-        pthread_mutex_unlock(&student_course_file_mutex);
-        return;
-    }
-
-    int temp_sc_fd = open(TEMP_SC_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (temp_sc_fd == -1) {
-        send_message(client_socket, "Error creating temporary student-course file.\n");
-        close(sc_fd);
-        pthread_mutex_unlock(&student_course_file_mutex);
-        return;
-    }
-
-    StudentCourse sc_entry;
-
-    // Copy all student-course relationships except those for the removed course
-    while (read(sc_fd, &sc_entry, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc_entry.course_code, course_code) != 0) {
-            write(temp_sc_fd, &sc_entry, sizeof(StudentCourse));
-        }
-    }
-
-    close(sc_fd);
-    close(temp_sc_fd);
-
-    // Replace the original student-course file with the temporary file
-    rename(TEMP_SC_FILE, STUDENT_COURSE_FILE);
+static const char *enrollment_student_key(const void *record) {
+    return ((const StudentCourse *)record)->student_id;
+}
 
-    pthread_mutex_unlock(&student_course_file_mutex);
-    //send_message(client_socket, "Associated student enrollments removed successfully.\n");
+static void format_enrollment_row(const void *record, char *row, size_t size) {
+    snprintf(row, size, "%s\n", ((const StudentCourse *)record)->student_id);
 }
 
-void view_course_enrollments_helper(int client_socket, const char *faculty_id) {
+static const Listing enrollment_listing = {
+    'E', "Enrollments for Course", "Student ID", "No enrollments found.\n",
+    sizeof(StudentCourse), enrollment_student_key, format_enrollment_row
+};
+
+void view_course_enrollments_helper(int client_socket, const char *faculty_id, Arena *arena) {
+    TRACE_FUNCTION("helper");
     char course_code[MAX_COURSE_CODE_LEN];
 
     send_message(client_socket, "Enter Course Code: ");
-    receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN);
+    if (receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN) < 0) {
+        return; // the session ended
+    }
 
     // Verify faculty owns this course
-    Course *course = find_course(course_code);
-    if (!course || strcmp(course->faculty_id, faculty_id) != 0) {
+    Course course;
+    if (find_course(course_code, &course) != 1 || strcmp(course.faculty_id, faculty_id) != 0) {
         send_message(client_socket, "Course not found or you don't own this course.\n");
         return;
     }
 
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the student-course file mutex
-
-    int fd = open(STUDENT_COURSE_FILE, O_RDONLY);
-    if (fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
+    Page page;
+    if (page_begin(&page, arena, &enrollment_listing, course_code) == -1) {
         send_message(client_socket, "Error accessing enrollment records.\n");
         return;
     }
 
-    StudentCourse sc;
-    int count = 0;
-
-    send_message(client_socket, "\n=== Enrollments for Course ===\n");
-    send_message(client_socket, "Student ID\n");
-
-    while (read(fd, &sc, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc.course_code, course_code) == 0 && sc.is_enrolled) {
-            send_message(client_socket, sc.student_id);
-            send_message(client_socket, "\n"); // Send each student ID immediately
-            count++;
+    // Enrollments are spread over partitions; each page is gathered from all in parallel
+    do {
+        if (list_course_enrollments(course_code, &page) == -1) {
+            send_message(client_socket, "Error accessing enrollment records.\n");
+            break;
         }
-    }
+    } while (page_send(client_socket, &page));
+}
 
-    if (count == 0) {
-        send_message(client_socket, "No enrollments found.\n");
+void view_course_load_helper(int client_socket, const char *faculty_id) {
+    TRACE_FUNCTION("helper");
+    Aggregate load;
+    if (aggregates_get(AGGREGATE_FACULTY, faculty_id, &load) == -1) {
+        send_message(client_socket, "Error accessing course load.\n");
+        return;
     }
 
-    close(fd);
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
+    char buffer[BUFFER_SIZE];
+    snprintf(buffer, BUFFER_SIZE,
+             "\n=== Course Load ===\nCourses Offered: %d\nTotal Enrollments: %d\n",
+             load.courses, load.enrolled);
+    send_message(client_socket, buffer);
 }
 
 void change_faculty_password_helper(int client_socket, const char *faculty_id) {
-    pthread_mutex_lock(&faculty_file_mutex); // Lock the faculty file mutex
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
 
-    Faculty *faculty = find_faculty(faculty_id);
-    if (faculty == NULL) {
+    // find_faculty and update_faculty each take faculty_file_mutex
+    // themselves; the update is refused if the record changed in between
+    Faculty faculty;
+    if (find_faculty(faculty_id, &faculty) != 1) {
         send_message(client_socket, "Faculty record not found!\n");
-        pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex before returning
         return;
     }
 
     char new_password[MAX_PASSWORD_LEN];
     send_message(client_socket, "Enter new password: ");
-    receive_message(client_socket, new_password, MAX_PASSWORD_LEN);
+    if (receive_message(client_socket, new_password, MAX_PASSWORD_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Faculty updated = *faculty;
+    Faculty updated = faculty;
     strcpy(updated.password, new_password);
 
-    if (update_faculty(updated) == 0) {
+    int result = update_faculty(&faculty, &updated);
+    if (result == 0) {
         send_message(client_socket, "Password changed successfully!\n");
+    } else if (result == UPDATE_CONFLICT) {
+        stats_add(STAT_UPDATE_CONFLICTS, 1);
+        send_message(client_socket, "Your record was changed meanwhile; the password was not changed. Please retry.\n");
     } else {
         send_message(client_socket, "Failed to change password.\n");
     }
-
-    pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
 }
 
-void faculty_handler(int client_socket, const char *faculty_id) {
-    char buffer[BUFFER_SIZE];
+void faculty_handler(ConnectionContext *conn) {
+    int client_socket = conn->socket;
+    const char *faculty_id = conn->id;
+    Arena *arena = &conn->arena;
+    char *buffer = conn->recv_buffer;
     int choice;
     
     while (1) {
+        arena_reset(arena); // storage of the previous request is released
         
-        receive_message(client_socket, buffer, BUFFER_SIZE);
+        if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+            return; // the client disconnected without logging out
+        }
         choice = atoi(buffer);
         
         switch(choice) {
             case 1:
                 // View courses offered by this faculty
-                view_faculty_courses_helper(client_socket,faculty_id);
+                view_faculty_courses_helper(client_socket, faculty_id, arena);
                 break;
 
             case 2:
@@ -264,7 +275,7 @@ void faculty_handler(int client_socket, const char *faculty_id) {
                 break;
 
             case 4:
-                view_course_enrollments_helper(client_socket,faculty_id);
+                view_course_enrollments_helper(client_socket, faculty_id, arena);
                 break;
             
             case 5: 
@@ -272,11 +283,16 @@ void faculty_handler(int client_socket, const char *faculty_id) {
                 break;
 
             case 6:
+                view_course_load_helper(client_socket, faculty_id);
+                break;
+
+            case 7:
                 send_message(client_socket, "Logging out... Thank You!\n");
                 return;
             default:
                 send_message(client_socket, "Invalid choice. Please try again.\n");
                 break;
         }
+        finish_request(conn);
     }
 }
\ No newline at end of file
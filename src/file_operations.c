@@ -1,10 +1,832 @@
 #include "utils.h"
 #include "file_operations.h"
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "replication.h"
+#include "storage.h"
+#include "course_index.h"
+#include "pagination.h"
+#include "aggregates.h"
+#include "log.h"
+#include "trace.h"
+#include "bloom.h"
+#include "btree.h"
+#include "subscriptions.h"
+#include "catalog.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// ==================== Table Registry ====================
+
+static const char *table_paths[TABLE_STUDENT_COURSE] = {
+    STUDENT_FILE,
+    FACULTY_FILE,
+    COURSE_FILE
+};
+
+static int enroll_partitions = DEFAULT_ENROLL_PARTITIONS;
+static char enroll_paths[MAX_ENROLL_PARTITIONS][64];
+
+static void record_index_invalidate(int table);
+static void id_filter_invalidate(int table);
+static int change_followable(int table, off_t offset, size_t len, off_t old_size, off_t new_size);
+static void change_follow(int table, off_t offset, const char *data, size_t len, const char *before, size_t before_len);
+
+int table_count(void) {
+    return TABLE_STUDENT_COURSE + enroll_partitions + 1;
+}
+
+int table_aggregate(void) {
+    return TABLE_STUDENT_COURSE + enroll_partitions;
+}
+
+const char *table_path(int table) {
+    if (table == table_aggregate()) {
+        return AGGREGATE_FILE;
+    }
+    if (table >= TABLE_STUDENT_COURSE) {
+        return enroll_paths[table - TABLE_STUDENT_COURSE];
+    }
+    return table_paths[table];
+}
+
+pthread_mutex_t *table_mutex(int table) {
+    switch (table) {
+        case TABLE_STUDENT:
+            return &student_file_mutex;
+        case TABLE_FACULTY:
+            return &faculty_file_mutex;
+        case TABLE_COURSE:
+            return &course_file_mutex;
+        default:
+            if (table == table_aggregate()) {
+                return &aggregate_file_mutex;
+            }
+            return &student_course_file_mutex[table - TABLE_STUDENT_COURSE];
+    }
+}
+
+// Tables are always locked in ascending order to avoid deadlocks
+void lock_all_tables(void) {
+    for (int t = 0; t < table_count(); t++) {
+        trace_mutex_lock(table_mutex(t));
+    }
+}
+
+void unlock_all_tables(void) {
+    for (int t = table_count() - 1; t >= 0; t--) {
+        pthread_mutex_unlock(table_mutex(t));
+    }
+}
+
+// ==================== Table Write Helpers ====================
+// Every modification of a table file goes through these helpers so that
+// active snapshots and the change log see it. Callers hold the table mutex.
+
+int table_append(int table, int fd, const void *record, size_t len) {
+    off_t offset = lseek(fd, 0, SEEK_END);
+    if (offset == -1) {
+        return -1;
+    }
+
+    int result = storage_pwrite(fd, record, len, offset);
+    if (result > 0) {
+        uint64_t lsn = changelog_record(table, offset, record, result, offset + result);
+        if (lsn == 0) {
+            // Not logged, so not made: a recovery would not bring it back
+            if (ftruncate(fd, offset) == -1) {
+                log_error("cannot undo an unlogged append to table %d: %s", table, strerror(errno));
+            }
+            return -1;
+        }
+        replication_publish(table, lsn, offset, record, result, offset + result);
+    }
+    return result;
+}
+
+int table_overwrite(int table, int fd, off_t offset, const void *record, size_t len) {
+    // The before-image undoes the write if the change log refuses it
+    char *before = malloc(len ? len : 1);
+    if (!before || storage_pread(fd, before, len, offset) != (ssize_t)len) {
+        free(before);
+        return -1;
+    }
+
+    snapshot_preserve(table, offset, len);
+
+    if (storage_pwrite(fd, record, len, offset) != (ssize_t)len) {
+        free(before);
+        return -1;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    uint64_t lsn = changelog_record(table, offset, record, len, size);
+    if (lsn == 0) {
+        if (storage_pwrite(fd, before, len, offset) != (ssize_t)len) {
+            log_error("cannot undo an unlogged write to table %d: %s", table, strerror(errno));
+        }
+        free(before);
+        return -1;
+    }
+    free(before);
+    replication_publish(table, lsn, offset, record, len, size);
+    return 0;
+}
+
+// Swap in a rewritten copy of the table; bytes before first_changed are identical
+static int table_swap(int table, const char *temp_path, off_t first_changed) {
+    int old_fd = open(table_path(table), O_RDONLY);
+    if (old_fd != -1) {
+        off_t old_size = lseek(old_fd, 0, SEEK_END);
+        if (old_size > first_changed) {
+            snapshot_preserve(table, first_changed, old_size - first_changed);
+        }
+        close(old_fd);
+    }
+
+    int fd = open(temp_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // The rewritten tail is the after-image for the change log and replicas.
+    // It is logged before the swap, so a copy the log refuses is discarded.
+    off_t new_size = lseek(fd, 0, SEEK_END);
+    size_t len = new_size > first_changed ? new_size - first_changed : 0;
+    char *tail = malloc(len ? len : 1);
+    if (!tail || (len && storage_pread(fd, tail, len, first_changed) != (ssize_t)len)) {
+        free(tail);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    uint64_t lsn = changelog_record(table, first_changed, tail, len, new_size);
+    if (lsn == 0 || rename(temp_path, table_path(table)) == -1) {
+        remove(temp_path);
+        free(tail);
+        return -1;
+    }
+    replication_publish(table, lsn, first_changed, tail, len, new_size);
+    free(tail);
+    return 0;
+}
+
+// In-memory indexes cannot follow a change made outside the operations
+// below, so they are dropped and rebuilt from the file on next use, and
+// catalog clients are sent the whole catalog. Callers hold the table's mutex.
+static void table_indexes_invalidate(int table) {
+    if (table < TABLE_STUDENT_COURSE) {
+        id_filter_invalidate(table);
+    }
+    if (table == TABLE_COURSE) {
+        course_index_invalidate();
+        catalog_invalidate();
+    } else if (table == table_aggregate()) {
+        aggregates_invalidate();
+    } else if (table == TABLE_STUDENT || table >= TABLE_STUDENT_COURSE) {
+        record_index_invalidate(table);
+    }
+}
+
+int table_replace(int table, const char *temp_path, off_t first_changed) {
+    TRACE_FUNCTION("file");
+    int result = table_swap(table, temp_path, first_changed);
+    table_indexes_invalidate(table);
+    return result;
+}
+
+// Apply a change received from a primary exactly as it was made there
+int table_apply_change(int table, off_t offset, const void *data, size_t len, off_t new_size) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(table_mutex(table)); // Lock the mutex for thread safety
+
+    int fd = open(table_path(table), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex before returning
+        return -1;
+    }
+
+    off_t old_size = lseek(fd, 0, SEEK_END);
+    snapshot_preserve(table, offset, len);
+    if (new_size < old_size) {
+        snapshot_preserve(table, new_size, old_size - new_size);
+    }
+
+    // Appended and overwritten records are followed one by one, which needs
+    // the records they replace; any other change drops the indexes
+    size_t before_len = offset < old_size ? (size_t)(old_size - offset) : 0;
+    if (before_len > len) {
+        before_len = len;
+    }
+    char *before = NULL;
+    int follow = change_followable(table, offset, len, old_size, new_size);
+    if (follow) {
+        before = malloc(before_len ? before_len : 1);
+        follow = before && (before_len == 0 ||
+                            storage_pread(fd, before, before_len, offset) == (ssize_t)before_len);
+    }
+    if (!follow) {
+        table_indexes_invalidate(table);
+    }
+
+    int result = 0;
+    if ((len && storage_pwrite(fd, data, len, offset) != (ssize_t)len) ||
+        ftruncate(fd, new_size) == -1) {
+        result = -1;
+    } else {
+        uint64_t lsn = changelog_record(table, offset, data, len, new_size);
+        if (lsn == 0) {
+            result = -1;
+        } else {
+            replication_publish(table, lsn, offset, data, len, new_size);
+        }
+    }
+
+    if (follow && result == 0) {
+        change_follow(table, offset, data, len, before, before_len);
+    } else if (follow) {
+        table_indexes_invalidate(table); // the file may hold part of the change
+    }
+    free(before);
+    close(fd);
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    return result;
+}
+
+// Rewrite a table without the records whose field matches, writing the
+// survivors in SCAN_BLOCK_SIZE batches. on_removed, if set, sees every
+// removed record and can cancel the rewrite by returning -1. Returns 1 if
+// anything was removed, 0 if nothing matched and -1 on error. Caller holds
+// the table mutex.
+static int table_remove_matching(int table, const char *temp_path, size_t record_size,
+                                 const FieldMatch *match,
+                                 int (*on_removed)(const void *record, void *arg), void *arg) {
+    int read_fd = open(table_path(table), O_RDONLY);
+    if (read_fd == -1) {
+        return -1;
+    }
+
+    int write_fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (write_fd == -1) {
+        close(read_fd);
+        return -1;
+    }
+
+    RecordScanner scan;
+    char out[SCAN_BLOCK_SIZE];
+    size_t out_len = 0;
+    off_t out_offset = 0, first_changed = 0;
+    int found = 0, failed = 0;
+    const void *record;
+
+    scan_open(&scan, read_fd, record_size);
+    while (!failed && (record = scan_next(&scan)) != NULL) {
+        if (field_matches(match, record)) {
+            if (!found) {
+                found = 1;
+                first_changed = scan_offset(&scan);
+            }
+            if (on_removed && on_removed(record, arg) == -1) {
+                failed = 1;
+            }
+            continue;
+        }
+        if (out_len + record_size > sizeof(out)) {
+            failed = storage_pwrite(write_fd, out, out_len, out_offset) != (ssize_t)out_len;
+            out_offset += out_len;
+            out_len = 0;
+        }
+        memcpy(out + out_len, record, record_size);
+        out_len += record_size;
+    }
+    scan_close(&scan);
+
+    if (!failed && out_len > 0) {
+        failed = storage_pwrite(write_fd, out, out_len, out_offset) != (ssize_t)out_len;
+    }
+
+    close(read_fd);
+    close(write_fd);
+
+    if (failed || !found) {
+        remove(temp_path);
+        return failed ? -1 : 0;
+    }
+    return table_swap(table, temp_path, first_changed) == 0 ? 1 : -1;
+}
+// ==================== ID Filters ====================
+
+// A Bloom filter over each table's IDs lets a lookup of an ID that does not
+// exist, such as the duplicate check before an add, skip the table scan.
+// A filter is built from the file at startup or on first use, updated by
+// the add operations and guarded by the table mutex.
+#define ID_FILTER_MIN_KEYS 1024
+
+typedef struct {
+    BloomFilter filter;
+    int valid;
+} IdFilter;
+
+typedef struct {
+    size_t record_size;
+    size_t key_offset;
+    size_t key_size;
+} IdField;
+
+static IdFilter id_filters[TABLE_STUDENT_COURSE];
+
+static const IdField id_fields[TABLE_STUDENT_COURSE] = {
+    {sizeof(Student), offsetof(Student, student_id), MAX_ID_LEN},
+    {sizeof(Faculty), offsetof(Faculty, faculty_id), MAX_ID_LEN},
+    {sizeof(Course), offsetof(Course, course_code), MAX_COURSE_CODE_LEN}
+};
+
+static void id_filter_invalidate(int table) {
+    bloom_free(&id_filters[table].filter);
+    id_filters[table].valid = 0;
+}
+
+// Sized for twice the records on file, so it stays accurate while the table grows
+static int id_filter_build(int table) {
+    IdFilter *id_filter = &id_filters[table];
+    const IdField *field = &id_fields[table];
+    off_t size = 0;
+
+    int fd = open(table_path(table), O_RDONLY);
+    if (fd == -1 && errno != ENOENT) {
+        return -1;
+    }
+    if (fd != -1) {
+        size = lseek(fd, 0, SEEK_END);
+    }
+
+    size_t records = size > 0 ? size / field->record_size : 0;
+    if (bloom_init(&id_filter->filter, records * 2 + ID_FILTER_MIN_KEYS) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if (fd != -1) {
+        RecordScanner scan;
+        const char *record;
+
+        scan_open(&scan, fd, field->record_size);
+        while ((record = scan_next(&scan)) != NULL) {
+            const char *key = record + field->key_offset;
+            bloom_add(&id_filter->filter, key, strnlen(key, field->key_size));
+        }
+        scan_close(&scan);
+        close(fd);
+    }
+
+    id_filter->valid = 1;
+    return 0;
+}
+
+// 0 when the table has no record with this ID; 1 when it may have one, or
+// the filter could not be built. Caller holds the table mutex.
+static int id_filter_may_contain(int table, const char *id) {
+    IdFilter *id_filter = &id_filters[table];
+    if (!id_filter->valid && id_filter_build(table) != 0) {
+        return 1; // the caller scans the table
+    }
+    return bloom_may_contain(&id_filter->filter, id, strnlen(id, id_fields[table].key_size));
+}
+
+// Caller holds the table mutex
+static void id_filter_add(int table, const char *id) {
+    IdFilter *id_filter = &id_filters[table];
+    if (!id_filter->valid) {
+        return; // the next build reads the new record from the file
+    }
+    if (id_filter->filter.count >= id_filter->filter.capacity) {
+        id_filter_invalidate(table); // rebuilt larger on next use
+        return;
+    }
+    bloom_add(&id_filter->filter, id, strnlen(id, id_fields[table].key_size));
+}
+
+int id_filters_init(void) {
+    int result = 0;
+    for (int table = TABLE_STUDENT; table < TABLE_STUDENT_COURSE; table++) {
+        trace_mutex_lock(table_mutex(table)); // Lock the mutex for thread safety
+        id_filter_invalidate(table);
+        if (id_filter_build(table) != 0) {
+            result = -1;
+        }
+        pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    }
+    return result;
+}
+
+// ==================== Record Indexes ====================
+
+// students.dat and every enrollment partition have a B+tree index file
+// beside them, mapping the student ID, or the student ID and course code of
+// an active enrollment, to the record's offset. An index follows every
+// change to its table under the table mutex and is synced at checkpoints,
+// when every table mutex is held, with the table's size and mtime in its
+// header. An index whose stamp does not
+// match its table, e.g. after a crash or a recovery, is rebuilt from the
+// file when it is opened, as is one invalidated by a change it could not
+// follow (course removal, replica sync). Lookups check the record an entry
+// points at, so an entry left behind by a crash is never trusted.
+#define RECORD_INDEX_BUILD_BATCH 16384
+#define RECORD_INDEX_RETRY_SECONDS 5
+
+enum {
+    INDEX_KEEP,     // the keys did not change, only the stamp
+    INDEX_INSERT,
+    INDEX_DELETE
+};
+
+typedef struct {
+    BTree tree;
+    int open;
+    int valid;          // matches the table file
+    int unsynced;       // changed since the last sync
+    time_t failed_at;   // last failed open or build; lookups scan until the retry
+} RecordIndex;
+
+typedef struct {
+    char key[BTREE_MAX_KEY];
+    off_t offset;
+} RecordIndexEntry;
+
+static RecordIndex student_index;
+static RecordIndex enroll_indexes[MAX_ENROLL_PARTITIONS];
+
+static RecordIndex *record_index_of(int table) {
+    return table == TABLE_STUDENT ? &student_index : &enroll_indexes[table - TABLE_STUDENT_COURSE];
+}
+
+// data/students.dat is indexed in data/students.idx
+static void index_path_for(char *buf, size_t size, const char *table_file) {
+    size_t len = strlen(table_file);
+    if (len > 4 && strcmp(table_file + len - 4, ".dat") == 0) {
+        len -= 4;
+    }
+    snprintf(buf, size, "%.*s.idx", (int)len, table_file);
+}
+
+// Keys are fixed-size: each part is padded with zeros to its field size
+static void key_part(char *dst, const char *src, size_t size) {
+    size_t len = strnlen(src, size);
+    memcpy(dst, src, len);
+    memset(dst + len, 0, size - len);
+}
+
+static void student_key(char *key, const char *student_id) {
+    key_part(key, student_id, MAX_ID_LEN);
+}
+
+static void enrollment_key(char *key, const char *student_id, const char *course_code) {
+    key_part(key, student_id, MAX_ID_LEN);
+    key_part(key + MAX_ID_LEN, course_code, MAX_COURSE_CODE_LEN);
+}
+
+// The index key of a record, or 0 when the index does not hold the record
+static int record_key(int table, const void *record, char *key) {
+    if (table == TABLE_STUDENT) {
+        student_key(key, ((const Student *)record)->student_id);
+        return 1;
+    }
+    const StudentCourse *sc = (const StudentCourse *)record;
+    if (!sc->is_enrolled) {
+        return 0;
+    }
+    enrollment_key(key, sc->student_id, sc->course_code);
+    return 1;
+}
+
+static int table_stamp(int table, BTreeStamp *stamp) {
+    struct stat st;
+    if (stat(table_path(table), &st) == -1) {
+        memset(stamp, 0, sizeof(*stamp));
+        return errno == ENOENT ? 0 : -1; // no file yet
+    }
+    stamp->size = st.st_size;
+    stamp->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+static void record_index_invalidate(int table) {
+    record_index_of(table)->valid = 0;
+}
+
+static int compare_index_entries(const void *a, const void *b) {
+    const RecordIndexEntry *x = (const RecordIndexEntry *)a;
+    const RecordIndexEntry *y = (const RecordIndexEntry *)b;
+    int cmp = memcmp(x->key, y->key, BTREE_MAX_KEY);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int record_index_insert_batch(BTree *tree, RecordIndexEntry *batch, size_t count) {
+    qsort(batch, count, sizeof(*batch), compare_index_entries);
+    for (size_t i = 0; i < count; i++) {
+        if (btree_insert(tree, batch[i].key, batch[i].offset) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Rebuild the index from the table file. Keys go in as sorted batches, so
+// each batch sweeps the leaves in order instead of touching them at random;
+// a duplicate key keeps the earliest record, as a file scan would.
+static int record_index_build(int table) {
+    RecordIndex *index = record_index_of(table);
+    size_t record_size = table == TABLE_STUDENT ? sizeof(Student) : sizeof(StudentCourse);
+    BTreeStamp stamp;
+
+    if (table_stamp(table, &stamp) == -1 || btree_reset(&index->tree) == -1) {
+        return -1;
+    }
+
+    int fd = open(table_path(table), O_RDONLY);
+    if (fd == -1 && errno != ENOENT) {
+        return -1;
+    }
+
+    int failed = 0;
+    if (fd != -1) {
+        RecordIndexEntry *batch = malloc(RECORD_INDEX_BUILD_BATCH * sizeof(RecordIndexEntry));
+        RecordScanner scan;
+        const void *record;
+        size_t count = 0;
+
+        failed = batch == NULL;
+        scan_open(&scan, fd, record_size);
+        while (!failed && (record = scan_next(&scan)) != NULL) {
+            RecordIndexEntry *entry = &batch[count];
+            memset(entry->key, 0, sizeof(entry->key));
+            if (!record_key(table, record, entry->key)) {
+                continue;
+            }
+            entry->offset = scan_offset(&scan);
+            if (++count == RECORD_INDEX_BUILD_BATCH) {
+                failed = record_index_insert_batch(&index->tree, batch, count) == -1;
+                count = 0;
+            }
+        }
+        scan_close(&scan);
+        close(fd);
+
+        if (!failed && count > 0) {
+            failed = record_index_insert_batch(&index->tree, batch, count) == -1;
+        }
+        free(batch);
+    }
+
+    // The table mutex kept the file as it was when the stamp was taken
+    if (failed || btree_sync(&index->tree, &stamp) == -1) {
+        return -1;
+    }
+    index->valid = 1;
+    index->unsynced = 0;
+    log_debug("%s: index rebuilt with %llu keys", table_path(table),
+              (unsigned long long)index->tree.entries);
+    return 0;
+}
+
+// The table's index, opened and rebuilt as needed, or NULL when it cannot
+// be used. Caller holds the table mutex.
+static BTree *record_index_get(int table) {
+    RecordIndex *index = record_index_of(table);
+
+    if (index->valid) {
+        return &index->tree;
+    }
+    if (index->failed_at && time(NULL) - index->failed_at < RECORD_INDEX_RETRY_SECONDS) {
+        return NULL; // a rebuild failed moments ago; do not pay for another one per lookup
+    }
+
+    if (!index->open) {
+        char path[sizeof(enroll_paths[0]) + 4];
+        BTreeStamp stamp;
+        size_t key_size = table == TABLE_STUDENT ? MAX_ID_LEN : MAX_ID_LEN + MAX_COURSE_CODE_LEN;
+
+        index_path_for(path, sizeof(path), table_path(table));
+        if (btree_open(&index->tree, path, key_size) == -1) {
+            index->failed_at = time(NULL);
+            return NULL;
+        }
+        index->open = 1;
+        index->valid = table_stamp(table, &stamp) == 0 && btree_matches(&index->tree, &stamp);
+    }
+    if (!index->valid && record_index_build(table) == -1) {
+        index->failed_at = time(NULL);
+        return NULL;
+    }
+    index->failed_at = 0;
+    return &index->tree;
+}
+
+// Follow a change that has just been written to the table. The index is
+// written out at the next checkpoint; until then lookups check the record
+// an entry points at. An index that cannot follow is rebuilt on next use.
+// Caller holds the table mutex.
+static void record_index_follow(int table, int change, const char *key, off_t offset) {
+    RecordIndex *index = record_index_of(table);
+    int result = 0;
+
+    if (!index->valid) {
+        return; // the next build reads the change from the file
+    }
+    if (change == INDEX_INSERT) {
+        result = btree_insert(&index->tree, key, offset);
+    } else if (change == INDEX_DELETE) {
+        result = btree_delete(&index->tree, key);
+    }
+    if (result == -1) {
+        record_index_invalidate(table);
+    } else {
+        index->unsynced = 1;
+    }
+}
+
+static void record_index_sync(int table) {
+    RecordIndex *index = record_index_of(table);
+    BTreeStamp stamp;
+
+    if (index->valid && index->unsynced) {
+        if (table_stamp(table, &stamp) == -1 || btree_sync(&index->tree, &stamp) == -1) {
+            record_index_invalidate(table);
+        } else {
+            index->unsynced = 0;
+        }
+    }
+}
+
+void record_indexes_sync(void) {
+    record_index_sync(TABLE_STUDENT);
+    for (int p = 0; p < enroll_partitions; p++) {
+        record_index_sync(TABLE_STUDENT_COURSE + p);
+    }
+}
+
+// ==================== Replicated Changes ====================
+
+// Size of the records whose indexes follow a replicated change, 0 when
+// the table's indexes are dropped instead. Course records also feed the
+// catalog, so clients of a replica get deltas rather than full refreshes.
+static size_t followed_record_size(int table) {
+    if (table == TABLE_STUDENT) {
+        return sizeof(Student);
+    }
+    if (table == TABLE_COURSE) {
+        return sizeof(Course);
+    }
+    if (table >= TABLE_STUDENT_COURSE && table < table_aggregate()) {
+        return sizeof(StudentCourse);
+    }
+    return 0;
+}
+
+// A change the indexes can follow record by record: whole records
+// overwritten in place or appended, with nothing truncated
+static int change_followable(int table, off_t offset, size_t len, off_t old_size, off_t new_size) {
+    size_t record_size = followed_record_size(table);
+    off_t end = offset + (off_t)len;
+    return record_size && len && offset % record_size == 0 && len % record_size == 0 &&
+           offset <= old_size && new_size == (end > old_size ? end : old_size);
+}
+
+// Update the indexes for the records of a replicated change; before holds
+// the before_len bytes the change overwrote. Caller holds the table mutex.
+// A replicated course record: the course index and the catalog get the
+// same add, update or seat change the primary's operation gave them
+static void course_follow(const Course *old, const Course *course) {
+    if (old && strncmp(old->course_code, course->course_code, MAX_COURSE_CODE_LEN) != 0) {
+        course_index_remove(old->course_code);
+        catalog_course_removed(old->course_code);
+        old = NULL;
+    }
+    if (!old) {
+        id_filter_add(TABLE_COURSE, course->course_code);
+        course_index_add(course);
+        catalog_course_added(course);
+        return;
+    }
+
+    course_index_update(course);
+    if (strncmp(old->name, course->name, MAX_NAME_LEN) != 0 ||
+        strncmp(old->faculty_id, course->faculty_id, MAX_ID_LEN) != 0 ||
+        old->credits != course->credits || old->max_seats != course->max_seats) {
+        catalog_course_added(course); // replaces the client's row
+    } else if (old->available_seats != course->available_seats) {
+        catalog_seats_changed(course);
+    }
+}
+
+static void change_follow(int table, off_t offset, const char *data, size_t len, const char *before, size_t before_len) {
+    size_t record_size = followed_record_size(table);
+
+    if (table == TABLE_COURSE) {
+        for (size_t at = 0; at < len; at += record_size) {
+            Course old, course;
+            memcpy(&course, data + at, sizeof(Course));
+            if (at < before_len) {
+                memcpy(&old, before + at, sizeof(Course));
+            }
+            course_follow(at < before_len ? &old : NULL, &course);
+        }
+        return;
+    }
+
+    for (size_t at = 0; at < len; at += record_size) {
+        char old_key[BTREE_MAX_KEY], new_key[BTREE_MAX_KEY];
+        memset(old_key, 0, sizeof(old_key));
+        memset(new_key, 0, sizeof(new_key));
+        int had = at < before_len && record_key(table, before + at, old_key);
+        int has = record_key(table, data + at, new_key);
+        int same = had && has && memcmp(old_key, new_key, sizeof(old_key)) == 0;
+
+        if (had && !same) {
+            record_index_follow(table, INDEX_DELETE, old_key, 0);
+        }
+        if (has && !same) {
+            record_index_follow(table, INDEX_INSERT, new_key, offset + at);
+        } else {
+            record_index_follow(table, INDEX_KEEP, NULL, 0);
+        }
+        if (table == TABLE_STUDENT) {
+            id_filter_add(TABLE_STUDENT, ((const Student *)(data + at))->student_id);
+        }
+    }
+}
+
+static int record_index_open(int table) {
+    trace_mutex_lock(table_mutex(table)); // Lock the mutex for thread safety
+    int result = record_index_get(table) ? 0 : -1;
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    return result;
+}
+
+int record_indexes_init(void) {
+    int result = record_index_open(TABLE_STUDENT);
+    for (int p = 0; p < enroll_partitions; p++) {
+        result |= record_index_open(TABLE_STUDENT_COURSE + p);
+    }
+    return result;
+}
 
 // ==================== Student File Operations ====================
 
+// Read the student's record and its offset: 1 when found, 0 when not, -1
+// on error. Scans the table when the index cannot be used. Caller holds
+// student_file_mutex.
+static int student_locate(int fd, const char *student_id, Student *student, off_t *offset) {
+    char key[BTREE_MAX_KEY];
+    student_key(key, student_id);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        BTree *tree = record_index_get(TABLE_STUDENT);
+        uint64_t value;
+        int found = tree ? btree_find(tree, key, &value) : -1;
+        if (found == -1) {
+            break;
+        }
+        if (found == 0) {
+            return 0;
+        }
+        if (storage_pread(fd, student, sizeof(Student), value) == sizeof(Student) &&
+            strncmp(student->student_id, student_id, MAX_ID_LEN) == 0) {
+            *offset = value;
+            return 1;
+        }
+        record_index_invalidate(TABLE_STUDENT); // out of step with the file; rebuilt for the retry
+    }
+
+    RecordScanner scan;
+    FieldMatch match;
+    const Student *record;
+    int found = 0;
+
+    field_match_init(&match, offsetof(Student, student_id), MAX_ID_LEN, student_id);
+    scan_open(&scan, fd, sizeof(Student));
+    if ((record = scan_next_match(&scan, &match)) != NULL) {
+        *student = *record;
+        *offset = scan_offset(&scan);
+        found = 1;
+    }
+    scan_close(&scan);
+    return found;
+}
+
 int add_student(Student *student) {
-    pthread_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(STUDENT_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
     if (fd == -1) {
@@ -12,45 +834,46 @@ int add_student(Student *student) {
         return -1;
     }
 
-    int result = write(fd, student, sizeof(Student));
+    off_t offset = lseek(fd, 0, SEEK_END);
+    int result = table_append(TABLE_STUDENT, fd, student, sizeof(Student));
+    if (result > 0) {
+        char key[BTREE_MAX_KEY];
+        student_key(key, student->student_id);
+        record_index_follow(TABLE_STUDENT, INDEX_INSERT, key, offset);
+        id_filter_add(TABLE_STUDENT, student->student_id);
+    }
 
     close(fd);
     pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
     return result;
 }
 
-Student *find_student(const char *student_id) {
-    pthread_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
+int find_student(const char *student_id, Student *student) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
 
-    int fd = open(STUDENT_FILE, O_RDONLY);
-    if (fd == -1) {
+    if (!id_filter_may_contain(TABLE_STUDENT, student_id)) {
         pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return 0;
     }
 
-    Student *student = malloc(sizeof(Student));
-    if (!student) {
-        close(fd);
+    int fd = open(STUDENT_FILE, O_RDONLY);
+    if (fd == -1) {
         pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return -1;
     }
 
-    while (read(fd, student, sizeof(Student)) > 0) {
-        if (strcmp(student->student_id, student_id) == 0) {
-            close(fd);
-            pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-            return student;
-        }
-    }
+    off_t offset;
+    int found = student_locate(fd, student_id, student, &offset);
 
-    free(student);
     close(fd);
     pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-    return NULL;
+    return found;
 }
 
 int activate_deactivate_student(const char *student_id, int activate_flag) {
-    pthread_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(STUDENT_FILE, O_RDWR);
     if (fd == -1) {
@@ -59,30 +882,22 @@ int activate_deactivate_student(const char *student_id, int activate_flag) {
     }
 
     Student student;
-    int found = 0;
-
-    while (read(fd, &student, sizeof(Student)) > 0) {
-        if (strcmp(student.student_id, student_id) == 0) {
-            found = 1;
-            student.is_active = activate_flag;
-
-            lseek(fd, -sizeof(Student), SEEK_CUR);
-            if (write(fd, &student, sizeof(Student)) == -1) {
-                close(fd);
-                pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-                return -1;
-            }
-            break;
-        }
+    off_t offset;
+    int result = student_locate(fd, student_id, &student, &offset);
+    if (result == 1) {
+        student.is_active = activate_flag;
+        result = table_overwrite(TABLE_STUDENT, fd, offset, &student, sizeof(Student)) == -1 ? -1 : 1;
+        record_index_follow(TABLE_STUDENT, INDEX_KEEP, NULL, 0);
     }
 
     close(fd);
     pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-    return found ? 1 : 0;
+    return result;
 }
 
-int update_student(Student updated_student) {
-    pthread_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
+int update_student(const Student *expected, const Student *updated) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&student_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(STUDENT_FILE, O_RDWR);
     if (fd == -1) {
@@ -90,31 +905,29 @@ int update_student(Student updated_student) {
         return -1;
     }
 
-    Student student;
-    int found = 0;
+    Student current;
+    off_t offset;
+    int result = -1;
 
-    while (read(fd, &student, sizeof(Student)) > 0) {
-        if (strcmp(student.student_id, updated_student.student_id) == 0) {
-            found = 1;
-            lseek(fd, -sizeof(Student), SEEK_CUR);
-            if (write(fd, &updated_student, sizeof(Student)) == -1) {
-                close(fd);
-                pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-                return -1;
-            }
-            break;
+    if (student_locate(fd, updated->student_id, &current, &offset) == 1) {
+        if (memcmp(&current, expected, sizeof(Student)) != 0) {
+            result = UPDATE_CONFLICT; // changed since the caller read it
+        } else {
+            result = table_overwrite(TABLE_STUDENT, fd, offset, updated, sizeof(Student));
+            record_index_follow(TABLE_STUDENT, INDEX_KEEP, NULL, 0);
         }
     }
 
     close(fd);
     pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
-    return found ? 0 : -1;
+    return result;
 }
 
 // ==================== Faculty File Operations ====================
 
 int add_faculty(Faculty *faculty) {
-    pthread_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(FACULTY_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
     if (fd == -1) {
@@ -122,46 +935,53 @@ int add_faculty(Faculty *faculty) {
         return -1;
     }
 
-    int result = write(fd, faculty, sizeof(Faculty));
+    int result = table_append(TABLE_FACULTY, fd, faculty, sizeof(Faculty));
+    if (result > 0) {
+        id_filter_add(TABLE_FACULTY, faculty->faculty_id);
+    }
 
     close(fd);
     pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
     return result;
 }
 
-Faculty *find_faculty(const char *faculty_id) {
-    pthread_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
+int find_faculty(const char *faculty_id, Faculty *faculty) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
 
-    int fd = open(FACULTY_FILE, O_RDONLY);
-    if (fd == -1) {
+    if (!id_filter_may_contain(TABLE_FACULTY, faculty_id)) {
         pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return 0;
     }
 
-    Faculty *faculty = malloc(sizeof(Faculty));
-    if (!faculty) {
-        close(fd);
+    int fd = open(FACULTY_FILE, O_RDONLY);
+    if (fd == -1) {
         pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return -1;
     }
 
-    while (read(fd, faculty, sizeof(Faculty)) > 0) {
-        if (strcmp(faculty->faculty_id, faculty_id) == 0) {
-            close(fd);
-            pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
-            return faculty;
-        }
+    RecordScanner scan;
+    FieldMatch match;
+    const Faculty *record;
+    int found = 0;
+
+    field_match_init(&match, offsetof(Faculty, faculty_id), MAX_ID_LEN, faculty_id);
+    scan_open(&scan, fd, sizeof(Faculty));
+    if ((record = scan_next_match(&scan, &match)) != NULL) {
+        *faculty = *record;
+        found = 1;
     }
+    scan_close(&scan);
 
-    free(faculty);
     close(fd);
     pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
-    return NULL;
+    return found;
 }
 
 
-int update_faculty(Faculty updated_faculty) {
-    pthread_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
+int update_faculty(const Faculty *expected, const Faculty *updated) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&faculty_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(FACULTY_FILE, O_RDWR);
     if (fd == -1) {
@@ -169,60 +989,64 @@ int update_faculty(Faculty updated_faculty) {
         return -1;
     }
 
-    Faculty faculty;
-    int found = 0;
+    RecordScanner scan;
+    FieldMatch match;
+    const Faculty *record;
+    int result = -1;
 
-    while (read(fd, &faculty, sizeof(Faculty)) > 0) {
-        if (strcmp(faculty.faculty_id, updated_faculty.faculty_id) == 0) {
-            found = 1;
-            lseek(fd, -sizeof(Faculty), SEEK_CUR);
-            if (write(fd, &updated_faculty, sizeof(Faculty)) == -1) {
-                close(fd);
-                pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
-                return -1;
-            }
-            break;
+    field_match_init(&match, offsetof(Faculty, faculty_id), MAX_ID_LEN, updated->faculty_id);
+    scan_open(&scan, fd, sizeof(Faculty));
+    if ((record = scan_next_match(&scan, &match)) != NULL) {
+        if (memcmp(record, expected, sizeof(Faculty)) != 0) {
+            result = UPDATE_CONFLICT; // changed since the caller read it
+        } else {
+            result = table_overwrite(TABLE_FACULTY, fd, scan_offset(&scan), updated, sizeof(Faculty));
         }
     }
+    scan_close(&scan);
 
     close(fd);
     pthread_mutex_unlock(&faculty_file_mutex); // Unlock the mutex
-    return found ? 0 : -1;
+    return result;
 }
 // ==================== Course File Operations ====================
 
-Course *find_course(const char *course_code) {
-    pthread_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
+int find_course(const char *course_code, Course *course) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
 
-    int fd = open(COURSE_FILE, O_RDONLY);
-    if (fd == -1) {
+    if (!id_filter_may_contain(TABLE_COURSE, course_code)) {
         pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return 0;
     }
 
-    Course *course = malloc(sizeof(Course));
-    if (!course) {
-        close(fd);
+    int fd = open(COURSE_FILE, O_RDONLY);
+    if (fd == -1) {
         pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
-        return NULL;
+        return -1;
     }
 
-    while (read(fd, course, sizeof(Course)) > 0) {
-        if (strcmp(course->course_code, course_code) == 0) {
-            close(fd);
-            pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
-            return course;
-        }
+    RecordScanner scan;
+    FieldMatch match;
+    const Course *record;
+    int found = 0;
+
+    field_match_init(&match, offsetof(Course, course_code), MAX_COURSE_CODE_LEN, course_code);
+    scan_open(&scan, fd, sizeof(Course));
+    if ((record = scan_next_match(&scan, &match)) != NULL) {
+        *course = *record;
+        found = 1;
     }
+    scan_close(&scan);
 
-    free(course);
     close(fd);
     pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
-    return NULL;
+    return found;
 }
 
 int add_course(Course *course) {
-    pthread_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
 
     int fd = open(COURSE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
     if (fd == -1) {
@@ -230,134 +1054,575 @@ int add_course(Course *course) {
         return -1;
     }
 
-    int result = write(fd, course, sizeof(Course));
+    int result = table_append(TABLE_COURSE, fd, course, sizeof(Course));
+    if (result > 0) {
+        id_filter_add(TABLE_COURSE, course->course_code);
+        course_index_add(course);
+        aggregates_course_added(course);
+        subscriptions_publish(course->course_code, course->available_seats);
+        catalog_course_added(course);
+    }
 
     close(fd);
     pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
     return result;
 }
 
+// Removes the course together with its enrollments; the course mutex is
+// held throughout so nobody can enroll in the course while it goes away
 int remove_course(char *course_id) {
-    pthread_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
+
+    FieldMatch match;
+    field_match_init(&match, offsetof(Course, course_code), MAX_COURSE_CODE_LEN, course_id);
+
+    int result = table_remove_matching(TABLE_COURSE, TEMP_FILE, sizeof(Course), &match, NULL, NULL);
+    if (result == 1) {
+        course_index_remove(course_id);
+        remove_student_course_by_course(course_id);
+        aggregates_course_removed(course_id);
+        subscriptions_publish(course_id, WATCH_GONE);
+        catalog_course_removed(course_id);
+    }
 
-    int read_fd = open(COURSE_FILE, O_RDONLY);
-    if (read_fd == -1) {
-        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+    return result == 1 ? 0 : -1;
+}
+
+// Adjust a course's available seats; the caller holds course_file_mutex.
+// Taking a seat from a full course is refused. Returns 1 on success, 0
+// when the course does not exist or is full, -1 on error.
+static int course_seats_locked(const char *course_code, int delta) {
+    int fd = open(COURSE_FILE, O_RDWR);
+    if (fd == -1) {
         return -1;
     }
 
-    int write_fd = open(TEMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (write_fd == -1) {
-        close(read_fd);
-        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
+    RecordScanner scan;
+    FieldMatch match;
+    const Course *record;
+    int result = 0;
+
+    field_match_init(&match, offsetof(Course, course_code), MAX_COURSE_CODE_LEN, course_code);
+    scan_open(&scan, fd, sizeof(Course));
+    if ((record = scan_next_match(&scan, &match)) != NULL) {
+        Course course = *record;
+        if (course.available_seats + delta >= 0) { // otherwise no free seat
+            course.available_seats += delta;
+            result = table_overwrite(TABLE_COURSE, fd, scan_offset(&scan), &course, sizeof(Course)) == 0 ? 1 : -1;
+            if (result == 1) {
+                course_index_update(&course);
+                subscriptions_publish(course.course_code, course.available_seats);
+                catalog_seats_changed(&course);
+            }
+        }
+    }
+    scan_close(&scan);
+
+    close(fd);
+    return result;
+}
+
+int update_course_seats(const char *course_code, int delta) {
+    TRACE_FUNCTION("file");
+    trace_mutex_lock(&course_file_mutex); // Lock the mutex for thread safety
+    int result = course_seats_locked(course_code, delta);
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+    return result == 1 ? 0 : -1;
+}
+
+// ==================== Enrollment Partitions ====================
+// Enrollments are spread over partitions by hash of student_id. Every
+// partition has its own file, mutex and B+tree index of its active
+// enrollments keyed by (student_id, course_code); the index is only
+// touched under the partition mutex.
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t fnv1a(uint32_t hash, const char *s) {
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static int partition_for(const char *student_id, int partitions) {
+    return fnv1a(FNV_OFFSET_BASIS, student_id) % partitions;
+}
+
+static void enroll_partition_path(char *buf, size_t size, int partition, int partitions) {
+    if (partitions == 1) {
+        snprintf(buf, size, "%s", STUDENT_COURSE_FILE);
+    } else {
+        snprintf(buf, size, STUDENT_COURSE_PARTITION_FILE, partition);
+    }
+}
+
+int enroll_partition_count(void) {
+    return enroll_partitions;
+}
+
+int enroll_partition_of(const char *student_id) {
+    return partition_for(student_id, enroll_partitions);
+}
+
+typedef struct {
+    int partition;
+    void (*task)(int partition, void *arg);
+    void *arg;
+} PartitionJob;
+
+static void *partition_job_thread(void *arg) {
+    PartitionJob *job = (PartitionJob *)arg;
+    job->task(job->partition, job->arg);
+    return NULL;
+}
+
+// Run task for every partition on its own thread and wait for all of them.
+// args holds one arg_size element per partition.
+static void for_each_partition_parallel(void (*task)(int partition, void *arg), void *args, size_t arg_size) {
+    PartitionJob jobs[MAX_ENROLL_PARTITIONS];
+    pthread_t threads[MAX_ENROLL_PARTITIONS];
+    int started[MAX_ENROLL_PARTITIONS];
+
+    for (int p = 0; p < enroll_partitions; p++) {
+        jobs[p].partition = p;
+        jobs[p].task = task;
+        jobs[p].arg = (char *)args + p * arg_size;
+        started[p] = enroll_partitions > 1 &&
+                     pthread_create(&threads[p], NULL, partition_job_thread, &jobs[p]) == 0;
+        if (!started[p]) {
+            task(p, jobs[p].arg); // single partition, or no thread available
+        }
+    }
+    for (int p = 0; p < enroll_partitions; p++) {
+        if (started[p]) {
+            pthread_join(threads[p], NULL);
+        }
+    }
+}
+
+static int read_partition_meta(void) {
+    FILE *meta = fopen(STUDENT_COURSE_META_FILE, "r");
+    if (!meta) {
+        return errno == ENOENT ? 1 : -1; // older data directories only have the single file
+    }
+
+    int partitions = 0;
+    if (fscanf(meta, "%d", &partitions) != 1 || partitions < 1 || partitions > MAX_ENROLL_PARTITIONS) {
+        partitions = -1;
+    }
+    fclose(meta);
+    return partitions;
+}
+
+static int write_partition_meta(int partitions) {
+    FILE *meta = fopen(STUDENT_COURSE_META_FILE, "w");
+    if (!meta) {
         return -1;
     }
+    fprintf(meta, "%d\n", partitions);
+    return fclose(meta) == 0 ? 0 : -1;
+}
+
+// Move every enrollment from the layout with `from` partitions into the new
+// paths. The new partitions are written beside the live files and renamed
+// into place, then files belonging only to the old layout are removed.
+static int repartition_enrollments(int from, int to) {
+    char temp_paths[MAX_ENROLL_PARTITIONS][sizeof(enroll_paths[0]) + 4];
+    int fds[MAX_ENROLL_PARTITIONS];
+    int failed = 0, moved = 0;
+
+    for (int p = 0; p < to; p++) {
+        snprintf(temp_paths[p], sizeof(temp_paths[p]), "%s.new", enroll_paths[p]);
+        fds[p] = open(temp_paths[p], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed |= fds[p] == -1;
+    }
 
-    Course course;
-    int found = 0;
+    for (int q = 0; q < from && !failed; q++) {
+        char old_path[sizeof(enroll_paths[0])];
+        enroll_partition_path(old_path, sizeof(old_path), q, from);
 
-    while (read(read_fd, &course, sizeof(Course)) > 0) {
-        if (strcmp(course.course_code, course_id) != 0) {
-            write(write_fd, &course, sizeof(Course));
-        } else {
-            found = 1;
+        int fd = open(old_path, O_RDONLY);
+        if (fd == -1) {
+            failed = errno != ENOENT;
+            continue;
+        }
+
+        RecordScanner scan;
+        const StudentCourse *sc;
+        scan_open(&scan, fd, sizeof(StudentCourse));
+        while (!failed && (sc = scan_next(&scan)) != NULL) {
+            int p = partition_for(sc->student_id, to);
+            failed = write(fds[p], sc, sizeof(StudentCourse)) != sizeof(StudentCourse);
+            moved++;
         }
+        scan_close(&scan);
+        close(fd);
     }
 
-    close(read_fd);
-    close(write_fd);
+    for (int p = 0; p < to; p++) {
+        if (fds[p] != -1) {
+            failed |= fsync(fds[p]) == -1;
+            close(fds[p]);
+        }
+    }
+    for (int p = 0; p < to; p++) {
+        if (failed) {
+            remove(temp_paths[p]);
+        } else if (rename(temp_paths[p], enroll_paths[p]) == -1) {
+            return -1;
+        }
+    }
+    if (failed) {
+        return -1;
+    }
 
-    if (found) {
-        remove(COURSE_FILE);
-        rename(TEMP_FILE, COURSE_FILE);
-    } else {
-        remove(TEMP_FILE);
+    for (int q = 0; q < from; q++) {
+        char old_path[sizeof(enroll_paths[0])];
+        enroll_partition_path(old_path, sizeof(old_path), q, from);
+
+        int reused = 0;
+        for (int p = 0; p < to; p++) {
+            reused |= strcmp(old_path, enroll_paths[p]) == 0;
+        }
+        if (!reused) {
+            char index_path[sizeof(old_path) + 4];
+            index_path_for(index_path, sizeof(index_path), old_path);
+            remove(old_path);
+            remove(index_path);
+        }
     }
 
-    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
-    return found ? 0 : -1;
+    log_info("enrollments: moved %d records from %d to %d partitions", moved, from, to);
+    return 0;
 }
 
-// ==================== Student-Course File Operations ====================
+int enroll_partitions_init(int partitions) {
+    TRACE_FUNCTION("file");
+    if (partitions < 1 || partitions > MAX_ENROLL_PARTITIONS) {
+        errno = EINVAL;
+        return -1;
+    }
 
-int enroll_student_course(StudentCourse *sc) {
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the mutex for thread safety
+    for (int p = 0; p < partitions; p++) {
+        enroll_partition_path(enroll_paths[p], sizeof(enroll_paths[p]), p, partitions);
+    }
 
-    int fd = open(STUDENT_COURSE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
+    int on_disk = read_partition_meta();
+    if (on_disk == -1) {
+        return -1;
+    }
+    if (on_disk != partitions && repartition_enrollments(on_disk, partitions) == -1) {
         return -1;
     }
 
-    sc->is_enrolled = 1;
-    int result = write(fd, sc, sizeof(StudentCourse));
+    enroll_partitions = partitions;
+    return write_partition_meta(partitions);
+}
 
-    close(fd);
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
+// ==================== Student-Course File Operations ====================
+// Per-student operations lock and touch only the student's own partition.
+// Enrolling and dropping also move a seat, so they take course_file_mutex
+// first (lower table id) and hold both locks while the seat count and the
+// enrollment change; no reader sees one change without the other.
+
+// Read the student's active enrollment in the course and its offset: 1
+// when enrolled, 0 when not, -1 on error. Scans the partition when the
+// index cannot be used. Caller holds the partition mutex.
+static int enrollment_locate(int table, int fd, const char *student_id, const char *course_code,
+                             StudentCourse *sc, off_t *offset) {
+    char key[BTREE_MAX_KEY];
+    enrollment_key(key, student_id, course_code);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        BTree *tree = record_index_get(table);
+        uint64_t value;
+        int found = tree ? btree_find(tree, key, &value) : -1;
+        if (found == -1) {
+            break;
+        }
+        if (found == 0) {
+            return 0;
+        }
+        if (storage_pread(fd, sc, sizeof(StudentCourse), value) == sizeof(StudentCourse) &&
+            sc->is_enrolled && strncmp(sc->student_id, student_id, MAX_ID_LEN) == 0 &&
+            strncmp(sc->course_code, course_code, MAX_COURSE_CODE_LEN) == 0) {
+            *offset = value;
+            return 1;
+        }
+        record_index_invalidate(table); // out of step with the file; rebuilt for the retry
+    }
+
+    RecordScanner scan;
+    FieldMatch match;
+    const StudentCourse *record;
+    int found = 0;
+
+    // Dropped enrollments keep their records, so the student may match
+    // several times before the active one
+    field_match_init(&match, offsetof(StudentCourse, student_id), MAX_ID_LEN, student_id);
+    scan_open(&scan, fd, sizeof(StudentCourse));
+    while (!found && (record = scan_next_match(&scan, &match)) != NULL) {
+        if (record->is_enrolled && strncmp(record->course_code, course_code, MAX_COURSE_CODE_LEN) == 0) {
+            *sc = *record;
+            *offset = scan_offset(&scan);
+            found = 1;
+        }
+    }
+    scan_close(&scan);
+    return found;
+}
+
+int enroll_student_course(StudentCourse *sc) {
+    TRACE_FUNCTION("file");
+    int partition = enroll_partition_of(sc->student_id);
+    int table = TABLE_STUDENT_COURSE + partition;
+    int result;
+
+    trace_mutex_lock(&course_file_mutex); // Lock the course file mutex
+    trace_mutex_lock(table_mutex(table)); // Lock the partition mutex
+
+    // All of a student's enrollments go through this partition lock, so
+    // neither the duplicate check nor the count can change before the append
+    int fd = open(table_path(table), O_RDWR | O_CREAT | O_APPEND, 0644);
+    StudentCourse existing;
+    off_t offset;
+    int enrolled = fd == -1 ? -1 : enrollment_locate(table, fd, sc->student_id, sc->course_code, &existing, &offset);
+    Aggregate student;
+    if (enrolled == -1) {
+        result = -4;
+    } else if (enrolled == 1) {
+        result = -2;
+    } else if (aggregates_get(AGGREGATE_STUDENT, sc->student_id, &student) == -1) {
+        result = -4; // the course limit cannot be checked
+    } else if (student.courses >= MAX_COURSES) {
+        result = -3;
+    } else {
+        // Take the seat first; it is given back if the enrollment cannot be written
+        int seat = course_seats_locked(sc->course_code, -1);
+        if (seat != 1) {
+            result = seat == 0 ? -1 : -4;
+        } else {
+            sc->is_enrolled = 1;
+            offset = lseek(fd, 0, SEEK_END);
+            result = offset == -1 ? -4 : table_append(table, fd, sc, sizeof(StudentCourse));
+
+            if (result > 0) {
+                char key[BTREE_MAX_KEY];
+                enrollment_key(key, sc->student_id, sc->course_code);
+                record_index_follow(table, INDEX_INSERT, key, offset);
+                aggregates_enrollment_changed(sc->student_id, sc->course_code, 1);
+            } else {
+                course_seats_locked(sc->course_code, 1);
+                result = -4;
+            }
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
     return result;
 }
 
 int is_student_enrolled(const char *student_id, const char *course_code) {
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    int partition = enroll_partition_of(student_id);
+    int table = TABLE_STUDENT_COURSE + partition;
 
-    int fd = open(STUDENT_COURSE_FILE, O_RDONLY);
-    if (fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
-        return 0;
-    }
+    trace_mutex_lock(table_mutex(table)); // Lock the partition mutex
 
+    int fd = open(table_path(table), O_RDONLY);
     StudentCourse sc;
-    int enrolled = 0;
+    off_t offset;
+    int enrolled = fd != -1 && enrollment_locate(table, fd, student_id, course_code, &sc, &offset) == 1;
+    if (fd != -1) {
+        close(fd);
+    }
 
-    while (read(fd, &sc, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc.student_id, student_id) == 0 && strcmp(sc.course_code, course_code) == 0 && sc.is_enrolled) {
-            enrolled = 1;
-            break;
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    return enrolled;
+}
+
+typedef struct {
+    const char *course_code;
+    int result;
+    char (*student_ids)[MAX_ID_LEN]; // students whose active enrollment was removed
+    int count;
+    int capacity;
+} RemoveByCourseJob;
+
+// A student that cannot be recorded fails the removal, since the
+// aggregates could not be told about the enrollment
+static int collect_removed_student(const void *record, void *arg) {
+    const StudentCourse *sc = (const StudentCourse *)record;
+    RemoveByCourseJob *job = (RemoveByCourseJob *)arg;
+
+    if (!sc->is_enrolled) {
+        return 0;
+    }
+    if (job->count == job->capacity) {
+        int capacity = job->capacity ? job->capacity * 2 : 16;
+        char (*grown)[MAX_ID_LEN] = realloc(job->student_ids, capacity * sizeof(*grown));
+        if (!grown) {
+            return -1;
         }
+        job->student_ids = grown;
+        job->capacity = capacity;
     }
+    memcpy(job->student_ids[job->count++], sc->student_id, MAX_ID_LEN);
+    return 0;
+}
 
-    close(fd);
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
-    return enrolled;
+static void remove_by_course_partition(int partition, void *arg) {
+    TRACE_FUNCTION("file");
+    RemoveByCourseJob *job = (RemoveByCourseJob *)arg;
+    int table = TABLE_STUDENT_COURSE + partition;
+    char temp_path[sizeof(enroll_paths[0]) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", table_path(table));
+
+    trace_mutex_lock(table_mutex(table)); // Lock the partition mutex
+
+    FieldMatch match;
+    field_match_init(&match, offsetof(StudentCourse, course_code), MAX_COURSE_CODE_LEN, job->course_code);
+
+    job->result = table_remove_matching(table, temp_path, sizeof(StudentCourse), &match,
+                                        collect_removed_student, job);
+    if (job->result == 1) {
+        record_index_invalidate(table); // surviving records moved
+        aggregates_enrollments_removed(job->course_code, (const char (*)[MAX_ID_LEN])job->student_ids, job->count);
+    }
+    free(job->student_ids);
+
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
 }
 
 int remove_student_course_by_course(char *course_id) {
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the mutex for thread safety
+    TRACE_FUNCTION("file");
+    RemoveByCourseJob jobs[MAX_ENROLL_PARTITIONS];
+    memset(jobs, 0, sizeof(jobs));
+    for (int p = 0; p < enroll_partitions; p++) {
+        jobs[p].course_code = course_id;
+    }
 
-    int read_fd = open(STUDENT_COURSE_FILE, O_RDONLY);
-    if (read_fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
-        return -1;
+    for_each_partition_parallel(remove_by_course_partition, jobs, sizeof(RemoveByCourseJob));
+
+    int removed = 0;
+    for (int p = 0; p < enroll_partitions; p++) {
+        removed |= jobs[p].result == 1;
     }
+    return removed ? 0 : -1;
+}
 
-    int write_fd = open(TEMP_SC_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (write_fd == -1) {
-        close(read_fd);
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
-        return -1;
+int drop_student_course(const char *student_id, const char *course_code) {
+    TRACE_FUNCTION("file");
+    int partition = enroll_partition_of(student_id);
+    int table = TABLE_STUDENT_COURSE + partition;
+
+    trace_mutex_lock(&course_file_mutex); // Lock the course file mutex
+    trace_mutex_lock(table_mutex(table)); // Lock the partition mutex
+
+    int fd = open(table_path(table), O_RDWR);
+    if (fd == -1) {
+        pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex before returning
+        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
+        return errno == ENOENT ? 0 : -1;
     }
 
     StudentCourse sc;
-    int found = 0;
+    off_t offset;
+    int result = enrollment_locate(table, fd, student_id, course_code, &sc, &offset);
+    if (result == 1) {
+        result = -1;
+        if (course_seats_locked(course_code, 1) == 1) {
+            // The seat is back; it is taken again if the enrollment cannot be marked dropped
+            sc.is_enrolled = 0;
+            if (table_overwrite(table, fd, offset, &sc, sizeof(StudentCourse)) == 0) {
+                char key[BTREE_MAX_KEY];
+                enrollment_key(key, student_id, course_code);
+                record_index_follow(table, INDEX_DELETE, key, 0);
+                aggregates_enrollment_changed(student_id, course_code, -1);
+                result = 1;
+            } else {
+                course_seats_locked(course_code, -1);
+            }
+        }
+    }
 
-    while (read(read_fd, &sc, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc.course_code, course_id) != 0) {
-            write(write_fd, &sc, sizeof(StudentCourse));
-        } else {
-            found = 1;
+    close(fd);
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+    return result;
+}
+
+typedef struct {
+    const char *course_code;
+    Page page;
+    int failed;
+} CourseEnrollmentsJob;
+
+static void collect_course_enrollments(int partition, void *arg) {
+    TRACE_FUNCTION("file");
+    CourseEnrollmentsJob *job = (CourseEnrollmentsJob *)arg;
+    int table = TABLE_STUDENT_COURSE + partition;
+    if (job->failed) {
+        return;
+    }
+
+    trace_mutex_lock(table_mutex(table)); // Lock the partition mutex
+
+    int fd = open(table_path(table), O_RDONLY);
+    if (fd == -1) {
+        job->failed = errno != ENOENT;
+        pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex before returning
+        return;
+    }
+
+    RecordScanner scan;
+    FieldMatch match;
+    const StudentCourse *sc;
+
+    field_match_init(&match, offsetof(StudentCourse, course_code), MAX_COURSE_CODE_LEN, job->course_code);
+    scan_open(&scan, fd, sizeof(StudentCourse));
+    while ((sc = scan_next_match(&scan, &match)) != NULL) {
+        if (sc->is_enrolled) {
+            page_offer(&job->page, sc);
         }
     }
+    scan_close(&scan);
 
-    close(read_fd);
-    close(write_fd);
+    close(fd);
+    pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+}
 
-    if (found) {
-        remove(STUDENT_COURSE_FILE);
-        rename(TEMP_SC_FILE, STUDENT_COURSE_FILE);
-    } else {
-        remove(TEMP_SC_FILE);
+int list_course_enrollments(const char *course_code, Page *page) {
+    TRACE_FUNCTION("file");
+    CourseEnrollmentsJob jobs[MAX_ENROLL_PARTITIONS];
+    int failed = 0;
+
+    // The per-partition pages come from the caller's arena and are given
+    // back once merged; the arena is only touched from this thread
+    ArenaMark mark = arena_mark(page->arena);
+    for (int p = 0; p < enroll_partitions; p++) {
+        jobs[p].course_code = course_code;
+        jobs[p].failed = page_begin(&jobs[p].page, page->arena, page->listing, page->scope) == -1;
+        memcpy(jobs[p].page.after, page->after, sizeof(page->after));
     }
 
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
-    return found ? 0 : -1;
-}
\ No newline at end of file
+    for_each_partition_parallel(collect_course_enrollments, jobs, sizeof(CourseEnrollmentsJob));
+
+    for (int p = 0; p < enroll_partitions; p++) {
+        failed |= jobs[p].failed;
+        if (jobs[p].page.records) {
+            page_merge(page, &jobs[p].page);
+        }
+    }
+    arena_rewind(page->arena, mark);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,286 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define LOG_BATCH_SIZE (64 * 1024)
+
+typedef struct {
+    uint64_t time_ns;   // wall clock
+    int level;
+    int tid;
+    char text[LOG_RECORD_TEXT];
+} LogRecord;
+
+// Single producer (the owning thread), single consumer (whoever holds flush_mutex)
+typedef struct LogRing {
+    _Atomic uint32_t head;      // next slot the owner fills
+    _Atomic uint32_t tail;      // next slot the flusher reads
+    _Atomic uint64_t dropped;
+    int in_use;                 // guarded by rings_mutex
+    int tid;
+    struct LogRing *next;       // set before the ring is published, never changed
+    LogRecord records[LOG_RING_RECORDS];
+} LogRing;
+
+static const char *level_names[] = {"debug", "info", "warn", "error"};
+
+static int log_fd = -1;
+static int min_level = LOG_INFO;
+static _Atomic(LogRing *) rings;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread LogRing *thread_ring;
+static uint64_t dropped_reported;
+
+// ==================== Producer Side ====================
+
+// Thread exit: the next thread reuses the ring; records still queued are flushed as usual
+static void ring_release(void *arg) {
+    LogRing *ring = arg;
+
+    pthread_mutex_lock(&rings_mutex); // Lock the ring list mutex
+    ring->in_use = 0;
+    pthread_mutex_unlock(&rings_mutex); // Unlock the mutex
+}
+
+// Only a thread's first record takes the list mutex
+static LogRing *ring_get(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    pthread_mutex_lock(&rings_mutex); // Lock the ring list mutex
+    LogRing *ring = atomic_load(&rings);
+    while (ring && ring->in_use) {
+        ring = ring->next;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(LogRing));
+        if (!ring) {
+            pthread_mutex_unlock(&rings_mutex); // Unlock the mutex before returning
+            return NULL;
+        }
+        ring->next = atomic_load(&rings);
+        atomic_store(&rings, ring); // publish to the flusher
+    }
+    ring->in_use = 1;
+    ring->tid = (int)syscall(SYS_gettid);
+    pthread_mutex_unlock(&rings_mutex); // Unlock the mutex
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void log_write(int level, const char *format, ...) {
+    if (level < min_level) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    LogRing *ring = log_fd == -1 ? NULL : ring_get();
+    if (!ring) {
+        // Not started yet (or out of memory): write synchronously
+        char text[LOG_RECORD_TEXT];
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        fprintf(stderr, "%s\n", text);
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == LOG_RING_RECORDS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    LogRecord *record = &ring->records[head % LOG_RING_RECORDS];
+    record->time_ns = wall_ns();
+    record->level = level;
+    record->tid = ring->tid;
+    vsnprintf(record->text, sizeof(record->text), format, args);
+    va_end(args);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// ==================== Flusher ====================
+
+static int is_secret_key(const char *key, size_t len) {
+    static const char *secrets[] = {"password", "passwd", "token", "secret"};
+
+    for (size_t i = 0; i < sizeof(secrets) / sizeof(secrets[0]); i++) {
+        size_t n = strlen(secrets[i]);
+        if (len >= n && strncasecmp(key + len - n, secrets[i], n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Copy text into out with the value after every "<secret>=" or "<secret>: "
+// replaced, quoting and escaping it for logfmt
+static size_t format_message(const char *text, char *out, size_t size) {
+    size_t len = 0;
+    const char *word = text; // start of the current key candidate
+
+    for (const char *p = text; *p && len + 16 < size; p++) {
+        int separator = *p == '=' || (*p == ':' && p[1] == ' ');
+        if (separator && is_secret_key(word, p - word)) {
+            len += snprintf(out + len, size - len, "%s[REDACTED]", *p == '=' ? "=" : ": ");
+            p += *p == '=' ? 1 : 2;
+            while (*p && *p != ' ' && *p != ',') {
+                p++;
+            }
+            p--;
+            word = p + 1;
+            continue;
+        }
+        if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') && *p != '_') {
+            word = p + 1;
+        }
+        if (*p == '"' || *p == '\\') {
+            out[len++] = '\\';
+            out[len++] = *p;
+        } else if (*p == '\n') {
+            out[len++] = ' ';
+        } else {
+            out[len++] = *p;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static size_t format_line(const LogRecord *record, char *out, size_t size) {
+    char message[2 * LOG_RECORD_TEXT];
+    time_t seconds = record->time_ns / 1000000000ULL;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    format_message(record->text, message, sizeof(message));
+    return snprintf(out, size, "ts=%04d-%02d-%02dT%02d:%02d:%02d.%06uZ level=%s tid=%d msg=\"%s\"\n",
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                    (unsigned int)(record->time_ns % 1000000000ULL / 1000),
+                    level_names[record->level], record->tid, message);
+}
+
+static void write_batch(const char *batch, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(log_fd, batch, len);
+        if (n <= 0) {
+            return; // nowhere to report it
+        }
+        batch += n;
+        len -= n;
+    }
+}
+
+void log_flush(void) {
+    static char batch[LOG_BATCH_SIZE];
+    char line[3 * LOG_RECORD_TEXT];
+    size_t len = 0;
+
+    if (log_fd == -1) {
+        return;
+    }
+
+    pthread_mutex_lock(&flush_mutex); // Lock the flush mutex (the single consumer)
+
+    for (LogRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            size_t n = format_line(&ring->records[tail % LOG_RING_RECORDS], line, sizeof(line));
+            if (len + n > sizeof(batch)) {
+                write_batch(batch, len);
+                len = 0;
+            }
+            memcpy(batch + len, line, n);
+            len += n;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    // Report drops once per flush, as a record of the flusher's own
+    uint64_t dropped = log_dropped();
+    if (dropped > dropped_reported) {
+        LogRecord record = {wall_ns(), LOG_WARN, (int)syscall(SYS_gettid), ""};
+        snprintf(record.text, sizeof(record.text), "dropped %llu log records (ring full)",
+                 (unsigned long long)(dropped - dropped_reported));
+        dropped_reported = dropped;
+        size_t n = format_line(&record, line, sizeof(line));
+        if (len + n > sizeof(batch)) {
+            write_batch(batch, len);
+            len = 0;
+        }
+        memcpy(batch + len, line, n);
+        len += n;
+    }
+
+    write_batch(batch, len);
+    pthread_mutex_unlock(&flush_mutex); // Unlock the mutex
+}
+
+uint64_t log_dropped(void) {
+    uint64_t total = 0;
+    for (LogRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+        total += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return total;
+}
+
+static void *flusher_thread(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        log_flush();
+    }
+    return NULL;
+}
+
+int log_level_parse(const char *name) {
+    for (int level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (strcmp(name, level_names[level]) == 0) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+int log_init(const char *path, int level) {
+    int fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1 || pthread_key_create(&ring_key, ring_release) != 0) {
+        return -1;
+    }
+
+    min_level = level;
+    log_fd = fd;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, flusher_thread, NULL) != 0) {
+        log_fd = -1;
+        return -1;
+    }
+    pthread_detach(tid);
+    atexit(log_flush); // records queued before exit() still reach the file
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "utils.h"
+#include "pagination.h"
+
+#include <stdint.h>
+#include <time.h>
+
+extern int send_message(int socket, const char *message);
+extern int receive_message(int socket, char *buffer, int size);
+
+// Room left at the end of a page message for the token and prompt
+#define PAGE_FOOTER_RESERVE (2 * MAX_NAME_LEN + 128)
+
+// ==================== Cursor Tokens ====================
+// A token is the hex-encoded last key followed by a keyed hash over the
+// listing kind, scope and key, so clients cannot forge a cursor into a
+// listing they were not given. The key changes on every server start.
+
+static pthread_once_t token_secret_once = PTHREAD_ONCE_INIT;
+static uint64_t token_secret;
+
+static void token_secret_init(void) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1 || read(fd, &token_secret, sizeof(token_secret)) != sizeof(token_secret)) {
+        token_secret = (uint64_t)time(NULL) * 6364136223846793005ULL ^ (uint64_t)getpid();
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+static uint32_t token_mac(char kind, const char *scope, const char *key) {
+    uint64_t hash = 14695981039346656037ULL ^ token_secret;
+    const char *parts[] = {scope, key};
+
+    hash = (hash ^ (unsigned char)kind) * 1099511628211ULL;
+    for (int i = 0; i < 2; i++) {
+        for (const char *p = parts[i]; *p; p++) {
+            hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0xff) * 1099511628211ULL; // separator
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static void token_encode(const Page *page, const char *key, char *token, size_t size) {
+    size_t len = 0;
+    for (const char *p = key; *p && len + 2 < size; p++) {
+        len += snprintf(token + len, size - len, "%02x", (unsigned char)*p);
+    }
+    snprintf(token + len, size - len, ".%08x", token_mac(page->listing->kind, page->scope, key));
+}
+
+static int token_decode(const Page *page, const char *token, char *key, size_t size) {
+    const char *dot = strchr(token, '.');
+    if (!dot || (dot - token) % 2 != 0 || (size_t)(dot - token) / 2 >= size) {
+        return -1;
+    }
+
+    size_t len = 0;
+    for (const char *p = token; p < dot; p += 2) {
+        unsigned int byte;
+        if (sscanf(p, "%2x", &byte) != 1 || byte == 0) {
+            return -1;
+        }
+        key[len++] = (char)byte;
+    }
+    key[len] = '\0';
+
+    unsigned int mac;
+    if (sscanf(dot + 1, "%8x", &mac) != 1 || mac != token_mac(page->listing->kind, page->scope, key)) {
+        return -1;
+    }
+    return 0;
+}
+
+// ==================== Pages ====================
+
+int page_begin(Page *page, Arena *arena, const Listing *listing, const char *scope) {
+    pthread_once(&token_secret_once, token_secret_init);
+
+    memset(page, 0, sizeof(*page));
+    page->listing = listing;
+    page->arena = arena;
+    page->scope = scope;
+    page->records = arena_alloc(arena, LISTING_PAGE_SIZE * listing->record_size);
+    return page->records ? 0 : -1;
+}
+
+static char *page_record(const Page *page, size_t i) {
+    return page->records + i * page->listing->record_size;
+}
+
+void page_offer(Page *page, const void *record) {
+    const Listing *listing = page->listing;
+    const char *key = listing->key(record);
+
+    if (page->after[0] && strcmp(key, page->after) <= 0) {
+        return; // already sent
+    }
+
+    // Insertion into a small sorted array; equal keys are kept once
+    size_t pos = page->count;
+    while (pos > 0) {
+        int cmp = strcmp(key, listing->key(page_record(page, pos - 1)));
+        if (cmp == 0) {
+            return;
+        }
+        if (cmp > 0) {
+            break;
+        }
+        pos--;
+    }
+
+    if (page->count == LISTING_PAGE_SIZE) {
+        page->more = 1;
+        if (pos == LISTING_PAGE_SIZE) {
+            return; // sorts after the whole page
+        }
+        page->count--; // the last record moves to a later page
+    }
+    memmove(page_record(page, pos + 1), page_record(page, pos), (page->count - pos) * listing->record_size);
+    memcpy(page_record(page, pos), record, listing->record_size);
+    page->count++;
+}
+
+void page_merge(Page *page, const Page *other) {
+    for (size_t i = 0; i < other->count; i++) {
+        page_offer(page, page_record(other, i));
+    }
+    page->more |= other->more;
+}
+
+int page_send(int client_socket, Page *page) {
+    const Listing *listing = page->listing;
+    char text[BUFFER_SIZE]; // one message, so the page arrives in a single client read
+    char row[BUFFER_SIZE];
+    size_t len, sent = 0;
+
+    len = snprintf(text, sizeof(text), "\n=== %s ===\n%s\n", listing->title, listing->columns);
+
+    for (; sent < page->count; sent++) {
+        listing->format(page_record(page, sent), row, sizeof(row));
+        size_t row_len = strlen(row);
+        if (len + row_len + PAGE_FOOTER_RESERVE >= sizeof(text)) {
+            page->more = 1; // the rest goes on the next page
+            break;
+        }
+        memcpy(text + len, row, row_len + 1);
+        len += row_len;
+    }
+
+    if (page->count == 0 && !page->after[0]) {
+        len += snprintf(text + len, sizeof(text) - len, "%s", listing->empty_message);
+    }
+
+    int more = page->more && sent > 0;
+    char last_key[MAX_NAME_LEN];
+    if (more) {
+        snprintf(last_key, sizeof(last_key), "%s", listing->key(page_record(page, sent - 1)));
+    }
+    if (more && !page->all) {
+        char token[2 * MAX_NAME_LEN + 16];
+        token_encode(page, last_key, token, sizeof(token));
+        snprintf(text + len, sizeof(text) - len, "%s%s\n%s", PAGE_TOKEN_LABEL, token, PAGE_PROMPT);
+    }
+    int delivered = send_message(client_socket, text) == 0;
+
+    page->count = 0;
+    page->more = 0;
+    if (!more || !delivered) { // no one is left to read further pages
+        return 0;
+    }
+    if (page->all) {
+        strcpy(page->after, last_key);
+        return 1;
+    }
+
+    // Any token of this listing is accepted, so a page can be fetched again
+    char reply[BUFFER_SIZE];
+    if (receive_message(client_socket, reply, sizeof(reply)) <= 0 || strcmp(reply, "-") == 0) {
+        return 0;
+    }
+    if (strcmp(reply, PAGE_ALL) == 0) {
+        page->all = 1;
+        strcpy(page->after, last_key);
+        return 1;
+    }
+    if (token_decode(page, reply, page->after, sizeof(page->after)) == -1) {
+        send_message(client_socket, "Invalid page token.\n");
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,126 @@
+#include "ratelimit.h"
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    char key[RATE_KEY_LEN];         // empty when unused
+    int bucket_class;
+    double tokens;
+    uint64_t updated_us;            // last refill
+} RateBucket;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    RateBucket buckets[RATE_WAYS];
+} RateSet;
+
+typedef struct {
+    double rate;                    // tokens per second; 0 disables the class
+    double burst;
+} RateLimit;
+
+static RateSet sets[RATE_SETS];
+static RateLimit limits[RATE_CLASS_COUNT];
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// FNV-1a over the class and the key
+static unsigned int rate_hash(int bucket_class, const char *key) {
+    unsigned int hash = 2166136261u ^ (unsigned int)bucket_class;
+    for (const char *p = key; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+int rate_limit_configure(int bucket_class, const char *spec) {
+    char *end;
+    double rate = strtod(spec, &end);
+    double burst = rate;
+
+    if (end == spec || rate <= 0) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char *burst_spec = end + 1;
+        burst = strtod(burst_spec, &end);
+        if (end == burst_spec || burst < 1) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    if (burst < 1) {
+        burst = 1; // a bucket must be able to hold the token it hands out
+    }
+
+    // Called while parsing options, before any thread exists
+    static int sets_ready;
+    if (!sets_ready) {
+        for (int i = 0; i < RATE_SETS; i++) {
+            pthread_mutex_init(&sets[i].mutex, NULL);
+        }
+        sets_ready = 1;
+    }
+    limits[bucket_class].rate = rate;
+    limits[bucket_class].burst = burst;
+    return 0;
+}
+
+int rate_limit_enabled(int bucket_class) {
+    return limits[bucket_class].rate > 0;
+}
+
+unsigned int rate_limit_take(int bucket_class, const char *key) {
+    const RateLimit *limit = &limits[bucket_class];
+    if (limit->rate <= 0) {
+        return 0;
+    }
+
+    RateSet *set = &sets[rate_hash(bucket_class, key) % RATE_SETS];
+    uint64_t now = monotonic_us();
+    unsigned int wait_ms = 0;
+
+    pthread_mutex_lock(&set->mutex); // Lock the set mutex
+    RateBucket *bucket = NULL;
+    RateBucket *victim = &set->buckets[0];
+    for (int way = 0; way < RATE_WAYS; way++) {
+        RateBucket *candidate = &set->buckets[way];
+        if (candidate->key[0] && candidate->bucket_class == bucket_class &&
+            strncmp(candidate->key, key, RATE_KEY_LEN - 1) == 0) {
+            bucket = candidate;
+            break;
+        }
+        // Prefer a free entry, then the one used longest ago
+        if (victim->key[0] && (!candidate->key[0] || candidate->updated_us < victim->updated_us)) {
+            victim = candidate;
+        }
+    }
+
+    if (bucket) {
+        bucket->tokens += (now - bucket->updated_us) / 1e6 * limit->rate;
+        if (bucket->tokens > limit->burst) {
+            bucket->tokens = limit->burst;
+        }
+    } else {
+        bucket = victim;
+        snprintf(bucket->key, RATE_KEY_LEN, "%s", key);
+        bucket->bucket_class = bucket_class;
+        bucket->tokens = limit->burst;
+    }
+    bucket->updated_us = now;
+
+    if (bucket->tokens >= 1) {
+        bucket->tokens -= 1;
+    } else {
+        wait_ms = (unsigned int)((1 - bucket->tokens) / limit->rate * 1000) + 1;
+    }
+    pthread_mutex_unlock(&set->mutex); // Unlock the mutex
+    return wait_ms;
+}
@@ -0,0 +1,477 @@
+#include "../includes/utils.h"
+#include "capture.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Capture replay. Reads a file written by academia_server --capture and
+// re-drives every captured session against a server, each on its own
+// connection and thread. Sessions start at their captured offsets divided
+// by --speed; with --speed max they start as soon as no more sessions are
+// running than were open when they were captured. Within a session each
+// message is sent at its scaled offset, but never before the reply to the
+// previous one has arrived.
+//
+// A reply's latency is the time until its last byte. The captured value
+// is measured by the server (message received to last send) and the
+// replayed one by this tool, so the loopback round trip is included on
+// the replay side only. Run it against a copy of the data directory the
+// capture started from; otherwise replies differ in size and are ended by
+// REPLAY_IDLE_MS of silence instead.
+
+#define REPLAY_TIMEOUT_SECONDS 30
+#define REPLAY_IDLE_MS 100
+#define REPLAY_RAW_GAP_US 20000         // kept between unanswered messages of a raw session
+#define REPLAY_SLOWER_FACTOR 2.0
+
+typedef struct {
+    uint64_t time_us;
+    const char *data;
+    size_t len;
+    int answered;
+    uint64_t reply_bytes;
+    double captured;                    // seconds, from the capture
+    double replayed;                    // seconds, -1 when not measured
+} Message;
+
+typedef struct {
+    int present;
+    uint64_t open_us;
+    uint64_t close_us;                  // UINT64_MAX when the capture ended first
+    int concurrency;                    // sessions open when this one opened, itself included
+    Message *messages;
+    int count;
+    int capacity;
+    int mismatched;                     // replies of a different size
+    int failed;
+    pthread_t thread;
+    int started;
+} Session;
+
+static int port = PORT;
+static double speed = 1.0;              // 0 for as fast as possible
+static Session *sessions;
+static int session_count;
+static double replay_started;
+static int active;
+static pthread_mutex_t active_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t active_changed = PTHREAD_COND_INITIALIZER;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double when) {
+    double delay = when - now_seconds();
+    if (delay > 0) {
+        struct timespec ts = {(time_t)delay, (long)((delay - (time_t)delay) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// ==================== Capture Loading ====================
+
+static Session *session_get(uint32_t id) {
+    if ((int)id >= session_count) {
+        int count = id + 1;
+        Session *grown = realloc(sessions, count * sizeof(Session));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + session_count, 0, (count - session_count) * sizeof(Session));
+        sessions = grown;
+        session_count = count;
+    }
+    return &sessions[id];
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Concurrency at each session's start: sessions opened so far minus those
+// already closed. Session ids follow accept order.
+static int count_concurrency(void) {
+    uint64_t *closes = malloc((session_count + 1) * sizeof(uint64_t));
+    if (!closes) {
+        return -1;
+    }
+    int n = 0;
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].present) {
+            closes[n++] = sessions[i].close_us;
+        }
+    }
+    qsort(closes, n, sizeof(uint64_t), compare_u64);
+
+    int opened = 0, closed = 0;
+    for (int i = 0; i < session_count; i++) {
+        if (!sessions[i].present) {
+            continue;
+        }
+        opened++;
+        while (closed < n && closes[closed] <= sessions[i].open_us) {
+            closed++;
+        }
+        sessions[i].concurrency = opened - closed;
+    }
+    free(closes);
+    return 0;
+}
+
+// The file is read into memory once; messages point into it
+static int load_capture(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        return -1;
+    }
+    char *buf = malloc(st.st_size + 1);
+    if (!buf || read(fd, buf, st.st_size) != st.st_size) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (st.st_size < CAPTURE_MAGIC_LEN || memcmp(buf, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return -1;
+    }
+
+    size_t pos = CAPTURE_MAGIC_LEN;
+    while (pos + sizeof(CaptureRecord) <= (size_t)st.st_size) {
+        CaptureRecord record;
+        memcpy(&record, buf + pos, sizeof(record));
+        size_t payload = record.type == CAPTURE_DATA ? record.length : 0;
+        if (pos + sizeof(record) + payload > (size_t)st.st_size) {
+            break; // the server stopped mid-record
+        }
+
+        Session *session = session_get(record.session);
+        if (!session) {
+            return -1;
+        }
+        if (record.type == CAPTURE_OPEN) {
+            session->present = 1;
+            session->open_us = record.time_us;
+            session->close_us = UINT64_MAX;
+        } else if (record.type == CAPTURE_DATA && session->present) {
+            if (session->count == session->capacity) {
+                session->capacity = session->capacity ? 2 * session->capacity : 16;
+                Message *grown = realloc(session->messages, session->capacity * sizeof(Message));
+                if (!grown) {
+                    return -1;
+                }
+                session->messages = grown;
+            }
+            Message *message = &session->messages[session->count++];
+            memset(message, 0, sizeof(*message));
+            message->time_us = record.time_us;
+            message->data = buf + pos + sizeof(record);
+            message->len = payload;
+            message->replayed = -1;
+        } else if (record.type == CAPTURE_REPLY && session->count > 0) {
+            Message *message = &session->messages[session->count - 1];
+            message->answered = 1;
+            message->reply_bytes = record.length;
+            message->captured = (record.time_us - message->time_us) / 1e6;
+        } else if (record.type == CAPTURE_CLOSE) {
+            session->close_us = record.time_us;
+        }
+        pos += sizeof(record) + payload;
+    }
+    return count_concurrency();
+}
+
+// ==================== Replay ====================
+
+static int session_connect(void) {
+    struct sockaddr_in addr;
+    struct timeval timeout = {REPLAY_TIMEOUT_SECONDS, 0};
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(port);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int send_all(int sock, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read the reply to a message: the captured byte count, or whatever
+// arrives until REPLAY_IDLE_MS of silence. Returns the seconds until its
+// last byte, or -1 when nothing arrived.
+static double read_reply(int sock, uint64_t expected, double sent, uint64_t *received) {
+    char buffer[BUFFER_SIZE];
+    double last = -1;
+    *received = 0;
+
+    while (*received < expected) {
+        struct pollfd pfd = {sock, POLLIN, 0};
+        int wait_ms = last < 0 ? REPLAY_TIMEOUT_SECONDS * 1000 : REPLAY_IDLE_MS;
+        if (poll(&pfd, 1, wait_ms) <= 0) {
+            break;
+        }
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        *received += n;
+        last = now_seconds();
+    }
+    return last < 0 ? -1 : last - sent;
+}
+
+// Bytes nobody waits for (the reply to an unanswered message, or one
+// longer than captured) are discarded before the next send
+static void drain(int sock) {
+    char buffer[BUFFER_SIZE];
+    while (recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+    }
+}
+
+static void *session_thread(void *arg) {
+    Session *session = arg;
+    int sock = session_connect();
+    double opened = now_seconds();
+    double previous_send = 0;
+    int raw = session->count > 0 && !memchr(session->messages[0].data, '\n', session->messages[0].len);
+
+    if (sock == -1) {
+        session->failed = 1;
+    }
+    for (int i = 0; sock != -1 && i < session->count; i++) {
+        Message *message = &session->messages[i];
+        double when = opened;
+        if (speed > 0) {
+            when += (message->time_us - session->open_us) / 1e6 / speed;
+        }
+        // A raw server reads each recv as one message, so unanswered
+        // messages (role, then ID) must not arrive together
+        if (raw && i > 0 && !session->messages[i - 1].answered && when < previous_send + REPLAY_RAW_GAP_US / 1e6) {
+            when = previous_send + REPLAY_RAW_GAP_US / 1e6;
+        }
+        sleep_until(when);
+
+        drain(sock);
+        previous_send = now_seconds();
+        if (send_all(sock, message->data, message->len) == -1) {
+            session->failed = 1;
+            break;
+        }
+        if (message->answered) {
+            uint64_t received;
+            message->replayed = read_reply(sock, message->reply_bytes, previous_send, &received);
+            if (received != message->reply_bytes) {
+                session->mismatched++;
+            }
+            if (message->replayed < 0) {
+                session->failed = 1;
+                break;
+            }
+        }
+    }
+
+    if (sock != -1) {
+        if (speed > 0 && session->close_us != UINT64_MAX) {
+            sleep_until(opened + (session->close_us - session->open_us) / 1e6 / speed);
+        }
+        close(sock);
+    }
+
+    pthread_mutex_lock(&active_mutex); // Lock the active count mutex
+    active--;
+    pthread_cond_broadcast(&active_changed);
+    pthread_mutex_unlock(&active_mutex); // Unlock the mutex
+    return NULL;
+}
+
+static void run_replay(void) {
+    replay_started = now_seconds();
+
+    for (int i = 0; i < session_count; i++) {
+        Session *session = &sessions[i];
+        if (!session->present) {
+            continue;
+        }
+
+        if (speed > 0) {
+            sleep_until(replay_started + session->open_us / 1e6 / speed);
+        }
+
+        pthread_mutex_lock(&active_mutex); // Lock the active count mutex
+        while (speed == 0 && active >= session->concurrency) {
+            pthread_cond_wait(&active_changed, &active_mutex);
+        }
+        active++;
+        pthread_mutex_unlock(&active_mutex); // Unlock the mutex
+
+        if (pthread_create(&session->thread, NULL, session_thread, session) != 0) {
+            perror("pthread_create");
+            session->failed = 1;
+            pthread_mutex_lock(&active_mutex); // Lock the active count mutex
+            active--;
+            pthread_mutex_unlock(&active_mutex); // Unlock the mutex
+            continue;
+        }
+        session->started = 1;
+    }
+
+    for (int i = 0; i < session_count; i++) {
+        if (sessions[i].started) {
+            pthread_join(sessions[i].thread, NULL);
+        }
+    }
+}
+
+// ==================== Report ====================
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_distribution(const char *label, double *values, long count) {
+    double sum = 0;
+    qsort(values, count, sizeof(double), compare_double);
+    for (long i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    printf("%-10s mean %8.2f ms  p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n", label,
+           sum / count * 1000, values[count / 2] * 1000, values[count * 90 / 100] * 1000,
+           values[count * 99 / 100] * 1000, values[count - 1] * 1000);
+}
+
+static int report(double elapsed) {
+    long messages = 0, answered = 0, measured = 0, slower = 0, mismatched = 0;
+    int present = 0, failed = 0, peak = 0;
+    uint64_t span_us = 0;
+
+    for (int i = 0; i < session_count; i++) {
+        Session *session = &sessions[i];
+        if (!session->present) {
+            continue;
+        }
+        present++;
+        failed += session->failed;
+        mismatched += session->mismatched;
+        peak = session->concurrency > peak ? session->concurrency : peak;
+        messages += session->count;
+        for (int m = 0; m < session->count; m++) {
+            answered += session->messages[m].answered;
+            if (session->messages[m].time_us > span_us) {
+                span_us = session->messages[m].time_us;
+            }
+        }
+    }
+
+    double *captured = malloc((answered + 1) * sizeof(double));
+    double *replayed = malloc((answered + 1) * sizeof(double));
+    if (!captured || !replayed) {
+        free(captured);
+        free(replayed);
+        return -1;
+    }
+    for (int i = 0; i < session_count; i++) {
+        for (int m = 0; m < sessions[i].count; m++) {
+            Message *message = &sessions[i].messages[m];
+            if (message->answered && message->replayed >= 0) {
+                captured[measured] = message->captured;
+                replayed[measured] = message->replayed;
+                slower += message->replayed > message->captured * REPLAY_SLOWER_FACTOR + 0.001;
+                measured++;
+            }
+        }
+    }
+
+    printf("=== Replay ===\n");
+    if (speed > 0) {
+        printf("Speed: %gx\n", speed);
+    } else {
+        printf("Speed: max\n");
+    }
+    printf("Sessions: %d (peak concurrency %d), failed: %d\n", present, peak, failed);
+    printf("Messages: %ld, answered: %ld, measured: %ld\n", messages, answered, measured);
+    printf("Wall time: %.2f s (captured span %.2f s)\n", elapsed, span_us / 1e6);
+    if (measured > 0) {
+        printf("\n=== Reply Latency ===\n");
+        print_distribution("captured", captured, measured);
+        print_distribution("replayed", replayed, measured);
+        printf("Slower than %.0fx captured (+1 ms): %ld of %ld\n", REPLAY_SLOWER_FACTOR, slower, measured);
+    }
+    if (mismatched > 0) {
+        printf("Replies of a different size: %ld (data differs from the captured run)\n", mismatched);
+    }
+
+    free(captured);
+    free(replayed);
+    return failed ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--port PORT] [--speed N|max] CAPTURE\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--port") == 0 && has_value) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && has_value) {
+            i++;
+            speed = strcmp(argv[i], "max") == 0 ? 0 : atof(argv[i]);
+            if (speed <= 0 && strcmp(argv[i], "max") != 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (load_capture(path) == -1) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN); // a session the server closed early is reported, not fatal
+
+    double started = now_seconds();
+    run_replay();
+    return report(now_seconds() - started) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+#include "utils.h"
+#include "file_operations.h"
+#include "replication.h"
+#include "snapshot.h"
+#include "log.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+
+#define REPL_SYNC_BEGIN 1 // table = number of tables that follow
+#define REPL_TABLE_DATA 2 // full-sync bytes of one table
+#define REPL_SYNC_END 3   // full sync complete, swap the tables in
+#define REPL_CHANGE 4     // one committed change
+
+#define REPL_CHUNK_SIZE (64 * 1024)
+#define REPL_MAX_QUEUED (64 * 1024 * 1024) // a replica further behind is dropped and resyncs
+#define REPL_RETRY_SECONDS 1
+#define MAX_REPLICAS 4 // listen backlog
+
+typedef struct {
+    uint32_t type;
+    uint32_t table;
+    uint64_t lsn;
+    int64_t offset;
+    int64_t size;   // table size after the message is applied
+    uint64_t length; // payload bytes that follow
+} ReplMessage;
+
+typedef struct ReplItem {
+    struct ReplItem *next;
+    ReplMessage header;
+    char data[];
+} ReplItem;
+
+typedef struct Replica {
+    int socket;
+    Snapshot *snapshot;     // full-sync source, released once sent
+    ReplItem *head, *tail;  // changes committed after the snapshot
+    size_t queued_bytes;
+    int dropped;
+    pthread_cond_t cond;
+    struct Replica *next;
+} Replica;
+
+// Lock order: table mutexes, then replicas_mutex
+static pthread_mutex_t replicas_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Replica *replicas = NULL;
+
+static volatile int read_only = 0;
+static volatile int promoted = 0;
+static volatile int primary_socket = -1;
+static char primary_host[256];
+static int primary_port;
+
+// ==================== Socket Helpers ====================
+
+static int send_all(int socket, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(socket, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int socket, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(socket, p, len, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_message_frame(int socket, ReplMessage *header, const void *data) {
+    if (send_all(socket, header, sizeof(*header)) == -1) {
+        return -1;
+    }
+    return header->length ? send_all(socket, data, header->length) : 0;
+}
+
+// ==================== Primary Side ====================
+
+void replication_publish(int table, uint64_t lsn, off_t offset, const void *data, size_t len, off_t new_size) {
+    if (!__atomic_load_n(&replicas, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    pthread_mutex_lock(&replicas_mutex);
+    for (Replica *replica = replicas; replica; replica = replica->next) {
+        if (replica->dropped) {
+            continue;
+        }
+
+        ReplItem *item = NULL;
+        if (replica->queued_bytes + len <= REPL_MAX_QUEUED) {
+            item = malloc(sizeof(ReplItem) + len);
+        }
+        if (!item) {
+            // Too far behind: cut it off, it will reconnect and resync
+            replica->dropped = 1;
+            shutdown(replica->socket, SHUT_RDWR);
+            pthread_cond_signal(&replica->cond);
+            continue;
+        }
+
+        item->next = NULL;
+        item->header = (ReplMessage){REPL_CHANGE, table, lsn, offset, new_size, len};
+        memcpy(item->data, data, len);
+
+        if (replica->tail) {
+            replica->tail->next = item;
+        } else {
+            replica->head = item;
+        }
+        replica->tail = item;
+        replica->queued_bytes += len;
+        pthread_cond_signal(&replica->cond);
+    }
+    pthread_mutex_unlock(&replicas_mutex);
+}
+
+static int send_full_sync(Replica *replica) {
+    ReplMessage header = {REPL_SYNC_BEGIN, table_count(), 0, 0, 0, 0};
+    if (send_message_frame(replica->socket, &header, NULL) == -1) {
+        return -1;
+    }
+
+    char *chunk = malloc(REPL_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+
+    int result = 0;
+    for (int t = 0; t < table_count() && result == 0; t++) {
+        off_t size = snapshot_table_size(replica->snapshot, t);
+        off_t offset = 0;
+        do {
+            ssize_t got = snapshot_read(replica->snapshot, t, offset, chunk, REPL_CHUNK_SIZE);
+            if (got < 0) {
+                result = -1;
+                break;
+            }
+            header = (ReplMessage){REPL_TABLE_DATA, t, 0, offset, size, got};
+            result = send_message_frame(replica->socket, &header, chunk);
+            offset += got;
+        } while (result == 0 && offset < size);
+    }
+    free(chunk);
+
+    header = (ReplMessage){REPL_SYNC_END, 0, 0, 0, 0, 0};
+    return result == 0 ? send_message_frame(replica->socket, &header, NULL) : -1;
+}
+
+static void *replica_sender_thread(void *arg) {
+    Replica *replica = arg;
+
+    int result = send_full_sync(replica);
+    snapshot_release(replica->snapshot);
+    replica->snapshot = NULL;
+
+    while (result == 0) {
+        pthread_mutex_lock(&replicas_mutex);
+        while (!replica->head && !replica->dropped) {
+            pthread_cond_wait(&replica->cond, &replicas_mutex);
+        }
+        ReplItem *item = replica->dropped ? NULL : replica->head;
+        if (item) {
+            replica->head = item->next;
+            if (!replica->head) {
+                replica->tail = NULL;
+            }
+            replica->queued_bytes -= item->header.length;
+        }
+        pthread_mutex_unlock(&replicas_mutex);
+
+        if (!item) {
+            break;
+        }
+        result = send_message_frame(replica->socket, &item->header, item->data);
+        free(item);
+    }
+
+    // Unlink and free everything still queued
+    pthread_mutex_lock(&replicas_mutex);
+    for (Replica **link = &replicas; *link; link = &(*link)->next) {
+        if (*link == replica) {
+            *link = replica->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&replicas_mutex);
+
+    while (replica->head) {
+        ReplItem *next = replica->head->next;
+        free(replica->head);
+        replica->head = next;
+    }
+    close(replica->socket);
+    pthread_cond_destroy(&replica->cond);
+    free(replica);
+
+    log_info("replication: replica disconnected");
+    return NULL;
+}
+
+static void *replication_listener_thread(void *arg) {
+    int server_fd = (int)(intptr_t)arg;
+
+    while (1) {
+        struct sockaddr_in address;
+        socklen_t addrlen = sizeof(address);
+        int socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+        if (socket < 0) {
+            log_warn("replication accept failed: %s", strerror(errno));
+            continue;
+        }
+
+        Replica *replica = calloc(1, sizeof(Replica));
+        if (!replica) {
+            close(socket);
+            continue;
+        }
+        replica->socket = socket;
+        pthread_cond_init(&replica->cond, NULL);
+
+        // The snapshot and the subscription start at the same instant: no
+        // change can be published while every table mutex is held
+        lock_all_tables();
+        replica->snapshot = snapshot_create_locked();
+        if (replica->snapshot) {
+            pthread_mutex_lock(&replicas_mutex);
+            replica->next = replicas;
+            __atomic_store_n(&replicas, replica, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&replicas_mutex);
+        }
+        unlock_all_tables();
+
+        pthread_t tid;
+        if (replica->snapshot && pthread_create(&tid, NULL, replica_sender_thread, replica) != 0) {
+            pthread_mutex_lock(&replicas_mutex);
+            for (Replica **link = &replicas; *link; link = &(*link)->next) {
+                if (*link == replica) {
+                    *link = replica->next;
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&replicas_mutex);
+            snapshot_release(replica->snapshot);
+            replica->snapshot = NULL;
+        }
+        if (!replica->snapshot) {
+            while (replica->head) {
+                ReplItem *next = replica->head->next;
+                free(replica->head);
+                replica->head = next;
+            }
+            close(socket);
+            pthread_cond_destroy(&replica->cond);
+            free(replica);
+            continue;
+        }
+        pthread_detach(tid);
+
+        char ip_buf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, ip_buf, sizeof(ip_buf));
+        log_info("replication: replica connected from %s:%d", ip_buf, ntohs(address.sin_port));
+    }
+    return NULL;
+}
+
+int replication_listen(int port) {
+    if (port <= 0) {
+        return 0;
+    }
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(server_fd, MAX_REPLICAS) < 0) {
+        close(server_fd);
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, replication_listener_thread, (void *)(intptr_t)server_fd) != 0) {
+        close(server_fd);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+// ==================== Replica Side ====================
+
+static void sync_path(char *buf, size_t size, int table) {
+    snprintf(buf, size, "%s.sync", table_path(table));
+}
+
+static int connect_to_primary(void) {
+    struct addrinfo hints = {0}, *result;
+    char port[16];
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", primary_port);
+    if (getaddrinfo(primary_host, port, &hints, &result) != 0) {
+        return -1;
+    }
+
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd >= 0 && connect(socket_fd, result->ai_addr, result->ai_addrlen) < 0) {
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    freeaddrinfo(result);
+    return socket_fd;
+}
+
+// Apply messages until the connection drops; returns after promotion too
+static void follow_stream(int socket) {
+    int sync_fds[MAX_TABLES];
+    int sync_tables = 0;
+    char *data = NULL;
+    size_t capacity = 0;
+    ReplMessage header;
+
+    while (!promoted && recv_all(socket, &header, sizeof(header)) == 0) {
+        if (header.length > capacity) {
+            char *grown = realloc(data, header.length);
+            if (!grown) {
+                break;
+            }
+            data = grown;
+            capacity = header.length;
+        }
+        if (header.length && recv_all(socket, data, header.length) == -1) {
+            break;
+        }
+        if (promoted) {
+            break; // never apply anything received after promotion
+        }
+
+        if (header.type == REPL_SYNC_BEGIN) {
+            if ((int)header.table != table_count()) {
+                log_error("replication: primary has %u tables, this server has %d (check --enroll-partitions)",
+                          header.table, table_count());
+                break;
+            }
+            // Build the copy beside the live tables so readers keep working
+            sync_tables = header.table;
+            for (int t = 0; t < sync_tables; t++) {
+                char path[256];
+                sync_path(path, sizeof(path), t);
+                sync_fds[t] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            }
+        } else if (header.type == REPL_TABLE_DATA && header.table < (uint32_t)sync_tables) {
+            if (sync_fds[header.table] == -1 ||
+                pwrite(sync_fds[header.table], data, header.length, header.offset) != (ssize_t)header.length) {
+                log_error("replication: sync write failed: %s", strerror(errno));
+            }
+        } else if (header.type == REPL_SYNC_END) {
+            lock_all_tables();
+            for (int t = 0; t < sync_tables; t++) {
+                char path[256];
+                sync_path(path, sizeof(path), t);
+                if (sync_fds[t] != -1) {
+                    close(sync_fds[t]);
+                }
+                table_replace(t, path, 0);
+            }
+            unlock_all_tables();
+            sync_tables = 0;
+            log_info("replication: full sync from %s:%d complete", primary_host, primary_port);
+        } else if (header.type == REPL_CHANGE && header.table < (uint32_t)table_count()) {
+            table_apply_change(header.table, header.offset, data, header.length, header.size);
+        }
+    }
+
+    for (int t = 0; t < sync_tables; t++) {
+        if (sync_fds[t] != -1) {
+            close(sync_fds[t]);
+        }
+    }
+    free(data);
+}
+
+static void *replica_follower_thread(void *arg) {
+    (void)arg;
+
+    while (!promoted) {
+        int socket = connect_to_primary();
+        if (socket < 0) {
+            sleep(REPL_RETRY_SECONDS);
+            continue;
+        }
+
+        primary_socket = socket;
+        log_info("replication: following %s:%d", primary_host, primary_port);
+        follow_stream(socket);
+        primary_socket = -1;
+        close(socket);
+
+        if (!promoted) {
+            log_warn("replication: lost primary, reconnecting");
+            sleep(REPL_RETRY_SECONDS);
+        }
+    }
+    return NULL;
+}
+
+int replication_follow(const char *host, int port) {
+    snprintf(primary_host, sizeof(primary_host), "%s", host);
+    primary_port = port;
+    read_only = 1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, replica_follower_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void replication_promote(void) {
+    if (!read_only) {
+        return;
+    }
+
+    promoted = 1;
+    int socket = primary_socket;
+    if (socket != -1) {
+        shutdown(socket, SHUT_RDWR); // wakes the follower out of recv
+    }
+    read_only = 0;
+    log_info("replication: promoted to primary");
+}
+
+int replication_is_read_only(void) {
+    return read_only;
+}
@@ -1,6 +1,19 @@
 #include "../includes/utils.h"
 #include "handler.h"
 #include "file_operations.h"
+#include "checkpoint.h"
+#include "storage.h"
+#include "replication.h"
+#include "aggregates.h"
+#include "connection.h"
+#include "trace.h"
+#include "log.h"
+#include "capture.h"
+#include "stats.h"
+#include "timer_wheel.h"
+#include "ratelimit.h"
+#include "analytics.h"
+#include "catalog.h"
 
 #include <unistd.h>      // for write(), close()
 #include <stdlib.h>
@@ -9,6 +22,12 @@
 #include <pthread.h>
 #include <stdio.h>       // for perror()
 #include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <errno.h>
+#include <stddef.h>
+#include <poll.h>
+#include <stdatomic.h>
 
 #define MAX_CLIENTS 3
 #define PORT 8080       // Define your port number here or include from a header
@@ -18,21 +37,53 @@
 pthread_mutex_t student_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t faculty_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t course_file_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t student_course_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t student_course_file_mutex[MAX_ENROLL_PARTITIONS];
+pthread_mutex_t aggregate_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Function prototypes
 void *handle_client(void *arg);
-char *authenticate_user(int client_socket, int role);
-void send_message(int socket, const char *message);
+int authenticate_user(ConnectionContext *conn);
+int send_message(int socket, const char *message);
 int receive_message(int socket, char *buffer, int size);
 
-// Helper function to write string to stdout
-void safe_write_stdout(const char *msg) {
-    write(STDOUT_FILENO, msg, strlen(msg));
+// The session served by this thread; its context holds the framing state
+static __thread ConnectionContext *session_conn;
+
+static int login_timeout = DEFAULT_LOGIN_TIMEOUT;
+static int idle_timeout = DEFAULT_IDLE_TIMEOUT;
+static int write_timeout = DEFAULT_WRITE_TIMEOUT;
+
+// Refuse a mutating operation while this server is a read-only replica
+int reject_if_read_only(int client_socket) {
+    if (!replication_is_read_only()) {
+        return 0;
+    }
+    send_message(client_socket, "This server is a read-only replica. Please use the primary server.\n");
+    return 1;
+}
+
+// Handles process signals synchronously: SIGUSR1 promotes a replica,
+// SIGUSR2 writes the trace file
+static void *signal_thread(void *arg) {
+    sigset_t *signals = arg;
+    int sig;
+
+    while (sigwait(signals, &sig) == 0) {
+        if (sig == SIGUSR1) {
+            replication_promote();
+        } else if (sig == SIGUSR2) {
+            if (trace_dump() == 0) {
+                log_info("trace written");
+            } else {
+                log_error("trace dump failed: %s", strerror(errno));
+            }
+        }
+    }
+    return NULL;
 }
 
 // Main server function
-int start_server() {
+int start_server(int port) {
     int server_fd, new_socket;
     struct sockaddr_in address;
     socklen_t addrlen = sizeof(address);
@@ -43,9 +94,13 @@ int start_server() {
         exit(EXIT_FAILURE);
     }
 
+    // Allow an immediate restart (e.g. after recovery or promotion)
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(port);
 
     // Bind socket to port
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
@@ -53,49 +108,57 @@ int start_server() {
         exit(EXIT_FAILURE);
     }
 
-    // Listen for connections
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
+    // Listen for connections; clients beyond the connection pool wait here
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    char buf[100];
-    snprintf(buf, sizeof(buf), "Server started on port %d\n", PORT);
-    safe_write_stdout(buf);
+    log_info("server started on port %d%s", port, replication_is_read_only() ? " (read-only replica)" : "");
 
     // Main server loop
     while (1) {
-        safe_write_stdout("Waiting for new connection...\n");
+        log_debug("waiting for new connection");
+
+        // Take a pooled context first, so no connection is accepted without one
+        ConnectionContext *conn = connection_acquire();
 
         // Accept new connection
         new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
         if (new_socket < 0) {
-            perror("accept");
+            log_error("accept failed: %s", strerror(errno));
+            connection_release(conn);
             continue;
         }
-
-        char ip_buf[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &(address.sin_addr), ip_buf, INET_ADDRSTRLEN);
-        snprintf(buf, sizeof(buf), "New connection from %s:%d\n", ip_buf, ntohs(address.sin_port));
-        safe_write_stdout(buf);
-
-        int *client_sock = malloc(sizeof(int));
-        if (!client_sock) {
-            perror("malloc failed");
+        conn->socket = new_socket;
+
+        // A reply is several small writes (prompt, result, REPLY_END); with
+        // Nagle each one after the first would wait for the client's ACK
+        int nodelay = 1;
+        setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        inet_ntop(AF_INET, &(address.sin_addr), conn->peer, INET_ADDRSTRLEN);
+
+        // Refuse a client that reconnects faster than --conn-limit allows
+        unsigned int wait_ms = rate_limit_take(RATE_CONNECT, conn->peer);
+        if (wait_ms > 0) {
+            stats_add(STAT_THROTTLED_CONNECTS, 1);
+            log_debug("connection from %s throttled", conn->peer);
+            snprintf(conn->send_buffer, BUFFER_SIZE, "Too many connections. Retry after %u ms.\n", wait_ms);
+            send_message(new_socket, conn->send_buffer);
             close(new_socket);
+            connection_release(conn);
             continue;
         }
-        *client_sock = new_socket;
+        log_info("new connection from %s:%d", conn->peer, ntohs(address.sin_port));
 
         // Create a new thread for each client
         pthread_t tid;
-        if (pthread_create(&tid, NULL, handle_client, (void *)client_sock) != 0) {
-            perror("could not create thread");
+        if (pthread_create(&tid, NULL, handle_client, conn) != 0) {
+            log_error("could not create thread: %s", strerror(errno));
             close(new_socket);
-            free(client_sock);
+            connection_release(conn);
             continue;
-        } else {
-            safe_write_stdout("Thread created successfully\n");
         }
 
         // Detach thread so resources are freed when it exits
@@ -107,183 +170,668 @@ int start_server() {
 
 
 
-// Client handler thread function
-void *handle_client(void *arg) {
-    safe_write_stdout("handle_client started\n");
-    fflush(stdout);
+// ==================== Session Deadlines ====================
+
+// Runs on the wheel thread, so it only marks the session and wakes its thread
+static unsigned int session_expired(TimerEntry *entry) {
+    ConnectionContext *conn = (ConnectionContext *)((char *)entry - offsetof(ConnectionContext, timer));
+
+    // Only time blocked in send counts against the write deadline, not time
+    // spent preparing the reply between sends (e.g. waiting for a lock)
+    if (conn->deadline == DEADLINE_WRITE) {
+        uint64_t limit = (uint64_t)write_timeout * 1000;
+        // The acquire pairs with the release in send_message, so a send seen
+        // as in progress is never matched with the start of an earlier one
+        uint64_t blocked = 0;
+        if (atomic_load_explicit(&conn->sending, memory_order_acquire)) {
+            uint64_t started = atomic_load_explicit(&conn->send_started_ms, memory_order_relaxed);
+            uint64_t now = timer_now_ms();
+            blocked = now > started ? now - started : 0;
+        }
+        if (blocked < limit) {
+            return limit - blocked;
+        }
+    }
+    conn->timed_out = conn->deadline;
+    shutdown(conn->socket, SHUT_RDWR);
+    return 0;
+}
+
+static void arm_deadline(ConnectionContext *conn, int deadline, int seconds) {
+    conn->deadline = deadline;
+    if (seconds > 0) {
+        timer_schedule(&conn->timer, seconds * 1000);
+    } else {
+        timer_cancel(&conn->timer);
+    }
+}
+
+// Before each recv: the rest of the login deadline, or the idle deadline
+static void arm_read_deadline(ConnectionContext *conn) {
+    if (conn->id[0]) {
+        arm_deadline(conn, DEADLINE_IDLE, idle_timeout);
+    } else if (login_timeout > 0) {
+        uint64_t now = timer_now_ms();
+        conn->deadline = DEADLINE_LOGIN;
+        timer_schedule(&conn->timer, conn->login_deadline_ms > now ? conn->login_deadline_ms - now : 1);
+    } else {
+        arm_deadline(conn, DEADLINE_NONE, 0);
+    }
+}
+
+// Record the end of the reply to the last message received
+static void capture_reply_end(ConnectionContext *conn) {
+    if (conn->reply_bytes > 0) {
+        capture_reply(conn->capture_session, conn->reply_time_us, conn->reply_bytes);
+        conn->reply_bytes = 0;
+    }
+}
 
-    int client_socket = *(int *)arg;
-    free(arg);
+static void end_session(ConnectionContext *conn) {
+    static const char *deadline_names[] = {"", "login", "idle", "write"};
 
-    char buffer[BUFFER_SIZE] = {0};
-    int role;
+    // After the cancel the wheel thread no longer touches the context
+    timer_cancel(&conn->timer);
+    if (conn->timed_out != DEADLINE_NONE) {
+        stats_add(STAT_TIMEOUT_LOGIN + conn->timed_out - DEADLINE_LOGIN, 1);
+        log_info("session closed: %s timeout, id=%s", deadline_names[conn->timed_out],
+                 conn->id[0] ? conn->id : "-");
+    }
+    stats_add(STAT_ACTIVE_SESSIONS, -1);
 
-    safe_write_stdout("waiting for my role\n");
+    if (capture_enabled()) {
+        capture_reply_end(conn);
+        capture_close(conn->capture_session);
+    }
+    close(conn->socket);
+    connection_release(conn); // the context serves the next connection
+}
 
-    int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_received <= 0) {
-        perror("recv failed or connection closed");
-        close(client_socket);
+// Client handler thread function
+void *handle_client(void *arg) {
+    TRACE_FUNCTION("session");
+    ConnectionContext *conn = arg;
+    char *buffer = conn->recv_buffer;
+
+    // Label the thread with its peer in the trace viewer
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    if (trace_enabled() && getpeername(conn->socket, (struct sockaddr *)&peer, &peer_len) == 0) {
+        char ip_buf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip_buf, INET_ADDRSTRLEN);
+        snprintf(conn->send_buffer, BUFFER_SIZE, "session %s:%d", ip_buf, ntohs(peer.sin_port));
+        trace_thread_name(conn->send_buffer);
+    }
+
+    session_conn = conn;
+    stats_add(STAT_SESSIONS, 1);
+    stats_add(STAT_ACTIVE_SESSIONS, 1);
+    timer_init(&conn->timer, session_expired);
+    conn->deadline = DEADLINE_NONE;
+    conn->timed_out = DEADLINE_NONE;
+    atomic_store_explicit(&conn->sending, 0, memory_order_relaxed);
+    conn->login_deadline_ms = timer_now_ms() + (uint64_t)login_timeout * 1000;
+    if (capture_enabled()) {
+        conn->capture_session = capture_open();
+    }
+    if (receive_message(conn->socket, buffer, BUFFER_SIZE) < 0) {
+        log_info("connection closed before login");
+        end_session(conn);
         return NULL;
     }
-    buffer[bytes_received] = '\0';
-    role = atoi(buffer);
+    conn->role = atoi(buffer);
 
-    char role_buf[50];
-    snprintf(role_buf, sizeof(role_buf), "%d is my role\n", role);
-    safe_write_stdout(role_buf);
+    log_debug("session role %d, %s framing", conn->role, conn->framing == FRAMING_LINES ? "line" : "raw");
 
     // Authenticate user
-    char *id = authenticate_user(client_socket, role);
-    if (!id) {
-        send_message(client_socket, "Authentication failed. Disconnecting...\n");
-        close(client_socket);
+    if (authenticate_user(conn) == -1) {
+        send_message(conn->socket, "Authentication failed. Disconnecting...\n");
+        end_session(conn);
         return NULL;
     }
+    finish_request(conn);
 
     // Route to appropriate handler based on role
-    switch (role) {
+    switch (conn->role) {
         case 1: // Admin
-            admin_handler(client_socket);
+            admin_handler(conn);
             break;
         case 2: // Faculty
-            faculty_handler(client_socket, id);
+            faculty_handler(conn);
             break;
         case 3: // Student
-            student_handler(client_socket, id);
+            student_handler(conn);
             break;
         default:
-            send_message(client_socket, "Invalid role. Disconnecting...\n");
+            send_message(conn->socket, "Invalid role. Disconnecting...\n");
             break;
     }
 
-    free(id); // free dynamically allocated id string
-    close(client_socket);
+    end_session(conn);
     return NULL;
 }
 
-// Authentication function
-char *authenticate_user(int client_socket, int role) {
-    char id[BUFFER_SIZE];
-    char password[BUFFER_SIZE];
+// Authentication function; stores the authenticated ID in conn->id and
+// returns 0, or returns -1
+int authenticate_user(ConnectionContext *conn) {
+    TRACE_FUNCTION("session");
+    int client_socket = conn->socket;
+    int role = conn->role;
+    char id[MAX_ID_LEN];
+    char *password = conn->recv_buffer;
 
     // Receive ID
-    if (receive_message(client_socket, id, BUFFER_SIZE) < 0) {
-        safe_write_stdout("Failed to receive ID\n");
-        return NULL;
+    if (receive_message(client_socket, conn->recv_buffer, BUFFER_SIZE) < 0) {
+        log_info("login aborted before ID");
+        return -1;
+    }
+    if (strlen(conn->recv_buffer) >= sizeof(id)) {
+        log_warn("login rejected: ID too long");
+        send_message(client_socket, "Authentication failed. Invalid credentials or inactive account.\n");
+        return -1;
     }
-    safe_write_stdout("Received ID: ");
-    safe_write_stdout(id);
-    safe_write_stdout("\n");
+    strcpy(id, conn->recv_buffer);
 
     // Receive password
     if (receive_message(client_socket, password, BUFFER_SIZE) < 0) {
-        safe_write_stdout("Failed to receive password\n");
-        return NULL;
+        log_info("login aborted before password, id=%s", id);
+        return -1;
     }
-    safe_write_stdout("Received password: ");
-    safe_write_stdout(password);
-    safe_write_stdout("\n");
 
     if (role == 1) { // Admin
         if (strcmp(id, "admin") == 0 && strcmp(password, "admin123") == 0) {
+            log_info("login succeeded, role=admin id=%s", id);
             send_message(client_socket, "Admin login successful!\n");
-            char *admin_id = malloc(strlen("admin") + 1);
-            if (admin_id) strcpy(admin_id, "admin");
-            return admin_id;
+            strcpy(conn->id, "admin");
+            return 0;
         }
     } else if (role == 2) { // Faculty
-        Faculty *faculty = find_faculty(id); // Search by ID
-        if (faculty != NULL) {
-            safe_write_stdout("Faculty found: ");
-            safe_write_stdout(faculty->faculty_id);
-            safe_write_stdout("\n");
-            if (strcmp(faculty->password, password) == 0) {
+        Faculty faculty;
+        if (find_faculty(id, &faculty) == 1) { // Search by ID
+            if (strcmp(faculty.password, password) == 0) {
+                log_info("login succeeded, role=faculty id=%s", id);
                 send_message(client_socket, "Faculty login successful!\n");
-                char *fac_id = malloc(strlen(faculty->faculty_id) + 1);
-                if (fac_id) strcpy(fac_id, faculty->faculty_id);
-                return fac_id;
+                strcpy(conn->id, faculty.faculty_id);
+                return 0;
             } else {
-                safe_write_stdout("Password mismatch for faculty ID: ");
-                safe_write_stdout(faculty->faculty_id);
-                safe_write_stdout("\n");
+                log_warn("login failed, role=faculty id=%s: wrong password", id);
             }
         } else {
-            safe_write_stdout("Faculty not found for ID: ");
-            safe_write_stdout(id);
-            safe_write_stdout("\n");
+            log_warn("login failed, role=faculty id=%s: not found", id);
         }
     } else if (role == 3) { // Student
-        Student *student = find_student(id); // Search by ID
-        if (student != NULL) {
-            safe_write_stdout("Student found: ");
-            safe_write_stdout(student->student_id);
-            safe_write_stdout("\n");
-            if (strcmp(student->password, password) == 0 && student->is_active) {
+        Student student;
+        if (find_student(id, &student) == 1) { // Search by ID
+            if (strcmp(student.password, password) == 0 && student.is_active) {
+                log_info("login succeeded, role=student id=%s", id);
                 send_message(client_socket, "Student login successful!\n");
-                char *stud_id = malloc(strlen(student->student_id) + 1);
-                if (stud_id) strcpy(stud_id, student->student_id);
-                return stud_id;
-            } else if (!student->is_active) {
-                safe_write_stdout("Student account is inactive\n");
+                strcpy(conn->id, student.student_id);
+                return 0;
+            } else if (!student.is_active) {
+                log_warn("login failed, role=student id=%s: account inactive", id);
             } else {
-                safe_write_stdout("Password mismatch for student ID: ");
-                safe_write_stdout(student->student_id);
-                safe_write_stdout("\n");
+                log_warn("login failed, role=student id=%s: wrong password", id);
             }
         } else {
-            safe_write_stdout("Student not found for ID: ");
-            safe_write_stdout(id);
-            safe_write_stdout("\n");
+            log_warn("login failed, role=student id=%s: not found", id);
         }
     }
 
+    stats_add(STAT_LOGIN_FAILURES, 1);
     send_message(client_socket, "Authentication failed. Invalid credentials or inactive account.\n");
-    return NULL;
+    return -1;
 }
 
-// Utility function to send messages
-void send_message(int socket, const char *message) {
+// Utility function to send messages; returns -1 once the client is gone
+int send_message(int socket, const char *message) {
+    TRACE_SPAN("net", "send");
+    ConnectionContext *conn = session_conn;
+    if (conn && conn->timed_out != DEADLINE_NONE) {
+        return -1; // the socket was shut down; the session is ending
+    }
+    if (conn) {
+        if (conn->deadline != DEADLINE_WRITE && write_timeout > 0) {
+            arm_deadline(conn, DEADLINE_WRITE, write_timeout);
+        }
+        atomic_store_explicit(&conn->send_started_ms, timer_now_ms(), memory_order_relaxed);
+        atomic_store_explicit(&conn->sending, 1, memory_order_release);
+    }
     ssize_t sent_bytes = send(socket, message, strlen(message), 0);
+    if (conn) {
+        atomic_store_explicit(&conn->sending, 0, memory_order_relaxed);
+    }
     if (sent_bytes < 0) {
-        perror("send failed");
+        log_warn("send failed: %s", strerror(errno));
+        return -1;
+    }
+    if (capture_enabled() && conn) {
+        conn->reply_bytes += sent_bytes;
+        conn->reply_time_us = capture_now_us();
     }
     fsync(socket);
+    return 0;
 }
 
-// Utility function to receive messages with error checking
-int receive_message(int socket, char *buffer, int size) {
-    memset(buffer, 0, size);
-    int valread = recv(socket, buffer, size - 1, 0);
+// ==================== Message Framing ====================
+
+// Append received bytes to the frame; returns the count, or -1 once the
+// client is gone
+static int fill_frame(ConnectionContext *conn) {
+    if (capture_enabled()) {
+        capture_reply_end(conn); // everything owed to the client has been sent
+    }
+    arm_read_deadline(conn);
+
+    int valread = recv(conn->socket, conn->frame + conn->frame_len, sizeof(conn->frame) - conn->frame_len, 0);
+    if (valread > 0 && capture_enabled()) {
+        capture_data(conn->capture_session, conn->frame + conn->frame_len, valread);
+    }
     if (valread < 0) {
-        perror("recv failed");
+        log_warn("recv failed: %s", strerror(errno));
         return -1;
     } else if (valread == 0) {
         // Connection closed by client
         return -1;
     }
-    buffer[valread] = '\0';
+    conn->frame_len += valread;
     return valread;
 }
 
-int main() {
+// Move the next complete line out of the frame into conn->line
+static int next_line(ConnectionContext *conn) {
+    while (1) {
+        char *newline = memchr(conn->frame, '\n', conn->frame_len);
+        if (newline) {
+            int len = newline - conn->frame;
+            int consumed = len + 1;
+            if (conn->skip_line) {
+                conn->skip_line = 0; // the tail of a line that was already returned
+            } else {
+                if (len > 0 && conn->frame[len - 1] == '\r') {
+                    len--;
+                }
+                memcpy(conn->line, conn->frame, len);
+                conn->line[len] = '\0';
+                conn->line_pos = 0;
+                conn->line_open = 1;
+            }
+            conn->frame_len -= consumed;
+            memmove(conn->frame, conn->frame + consumed, conn->frame_len);
+            if (conn->line_open) {
+                return 0;
+            }
+            continue;
+        }
+
+        // A line longer than the frame is cut off; its tail is dropped
+        if (conn->frame_len == (int)sizeof(conn->frame)) {
+            int keep_partial = !conn->skip_line;
+            if (keep_partial) {
+                memcpy(conn->line, conn->frame, sizeof(conn->line) - 1);
+                conn->line[sizeof(conn->line) - 1] = '\0';
+                conn->line_pos = 0;
+                conn->line_open = 1;
+            }
+            conn->frame_len = 0;
+            conn->skip_line = 1;
+            if (keep_partial) {
+                return 0;
+            }
+        }
+
+        if (fill_frame(conn) == -1) {
+            return -1;
+        }
+    }
+}
+
+// The first message decides the framing. A raw client's message is
+// whatever one recv returns, as before line framing existed.
+static int receive_raw(ConnectionContext *conn, char *buffer, int size) {
+    if (conn->frame_len == 0 && fill_frame(conn) == -1) {
+        return -1;
+    }
+    if (conn->framing == FRAMING_UNKNOWN) {
+        conn->framing = memchr(conn->frame, '\n', conn->frame_len) ? FRAMING_LINES : FRAMING_RAW;
+        if (conn->framing == FRAMING_LINES) {
+            return 0;
+        }
+    }
+
+    int len = conn->frame_len < size - 1 ? conn->frame_len : size - 1;
+    memcpy(buffer, conn->frame, len);
+    buffer[len] = '\0';
+    conn->frame_len = 0;
+    return len;
+}
+
+// For a line client the message is the next field of the current request
+// line, and a new line is read once every field has been consumed
+static int receive_field(ConnectionContext *conn, char *buffer, int size) {
+    memset(buffer, 0, size);
+
+    // Requests already buffered are dropped once a deadline has expired
+    if (conn->timed_out != DEADLINE_NONE) {
+        return -1;
+    }
+
+    if (conn->framing != FRAMING_LINES) {
+        int len = receive_raw(conn, buffer, size);
+        if (conn->framing != FRAMING_LINES) {
+            return len;
+        }
+    }
+
+    if (!conn->line_open && next_line(conn) == -1) {
+        return -1;
+    }
+    const char *field = conn->line + conn->line_pos;
+    int len = strcspn(field, "\t");
+    if (field[len] == '\t') {
+        conn->line_pos += len + 1;
+    } else {
+        conn->line_open = 0;
+    }
+    snprintf(buffer, size, "%.*s", len, field);
+    return strlen(buffer);
+}
+
+// Take a token from the client's address bucket and, once logged in, its
+// account bucket; returns 0, or the milliseconds to wait
+static unsigned int throttle_request(ConnectionContext *conn) {
+    unsigned int wait_ms = rate_limit_take(RATE_REQUEST_IP, conn->peer);
+    if (wait_ms == 0 && conn->id[0]) {
+        char account[RATE_KEY_LEN];
+        snprintf(account, sizeof(account), "%d:%s", conn->role, conn->id);
+        wait_ms = rate_limit_take(RATE_REQUEST_ACCOUNT, account);
+    }
+    return wait_ms;
+}
+
+// Utility function to receive messages with error checking. The first
+// message of each request is rate limited; a throttled request is answered
+// with the time to wait and dropped, and the next one is read instead.
+int receive_message(int socket, char *buffer, int size) {
+    TRACE_SPAN("net", "recv");
+    ConnectionContext *conn = session_conn;
+    (void)socket; // always the session's own socket
+
+    while (1) {
+        int len = receive_field(conn, buffer, size);
+        if (len < 0 || conn->request_open) {
+            return len;
+        }
+        conn->request_open = 1;
+
+        unsigned int wait_ms = throttle_request(conn);
+        if (wait_ms == 0) {
+            return len;
+        }
+        stats_add(STAT_THROTTLED_REQUESTS, 1);
+        log_debug("request throttled, peer=%s id=%s", conn->peer, conn->id);
+        snprintf(conn->send_buffer, BUFFER_SIZE, "Too many requests. Retry after %u ms.\n", wait_ms);
+        send_message(conn->socket, conn->send_buffer);
+        finish_request(conn);
+    }
+}
+
+// Wait for the client's next message while also watching event_fd. The
+// read deadline applies as it does to a recv. Returns 1 when a message is
+// buffered or arriving (or the client hung up, which the next receive
+// reports), 0 when event_fd is readable or timeout_ms (-1 for none)
+// passed, and -1 once the session is ending.
+int wait_for_message(ConnectionContext *conn, int event_fd, int timeout_ms) {
+    TRACE_SPAN("net", "wait");
+    if (conn->timed_out != DEADLINE_NONE) {
+        return -1;
+    }
+    if (conn->line_open || conn->frame_len > 0) {
+        return 1; // sent ahead, e.g. by a pipelining client
+    }
+    if (capture_enabled()) {
+        capture_reply_end(conn);
+    }
+    arm_read_deadline(conn);
+
+    struct pollfd fds[2] = {{conn->socket, POLLIN, 0}, {event_fd, POLLIN, 0}};
+    int ready = poll(fds, 2, timeout_ms);
+    if (ready < 0 && errno != EINTR) {
+        log_warn("poll failed: %s", strerror(errno));
+        return -1;
+    }
+    if (conn->timed_out != DEADLINE_NONE) {
+        return -1;
+    }
+    return ready > 0 && fds[0].revents ? 1 : 0;
+}
+
+// Ends the reply to one request: fields of the request line that the
+// handler did not read (answers to prompts skipped by an early reply) are
+// dropped, and a line client is told that the reply is complete
+void finish_request(ConnectionContext *conn) {
+    conn->line_open = 0;
+    conn->request_open = 0;
+    if (conn->framing == FRAMING_LINES) {
+        send_message(conn->socket, REPLY_END);
+    }
+    arm_read_deadline(conn); // a pipelined request gets its own write deadline
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--port PORT] [--recover] [--checkpoint-interval SECONDS]\n"
+            "          [--checkpoint-full-every N] [--storage posix|io_uring]\n"
+            "          [--replication-port PORT] [--replica-of HOST:PORT]\n"
+            "          [--enroll-partitions N] [--max-connections N] [--trace FILE]\n"
+            "          [--log-file FILE|-] [--log-level debug|info|warn|error]\n"
+            "          [--capture FILE] [--login-timeout SECONDS] [--idle-timeout SECONDS]\n"
+            "          [--write-timeout SECONDS] [--stats-interval SECONDS]\n"
+            "          [--conn-limit RATE[:BURST]] [--ip-limit RATE[:BURST]]\n"
+            "          [--account-limit RATE[:BURST]] [--analytics-workers N]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int port = PORT;
+    int replication_port = 0;
+    char *replica_of = NULL;
+    int recover = 0;
+    int checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    int checkpoint_full_every = DEFAULT_CHECKPOINT_FULL_EVERY;
+    const char *storage = STORAGE_POSIX;
+    int enroll_partitions = DEFAULT_ENROLL_PARTITIONS;
+    int max_connections = DEFAULT_MAX_CONNECTIONS;
+    const char *trace_file = NULL;
+    const char *capture_file = NULL;
+    int stats_interval = DEFAULT_STATS_INTERVAL;
+    const char *log_file = DEFAULT_LOG_FILE;
+    int log_level = LOG_INFO;
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replication-port") == 0 && i + 1 < argc) {
+            replication_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replica-of") == 0 && i + 1 < argc) {
+            replica_of = argv[++i];
+        } else if (strcmp(argv[i], "--recover") == 0) {
+            recover = 1;
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+            checkpoint_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-full-every") == 0 && i + 1 < argc) {
+            checkpoint_full_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--storage") == 0 && i + 1 < argc) {
+            storage = argv[++i];
+        } else if (strcmp(argv[i], "--enroll-partitions") == 0 && i + 1 < argc) {
+            enroll_partitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc) {
+            max_connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "--login-timeout") == 0 && i + 1 < argc) {
+            login_timeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            idle_timeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--write-timeout") == 0 && i + 1 < argc) {
+            write_timeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            stats_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--conn-limit") == 0 && i + 1 < argc &&
+                   rate_limit_configure(RATE_CONNECT, argv[i + 1]) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--ip-limit") == 0 && i + 1 < argc &&
+                   rate_limit_configure(RATE_REQUEST_IP, argv[i + 1]) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--account-limit") == 0 && i + 1 < argc &&
+                   rate_limit_configure(RATE_REQUEST_ACCOUNT, argv[i + 1]) == 0) {
+            i++;
+        } else if (strcmp(argv[i], "--analytics-workers") == 0 && i + 1 < argc) {
+            analytics_configure(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_file = argv[++i];
+        } else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc) {
+            log_file = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc && log_level_parse(argv[i + 1]) != -1) {
+            log_level = log_level_parse(argv[++i]);
+        } else {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Request threads only queue log records; a background thread writes them
+    if (log_init(log_file, log_level) != 0) {
+        perror("Log initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Record spans from the start; SIGUSR2 dumps them
+    if (trace_file && trace_init(trace_file) != 0) {
+        perror("Trace initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Record inbound traffic for academia_replay
+    if (capture_file && capture_init(capture_file) != 0) {
+        perror("Capture initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every thread inherits the blocked set; signal_thread collects them
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN); // a vanished peer must not kill the server
+
+    pthread_t signal_tid;
+    if (pthread_create(&signal_tid, NULL, signal_thread, &signals) != 0) {
+        perror("could not create signal thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(signal_tid);
+
     // Initialize mutexes
     if (pthread_mutex_init(&student_file_mutex, NULL) != 0 ||
         pthread_mutex_init(&faculty_file_mutex, NULL) != 0 ||
         pthread_mutex_init(&course_file_mutex, NULL) != 0 ||
-        pthread_mutex_init(&student_course_file_mutex, NULL) != 0) {
+        pthread_mutex_init(&aggregate_file_mutex, NULL) != 0) {
         perror("Mutex initialization failed");
         exit(EXIT_FAILURE);
     }
+    for (int p = 0; p < MAX_ENROLL_PARTITIONS; p++) {
+        if (pthread_mutex_init(&student_course_file_mutex[p], NULL) != 0) {
+            perror("Mutex initialization failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Select the storage backend; an unavailable one falls back to posix
+    storage_init(storage);
+    log_info("storage backend: %s", storage_backend_name());
+
+    // Split enrollments into partitions, moving existing ones if the count changed
+    if (enroll_partitions_init(enroll_partitions) != 0) {
+        perror("Enrollment partition initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Restore data files from the latest checkpoint and the log tail
+    if (recover && checkpoint_recover() != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the change log and start periodic checkpoints
+    if (checkpoint_init(checkpoint_interval, checkpoint_full_every) != 0 ||
+        checkpoint_start() != 0) {
+        perror("Checkpoint initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Materialize enrollment aggregates for data directories that have none
+    if (aggregates_init() != 0) {
+        perror("Aggregate initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Build the ID filters now rather than on the first lookup
+    if (id_filters_init() != 0) {
+        log_warn("ID filters unavailable, lookups will scan the tables");
+    }
+
+    // Open the record indexes, rebuilding any the tables have moved past
+    if (record_indexes_init() != 0) {
+        log_warn("record indexes unavailable, student and enrollment lookups will scan the tables");
+    }
+
+    // Number catalog changes from now on, past the versions of earlier runs
+    catalog_init();
+
+    // Stream changes to replicas, or follow a primary
+    if (replication_listen(replication_port) != 0) {
+        perror("Replication listener failed");
+        exit(EXIT_FAILURE);
+    }
+    if (replica_of) {
+        char host[256];
+        char *colon = strrchr(replica_of, ':');
+        if (!colon || colon - replica_of >= (long)sizeof(host)) {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - replica_of), replica_of);
+        if (replication_follow(host, atoi(colon + 1)) != 0) {
+            perror("Replication follower failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Session deadlines and the periodic stats line run on the timer wheel
+    if (timer_wheel_start() != 0) {
+        perror("Timer wheel initialization failed");
+        exit(EXIT_FAILURE);
+    }
+    stats_start(stats_interval);
+
+    // Preallocate every connection context the server will use
+    if (connection_pool_init(max_connections) != 0) {
+        perror("Connection pool initialization failed");
+        exit(EXIT_FAILURE);
+    }
 
     // Start the server
-    start_server();
+    start_server(port);
 
     // Destroy mutexes before exiting
     pthread_mutex_destroy(&student_file_mutex);
     pthread_mutex_destroy(&faculty_file_mutex);
     pthread_mutex_destroy(&course_file_mutex);
-    pthread_mutex_destroy(&student_course_file_mutex);
+    pthread_mutex_destroy(&aggregate_file_mutex);
+    for (int p = 0; p < MAX_ENROLL_PARTITIONS; p++) {
+        pthread_mutex_destroy(&student_course_file_mutex[p]);
+    }
 
     return 0;
 }
@@ -0,0 +1,168 @@
+#include "utils.h"
+#include "file_operations.h"
+#include "snapshot.h"
+
+#include <sys/stat.h>
+
+struct Snapshot {
+    off_t size[MAX_TABLES];
+    size_t page_count[MAX_TABLES];
+    char **pages[MAX_TABLES]; // preserved page images, NULL until a writer touches the page
+    int broken;               // a page could not be preserved, reads are refused
+    struct Snapshot *next;
+};
+
+// Only modified with every table mutex held, so holding any single table
+// mutex is enough to walk it
+static Snapshot *active_snapshots = NULL;
+
+static off_t file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+Snapshot *snapshot_create_locked(void) {
+    Snapshot *snapshot = calloc(1, sizeof(Snapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+
+    for (int t = 0; t < table_count(); t++) {
+        snapshot->size[t] = file_size(table_path(t));
+        snapshot->page_count[t] = (snapshot->size[t] + TABLE_PAGE_SIZE - 1) / TABLE_PAGE_SIZE;
+        if (snapshot->page_count[t] > 0) {
+            snapshot->pages[t] = calloc(snapshot->page_count[t], sizeof(char *));
+            if (!snapshot->pages[t]) {
+                for (int u = 0; u < t; u++) {
+                    free(snapshot->pages[u]);
+                }
+                free(snapshot);
+                return NULL;
+            }
+        }
+    }
+
+    snapshot->next = active_snapshots;
+    active_snapshots = snapshot;
+    return snapshot;
+}
+
+Snapshot *snapshot_create(void) {
+    lock_all_tables();
+    Snapshot *snapshot = snapshot_create_locked();
+    unlock_all_tables();
+    return snapshot;
+}
+
+void snapshot_release(Snapshot *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+
+    lock_all_tables();
+    for (Snapshot **link = &active_snapshots; *link; link = &(*link)->next) {
+        if (*link == snapshot) {
+            *link = snapshot->next;
+            break;
+        }
+    }
+    unlock_all_tables();
+
+    for (int t = 0; t < table_count(); t++) {
+        for (size_t p = 0; p < snapshot->page_count[t]; p++) {
+            free(snapshot->pages[t][p]);
+        }
+        free(snapshot->pages[t]);
+    }
+    free(snapshot);
+}
+
+off_t snapshot_table_size(Snapshot *snapshot, int table) {
+    return snapshot->size[table];
+}
+
+void snapshot_preserve(int table, off_t offset, size_t len) {
+    if (!active_snapshots || len == 0) {
+        return;
+    }
+
+    int fd = -1;
+    size_t first = offset / TABLE_PAGE_SIZE;
+    size_t last = (offset + len - 1) / TABLE_PAGE_SIZE;
+
+    for (Snapshot *snapshot = active_snapshots; snapshot; snapshot = snapshot->next) {
+        for (size_t p = first; p <= last && p < snapshot->page_count[table]; p++) {
+            if (snapshot->pages[table][p]) {
+                continue; // already holds the image from before the first change
+            }
+
+            char *page = calloc(1, TABLE_PAGE_SIZE);
+            if (fd == -1) {
+                fd = open(table_path(table), O_RDONLY);
+            }
+            if (!page || fd == -1 ||
+                pread(fd, page, TABLE_PAGE_SIZE, (off_t)p * TABLE_PAGE_SIZE) == -1) {
+                free(page);
+                snapshot->broken = 1;
+                continue;
+            }
+            snapshot->pages[table][p] = page;
+        }
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+ssize_t snapshot_read(Snapshot *snapshot, int table, off_t offset, void *buf, size_t len) {
+    if (offset >= snapshot->size[table]) {
+        return 0;
+    }
+    if ((off_t)len > snapshot->size[table] - offset) {
+        len = snapshot->size[table] - offset;
+    }
+
+    // The file is read without the table lock. Every page written since
+    // the snapshot was taken was preserved before the write, so whatever
+    // the read saw of such a page is replaced by its image below.
+    int fd = open(table_path(table), O_RDONLY);
+    char *out = buf;
+    size_t done = 0;
+    while (fd != -1 && done < len) {
+        ssize_t got = pread(fd, out + done, len - done, offset + done);
+        if (got <= 0) {
+            break; // the file was cut short since; the pages were preserved
+        }
+        done += got;
+    }
+    memset(out + done, 0, len - done);
+    if (fd != -1) {
+        close(fd);
+    }
+
+    pthread_mutex_lock(table_mutex(table)); // Writers preserve pages under this mutex
+
+    if (snapshot->broken) {
+        pthread_mutex_unlock(table_mutex(table));
+        return -1;
+    }
+
+    size_t first = offset / TABLE_PAGE_SIZE;
+    size_t last = (offset + len - 1) / TABLE_PAGE_SIZE;
+    for (size_t p = first; p <= last; p++) {
+        if (!snapshot->pages[table][p]) {
+            continue;
+        }
+        off_t page_start = (off_t)p * TABLE_PAGE_SIZE;
+        off_t from = page_start > offset ? page_start : offset;
+        off_t to = page_start + TABLE_PAGE_SIZE < offset + (off_t)len ? page_start + TABLE_PAGE_SIZE : offset + (off_t)len;
+        memcpy(out + (from - offset), snapshot->pages[table][p] + (from - page_start), to - from);
+    }
+
+    pthread_mutex_unlock(table_mutex(table));
+    return len;
+}
@@ -0,0 +1,50 @@
+#include "stats.h"
+#include "log.h"
+#include "timer_wheel.h"
+
+#include <stdatomic.h>
+
+static const char *stat_names[STAT_COUNT] = {
+    "sessions", "active", "login_failures", "timeouts_login", "timeouts_idle", "timeouts_write",
+    "throttled_connects", "throttled_requests", "update_conflicts",
+    "index_reads", "index_writes", "watchers", "seat_updates",
+    "catalog_deltas", "catalog_refreshes"
+};
+
+static _Atomic int64_t counters[STAT_COUNT];
+static TimerEntry stats_timer;
+static unsigned int interval_ms;
+
+void stats_add(int counter, int64_t delta) {
+    atomic_fetch_add_explicit(&counters[counter], delta, memory_order_relaxed);
+}
+
+int64_t stats_get(int counter) {
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+void stats_log(void) {
+    char line[LOG_RECORD_TEXT];
+    size_t len = snprintf(line, sizeof(line), "stats:");
+
+    for (int i = 0; i < STAT_COUNT && len < sizeof(line); i++) {
+        len += snprintf(line + len, sizeof(line) - len, " %s=%lld", stat_names[i], (long long)stats_get(i));
+    }
+    log_info("%s", line);
+}
+
+// Runs on the wheel thread; logging only queues a record
+static unsigned int stats_expired(TimerEntry *entry) {
+    (void)entry;
+    stats_log();
+    return interval_ms;
+}
+
+void stats_start(int interval_seconds) {
+    if (interval_seconds <= 0) {
+        return;
+    }
+    interval_ms = interval_seconds * 1000;
+    timer_init(&stats_timer, stats_expired);
+    timer_schedule(&stats_timer, interval_ms);
+}
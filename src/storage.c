@@ -0,0 +1,556 @@
+#include "utils.h"
+#include "storage.h"
+#include "log.h"
+
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// ==================== POSIX Backend ====================
+
+static int posix_init(void) {
+    return 0;
+}
+
+// Requests complete before submit returns
+static void posix_submit(StorageRequest *requests, int count) {
+    for (int i = 0; i < count; i++) {
+        StorageRequest *req = &requests[i];
+        ssize_t n;
+        do {
+            n = req->opcode == STORAGE_READ
+                    ? pread(req->fd, req->buf, req->len, req->offset)
+                    : pwrite(req->fd, req->buf, req->len, req->offset);
+        } while (n == -1 && errno == EINTR);
+        req->result = n == -1 ? -errno : n;
+        req->done = 1;
+    }
+}
+
+static void posix_wait(StorageRequest *requests, int count) {
+    (void)requests;
+    (void)count;
+}
+
+static const StorageBackend posix_backend = {
+    STORAGE_POSIX, posix_init, posix_submit, posix_wait
+};
+
+// ==================== io_uring Backend ====================
+
+#ifdef HAVE_IO_URING
+
+#define URING_ENTRIES 256
+#define URING_RETRY_MAX_MS 1000     // longest pause between failed io_uring_enter calls
+#define URING_STOP 0                // user_data of the NOP that ends the completion thread
+
+static struct {
+    int fd;
+    void *sq_map, *cq_map, *sqes_map;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned sq_entries, cq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned in_flight;       // submitted but not yet reaped, bounded by cq_entries
+} ring = {.fd = -1};
+
+static pthread_mutex_t submit_mutex = PTHREAD_MUTEX_INITIALIZER;   // SQ side
+static pthread_mutex_t complete_mutex = PTHREAD_MUTEX_INITIALIZER; // completions and in_flight
+static pthread_cond_t complete_cond = PTHREAD_COND_INITIALIZER;
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uring_complete(StorageRequest *req, int res) {
+    pthread_mutex_lock(&complete_mutex);
+    req->result = res;
+    req->done = 1;
+    ring.in_flight--;
+    pthread_cond_broadcast(&complete_cond);
+    pthread_mutex_unlock(&complete_mutex);
+}
+
+// Reaps completions for every submitter until the URING_STOP NOP arrives.
+// While io_uring_enter keeps failing it waits longer between attempts, up
+// to URING_RETRY_MAX_MS, and logs the first failure and the recovery only.
+static void *uring_completion_thread(void *arg) {
+    (void)arg;
+    int retry_ms = 0;
+    int stopping = 0;
+
+    while (!stopping) {
+        if (uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            if (retry_ms == 0) {
+                log_error("io_uring_enter failed: %s; retrying", strerror(errno));
+            }
+            retry_ms = retry_ms ? 2 * retry_ms : 1;
+            if (retry_ms > URING_RETRY_MAX_MS) {
+                retry_ms = URING_RETRY_MAX_MS;
+            }
+            usleep(retry_ms * 1000);
+            continue;
+        }
+        if (retry_ms) {
+            log_info("io_uring_enter recovered");
+            retry_ms = 0;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            if (cqe->user_data == URING_STOP) {
+                stopping = 1;
+            } else {
+                uring_complete((StorageRequest *)(uintptr_t)cqe->user_data, cqe->res);
+            }
+            head++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void uring_submit(StorageRequest *requests, int count) {
+    int queued = 0;
+
+    pthread_mutex_lock(&submit_mutex);
+    while (queued < count) {
+        // Never have more requests outstanding than the CQ can hold
+        pthread_mutex_lock(&complete_mutex);
+        while (ring.in_flight >= ring.cq_entries) {
+            pthread_cond_wait(&complete_cond, &complete_mutex);
+        }
+        unsigned room = ring.cq_entries - ring.in_flight;
+        pthread_mutex_unlock(&complete_mutex);
+
+        unsigned tail = *ring.sq_tail;
+        unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        unsigned sq_room = ring.sq_entries - (tail - head);
+        unsigned batch = count - queued;
+        if (batch > room) batch = room;
+        if (batch > sq_room) batch = sq_room;
+
+        for (unsigned i = 0; i < batch; i++) {
+            StorageRequest *req = &requests[queued + i];
+            unsigned index = tail & *ring.sq_mask;
+            struct io_uring_sqe *sqe = &ring.sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = req->opcode == STORAGE_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = req->fd;
+            sqe->addr = (uintptr_t)req->buf;
+            sqe->len = req->len;
+            sqe->off = req->offset;
+            sqe->user_data = (uintptr_t)req;
+            req->done = 0;
+
+            ring.sq_array[index] = index;
+            tail++;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&complete_mutex);
+        ring.in_flight += batch;
+        pthread_mutex_unlock(&complete_mutex);
+
+        // One syscall normally hands the whole batch to the kernel
+        unsigned submitted = 0;
+        while (submitted < batch) {
+            int n = uring_enter(batch - submitted, 0, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            submitted += n;
+        }
+
+        if (submitted < batch) {
+            // The kernel consumes the SQ in order, so the entries it has not
+            // taken are the last ones; roll only those back and finish them
+            // on this thread. The ones it took complete through the ring.
+            unsigned unsubmitted = batch - submitted;
+            __atomic_store_n(ring.sq_tail, tail - unsubmitted, __ATOMIC_RELEASE);
+            pthread_mutex_lock(&complete_mutex);
+            ring.in_flight -= unsubmitted;
+            pthread_mutex_unlock(&complete_mutex);
+            posix_submit(&requests[queued + submitted], unsubmitted);
+        }
+        queued += batch;
+    }
+    pthread_mutex_unlock(&submit_mutex);
+}
+
+static void uring_wait(StorageRequest *requests, int count) {
+    pthread_mutex_lock(&complete_mutex);
+    for (int i = 0; i < count; i++) {
+        while (!requests[i].done) {
+            pthread_cond_wait(&complete_cond, &complete_mutex);
+        }
+    }
+    pthread_mutex_unlock(&complete_mutex);
+}
+
+// Stop the completion thread with a NOP it recognizes and wait for it.
+// Returns -1 when the NOP could not be submitted; the thread then still
+// uses the ring, which must be left in place.
+static int uring_stop_thread(pthread_t tid) {
+    pthread_mutex_lock(&submit_mutex);
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = URING_STOP;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int n;
+    do {
+        n = uring_enter(1, 0, 0);
+    } while (n < 0 && errno == EINTR);
+    pthread_mutex_unlock(&submit_mutex);
+
+    if (n != 1) {
+        pthread_detach(tid);
+        return -1;
+    }
+    pthread_join(tid, NULL);
+    return 0;
+}
+
+// Unmap and close the ring; nothing may use it any more
+static void uring_teardown(void) {
+    if (ring.sqes_map && ring.sqes_map != MAP_FAILED) {
+        munmap(ring.sqes_map, ring.sqes_size);
+    }
+    if (ring.cq_map && ring.cq_map != MAP_FAILED && ring.cq_map != ring.sq_map) {
+        munmap(ring.cq_map, ring.cq_size);
+    }
+    if (ring.sq_map && ring.sq_map != MAP_FAILED) {
+        munmap(ring.sq_map, ring.sq_size);
+    }
+    close(ring.fd);
+    ring.fd = -1;
+    ring.sq_map = ring.cq_map = ring.sqes_map = NULL;
+}
+
+static int uring_init(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.fd = uring_setup(URING_ENTRIES, &params);
+    if (ring.fd < 0) {
+        return -1;
+    }
+
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    int single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring.cq_size > ring.sq_size) {
+        ring.sq_size = ring.cq_size;
+    }
+
+    ring.sq_map = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_map = single_mmap ? ring.sq_map
+                              : mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes_map = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring.fd, IORING_OFF_SQES);
+    if (ring.sq_map == MAP_FAILED || ring.cq_map == MAP_FAILED || ring.sqes_map == MAP_FAILED) {
+        uring_teardown();
+        return -1;
+    }
+
+    char *sq = ring.sq_map, *cq = ring.cq_map;
+    ring.sqes = ring.sqes_map;
+
+    ring.sq_entries = params.sq_entries;
+    ring.cq_entries = params.cq_entries;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // IORING_OP_READ needs Linux 5.6; probe it once before trusting the ring
+    int fd = open("/dev/zero", O_RDONLY);
+    if (fd == -1) {
+        uring_teardown();
+        return -1;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, uring_completion_thread, NULL) != 0) {
+        close(fd);
+        uring_teardown();
+        return -1;
+    }
+
+    char byte;
+    StorageRequest probe = {STORAGE_READ, fd, &byte, 1, 0, 0, 0};
+    uring_submit(&probe, 1);
+    uring_wait(&probe, 1);
+    close(fd);
+    if (probe.result == 1) {
+        pthread_detach(tid); // serves the server from now on
+        return 0;
+    }
+
+    // Fall back to posix without a thread or ring left behind
+    int errno_probe = probe.result < 0 ? -probe.result : EINVAL;
+    if (uring_stop_thread(tid) == 0) {
+        uring_teardown();
+    }
+    errno = errno_probe;
+    return -1;
+}
+
+static const StorageBackend uring_backend = {
+    STORAGE_IO_URING, uring_init, uring_submit, uring_wait
+};
+
+#endif // HAVE_IO_URING
+
+// ==================== Backend Selection ====================
+
+static const StorageBackend *backend = &posix_backend;
+
+int storage_init(const char *name) {
+    backend = &posix_backend;
+    if (!name || strcmp(name, STORAGE_POSIX) == 0) {
+        return 0;
+    }
+
+#ifdef HAVE_IO_URING
+    if (strcmp(name, STORAGE_IO_URING) == 0) {
+        if (uring_backend.init() == 0) {
+            backend = &uring_backend;
+            return 0;
+        }
+        log_warn("io_uring unavailable (%s), using posix storage", strerror(errno));
+        return -1;
+    }
+#endif
+
+    log_warn("unknown storage backend '%s', using posix storage", name);
+    return -1;
+}
+
+const char *storage_backend_name(void) {
+    return backend->name;
+}
+
+void storage_submit(StorageRequest *requests, int count) {
+    backend->submit(requests, count);
+}
+
+void storage_wait(StorageRequest *requests, int count) {
+    backend->wait(requests, count);
+}
+
+static ssize_t storage_sync(int opcode, int fd, void *buf, size_t len, off_t offset) {
+    StorageRequest req = {opcode, fd, buf, len, offset, 0, 0};
+    storage_submit(&req, 1);
+    storage_wait(&req, 1);
+    if (req.result < 0) {
+        errno = -req.result;
+        return -1;
+    }
+    return req.result;
+}
+
+ssize_t storage_pread(int fd, void *buf, size_t len, off_t offset) {
+    return storage_sync(STORAGE_READ, fd, buf, len, offset);
+}
+
+ssize_t storage_pwrite(int fd, const void *buf, size_t len, off_t offset) {
+    return storage_sync(STORAGE_WRITE, fd, (void *)buf, len, offset);
+}
+
+// ==================== Record Scanner ====================
+
+static void scan_request(RecordScanner *scan, int buffer) {
+    StorageRequest *req = &scan->request[buffer];
+    req->opcode = STORAGE_READ;
+    req->fd = scan->fd;
+    req->buf = scan->blocks[buffer];
+    req->len = scan->block_records * scan->record_size;
+    req->offset = scan->next_offset;
+    req->result = 0;
+    req->done = 0;
+
+    scan->block_offset[buffer] = scan->next_offset;
+    scan->next_offset += req->len;
+    scan->in_flight[buffer] = 1;
+    storage_submit(req, 1);
+}
+
+void scan_open(RecordScanner *scan, int fd, size_t record_size) {
+    scan->fd = fd;
+    scan->record_size = record_size;
+    scan->block_records = SCAN_BLOCK_SIZE / record_size;
+    scan->in_flight[0] = scan->in_flight[1] = 0;
+    scan->current = -1;
+    scan->position = scan->available = 0;
+    scan->next_offset = 0;
+    scan->record_offset = -1;
+    scan->eof = 0;
+
+    // Keep two blocks in flight: the one being consumed and the next one
+    scan_request(scan, 0);
+    scan_request(scan, 1);
+}
+
+const void *scan_next(RecordScanner *scan) {
+    while (scan->current < 0 || scan->position + scan->record_size > scan->available) {
+        if (scan->current >= 0) {
+            if (scan->eof) {
+                return NULL;
+            }
+            // Refill the exhausted buffer with the block after the one in flight
+            scan_request(scan, scan->current);
+            scan->current = 1 - scan->current;
+        } else {
+            scan->current = 0;
+        }
+
+        StorageRequest *req = &scan->request[scan->current];
+        storage_wait(req, 1);
+        scan->in_flight[scan->current] = 0;
+
+        size_t got = req->result > 0 ? (size_t)req->result : 0;
+        scan->available = got - got % scan->record_size;
+        scan->position = 0;
+        if (got < req->len) {
+            scan->eof = 1;
+        }
+        if (scan->available == 0) {
+            return NULL;
+        }
+    }
+
+    const char *record = scan->blocks[scan->current] + scan->position;
+    scan->record_offset = scan->block_offset[scan->current] + scan->position;
+    scan->position += scan->record_size;
+    return record;
+}
+
+void field_match_init(FieldMatch *match, size_t field_offset, size_t field_size, const char *key) {
+    size_t key_len = strnlen(key, field_size);
+
+    memset(match, 0, sizeof(*match));
+    match->offset = field_offset;
+    match->len = key_len < field_size ? key_len + 1 : field_size;
+    match->long_key = key;
+    if (match->len > sizeof(match->key)) {
+        return;
+    }
+
+    memcpy(match->key, key, key_len);
+    match->chunk_count = (match->len + MATCH_CHUNK - 1) / MATCH_CHUNK;
+    for (int c = 0; c < match->chunk_count; c++) {
+        size_t bytes = match->len - c * MATCH_CHUNK;
+        match->masks[c] = bytes >= MATCH_CHUNK ? 0xFFFF : (1 << bytes) - 1;
+    }
+}
+
+int field_matches(const FieldMatch *match, const void *record) {
+    const char *key = match->chunk_count ? match->key : match->long_key;
+    return memcmp((const char *)record + match->offset, key, match->len) == 0;
+}
+
+// Position of the first record in [start, end) whose field matches, or end
+static size_t block_match(const char *block, size_t start, size_t end, size_t record_size,
+                          const FieldMatch *match) {
+    const char *field = block + start + match->offset;
+    const char *stop = block + end + match->offset;
+
+#ifdef __SSE2__
+    // The loads may read past the field, but never past the block buffer;
+    // records too close to its end are left to the loop below
+    if (match->chunk_count) {
+        const char *last = block + SCAN_BLOCK_SIZE - match->chunk_count * MATCH_CHUNK;
+        const __m128i want0 = _mm_loadu_si128((const __m128i *)match->key);
+        const __m128i want1 = _mm_loadu_si128((const __m128i *)(match->key + MATCH_CHUNK));
+        const int mask0 = match->masks[0], mask1 = match->masks[1];
+
+        for (; field < stop && field <= last; field += record_size) {
+            int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)field), want0));
+            if ((equal & mask0) != mask0) {
+                continue;
+            }
+            if (mask1) {
+                equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(field + MATCH_CHUNK)), want1));
+                if ((equal & mask1) != mask1) {
+                    continue;
+                }
+            }
+            return field - match->offset - block;
+        }
+    }
+#endif
+    const char *key = match->chunk_count ? match->key : match->long_key;
+    for (; field < stop; field += record_size) {
+        if (memcmp(field, key, match->len) == 0) {
+            return field - match->offset - block;
+        }
+    }
+    return end;
+}
+
+const void *scan_next_match(RecordScanner *scan, const FieldMatch *match) {
+    // scan_next refills the buffers; the rest of each block is searched here
+    while (scan_next(scan) != NULL) {
+        const char *block = scan->blocks[scan->current];
+        size_t start = scan->position - scan->record_size;
+        size_t hit = block_match(block, start, scan->available, scan->record_size, match);
+        if (hit < scan->available) {
+            scan->position = hit + scan->record_size;
+            scan->record_offset = scan->block_offset[scan->current] + hit;
+            return block + hit;
+        }
+        scan->position = scan->available;
+    }
+    return NULL;
+}
+
+off_t scan_offset(const RecordScanner *scan) {
+    return scan->record_offset;
+}
+
+// Must be called before the scanner goes out of scope: reads may still be in flight
+void scan_close(RecordScanner *scan) {
+    for (int i = 0; i < 2; i++) {
+        if (scan->in_flight[i]) {
+            storage_wait(&scan->request[i], 1);
+            scan->in_flight[i] = 0;
+        }
+    }
+}
@@ -0,0 +1,598 @@
+#include "../includes/utils.h"
+#include "file_operations.h"
+
+#include <errno.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Concurrency stress harness. Creates its own students, a faculty member
+// and courses through the admin and faculty menus, then runs many student
+// clients enrolling and dropping at random while faculty clients keep
+// adding and removing courses that students are enrolling in. Afterwards
+// it reads the data files and checks the seat and enrollment invariants
+// for its own courses. Run it against a server with a scratch data
+// directory and --max-connections at least --clients + --removers.
+
+#define STRESS_PREFIX "SZ"              // every course the harness creates
+#define STRESS_FACULTY_ID "SZFAC"
+#define STRESS_PASSWORD "stress"
+#define STRESS_TIMEOUT_SECONDS 30
+
+typedef struct {
+    int port;
+    const char *data_dir;
+    int students;
+    int courses;
+    int seats;
+    int clients;
+    int ops;
+    int removers;
+    int verify_only;
+} StressConfig;
+
+static StressConfig config = {PORT, "data", 200, 16, 20, 200, 200, 4, 0};
+
+enum {
+    OUT_ENROLLED, OUT_FULL, OUT_DUPLICATE, OUT_MAX_COURSES,
+    OUT_DROPPED, OUT_NOT_ENROLLED,
+    OUT_COURSE_ADDED, OUT_COURSE_REMOVED,
+    OUT_ERROR,
+    OUT_COUNT
+};
+
+static const char *outcome_names[OUT_COUNT] = {
+    "enrolled", "course full/missing", "already enrolled", "at course limit",
+    "dropped", "not enrolled",
+    "course added", "course removed",
+    "errors"
+};
+
+typedef struct {
+    int index;
+    long counts[OUT_COUNT];
+    double *latencies;      // seconds per operation
+    int latency_count;
+    unsigned int seed;
+} Worker;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ==================== Protocol ====================
+// One line-framed connection with an accumulating receive buffer; every
+// request is answered, so reading until an expected phrase shows up keeps
+// the conversation in step.
+
+typedef struct {
+    int socket;
+    char buffer[8 * BUFFER_SIZE];
+    size_t len;
+} Session;
+
+static int session_open(Session *session) {
+    struct sockaddr_in addr;
+    struct timeval timeout = {STRESS_TIMEOUT_SECONDS, 0};
+
+    session->len = 0;
+    session->socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (session->socket < 0) {
+        return -1;
+    }
+    setsockopt(session->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(config.port);
+    if (connect(session->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(session->socket);
+        return -1;
+    }
+    return 0;
+}
+
+static int session_send(Session *session, const char *text) {
+    char line[BUFFER_SIZE];
+    int len = snprintf(line, sizeof(line), "%s\n", text);
+
+    session->len = 0; // replies to earlier requests are no longer needed
+    return send(session->socket, line, len, 0) < 0 ? -1 : 0;
+}
+
+// Read until one of the NULL-terminated phrases arrives; returns its index or -1
+static int session_expect(Session *session, const char *const *phrases) {
+    while (1) {
+        session->buffer[session->len] = '\0';
+        for (int i = 0; phrases[i]; i++) {
+            if (strstr(session->buffer, phrases[i])) {
+                return i;
+            }
+        }
+        if (session->len + 1 >= sizeof(session->buffer)) {
+            session->len = 0; // nothing expected in what was read so far
+        }
+        ssize_t n = recv(session->socket, session->buffer + session->len,
+                         sizeof(session->buffer) - session->len - 1, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        session->len += n;
+    }
+}
+
+static int session_login(Session *session, const char *role, const char *id, const char *password) {
+    static const char *const login_replies[] = {"login successful", "Authentication failed", NULL};
+
+    char login[BUFFER_SIZE];
+
+    if (session_open(session) == -1) {
+        return -1;
+    }
+    snprintf(login, sizeof(login), "%s\t%s\t%s", role, id, password);
+    if (session_send(session, login) == -1 || session_expect(session, login_replies) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void session_close(Session *session, const char *logout_choice) {
+    static const char *const logout_replies[] = {"Logging out", NULL};
+
+    if (session_send(session, logout_choice) == 0) {
+        session_expect(session, logout_replies);
+    }
+    close(session->socket);
+}
+
+// Send a menu choice and answer each prompt in turn; returns the index of
+// the final reply among the NULL-terminated `replies`, or -1 when the
+// conversation broke off. A reply arriving instead of a prompt (such as
+// "already exists") ends the exchange early.
+static int session_request(Session *session, const char *choice, const char *const *answers,
+                           const char *const *prompts, const char *const *replies) {
+    if (session_send(session, choice) == -1) {
+        return -1;
+    }
+    for (int i = 0; answers[i]; i++) {
+        const char *expect[8];
+        int n = 0;
+        expect[n++] = prompts[i];
+        for (int j = 0; replies[j] && n < 7; j++) {
+            expect[n++] = replies[j];
+        }
+        expect[n] = NULL;
+
+        int r = session_expect(session, expect);
+        if (r != 0) {
+            return r == -1 ? -1 : r - 1;
+        }
+        if (session_send(session, answers[i]) == -1) {
+            return -1;
+        }
+    }
+    return session_expect(session, replies);
+}
+
+// ==================== Setup ====================
+
+static void student_id(char *buf, size_t size, int i) {
+    snprintf(buf, size, "SZ%05d", i);
+}
+
+static void course_code(char *buf, size_t size, int i) {
+    snprintf(buf, size, STRESS_PREFIX "%03d", i);
+}
+
+// Courses churned by remover r; students pick from these as well
+static void churn_code(char *buf, size_t size, int remover) {
+    snprintf(buf, size, STRESS_PREFIX "R%02d", remover);
+}
+
+static int add_course_request(Session *session, const char *code) {
+    static const char *const prompts[] = {"Enter Course Code: ", "Enter Course Name: ",
+                                          "Enter Credits: ", "Enter Maximum Seats: "};
+    static const char *const replies[] = {"added successfully", "already exists", "Failed to add", NULL};
+    char seats[16];
+    snprintf(seats, sizeof(seats), "%d", config.seats);
+    const char *answers[] = {code, "Stress Course", "3", seats, NULL};
+    return session_request(session, "2", answers, prompts, replies);
+}
+
+static int remove_course_request(Session *session, const char *code) {
+    static const char *const prompts[] = {"Enter Course Code to Remove: "};
+    static const char *const replies[] = {"removed successfully", "not found", "Failed to remove", NULL};
+    const char *answers[] = {code, NULL};
+    return session_request(session, "3", answers, prompts, replies);
+}
+
+static int setup(void) {
+    static const char *const student_prompts[] = {"Enter Student ID: ", "Enter Student Name: ", "Enter Password: "};
+    static const char *const student_replies[] = {"added successfully", "already exists", "Failed to add", NULL};
+    static const char *const faculty_prompts[] = {"Enter Faculty ID: ", "Enter Faculty Name: ", "Enter Password: "};
+    Session session;
+    char id[MAX_ID_LEN];
+
+    if (session_login(&session, "1", "admin", "admin123") == -1) {
+        fprintf(stderr, "stress: admin login failed\n");
+        return -1;
+    }
+    const char *faculty_answers[] = {STRESS_FACULTY_ID, "Stress Faculty", STRESS_PASSWORD, NULL};
+    if (session_request(&session, "3", faculty_answers, faculty_prompts, student_replies) == -1) {
+        fprintf(stderr, "stress: adding the faculty member failed\n");
+        return -1;
+    }
+    for (int i = 0; i < config.students; i++) {
+        student_id(id, sizeof(id), i);
+        const char *answers[] = {id, "Stress Student", STRESS_PASSWORD, NULL};
+        if (session_request(&session, "1", answers, student_prompts, student_replies) == -1) {
+            fprintf(stderr, "stress: adding student %s failed\n", id);
+            return -1;
+        }
+    }
+    session_close(&session, "9");
+
+    if (session_login(&session, "2", STRESS_FACULTY_ID, STRESS_PASSWORD) == -1) {
+        fprintf(stderr, "stress: faculty login failed\n");
+        return -1;
+    }
+    for (int i = 0; i < config.courses; i++) {
+        char code[MAX_COURSE_CODE_LEN];
+        course_code(code, sizeof(code), i);
+        if (add_course_request(&session, code) == -1) {
+            fprintf(stderr, "stress: adding course %s failed\n", code);
+            return -1;
+        }
+    }
+    session_close(&session, "7");
+    return 0;
+}
+
+// ==================== Load ====================
+
+static void record(Worker *worker, int outcome, double started) {
+    worker->counts[outcome]++;
+    worker->latencies[worker->latency_count++] = now_seconds() - started;
+}
+
+static void *student_worker(void *arg) {
+    static const char *const enroll_prompts[] = {"Enter Course Code to enroll: "};
+    static const char *const enroll_replies[] = {"Enrolled in course successfully", "not found or no available seats",
+                                                 "already enrolled in this course", "the maximum", NULL};
+    static const char *const drop_prompts[] = {"Enter Course Code to drop: "};
+    static const char *const drop_replies[] = {"dropped successfully", "not enrolled", NULL};
+    Worker *worker = arg;
+    Session session;
+    char id[MAX_ID_LEN];
+
+    student_id(id, sizeof(id), worker->index % config.students);
+    if (session_login(&session, "3", id, STRESS_PASSWORD) == -1) {
+        worker->counts[OUT_ERROR]++;
+        return NULL;
+    }
+
+    for (int op = 0; op < config.ops; op++) {
+        char code[MAX_COURSE_CODE_LEN];
+        int pick = rand_r(&worker->seed) % (config.courses + config.removers);
+        if (pick < config.courses) {
+            course_code(code, sizeof(code), pick);
+        } else {
+            churn_code(code, sizeof(code), pick - config.courses);
+        }
+        const char *answers[] = {code, NULL};
+        double started = now_seconds();
+
+        if (rand_r(&worker->seed) % 5 < 3) {
+            int r = session_request(&session, "2", answers, enroll_prompts, enroll_replies);
+            static const int outcomes[] = {OUT_ENROLLED, OUT_FULL, OUT_DUPLICATE, OUT_MAX_COURSES};
+            record(worker, r == -1 ? OUT_ERROR : outcomes[r], started);
+        } else {
+            int r = session_request(&session, "3", answers, drop_prompts, drop_replies);
+            record(worker, r == -1 ? OUT_ERROR : r == 0 ? OUT_DROPPED : OUT_NOT_ENROLLED, started);
+        }
+        if (worker->counts[OUT_ERROR]) {
+            break; // the session is out of step
+        }
+    }
+
+    session_close(&session, "8");
+    return NULL;
+}
+
+static void *remover_worker(void *arg) {
+    Worker *worker = arg;
+    Session session;
+    char code[MAX_COURSE_CODE_LEN];
+
+    churn_code(code, sizeof(code), worker->index);
+    if (session_login(&session, "2", STRESS_FACULTY_ID, STRESS_PASSWORD) == -1) {
+        worker->counts[OUT_ERROR]++;
+        return NULL;
+    }
+
+    // Keep the course coming and going while students enroll in it
+    for (int op = 0; op < config.ops / 4 + 1; op++) {
+        double started = now_seconds();
+        int r = add_course_request(&session, code);
+        record(worker, r == -1 ? OUT_ERROR : OUT_COURSE_ADDED, started);
+        usleep(rand_r(&worker->seed) % 20000);
+
+        started = now_seconds();
+        r = remove_course_request(&session, code);
+        record(worker, r == -1 ? OUT_ERROR : OUT_COURSE_REMOVED, started);
+        if (worker->counts[OUT_ERROR]) {
+            break;
+        }
+    }
+
+    session_close(&session, "7");
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_load(void) {
+    int total = config.clients + config.removers;
+    Worker *workers = calloc(total, sizeof(Worker));
+    pthread_t *threads = calloc(total, sizeof(pthread_t));
+    int ops_per_worker = config.ops * 2 + 4;
+    double *latencies = malloc((size_t)total * ops_per_worker * sizeof(double));
+    if (!workers || !threads || !latencies) {
+        free(workers);
+        free(threads);
+        free(latencies);
+        return -1;
+    }
+
+    double started = now_seconds();
+    for (int i = 0; i < total; i++) {
+        int remover = i >= config.clients;
+        workers[i].index = remover ? i - config.clients : i;
+        workers[i].latencies = latencies + (size_t)i * ops_per_worker;
+        workers[i].seed = (unsigned int)(time(NULL) ^ (i * 2654435761u));
+        if (pthread_create(&threads[i], NULL, remover ? remover_worker : student_worker, &workers[i]) != 0) {
+            perror("pthread_create");
+            total = i;
+            break;
+        }
+    }
+
+    long counts[OUT_COUNT] = {0};
+    long operations = 0;
+    for (int i = 0; i < total; i++) {
+        pthread_join(threads[i], NULL);
+        for (int o = 0; o < OUT_COUNT; o++) {
+            counts[o] += workers[i].counts[o];
+        }
+        // Pack the latencies for sorting
+        memmove(latencies + operations, workers[i].latencies, workers[i].latency_count * sizeof(double));
+        operations += workers[i].latency_count;
+    }
+    double elapsed = now_seconds() - started;
+
+    printf("\n=== Load ===\n");
+    printf("Clients: %d students, %d course removers\n", config.clients, config.removers);
+    for (int o = 0; o < OUT_COUNT; o++) {
+        printf("%-20s %ld\n", outcome_names[o], counts[o]);
+    }
+    printf("Operations: %ld in %.2f s (%.0f ops/s)\n", operations, elapsed, elapsed > 0 ? operations / elapsed : 0.0);
+    if (operations > 0) {
+        qsort(latencies, operations, sizeof(double), compare_double);
+        double sum = 0;
+        for (long i = 0; i < operations; i++) {
+            sum += latencies[i];
+        }
+        printf("Latency: mean %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               sum / operations * 1000, latencies[operations / 2] * 1000,
+               latencies[operations * 99 / 100] * 1000, latencies[operations - 1] * 1000);
+    }
+
+    free(workers);
+    free(threads);
+    free(latencies);
+    return counts[OUT_ERROR] ? -1 : 0;
+}
+
+// ==================== Verification ====================
+// Reads the tables directly; the server should be idle while this runs.
+
+typedef struct {
+    Course course;
+    int enrolled;   // active enrollments found for it
+} CourseCheck;
+
+static void data_path(char *buf, size_t size, const char *path) {
+    snprintf(buf, size, "%s%s", config.data_dir, path + strlen("data"));
+}
+
+static void *read_table(const char *path, size_t record_size, size_t *count) {
+    char full[512];
+    data_path(full, sizeof(full), path);
+
+    *count = 0;
+    FILE *file = fopen(full, "rb");
+    if (!file) {
+        return errno == ENOENT ? calloc(1, record_size) : NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void *records = malloc(size > 0 ? size : 1);
+    if (records && fread(records, 1, size, file) != (size_t)size) {
+        free(records);
+        records = NULL;
+    }
+    fclose(file);
+    *count = records ? size / record_size : 0;
+    return records;
+}
+
+static int is_stress_course(const char *code) {
+    return strncmp(code, STRESS_PREFIX, strlen(STRESS_PREFIX)) == 0;
+}
+
+static int compare_enrollment(const void *a, const void *b) {
+    const StudentCourse *x = a, *y = b;
+    int cmp = strcmp(x->course_code, y->course_code);
+    return cmp ? cmp : strcmp(x->student_id, y->student_id);
+}
+
+static int verify(void) {
+    size_t course_count;
+    Course *courses = read_table(COURSE_FILE, sizeof(Course), &course_count);
+    if (!courses) {
+        perror("stress: reading courses");
+        return -1;
+    }
+
+    // The partition count on disk decides the enrollment file names
+    int partitions = 1;
+    char meta_path[512];
+    data_path(meta_path, sizeof(meta_path), STUDENT_COURSE_META_FILE);
+    FILE *meta = fopen(meta_path, "r");
+    if (meta) {
+        if (fscanf(meta, "%d", &partitions) != 1 || partitions < 1 || partitions > MAX_ENROLL_PARTITIONS) {
+            partitions = 1;
+        }
+        fclose(meta);
+    }
+
+    StudentCourse *active = NULL;
+    size_t active_count = 0;
+    for (int p = 0; p < partitions; p++) {
+        char path[64];
+        if (partitions == 1) {
+            snprintf(path, sizeof(path), "%s", STUDENT_COURSE_FILE);
+        } else {
+            snprintf(path, sizeof(path), STUDENT_COURSE_PARTITION_FILE, p);
+        }
+        size_t count;
+        StudentCourse *records = read_table(path, sizeof(StudentCourse), &count);
+        StudentCourse *grown = records ? realloc(active, (active_count + count + 1) * sizeof(StudentCourse)) : NULL;
+        if (!grown) {
+            perror("stress: reading enrollments");
+            free(records);
+            free(active);
+            free(courses);
+            return -1;
+        }
+        active = grown;
+        for (size_t i = 0; i < count; i++) {
+            if (records[i].is_enrolled && is_stress_course(records[i].course_code)) {
+                active[active_count++] = records[i];
+            }
+        }
+        free(records);
+    }
+
+    int violations = 0;
+    size_t checked = 0;
+
+    // No duplicate active enrollments
+    qsort(active, active_count, sizeof(StudentCourse), compare_enrollment);
+    for (size_t i = 1; i < active_count; i++) {
+        if (compare_enrollment(&active[i - 1], &active[i]) == 0) {
+            printf("VIOLATION: %s is enrolled in %s more than once\n", active[i].student_id, active[i].course_code);
+            violations++;
+        }
+    }
+
+    // Seats never negative, and every taken seat belongs to an active enrollment
+    for (size_t c = 0; c < course_count; c++) {
+        const Course *course = &courses[c];
+        if (!is_stress_course(course->course_code)) {
+            continue;
+        }
+        checked++;
+        int enrolled = 0;
+        for (size_t i = 0; i < active_count; i++) {
+            enrolled += strcmp(active[i].course_code, course->course_code) == 0;
+        }
+        if (course->available_seats < 0) {
+            printf("VIOLATION: %s has %d available seats\n", course->course_code, course->available_seats);
+            violations++;
+        }
+        if (enrolled != course->max_seats - course->available_seats) {
+            printf("VIOLATION: %s has %d enrolled but %d of %d seats taken\n", course->course_code,
+                   enrolled, course->max_seats - course->available_seats, course->max_seats);
+            violations++;
+        }
+    }
+
+    // No active enrollment outlives its course
+    for (size_t i = 0; i < active_count; i++) {
+        int exists = 0;
+        for (size_t c = 0; c < course_count && !exists; c++) {
+            exists = strcmp(courses[c].course_code, active[i].course_code) == 0;
+        }
+        if (!exists) {
+            printf("VIOLATION: %s is enrolled in removed course %s\n", active[i].student_id, active[i].course_code);
+            violations++;
+        }
+    }
+
+    printf("\n=== Invariants ===\n");
+    printf("Courses checked: %zu, active enrollments: %zu, violations: %d\n", checked, active_count, violations);
+
+    free(active);
+    free(courses);
+    return violations ? -1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--port PORT] [--data DIR] [--clients N] [--ops N] [--removers N]\n"
+            "          [--students N] [--courses N] [--seats N] [--verify-only]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--port") == 0 && has_value) {
+            config.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--data") == 0 && has_value) {
+            config.data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0 && has_value) {
+            config.clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ops") == 0 && has_value) {
+            config.ops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--removers") == 0 && has_value) {
+            config.removers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--students") == 0 && has_value) {
+            config.students = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--courses") == 0 && has_value) {
+            config.courses = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seats") == 0 && has_value) {
+            config.seats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verify-only") == 0) {
+            config.verify_only = 1;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (config.students < 1 || config.courses < 1 || config.courses > 1000 || config.removers > 100 ||
+        config.clients < 0 || config.ops < 1 || config.removers < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    if (!config.verify_only) {
+        printf("Setting up %d students and %d courses...\n", config.students, config.courses);
+        if (setup() == -1) {
+            return EXIT_FAILURE;
+        }
+        failed |= run_load() == -1;
+    }
+    failed |= verify() == -1;
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,64 +1,144 @@
 #include "utils.h"
 #include "file_operations.h"
 #include "handler.h"
+#include "storage.h"
+#include "course_index.h"
+#include "trace.h"
+#include "stats.h"
+#include "subscriptions.h"
+#include "catalog.h"
 
-extern void send_message(int socket, const char *message);
-extern void receive_message(int socket, char *buffer, int size);
+#include <stddef.h>
 
-void view_all_courses_helper(int client_socket) {
-    pthread_mutex_lock(&course_file_mutex); // Lock the course file mutex
+extern int send_message(int socket, const char *message);
+extern int receive_message(int socket, char *buffer, int size);
 
-    int fd = open(COURSE_FILE, O_RDONLY);
-    if (fd == -1) {
-        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex before returning
+static const char *course_key(const void *record) {
+    return ((const Course *)record)->course_code;
+}
+
+static void format_course_row(const void *record, char *row, size_t size) {
+    const Course *course = (const Course *)record;
+    snprintf(row, size, "%s\t%s\t%s\t%d\t%d\n",
+             course->course_code,
+             course->name,
+             course->faculty_id,
+             course->credits,
+             course->available_seats);
+}
+
+static const Listing course_listing = {
+    'C', "Available Courses", "Code\tName\tFaculty\tCredits\tAvailable Seats",
+    "No available courses found.\n", sizeof(Course), course_key, format_course_row
+};
+
+void view_all_courses_helper(int client_socket, Arena *arena) {
+    TRACE_FUNCTION("helper");
+    Page page;
+    if (page_begin(&page, arena, &course_listing, "") == -1) {
         send_message(client_socket, "Error accessing course records.\n");
         return;
     }
 
-    Course course;
+    // Each page walks the code-sorted index from the last code sent; one
+    // course past the page tells page_offer that more follow
+    ArenaMark mark = arena_mark(arena);
+    do {
+        Course *courses;
+        int count = course_index_page(page.after, 1, LISTING_PAGE_SIZE + 1, arena, &courses);
+        if (count == -1) {
+            send_message(client_socket, "Error accessing course records.\n");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            page_offer(&page, &courses[i]);
+        }
+        arena_rewind(arena, mark);
+    } while (page_send(client_socket, &page));
+}
+
+static const Listing search_listing = {
+    'Q', "Matching Courses", "Code\tName\tFaculty\tCredits\tAvailable Seats",
+    "No matching courses found.\n", sizeof(Course), course_key, format_course_row
+};
+
+void search_courses_helper(int client_socket, Arena *arena) {
+    TRACE_FUNCTION("helper");
+    CourseQuery query;
     char buffer[BUFFER_SIZE];
-    int count = 0;
 
-    // Send header immediately
-    send_message(client_socket, "\n=== Available Courses ===\n");
-    send_message(client_socket, "Code\tName\tFaculty\tCredits\tAvailable Seats\n");
-
-    // Read and send each course record
-    while (read(fd, &course, sizeof(Course)) > 0) {
-        if (course.available_seats > 0) {
-            snprintf(buffer, BUFFER_SIZE, "%s\t%s\t%s\t%d\t%d\n", 
-                     course.course_code,
-                     course.name,
-                     course.faculty_id,
-                     course.credits,
-                     course.available_seats);
-            send_message(client_socket, buffer); // Send each line immediately
-            count++;
-        }
+    // The client cannot send an empty line, so "-" stands for "any"
+    send_message(client_socket, "Enter Code/Name Prefix (- for any): ");
+    if (receive_message(client_socket, query.prefix, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
+    if (strcmp(query.prefix, "-") == 0) {
+        query.prefix[0] = '\0';
     }
 
-    if (count == 0) {
-        send_message(client_socket, "No available courses found.\n");
+    send_message(client_socket, "Enter Keywords (- for any): ");
+    if (receive_message(client_socket, query.keywords, MAX_NAME_LEN) < 0) {
+        return; // the session ended
+    }
+    if (strcmp(query.keywords, "-") == 0) {
+        query.keywords[0] = '\0';
+    }
+
+    send_message(client_socket, "Enter Credits (0 for any): ");
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
+    query.credits = atoi(buffer);
+
+    send_message(client_socket, "Enter Minimum Free Seats (0 for any): ");
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
+    query.min_free_seats = atoi(buffer);
+
+    Page page;
+    if (page_begin(&page, arena, &search_listing, "") == -1) {
+        send_message(client_socket, "Error accessing course records.\n");
+        return;
     }
 
-    close(fd);
-    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
+    // Re-run the query for every page; it only touches the in-memory index,
+    // and each run's results are released before the next
+    ArenaMark mark = arena_mark(arena);
+    do {
+        Course *courses;
+        int count = course_index_search(&query, arena, &courses);
+        if (count == -1) {
+            send_message(client_socket, "Error accessing course records.\n");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            page_offer(&page, &courses[i]);
+        }
+        arena_rewind(arena, mark);
+    } while (page_send(client_socket, &page));
 }
 
 void enroll_course_helper(int client_socket, const char *student_id) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
     char course_code[MAX_COURSE_CODE_LEN];
+    char buffer[BUFFER_SIZE];
 
     send_message(client_socket, "Enter Course Code to enroll: ");
-    receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN);
+    if (receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN) < 0) {
+        return; // the session ended
+    }
 
     StudentCourse sc;
     strcpy(sc.student_id, student_id);
     strcpy(sc.course_code, course_code);
 
-   // pthread_mutex_lock(&student_course_file_mutex); // Lock the student-course file mutex
-
+    // Checks the course, its seats and existing enrollments, and takes the seat
     int result = enroll_student_course(&sc);
-    //pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
 
     if (result > 0) {
         send_message(client_socket, "Enrolled in course successfully!\n");
@@ -66,161 +146,255 @@ void enroll_course_helper(int client_socket, const char *student_id) {
         send_message(client_socket, "Course not found or no available seats.\n");
     } else if (result == -2) {
         send_message(client_socket, "You are already enrolled in this course.\n");
+    } else if (result == -3) {
+        snprintf(buffer, BUFFER_SIZE, "You are already enrolled in %d courses, the maximum.\n", MAX_COURSES);
+        send_message(client_socket, buffer);
     } else {
         send_message(client_socket, "Failed to enroll in course.\n");
     }
 }
 
-void view_enrolled_courses_helper(int client_socket, const char *student_id) {
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the student-course file mutex
+static const char *enrolled_course_key(const void *record) {
+    return ((const StudentCourse *)record)->course_code;
+}
+
+static void format_enrolled_course_row(const void *record, char *row, size_t size) {
+    snprintf(row, size, "%s\n", ((const StudentCourse *)record)->course_code);
+}
+
+static const Listing enrolled_course_listing = {
+    'S', "Enrolled Courses", "Course Code", "No enrolled courses found.\n",
+    sizeof(StudentCourse), enrolled_course_key, format_enrolled_course_row
+};
 
-    int fd = open(STUDENT_COURSE_FILE, O_RDONLY);
-    if (fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex before returning
+void view_enrolled_courses_helper(int client_socket, const char *student_id, Arena *arena) {
+    TRACE_FUNCTION("helper");
+    Page page;
+    if (page_begin(&page, arena, &enrolled_course_listing, student_id) == -1) {
         send_message(client_socket, "Error accessing enrollment records.\n");
         return;
     }
 
-    StudentCourse sc;
-    int count = 0;
+    // Only the student's own enrollment partition holds their courses
+    int table = TABLE_STUDENT_COURSE + enroll_partition_of(student_id);
 
-    send_message(client_socket, "\n=== Enrolled Courses ===\n");
-    send_message(client_socket, "Course Code\n");
+    do {
+        trace_mutex_lock(table_mutex(table)); // Lock the enrollment partition mutex
 
-    while (read(fd, &sc, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc.student_id, student_id) == 0 && sc.is_enrolled) {
-            send_message(client_socket, sc.course_code);
-            send_message(client_socket, "\n"); // Send each course code immediately
-            count++;
+        int fd = open(table_path(table), O_RDONLY);
+        if (fd == -1) {
+            pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex before returning
+            send_message(client_socket, "Error accessing enrollment records.\n");
+            break;
         }
-    }
 
-    if (count == 0) {
-        send_message(client_socket, "No enrolled courses found.\n");
-    }
+        RecordScanner scan;
+        FieldMatch match;
+        const StudentCourse *sc;
 
-    close(fd);
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
+        field_match_init(&match, offsetof(StudentCourse, student_id), MAX_ID_LEN, student_id);
+        scan_open(&scan, fd, sizeof(StudentCourse));
+        while ((sc = scan_next_match(&scan, &match)) != NULL) {
+            if (sc->is_enrolled) {
+                page_offer(&page, sc);
+            }
+        }
+        scan_close(&scan);
+
+        close(fd);
+        pthread_mutex_unlock(table_mutex(table)); // Unlock the mutex
+    } while (page_send(client_socket, &page));
 }
 
 void drop_course_helper(int client_socket, const char *student_id) {
-    char course_code[MAX_COURSE_CODE_LEN];
-
-    send_message(client_socket, "Enter Course Code to drop: ");
-    receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN);
-
-    // Check if student is enrolled
-    if (!is_student_enrolled(student_id, course_code)) {
-        send_message(client_socket, "You are not enrolled in this course.\n");
-        return;
-    }
-
-    // Find the course to update available seats
-    Course *course = find_course(course_code);
-    if (!course) {
-        send_message(client_socket, "Course not found.\n");
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
         return;
     }
 
-    pthread_mutex_lock(&course_file_mutex); // Lock the course file mutex
-
-    int fd_course = open(COURSE_FILE, O_RDWR);
-    if (fd_course == -1) {
-        pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
-        send_message(client_socket, "Error accessing course records.\n");
-        return;
-    }
+    char course_code[MAX_COURSE_CODE_LEN];
 
-    Course temp_course;
-    off_t offset = 0;
-    while (read(fd_course, &temp_course, sizeof(Course)) > 0) {
-        if (strcmp(temp_course.course_code, course_code) == 0) {
-            temp_course.available_seats++;
-            lseek(fd_course, offset, SEEK_SET);
-            write(fd_course, &temp_course, sizeof(Course));
-            break;
-        }
-        offset += sizeof(Course);
+    send_message(client_socket, "Enter Course Code to drop: ");
+    if (receive_message(client_socket, course_code, MAX_COURSE_CODE_LEN) < 0) {
+        return; // the session ended
     }
 
-    close(fd_course);
-    pthread_mutex_unlock(&course_file_mutex); // Unlock the mutex
-
-    pthread_mutex_lock(&student_course_file_mutex); // Lock the student-course file mutex
-
-    // Mark enrollment as dropped
-    int fd = open(STUDENT_COURSE_FILE, O_RDWR);
-    if (fd == -1) {
-        pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
+    // Marks the enrollment dropped and gives the seat back in one step
+    int found = drop_student_course(student_id, course_code);
+    if (found == -1) {
         send_message(client_socket, "Error accessing enrollment records.\n");
         return;
     }
 
-    StudentCourse sc;
-    offset = 0;
-    int found = 0;
-
-    while (read(fd, &sc, sizeof(StudentCourse)) > 0) {
-        if (strcmp(sc.student_id, student_id) == 0 &&
-            strcmp(sc.course_code, course_code) == 0 &&
-            sc.is_enrolled) {
-            sc.is_enrolled = 0;
-            lseek(fd, offset, SEEK_SET);
-            write(fd, &sc, sizeof(StudentCourse));
-            found = 1;
-            break;
-        }
-        offset += sizeof(StudentCourse);
-    }
-
-    close(fd);
-    pthread_mutex_unlock(&student_course_file_mutex); // Unlock the mutex
-
     if (found) {
         send_message(client_socket, "Course dropped successfully!\n");
     } else {
-        send_message(client_socket, "Failed to drop course.\n");
+        send_message(client_socket, "You are not enrolled in this course.\n");
     }
 }
 
 void change_student_password_helper(int client_socket, const char *student_id) {
-    Student *student = find_student(student_id);
-    if (student == NULL) {
+    TRACE_FUNCTION("helper");
+    if (reject_if_read_only(client_socket)) {
+        return;
+    }
+
+    // find_student and update_student each take student_file_mutex
+    // themselves; the update is refused if the record changed in between
+    Student student;
+    if (find_student(student_id, &student) != 1) {
         send_message(client_socket, "Student record not found!\n");
         return;
     }
 
     char new_password[MAX_PASSWORD_LEN];
     send_message(client_socket, "Enter new password: ");
-    receive_message(client_socket, new_password, MAX_PASSWORD_LEN);
+    if (receive_message(client_socket, new_password, MAX_PASSWORD_LEN) < 0) {
+        return; // the session ended
+    }
 
-    Student updated = *student;
+    Student updated = student;
     strcpy(updated.password, new_password);
 
-    pthread_mutex_lock(&student_file_mutex); // Lock the student file mutex
-
-    if (update_student(updated) == 0) {
+    int result = update_student(&student, &updated);
+    if (result == 0) {
         send_message(client_socket, "Password changed successfully!\n");
+    } else if (result == UPDATE_CONFLICT) {
+        stats_add(STAT_UPDATE_CONFLICTS, 1);
+        send_message(client_socket, "Your record was changed meanwhile; the password was not changed. Please retry.\n");
     } else {
         send_message(client_socket, "Failed to change password.\n");
     }
+}
+
+// Push seat changes of the chosen courses until the time is up or the
+// client sends a message. Every course is reported once at the start.
+void watch_seats_helper(ConnectionContext *conn) {
+    TRACE_FUNCTION("helper");
+    int client_socket = conn->socket;
+    char buffer[BUFFER_SIZE];
+    char codes[WATCH_MAX_COURSES][MAX_COURSE_CODE_LEN];
+    int count = 0;
+
+    send_message(client_socket, "Enter Course Codes to watch (separated by spaces): ");
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
+    char *save = NULL;
+    for (char *code = strtok_r(buffer, " ,", &save); code && count < WATCH_MAX_COURSES;
+         code = strtok_r(NULL, " ,", &save)) {
+        int duplicate = strlen(code) >= MAX_COURSE_CODE_LEN; // too long to name a course
+        for (int i = 0; i < count && !duplicate; i++) {
+            duplicate = strcmp(codes[i], code) == 0;
+        }
+        if (!duplicate) {
+            strcpy(codes[count++], code);
+        }
+    }
+    if (count == 0) {
+        send_message(client_socket, "No course codes given.\n");
+        return;
+    }
 
-    pthread_mutex_unlock(&student_file_mutex); // Unlock the mutex
+    send_message(client_socket, "Enter Seconds to watch (0 until stopped): ");
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
+    int seconds = atoi(buffer);
+
+    Subscriber sub;
+    if (subscriber_open(&sub, (const char (*)[MAX_COURSE_CODE_LEN])codes, count) == -1) {
+        send_message(client_socket, "Error watching courses.\n");
+        return;
+    }
+    // Read only now, so that no change can fall between the read and the
+    // registration
+    for (int i = 0; i < count; i++) {
+        Course course;
+        subscriber_seed(&sub, i, find_course(codes[i], &course) == 1 ? course.available_seats : WATCH_GONE);
+    }
+    send_message(client_socket, WATCH_STARTED);
+
+    uint64_t end = seconds > 0 ? timer_now_ms() + (uint64_t)seconds * 1000 : 0;
+    uint64_t last_update = 0;
+    int woken = 0, ended = 0;
+
+    while (!ended) {
+        uint64_t now = timer_now_ms();
+        if (end && now >= end) {
+            break;
+        }
+        int timeout_ms = end ? (int)(end - now) : -1;
+
+        // Changes within WATCH_COALESCE_MS of the last update wait for the next
+        if (woken) {
+            uint64_t due = last_update + WATCH_COALESCE_MS;
+            if (now >= due) {
+                char update[BUFFER_SIZE - sizeof(SEATS_LABEL) - 1];
+                if (subscriber_take(&sub, update, sizeof(update)) > 0) {
+                    snprintf(buffer, BUFFER_SIZE, "%s%s\n", SEATS_LABEL, update);
+                    ended = send_message(client_socket, buffer) == -1 ? -1 : 0;
+                    stats_add(STAT_SEAT_UPDATES, 1);
+                }
+                last_update = now;
+                woken = 0;
+                continue;
+            }
+            if (timeout_ms == -1 || due - now < (uint64_t)timeout_ms) {
+                timeout_ms = due - now;
+            }
+        }
+
+        int ready = wait_for_message(conn, woken ? -1 : sub.event_fd, timeout_ms);
+        if (ready == 1) {
+            ended = receive_message(client_socket, buffer, BUFFER_SIZE) < 0 ? -1 : 1;
+        } else if (ready == 0) {
+            woken = 1; // or a deadline passed, which the next round sees
+        } else {
+            ended = -1;
+        }
+    }
+    subscriber_close(&sub);
+
+    if (ended != -1) {
+        send_message(client_socket, WATCH_STOPPED);
+    }
 }
 
-void student_handler(int client_socket, const char *student_id) {
+// Bring a client's cached catalog up to date; not on the menu, the client
+// sends it in place of View All Courses
+void catalog_sync_helper(int client_socket, Arena *arena) {
+    TRACE_FUNCTION("helper");
     char buffer[BUFFER_SIZE];
+
+    send_message(client_socket, "Enter Catalog Version (0 for all): ");
+    if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+        return; // the session ended
+    }
+    if (catalog_sync(client_socket, arena, strtoull(buffer, NULL, 10)) == -1) {
+        send_message(client_socket, "Error accessing course records.\n");
+    }
+}
+
+void student_handler(ConnectionContext *conn) {
+    int client_socket = conn->socket;
+    const char *student_id = conn->id;
+    Arena *arena = &conn->arena;
+    char *buffer = conn->recv_buffer;
     int choice;
     
     while (1) {
+        arena_reset(arena); // storage of the previous request is released
         
-        receive_message(client_socket, buffer, BUFFER_SIZE);
+        if (receive_message(client_socket, buffer, BUFFER_SIZE) < 0) {
+            return; // the client disconnected without logging out
+        }
         choice = atoi(buffer);
         
         switch(choice) {
             case 1:
                 // View all active courses
-                view_all_courses_helper(client_socket);
+                view_all_courses_helper(client_socket, arena);
                 break;
             case 2:
                 enroll_course_helper(client_socket, student_id);
@@ -231,7 +405,7 @@ void student_handler(int client_socket, const char *student_id) {
                 break;
                 
             case 4:
-                view_enrolled_courses_helper(client_socket,student_id);
+                view_enrolled_courses_helper(client_socket, student_id, arena);
                 break;
             
             case 5:
@@ -239,11 +413,25 @@ void student_handler(int client_socket, const char *student_id) {
                 break;
 
             case 6:
+                search_courses_helper(client_socket, arena);
+                break;
+
+            case 7:
+                watch_seats_helper(conn);
+                break;
+
+            case 8:
                 send_message(client_socket, "Logging out... Thank You!\n");
                 return;
+
+            case 9:
+                catalog_sync_helper(client_socket, arena);
+                break;
+
             default:
                 send_message(client_socket, "Invalid choice. Please try again.\n");
                 break;
         }
+        finish_request(conn);
     }
 }
\ No newline at end of file
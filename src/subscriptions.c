@@ -0,0 +1,146 @@
+#include "subscriptions.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+// Watches of every subscriber, guarded by subscriptions_mutex. Publishers
+// hold course_file_mutex and take this one inside it; nothing waits for a
+// course lock while holding it.
+static Watch *buckets[SUBSCRIPTION_BUCKETS];
+static pthread_mutex_t subscriptions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int subscriber_count; // lets publishers skip the lock while nobody watches
+
+static unsigned bucket_of(const char *course_code) {
+    unsigned hash = 5381;
+    while (*course_code) {
+        hash = hash * 33 + (unsigned char)*course_code++;
+    }
+    return hash % SUBSCRIPTION_BUCKETS;
+}
+
+// Mark the watch changed and wake its subscriber unless a wakeup is
+// already waiting; caller holds subscriptions_mutex
+static void watch_set(Watch *watch, int seats) {
+    Subscriber *sub = watch->owner;
+
+    watch->seats = seats;
+    watch->pending = 1;
+    if (!sub->signalled) {
+        uint64_t one = 1;
+        if (write(sub->event_fd, &one, sizeof(one)) == sizeof(one)) {
+            sub->signalled = 1;
+        }
+    }
+}
+
+int subscriber_open(Subscriber *sub, const char (*codes)[MAX_COURSE_CODE_LEN], int count) {
+    TRACE_FUNCTION("subscriptions");
+    sub->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (sub->event_fd == -1) {
+        return -1;
+    }
+    sub->signalled = 0;
+    sub->count = count < WATCH_MAX_COURSES ? count : WATCH_MAX_COURSES;
+
+    trace_mutex_lock(&subscriptions_mutex); // Lock the subscriptions mutex
+    for (int i = 0; i < sub->count; i++) {
+        Watch *watch = &sub->watches[i];
+        snprintf(watch->course_code, sizeof(watch->course_code), "%s", codes[i]);
+        watch->seats = WATCH_GONE;
+        watch->sent = WATCH_GONE - 1; // so that the first value is reported
+        watch->pending = 0;
+        watch->owner = sub;
+
+        unsigned bucket = bucket_of(watch->course_code);
+        watch->next = buckets[bucket];
+        buckets[bucket] = watch;
+    }
+    subscriber_count++;
+    pthread_mutex_unlock(&subscriptions_mutex); // Unlock the mutex
+
+    stats_add(STAT_WATCHERS, 1);
+    return 0;
+}
+
+void subscriber_close(Subscriber *sub) {
+    TRACE_FUNCTION("subscriptions");
+    trace_mutex_lock(&subscriptions_mutex); // Lock the subscriptions mutex
+    for (int i = 0; i < sub->count; i++) {
+        Watch **link = &buckets[bucket_of(sub->watches[i].course_code)];
+        while (*link && *link != &sub->watches[i]) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            *link = sub->watches[i].next;
+        }
+    }
+    subscriber_count--;
+    pthread_mutex_unlock(&subscriptions_mutex); // Unlock the mutex
+
+    // No publisher can reach the watches any more
+    close(sub->event_fd);
+    sub->event_fd = -1;
+    sub->count = 0;
+    stats_add(STAT_WATCHERS, -1);
+}
+
+void subscriber_seed(Subscriber *sub, int i, int seats) {
+    trace_mutex_lock(&subscriptions_mutex); // Lock the subscriptions mutex
+    if (!sub->watches[i].pending) {
+        watch_set(&sub->watches[i], seats);
+    }
+    pthread_mutex_unlock(&subscriptions_mutex); // Unlock the mutex
+}
+
+int subscriber_take(Subscriber *sub, char *buffer, size_t size) {
+    TRACE_FUNCTION("subscriptions");
+    size_t len = 0;
+    int changed = 0;
+
+    buffer[0] = '\0';
+    trace_mutex_lock(&subscriptions_mutex); // Lock the subscriptions mutex
+    uint64_t wakeups;
+    if (read(sub->event_fd, &wakeups, sizeof(wakeups)) < 0) {
+        wakeups = 0; // nothing was signalled; the counter is non-blocking
+    }
+    sub->signalled = 0;
+
+    for (int i = 0; i < sub->count; i++) {
+        Watch *watch = &sub->watches[i];
+        if (!watch->pending) {
+            continue;
+        }
+        watch->pending = 0;
+        if (watch->seats == watch->sent) {
+            continue; // changed back before the subscriber looked
+        }
+        watch->sent = watch->seats;
+        changed++;
+
+        int n = watch->seats == WATCH_GONE
+            ? snprintf(buffer + len, size - len, " %s=gone", watch->course_code)
+            : snprintf(buffer + len, size - len, " %s=%d", watch->course_code, watch->seats);
+        if (n > 0 && (size_t)n < size - len) {
+            len += n;
+        }
+    }
+    pthread_mutex_unlock(&subscriptions_mutex); // Unlock the mutex
+    return changed;
+}
+
+void subscriptions_publish(const char *course_code, int seats) {
+    // A subscriber registered after this check seeds itself from the
+    // table, which already holds this change
+    if (subscriber_count == 0) {
+        return;
+    }
+    trace_mutex_lock(&subscriptions_mutex); // Lock the subscriptions mutex
+    for (Watch *watch = buckets[bucket_of(course_code)]; watch; watch = watch->next) {
+        if (strcmp(watch->course_code, course_code) == 0) {
+            watch_set(watch, seats);
+        }
+    }
+    pthread_mutex_unlock(&subscriptions_mutex); // Unlock the mutex
+}
@@ -0,0 +1,165 @@
+#include "timer_wheel.h"
+
+#include <time.h>
+
+#define TIMER_LEVEL_MASK (TIMER_LEVEL_SLOTS - 1)
+#define TIMER_MAX_TICKS ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TimerEntry slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS]; // list heads
+static uint64_t now_tick;
+static uint64_t start_ms;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t timer_now_ms(void) {
+    return monotonic_ms() - start_ms;
+}
+
+// ==================== Slot Lists ====================
+
+static void unlink_entry(TimerEntry *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = entry;
+    entry->armed = 0;
+}
+
+// The slot is picked by the highest level whose span still separates
+// expires from now; the entry moves down when that slot is cascaded
+static void insert_entry(TimerEntry *entry) {
+    uint64_t delta = entry->expires - now_tick;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    TimerEntry *head = &slots[level][(entry->expires >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK];
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+    entry->armed = 1;
+}
+
+void timer_init(TimerEntry *entry, unsigned int (*expire)(TimerEntry *entry)) {
+    entry->next = entry->prev = entry;
+    entry->armed = 0;
+    entry->expire = expire;
+}
+
+static void schedule_locked(TimerEntry *entry, unsigned int ms) {
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+
+    if (entry->armed) {
+        unlink_entry(entry);
+    }
+    entry->expires = now_tick + ticks;
+    insert_entry(entry);
+}
+
+void timer_schedule(TimerEntry *entry, unsigned int ms) {
+    pthread_mutex_lock(&wheel_mutex); // Lock the wheel mutex
+    schedule_locked(entry, ms);
+    pthread_mutex_unlock(&wheel_mutex); // Unlock the mutex
+}
+
+void timer_cancel(TimerEntry *entry) {
+    pthread_mutex_lock(&wheel_mutex); // Lock the wheel mutex
+    if (entry->armed) {
+        unlink_entry(entry);
+    }
+    pthread_mutex_unlock(&wheel_mutex); // Unlock the mutex
+}
+
+// ==================== Wheel Thread ====================
+
+// Re-insert every entry of one higher-level slot; they land a level lower
+static void cascade(int level) {
+    TimerEntry *head = &slots[level][(now_tick >> (TIMER_LEVEL_BITS * level)) & TIMER_LEVEL_MASK];
+    TimerEntry pending;
+
+    if (head->next == head) {
+        return;
+    }
+    // Detach the whole list first, since insert_entry may put an entry back in this level
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    head->next = head->prev = head;
+
+    while (pending.next != &pending) {
+        TimerEntry *entry = pending.next;
+        unlink_entry(entry);
+        insert_entry(entry);
+    }
+}
+
+static void advance(void) {
+    now_tick++;
+
+    // When a level wraps, the matching slot of each level above comes due;
+    // cascade from the top so entries can fall more than one level
+    int top = 0;
+    while (top < TIMER_LEVELS - 1 &&
+           (now_tick & ((1ULL << (TIMER_LEVEL_BITS * (top + 1))) - 1)) == 0) {
+        top++;
+    }
+    for (int level = top; level > 0; level--) {
+        cascade(level);
+    }
+
+    TimerEntry *head = &slots[0][now_tick & TIMER_LEVEL_MASK];
+    while (head->next != head) {
+        TimerEntry *entry = head->next;
+        unlink_entry(entry);
+        unsigned int again = entry->expire(entry);
+        if (again > 0) {
+            schedule_locked(entry, again);
+        }
+    }
+}
+
+static void *wheel_thread(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, TIMER_TICK_MS * 1000000L};
+
+    while (1) {
+        nanosleep(&interval, NULL);
+
+        // Catch up on ticks missed while the thread was not scheduled
+        uint64_t target = timer_now_ms() / TIMER_TICK_MS;
+        pthread_mutex_lock(&wheel_mutex); // Lock the wheel mutex
+        while (now_tick < target) {
+            advance();
+        }
+        pthread_mutex_unlock(&wheel_mutex); // Unlock the mutex
+    }
+    return NULL;
+}
+
+int timer_wheel_start(void) {
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_LEVEL_SLOTS; slot++) {
+            slots[level][slot].next = slots[level][slot].prev = &slots[level][slot];
+        }
+    }
+    start_ms = monotonic_ms();
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, wheel_thread, NULL) != 0) {
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "trace.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+
+typedef struct {
+    const char *category;
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int tid;
+} TraceEvent;
+
+typedef struct TraceRing {
+    pthread_mutex_t mutex;          // only contended while trace_dump reads the ring
+    TraceEvent events[TRACE_RING_EVENTS];
+    uint64_t written;               // events ever recorded; the last TRACE_RING_EVENTS are kept
+    int tid;                        // current owner
+    char thread_name[64];
+    int in_use;
+    struct TraceRing *next;
+} TraceRing;
+
+static int enabled;
+static char trace_path[256];
+static TraceRing *rings;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread TraceRing *thread_ring;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Thread exit: the ring and its events stay for the next thread
+static void ring_release(void *arg) {
+    TraceRing *ring = arg;
+
+    pthread_mutex_lock(&rings_mutex); // Lock the ring list mutex
+    ring->in_use = 0;
+    pthread_mutex_unlock(&rings_mutex); // Unlock the mutex
+}
+
+static TraceRing *ring_get(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    pthread_mutex_lock(&rings_mutex); // Lock the ring list mutex
+    TraceRing *ring = rings;
+    while (ring && ring->in_use) {
+        ring = ring->next;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(TraceRing));
+        if (!ring) {
+            pthread_mutex_unlock(&rings_mutex); // Unlock the mutex before returning
+            return NULL;
+        }
+        pthread_mutex_init(&ring->mutex, NULL);
+        ring->next = rings;
+        rings = ring;
+    }
+    ring->in_use = 1;
+    pthread_mutex_unlock(&rings_mutex); // Unlock the mutex
+
+    pthread_mutex_lock(&ring->mutex); // Lock the ring mutex
+    ring->tid = (int)syscall(SYS_gettid);
+    ring->thread_name[0] = '\0';
+    pthread_mutex_unlock(&ring->mutex); // Unlock the mutex
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static void ring_record(const char *category, const char *name, uint64_t start_ns, uint64_t end_ns) {
+    TraceRing *ring = ring_get();
+    if (!ring) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring->mutex); // Lock the ring mutex
+    TraceEvent *event = &ring->events[ring->written % TRACE_RING_EVENTS];
+    event->category = category;
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns - start_ns;
+    event->tid = ring->tid;
+    ring->written++;
+    pthread_mutex_unlock(&ring->mutex); // Unlock the mutex
+}
+
+int trace_init(const char *path) {
+    if (strlen(path) >= sizeof(trace_path) || pthread_key_create(&ring_key, ring_release) != 0) {
+        return -1;
+    }
+    strcpy(trace_path, path);
+    enabled = 1;
+    return 0;
+}
+
+int trace_enabled(void) {
+    return enabled;
+}
+
+TraceSpan trace_span_begin(const char *category, const char *name) {
+    TraceSpan span = {category, name, enabled ? now_ns() : 0};
+    return span;
+}
+
+void trace_span_end(TraceSpan *span) {
+    if (span->start_ns) {
+        ring_record(span->category, span->name, span->start_ns, now_ns());
+    }
+}
+
+void trace_thread_name(const char *name) {
+    TraceRing *ring = enabled ? ring_get() : NULL;
+    if (!ring) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring->mutex); // Lock the ring mutex
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    pthread_mutex_unlock(&ring->mutex); // Unlock the mutex
+}
+
+void trace_mutex_lock(pthread_mutex_t *mutex) {
+    if (!enabled) {
+        pthread_mutex_lock(mutex);
+        return;
+    }
+
+    // The uncontended path records nothing
+    if (pthread_mutex_trylock(mutex) == 0) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+    pthread_mutex_lock(mutex);
+    ring_record("lock", "lock wait", start, now_ns());
+}
+
+// ==================== Chrome Trace Export ====================
+// Complete ("X") events with microsecond timestamps, plus one thread_name
+// metadata ("M") event per named ring.
+
+static void write_ring(FILE *out, TraceRing *ring, int pid, int *first) {
+    pthread_mutex_lock(&ring->mutex); // Lock the ring mutex
+
+    if (ring->thread_name[0]) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                *first ? "" : ",\n", pid, ring->tid, ring->thread_name);
+        *first = 0;
+    }
+
+    uint64_t oldest = ring->written > TRACE_RING_EVENTS ? ring->written - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = oldest; i < ring->written; i++) {
+        const TraceEvent *event = &ring->events[i % TRACE_RING_EVENTS];
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                *first ? "" : ",\n", event->name, event->category,
+                event->start_ns / 1000.0, event->duration_ns / 1000.0, pid, event->tid);
+        *first = 0;
+    }
+
+    pthread_mutex_unlock(&ring->mutex); // Unlock the mutex
+}
+
+int trace_dump(void) {
+    if (!enabled) {
+        return -1;
+    }
+
+    // Written beside the target and renamed, so a viewer never sees half a file
+    char temp_path[sizeof(trace_path) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", trace_path);
+    FILE *out = fopen(temp_path, "w");
+    if (!out) {
+        return -1;
+    }
+
+    int pid = (int)getpid();
+    int first = 1;
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&rings_mutex); // Lock the ring list mutex
+    for (TraceRing *ring = rings; ring; ring = ring->next) {
+        write_ring(out, ring, pid, &first);
+    }
+    pthread_mutex_unlock(&rings_mutex); // Unlock the mutex
+
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return rename(temp_path, trace_path);
+}